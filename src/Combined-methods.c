@@ -1,5 +1,12 @@
 #include "Combined-methods.h"
 #include "model-methods.h"
+#include "model-state.h"
+#include "update-nongeneric.h"
+#include "random-streams.h"
+#include "transform-index.h"
+#include "cohort-min.h"
+#include "account-batch.h"
+#include "log-factorial.h"
 #include "demest.h"
 
 /* File "Combined-methods.c" contains C versions of functions
@@ -62,6 +69,7 @@ extern SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -1015,10 +1023,12 @@ updateCombined_CombinedModelNormal(SEXP object_R, int nUpdate)
     SEXP model_R = GET_SLOT(object_R, model_sym);
     SEXP y_R = GET_SLOT(object_R, y_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, R_NilValue);
 
     while (nUpdate > 0) {
-        updateModelNotUseExp_Internal(model_R, y_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
         --nUpdate;
     }
@@ -1030,10 +1040,12 @@ updateCombined_CombinedModelPoissonNotHasExp(SEXP object_R, int nUpdate)
     SEXP model_R = GET_SLOT(object_R, model_sym);
     SEXP y_R = GET_SLOT(object_R, y_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, R_NilValue);
 
     while (nUpdate > 0) {
-        updateModelNotUseExp_Internal(model_R, y_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
         --nUpdate;
     }
@@ -1047,10 +1059,12 @@ updateCombined_CombinedModelBinomial(SEXP object_R, int nUpdate)
 
     SEXP exposure_R = GET_SLOT(object_R, exposure_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, exposure_R);
 
     while (nUpdate > 0) {
-        updateModelUseExp_Internal(model_R, y_R, exposure_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
         --nUpdate;
     }
@@ -1064,10 +1078,12 @@ updateCombined_CombinedModelPoissonHasExp(SEXP object_R, int nUpdate)
 
     SEXP exposure_R = GET_SLOT(object_R, exposure_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, exposure_R);
 
     while (nUpdate > 0) {
-        updateModelUseExp_Internal(model_R, y_R, exposure_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
         --nUpdate;
     }
@@ -1079,10 +1095,12 @@ updateCombined_CombinedModelCMPNotHasExp(SEXP object_R, int nUpdate)
     SEXP model_R = GET_SLOT(object_R, model_sym);
     SEXP y_R = GET_SLOT(object_R, y_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, R_NilValue);
 
     while (nUpdate > 0) {
-        updateModelNotUseExp_Internal(model_R, y_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
         --nUpdate;
     }
@@ -1096,19 +1114,58 @@ updateCombined_CombinedModelCMPHasExp(SEXP object_R, int nUpdate)
 
     SEXP exposure_R = GET_SLOT(object_R, exposure_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, exposure_R);
 
     while (nUpdate > 0) {
-        updateModelUseExp_Internal(model_R, y_R, exposure_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
         --nUpdate;
     }
 }
 
 
-void
-updateCombined_CombinedCountsPoissonNotHasExp(SEXP object_R,
-                                                        int nUpdate)
+/* Updates that set up caches of compiled transforms (and,
+   for accounts, other caches) are run through
+   'updateCombinedWithCleanup', which uses 'R_ExecWithCleanup'
+   so that the caches are torn down however the update ends,
+   including through an error or a user interrupt. */
+typedef struct CombinedUpdateArgs {
+    void (*update)(SEXP, int);
+    SEXP object_R;
+    int nUpdate;
+} CombinedUpdateArgs;
+
+static SEXP
+runCombinedUpdate(void *data)
+{
+    CombinedUpdateArgs *args = (CombinedUpdateArgs *)data;
+    args->update(args->object_R, args->nUpdate);
+    return R_NilValue;
+}
+
+static void
+endCombinedUpdateCaches(void *data)
+{
+    endAccountBatches();
+    endCohortMinCache();
+    endTransformIndexCache();
+}
+
+static void
+updateCombinedWithCleanup(void (*update)(SEXP, int), SEXP object_R, int nUpdate)
+{
+    CombinedUpdateArgs args;
+    args.update = update;
+    args.object_R = object_R;
+    args.nUpdate = nUpdate;
+    R_ExecWithCleanup(runCombinedUpdate, &args, endCombinedUpdateCaches, NULL);
+}
+
+
+static void
+updateCombined_CombinedCountsPoissonNotHasExp_i(SEXP object_R, int nUpdate)
 {
     SEXP model_R = GET_SLOT(object_R, model_sym);
     SEXP y_R = GET_SLOT(object_R, y_sym);
@@ -1116,25 +1173,35 @@ updateCombined_CombinedCountsPoissonNotHasExp(SEXP object_R,
     SEXP datasets_R = GET_SLOT(object_R, datasets_sym);
     SEXP transforms_R = GET_SLOT(object_R, transforms_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, R_NilValue);
+    ModelState *dataStates = prepareDataModelStates(dataModels_R, datasets_R);
+    beginTransformIndexCache(transforms_R);
 
     while (nUpdate > 0) {
 
         updateCountsPoissonNotUseExp(y_R, model_R, dataModels_R,
                                         datasets_R, transforms_R);
 
-        updateModelNotUseExp_Internal(model_R, y_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
-        updateDataModelsCounts(y_R, dataModels_R, datasets_R,
-                                        transforms_R);
+        updateDataModelsCountsStates(y_R, dataModels_R, datasets_R,
+                                        transforms_R, dataStates);
 
         --nUpdate;
     }
 }
 
-
 void
-updateCombined_CombinedCountsPoissonHasExp(SEXP object_R, int nUpdate)
+updateCombined_CombinedCountsPoissonNotHasExp(SEXP object_R, int nUpdate)
+{
+    updateCombinedWithCleanup(updateCombined_CombinedCountsPoissonNotHasExp_i, object_R, nUpdate);
+}
+
+
+static void
+updateCombined_CombinedCountsPoissonHasExp_i(SEXP object_R, int nUpdate)
 {
     SEXP model_R = GET_SLOT(object_R, model_sym);
     SEXP y_R = GET_SLOT(object_R, y_sym);
@@ -1143,23 +1210,33 @@ updateCombined_CombinedCountsPoissonHasExp(SEXP object_R, int nUpdate)
     SEXP datasets_R = GET_SLOT(object_R, datasets_sym);
     SEXP transforms_R = GET_SLOT(object_R, transforms_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, exposure_R);
+    ModelState *dataStates = prepareDataModelStates(dataModels_R, datasets_R);
+    beginTransformIndexCache(transforms_R);
 
     while (nUpdate > 0) {
 
         updateCountsPoissonUseExp(y_R, model_R,
                                 exposure_R, dataModels_R,
                                 datasets_R, transforms_R);
-        updateModelUseExp_Internal(model_R, y_R, exposure_R, i_method_model);
-        updateDataModelsCounts(y_R, dataModels_R, datasets_R,
-                                        transforms_R);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
+        updateDataModelsCountsStates(y_R, dataModels_R, datasets_R,
+                                        transforms_R, dataStates);
         --nUpdate;
     }
 }
 
-
 void
-updateCombined_CombinedCountsBinomial(SEXP object_R, int nUpdate)
+updateCombined_CombinedCountsPoissonHasExp(SEXP object_R, int nUpdate)
+{
+    updateCombinedWithCleanup(updateCombined_CombinedCountsPoissonHasExp_i, object_R, nUpdate);
+}
+
+
+static void
+updateCombined_CombinedCountsBinomial_i(SEXP object_R, int nUpdate)
 {
     SEXP model_R = GET_SLOT(object_R, model_sym);
     SEXP y_R = GET_SLOT(object_R, y_sym);
@@ -1168,7 +1245,10 @@ updateCombined_CombinedCountsBinomial(SEXP object_R, int nUpdate)
     SEXP datasets_R = GET_SLOT(object_R, datasets_sym);
     SEXP transforms_R = GET_SLOT(object_R, transforms_sym);
 
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
+    ModelState state;
+    prepareModelState(&state, model_R, y_R, exposure_R);
+    ModelState *dataStates = prepareDataModelStates(dataModels_R, datasets_R);
+    beginTransformIndexCache(transforms_R);
 
     while (nUpdate > 0) {
 
@@ -1176,15 +1256,22 @@ updateCombined_CombinedCountsBinomial(SEXP object_R, int nUpdate)
                                 exposure_R, dataModels_R,
                                 datasets_R, transforms_R);
 
-        updateModelUseExp_Internal(model_R, y_R, exposure_R, i_method_model);
+        updateModelState(&state);
+        recordModelStateAccept(&state);
 
-        updateDataModelsCounts(y_R, dataModels_R, datasets_R,
-                                        transforms_R);
+        updateDataModelsCountsStates(y_R, dataModels_R, datasets_R,
+                                        transforms_R, dataStates);
 
         --nUpdate;
     }
 }
 
+void
+updateCombined_CombinedCountsBinomial(SEXP object_R, int nUpdate)
+{
+    updateCombinedWithCleanup(updateCombined_CombinedCountsBinomial_i, object_R, nUpdate);
+}
+
 
 
 /* generic update combined object method */
@@ -1450,8 +1537,6 @@ updateProposalAccount_CombinedAccountMovements(SEXP object_R)
 {
 
     double probPopn = *REAL(GET_SLOT(object_R, probPopn_sym));
-    double probSmallUpdate = *REAL(GET_SLOT(object_R, probSmallUpdate_sym));
-    int hasAge = *LOGICAL(GET_SLOT(object_R, hasAge_sym));
 
     double u = runif(0, 1);
     int updatePopn = (u < probPopn);
@@ -1461,50 +1546,59 @@ updateProposalAccount_CombinedAccountMovements(SEXP object_R)
         updateProposalAccountMovePopn(object_R);
     }
     else {
+        updateProposalAccountComp_CombinedAccountMovements(object_R);
+    }
+}
 
-        double * cumProb = REAL(GET_SLOT(object_R, cumProbComp_sym));
-        int iBirths_r = *INTEGER(GET_SLOT(object_R, iBirths_sym));
-        int iOrigDest_r = *INTEGER(GET_SLOT(object_R, iOrigDest_sym));
-        int iPool_r = *INTEGER(GET_SLOT(object_R, iPool_sym));
-        int iIntNet_r = *INTEGER(GET_SLOT(object_R, iIntNet_sym));
-        int * isNetVec = LOGICAL(GET_SLOT(object_R, isNet_sym));
+/* proposal for a move in a component, chosen at random */
+void
+updateProposalAccountComp_CombinedAccountMovements(SEXP object_R)
+{
+    double probSmallUpdate = *REAL(GET_SLOT(object_R, probSmallUpdate_sym));
+    int hasAge = *LOGICAL(GET_SLOT(object_R, hasAge_sym));
 
-        int iComp_r = rcateg1(cumProb);
-        SET_INTSCALE_SLOT(object_R, iComp_sym, iComp_r);
+    double * cumProb = REAL(GET_SLOT(object_R, cumProbComp_sym));
+    int iBirths_r = *INTEGER(GET_SLOT(object_R, iBirths_sym));
+    int iOrigDest_r = *INTEGER(GET_SLOT(object_R, iOrigDest_sym));
+    int iPool_r = *INTEGER(GET_SLOT(object_R, iPool_sym));
+    int iIntNet_r = *INTEGER(GET_SLOT(object_R, iIntNet_sym));
+    int * isNetVec = LOGICAL(GET_SLOT(object_R, isNet_sym));
 
-        if(iComp_r == iBirths_r) {
-            int isSmallUpdate = (hasAge && (runif(0, 1) < probSmallUpdate));
-            if (isSmallUpdate) {
-                updateProposalAccountMoveBirthsSmall(object_R);
-            }
-            else {
-                updateProposalAccountMoveBirths(object_R);
-            }
+    int iComp_r = rcateg1(cumProb);
+    SET_INTSCALE_SLOT(object_R, iComp_sym, iComp_r);
+
+    if(iComp_r == iBirths_r) {
+        int isSmallUpdate = (hasAge && (runif(0, 1) < probSmallUpdate));
+        if (isSmallUpdate) {
+            updateProposalAccountMoveBirthsSmall(object_R);
         }
-        else if(iComp_r == iOrigDest_r) {
-            int isSmallUpdate = (hasAge && (runif(0, 1) < probSmallUpdate));
-            if (isSmallUpdate) {
-                updateProposalAccountMoveOrigDestSmall(object_R);
-            }
-            else {
-                updateProposalAccountMoveOrigDest(object_R);
-            }
+        else {
+            updateProposalAccountMoveBirths(object_R);
+        }
+    }
+    else if(iComp_r == iOrigDest_r) {
+        int isSmallUpdate = (hasAge && (runif(0, 1) < probSmallUpdate));
+        if (isSmallUpdate) {
+            updateProposalAccountMoveOrigDestSmall(object_R);
         }
-        else if(iComp_r == iPool_r) {
-            updateProposalAccountMovePool(object_R);
+        else {
+            updateProposalAccountMoveOrigDest(object_R);
         }
-        else if(iComp_r == iIntNet_r) {
-            updateProposalAccountMoveNet(object_R);
+    }
+    else if(iComp_r == iPool_r) {
+        updateProposalAccountMovePool(object_R);
+    }
+    else if(iComp_r == iIntNet_r) {
+        updateProposalAccountMoveNet(object_R);
+    }
+    else {
+        int isNet = isNetVec[iComp_r - 1];
+        int isSmallUpdate = (!isNet && hasAge && (runif(0, 1) < probSmallUpdate));
+        if (isSmallUpdate) {
+            updateProposalAccountMoveCompSmall(object_R);
         }
         else {
-            int isNet = isNetVec[iComp_r - 1];
-            int isSmallUpdate = (!isNet && hasAge && (runif(0, 1) < probSmallUpdate));
-            if (isSmallUpdate) {
-                updateProposalAccountMoveCompSmall(object_R);
-            }
-            else {
-                updateProposalAccountMoveComp(object_R);
-            }
+            updateProposalAccountMoveComp(object_R);
         }
     }
 }
@@ -1649,115 +1743,235 @@ updateSystemModels(SEXP object_R)
 
 
 
-void
-updateSystemModels_CombinedAccountMovements(SEXP combined_R)
+/* Inputs to the system models of an account.
+ *
+ * The transforms from the exposure held by the combined object
+ * to the exposures used by the system models are compiled once,
+ * by 'prepareSystemModels', into 'TransformIndex' structures.
+ * The transformed exposures, and the copies of components
+ * stored as doubles for Normal models, are written into buffers
+ * that are allocated once and refreshed in place at each
+ * iteration, rather than being created by 'dembase_Collapse_R',
+ * 'dembase_Extend_R', and 'coerceVector' each time.
+ *
+ * Because the y and exposure seen by each system model are
+ * always the same R objects, the model states are also set up
+ * once, and reused at each iteration. The classification of
+ * cells in a state does not go out of date as the account
+ * changes, since cells of system models are only excluded from
+ * the likelihood if they are structural zeros. */
+typedef struct SystemModels {
+    int nModels;
+    int *usesExposure; /* length nModels */
+    TransformIndex **transforms; /* NULL if exposure used as-is */
+    SEXP *buffers; /* R_NilValue if exposure used as-is */
+    SEXP *yDouble; /* R_NilValue unless component copied to doubles */
+    SEXP *y; /* y for each model, R_NilValue if not updated */
+    SEXP *exposure; /* exposure for each model, or R_NilValue */
+    ModelState *states; /* set up for models that are updated */
+} SystemModels;
+
+/* Copy the component values into the buffers of doubles,
+   and the exposures into the exposure buffers */
+static void
+refreshSystemModelInputs(SystemModels *models, SEXP combined_R)
 {
-
-    SEXP systemModels_R = GET_SLOT(combined_R, systemModels_sym);
-    int *updateSystemModel = LOGICAL(GET_SLOT(combined_R, updateSystemModel_sym));
-
     SEXP account_R = GET_SLOT(combined_R, account_sym);
-    SEXP population_R = GET_SLOT(account_R, population_sym);
     SEXP components_R = GET_SLOT(account_R, components_sym);
-    int nComponents = LENGTH(components_R);
+    SEXP exposure_R = GET_SLOT(combined_R, exposure_sym);
+    int nModels = models->nModels;
+    for (int i = 1; i < nModels; ++i) {
+        if (models->y[i] == R_NilValue)
+            continue;
+        TransformIndex *transform = models->transforms[i];
+        if (transform)
+            applyTransformIndex(models->buffers[i], exposure_R, transform);
+        SEXP yDouble_R = models->yDouble[i];
+        if (yDouble_R != R_NilValue) {
+            SEXP component_R = VECTOR_ELT(components_R, i-1);
+            int *component = INTEGER(component_R);
+            double *yDouble = REAL(yDouble_R);
+            int n = LENGTH(component_R);
+            for (int j = 0; j < n; ++j)
+                yDouble[j] = (component[j] == NA_INTEGER) ? NA_REAL : component[j];
+        }
+    }
+}
 
+/* Returns a list holding the buffers, which the
+   caller must protect. */
+static SEXP
+prepareSystemModels(SystemModels *ans, SEXP combined_R)
+{
+    SEXP systemModels_R = GET_SLOT(combined_R, systemModels_sym);
+    int nModels = LENGTH(systemModels_R);
     int * modelUsesExposureVec = LOGICAL(GET_SLOT(combined_R, modelUsesExposure_sym));
+    int *updateSystemModel = LOGICAL(GET_SLOT(combined_R, updateSystemModel_sym));
 
     SEXP transformsExpToComp_R = GET_SLOT(combined_R, transformsExpToComp_sym); /* list */
     SEXP transformExpToBirths_R = GET_SLOT(combined_R, transformExpToBirths_sym);
+    SEXP exposure_R = GET_SLOT(combined_R, exposure_sym);
+
+    SEXP account_R = GET_SLOT(combined_R, account_sym);
+    SEXP population_R = GET_SLOT(account_R, population_sym);
+    SEXP components_R = GET_SLOT(account_R, components_sym);
 
     int iBirths_r = *INTEGER(GET_SLOT(combined_R, iBirths_sym));
 
-    /* update model for population */
+    ans->nModels = nModels;
+    ans->usesExposure = (int *)R_alloc(nModels, sizeof(int));
+    ans->transforms = (TransformIndex **)R_alloc(nModels, sizeof(TransformIndex *));
+    ans->buffers = (SEXP *)R_alloc(nModels, sizeof(SEXP));
+    ans->yDouble = (SEXP *)R_alloc(nModels, sizeof(SEXP));
+    ans->y = (SEXP *)R_alloc(nModels, sizeof(SEXP));
+    ans->exposure = (SEXP *)R_alloc(nModels, sizeof(SEXP));
+    ans->states = (ModelState *)R_alloc(nModels, sizeof(ModelState));
+
+    /* exposure buffers first, then buffers of doubles */
+    SEXP buffers_R;
+    PROTECT(buffers_R = allocVector(VECSXP, 2 * nModels));
+
+    for (int i = 0; i < nModels; ++i) {
+
+        int usesExposure = (i > 0) && modelUsesExposureVec[i];
+        ans->usesExposure[i] = usesExposure;
+        ans->transforms[i] = NULL;
+        ans->buffers[i] = R_NilValue;
+        ans->yDouble[i] = R_NilValue;
+        ans->y[i] = R_NilValue;
+        ans->exposure[i] = R_NilValue;
 
-    if (updateSystemModel[0]) {
-        SEXP popnModel_R = VECTOR_ELT(systemModels_R, 0);
-        updateModelNotUseExp(popnModel_R, population_R);
-    }
+        if (usesExposure) {
 
-    /* update models for components */
+            SEXP transform_R = VECTOR_ELT(transformsExpToComp_R, i-1);
+            int haveTransform = !isNull(transform_R);
+            int isBirths = (i == iBirths_r);
+
+            TransformIndex *index = NULL;
+
+            if (isBirths) {
+                index = (TransformIndex *)R_alloc(1, sizeof(TransformIndex));
+                makeCollapseTransformIndex(index, transformExpToBirths_R);
+                if (haveTransform) {
+                    TransformIndex extend;
+                    TransformIndex *collapse = index;
+                    makeExtendTransformIndex(&extend, transform_R);
+                    index = (TransformIndex *)R_alloc(1, sizeof(TransformIndex));
+                    composeTransformIndex(index, collapse, &extend);
+                }
+            }
+            else if (haveTransform) {
+                index = (TransformIndex *)R_alloc(1, sizeof(TransformIndex));
+                makeExtendTransformIndex(index, transform_R);
+            }
 
-    for(int i = 0; i < nComponents; ++i) {
+            if (index) {
+                SEXP buffer_R = allocVector(TYPEOF(exposure_R), index->nAfter);
+                SET_VECTOR_ELT(buffers_R, i, buffer_R);
+                ans->transforms[i] = index;
+                ans->buffers[i] = buffer_R;
+                ans->exposure[i] = buffer_R;
+            }
+            else {
+                ans->exposure[i] = exposure_R;
+            }
+        }
 
-        if (updateSystemModel[i+1]) {
+        if (i == 0) {
+            ans->y[i] = population_R;
+        }
+        else if (updateSystemModel[i]) {
+            SEXP model_R = VECTOR_ELT(systemModels_R, i);
+            SEXP component_R = VECTOR_ELT(components_R, i-1);
+            ans->y[i] = component_R;
+            if (!usesExposure) {
+                const char *class_name = CHAR(STRING_ELT(GET_SLOT((model_R), R_ClassSymbol), 0));
+                if (strstr(class_name, "Normal")) {
+                    SEXP yDouble_R = allocVector(REALSXP, LENGTH(component_R));
+                    SET_VECTOR_ELT(buffers_R, nModels + i, yDouble_R);
+                    ans->yDouble[i] = yDouble_R;
+                    ans->y[i] = yDouble_R;
+                }
+            }
+        }
+    }
 
-            SEXP model_R = VECTOR_ELT(systemModels_R, i+1);
-            SEXP component_R = VECTOR_ELT(components_R, i);
-            int usesExposure = modelUsesExposureVec[i+1];
+    refreshSystemModelInputs(ans, combined_R);
 
-            if (usesExposure) {
+    for (int i = 0; i < nModels; ++i) {
+        if (updateSystemModel[i]) {
+            SEXP model_R = VECTOR_ELT(systemModels_R, i);
+            prepareModelState(ans->states + i, model_R, ans->y[i], ans->exposure[i]);
+        }
+    }
 
-                SEXP transform_R = VECTOR_ELT(transformsExpToComp_R, i);
-                int haveTransform = !isNull(transform_R);
+    UNPROTECT(1); /* buffers_R */
+    return buffers_R;
+}
 
-                SEXP exposure_R = GET_SLOT(combined_R, exposure_sym);
-                int isBirths = (i == (iBirths_r - 1));
+/* Once the account is fixed, the system models are conditionally
+ * independent. The y and exposure for each model, held in the
+ * buffers in 'models', are refreshed first. With R's random number
+ * generator, the models are then updated one after another. With
+ * counter-based streams, the theta updates for the models, which
+ * only touch native arrays, run side by side as parallel tasks,
+ * each with its own streams, and the remaining steps, which call
+ * back into R, are carried out serially afterwards. */
+static void
+updateSystemModels_CombinedAccountMovementsInternal(SEXP combined_R,
+                                                    SystemModels *models)
+{
+    int *updateSystemModel = LOGICAL(GET_SLOT(combined_R, updateSystemModel_sym));
+    int nModels = models->nModels;
+    ModelState *states = models->states;
 
-                if(isBirths) {
-                    SEXP newExposure_R = NULL;
-                    PROTECT(newExposure_R = dembase_Collapse_R(exposure_R,
-                             transformExpToBirths_R));
-                    if(haveTransform) {
-                        SEXP anotherNewExposure_R = NULL;
-                        PROTECT(anotherNewExposure_R = dembase_Extend_R(newExposure_R,
-                                    transform_R));
-                        updateModelUseExp(model_R, component_R, anotherNewExposure_R);
-                        UNPROTECT(1); /* anotherNewExposure */
+    refreshSystemModelInputs(models, combined_R);
 
-                        #ifdef DEBUGGING
-                        PrintValue(mkString("is Births and have transform"));
-                        #endif
-                    }
-                    else {
-                        updateModelUseExp(model_R, component_R, newExposure_R);
+    if (usesCounterRNG()) {
 
-                        #ifdef DEBUGGING
-                        PrintValue(mkString("isBirths, no transform"));
-                        #endif
-                    }
+        int *iTasks = (int *)R_alloc(nModels, sizeof(int));
+        int nTasks = 0;
 
-                    UNPROTECT(1); /* newExposure */
-                }
-                else if (haveTransform) {
-                    SEXP newExposure_R = NULL;
-                    PROTECT(newExposure_R = dembase_Extend_R(exposure_R,
-                           transform_R));
-                    updateModelUseExp(model_R, component_R, newExposure_R);
-                    UNPROTECT(1); /* newExposure */
+        for (int i = 0; i < nModels; ++i) {
+            if (updateSystemModel[i] && thetaUpdateIsThreadSafe(states + i)) {
+                iTasks[nTasks] = i;
+                ++nTasks;
+            }
+        }
 
-                    #ifdef DEBUGGING
-                    PrintValue(mkString("not isBirths, has transform"));
-                    #endif
-                    }
-                else {
-                    updateModelUseExp(model_R, component_R, exposure_R);
+        int use_threads = usesCounterRNGTasks(nTasks);
 
-                    #ifdef DEBUGGING
-                    PrintValue(mkString("not isBirths, no transform"));
-                    #endif
-                }
-            } /* end if usesExposure */
+        newStreamStage();
 
-            else {
-                const char *class_name = CHAR(STRING_ELT(GET_SLOT((model_R), R_ClassSymbol), 0));
-                char *found = NULL;
-                found = strstr(class_name, "Normal");
-
-                if (found) {
-                    SEXP componentDouble_R;
-                    PROTECT(componentDouble_R = coerceVector(component_R, REALSXP));
-                    updateModelNotUseExp(model_R, componentDouble_R);
-                    UNPROTECT(1);
-                    #ifdef DEBUGGING
-                    PrintValue(mkString("not use exp, normal"));
-                    #endif
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic, 1) if(use_threads) num_threads(nCounterRNGThreads())
+#endif
+        for (int k = 0; k < nTasks; ++k) {
+            int i = iTasks[k];
+            beginStreamTask(i);
+            updateModelStateTheta(states + i);
+            endStreamTask();
+        }
+
+        for (int i = 0, k = 0; i < nModels; ++i) {
+            if (updateSystemModel[i]) {
+                if ((k < nTasks) && (iTasks[k] == i)) {
+                    updateModelStateRest(states + i);
+                    ++k;
                 }
                 else {
-                    updateModelNotUseExp(model_R, component_R);
-                    #ifdef DEBUGGING
-                    PrintValue(mkString("not use exp, not normal"));
-                    #endif
+                    updateModelState(states + i);
                 }
+                recordModelStateAccept(states + i);
+            }
+        }
+    }
+    else {
+
+        for (int i = 0; i < nModels; ++i) {
+            if (updateSystemModel[i]) {
+                updateModelState(states + i);
+                recordModelStateAccept(states + i);
             }
         }
     }
@@ -1765,12 +1979,87 @@ updateSystemModels_CombinedAccountMovements(SEXP combined_R)
 
 
 void
-updateCombined_CombinedAccount(SEXP object_R, int nUpdate)
+updateSystemModels_CombinedAccountMovements(SEXP combined_R)
+{
+    SystemModels models;
+    SEXP buffers_R;
+    PROTECT(buffers_R = prepareSystemModels(&models, combined_R));
+    updateSystemModels_CombinedAccountMovementsInternal(combined_R, &models);
+    UNPROTECT(1); /* buffers_R */
+}
+
+
+/* Cache collapsed versions of the series that the datasets
+   refer to. The account is only changed by
+   'updateValuesAccount', which keeps the cache up to date. */
+static void
+cacheCollapsedSeriesAccount(SEXP combined_R)
+{
+    SEXP account_R = GET_SLOT(combined_R, account_sym);
+    SEXP population_R = GET_SLOT(account_R, population_sym);
+    SEXP components_R = GET_SLOT(account_R, components_sym);
+    SEXP datasets_R = GET_SLOT(combined_R, datasets_sym);
+    int *seriesIndices = INTEGER(GET_SLOT(combined_R, seriesIndices_sym));
+    int nDatasets = LENGTH(datasets_R);
+    for (int i = 0; i < nDatasets; ++i) {
+        int seriesIndex_r = seriesIndices[i];
+        SEXP series_R = population_R;
+        if (seriesIndex_r > 0)
+            series_R = VECTOR_ELT(components_R, seriesIndex_r - 1);
+        cacheCollapsedSeries(i, series_R);
+    }
+}
+
+/* Fill the table of log factorials up to twice the largest
+   count in the account, so that updates running in parallel
+   can use it. */
+static void
+reserveLogFactorialAccount(SEXP combined_R)
 {
+    SEXP account_R = GET_SLOT(combined_R, account_sym);
+    SEXP population_R = GET_SLOT(account_R, population_sym);
+    SEXP components_R = GET_SLOT(account_R, components_sym);
+    int nComponents = LENGTH(components_R);
+    int maxCount = 0;
+    for (int i = -1; i < nComponents; ++i) {
+        SEXP series_R = (i < 0) ? population_R : VECTOR_ELT(components_R, i);
+        int *series = INTEGER(series_R);
+        int n = LENGTH(series_R);
+        for (int j = 0; j < n; ++j) {
+            if ((series[j] != NA_INTEGER) && (series[j] > maxCount))
+                maxCount = series[j];
+        }
+    }
+    if (maxCount < K_MAX_LOG_FACTORIAL_TABLE / 2)
+        reserveLogFactorial(2 * maxCount);
+    else
+        reserveLogFactorial(K_MAX_LOG_FACTORIAL_TABLE);
+}
+
+static void
+updateCombined_CombinedAccount_i(SEXP object_R, int nUpdate)
+{
+    SystemModels models;
+    SEXP buffers_R;
+    PROTECT(buffers_R = prepareSystemModels(&models, object_R));
+    ModelState *dataStates = prepareDataModelStates(GET_SLOT(object_R, dataModels_sym),
+                                                    GET_SLOT(object_R, datasets_sym));
+    beginTransformIndexCache(GET_SLOT(object_R, transforms_sym));
+    cacheCollapsedSeriesAccount(object_R);
+    beginCohortMinCache(object_R);
+    beginAccountBatches(object_R);
+    reserveLogFactorialAccount(object_R);
     for (int i = 0; i < nUpdate; ++i) {
         updateAccount(object_R);
-        updateSystemModels(object_R);
+        updateSystemModels_CombinedAccountMovementsInternal(object_R, &models);
         updateExpectedExposure(object_R);
-        updateDataModelsAccount(object_R);
+        updateDataModelsAccountStates(object_R, dataStates);
     }
+    UNPROTECT(1); /* buffers_R */
+}
+
+void
+updateCombined_CombinedAccount(SEXP object_R, int nUpdate)
+{
+    updateCombinedWithCleanup(updateCombined_CombinedAccount_i, object_R, nUpdate);
 }
@@ -1,4 +1,5 @@
 #include "model-methods.h"
+#include "model-state.h"
 #include "update-nongeneric.h"
 #include "helper-functions.h"
 #include "demest.h"
@@ -64,6 +65,7 @@ extern SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -992,184 +994,129 @@ predictModelUseExp_LN2Predict(SEXP object, SEXP y_R, SEXP exposure_R)
 /* models not using exposure */
 
 static __inline__ void
-updateModelNotUseExp_CMPVaryingNotUseExp_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_CMPVaryingNotUseExp_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateThetaAndNu_CMPVaryingNotUseExp(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaKnown_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaKnown_i(ModelState *state)
 {
-    int varsigmaSetToZero = *LOGICAL(GET_SLOT(object, varsigmaSetToZero_sym));
-    if (!varsigmaSetToZero) {
-      updateTheta_NormalVarying(object, y_R);
-    }
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelState(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaUnknown_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaUnknown_i(ModelState *state)
 {
-    updateTheta_NormalVarying(object, y_R);
-    updateVarsigma(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelState(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_PoissonVaryingNotUseExp_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_PoissonVaryingNotUseExp_i(ModelState *state)
 {
-    updateTheta_PoissonVaryingNotUseExp(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelState(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaKnownAgCertain_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaKnownAgCertain_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateTheta_NormalVaryingAgCertain(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgCertain_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgCertain_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateTheta_NormalVaryingAgCertain(object, y_R);
     updateVarsigma(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_PoissonVaryingNotUseExpAgCertain_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_PoissonVaryingNotUseExpAgCertain_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateTheta_PoissonVaryingNotUseExpAgCertain(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaKnownAgNormal_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaKnownAgNormal_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateTheta_NormalVaryingAgCertain(object, y_R);
     updateThetaAndValueAgNormal_Normal(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgNormal_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgNormal_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateTheta_NormalVaryingAgCertain(object, y_R);
     updateThetaAndValueAgNormal_Normal(object, y_R);
     updateVarsigma(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaKnownAgFun_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaKnownAgFun_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateThetaAndValueAgFun_Normal(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgFun_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgFun_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateThetaAndValueAgFun_Normal(object, y_R);
     updateVarsigma(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_PoissonVaryingNotUseExpAgNormal_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_PoissonVaryingNotUseExpAgNormal_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateTheta_PoissonVaryingNotUseExpAgCertain(object, y_R);
     updateThetaAndValueAgNormal_PoissonNotUseExp(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 /* problem ScaleVec non positive on tests with n.test <- 20 */
 static __inline__ void
-updateModelNotUseExp_PoissonVaryingNotUseExpAgFun_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_PoissonVaryingNotUseExpAgFun_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateThetaAndValueAgFun_PoissonNotUseExp(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelNotUseExp_PoissonVaryingNotUseExpAgPoisson_i(SEXP object, SEXP y_R)
+updateModelNotUseExp_PoissonVaryingNotUseExpAgPoisson_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
     updateTheta_PoissonVaryingNotUseExpAgCertain(object, y_R);
     updateThetaAndValueAgPoisson_PoissonNotUseExp(object, y_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
@@ -1187,42 +1134,28 @@ updateModelNotUseExp_TFixedNotUseExp_i(SEXP object, SEXP y_R)
 /* models using exposure */
 
 static __inline__ void
-updateModelUseExp_CMPVaryingUseExp_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_CMPVaryingUseExp_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateThetaAndNu_CMPVaryingUseExp(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 
 
 static __inline__ void
-updateModelUseExp_BinomialVarying_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_BinomialVarying_i(ModelState *state)
 {
-    updateTheta_BinomialVarying(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelState(state);
 }
 
 
 static __inline__ void
-updateModelUseExp_PoissonVarying_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVarying_i(ModelState *state)
 {
-  updateTheta_PoissonVaryingUseExp(object, y_R, exposure_R);
-  updateSigma_Varying(object);
-  updateBetas(object);
-  updateMu(object);
-  updatePriorsBetas(object);
-  updateMeansBetas(object);
-  updateVariancesBetas(object);
+    updateModelState(state);
 }
 
 static __inline__ void
@@ -1239,105 +1172,89 @@ updateModelUseExp_Round3_i(SEXP object, SEXP y_R, SEXP exposure_R)
 }
 
 static __inline__ void
-updateModelUseExp_BinomialVaryingAgCertain_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_BinomialVaryingAgCertain_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateTheta_BinomialVaryingAgCertain(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelUseExp_BinomialVaryingAgNormal_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_BinomialVaryingAgNormal_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateTheta_BinomialVaryingAgCertain(object, y_R, exposure_R);
     updateThetaAndValueAgNormal_Binomial(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelUseExp_BinomialVaryingAgFun_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_BinomialVaryingAgFun_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateThetaAndValueAgFun_Binomial(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelUseExp_PoissonVaryingUseExpAgCertain_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgCertain_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateTheta_PoissonVaryingUseExpAgCertain(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
-updateModelUseExp_PoissonVaryingUseExpAgNormal_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgNormal_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateTheta_PoissonVaryingUseExpAgCertain(object, y_R, exposure_R);
     updateThetaAndValueAgNormal_PoissonUseExp(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 /* problem ScaleVec non positive on tests with n.test <- 20 */
 static __inline__ void
-updateModelUseExp_PoissonVaryingUseExpAgFun_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgFun_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateThetaAndValueAgFun_PoissonUseExp(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 
 static __inline__ void
-updateModelUseExp_PoissonVaryingUseExpAgPoisson_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgPoisson_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateTheta_PoissonVaryingUseExpAgCertain(object, y_R, exposure_R);
     updateThetaAndValueAgPoisson_PoissonUseExp(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 
 static __inline__ void
-updateModelUseExp_PoissonVaryingUseExpAgLife_i(SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgLife_i(ModelState *state)
 {
+    SEXP object = state->object_R;
+    SEXP y_R = state->y_R;
+    SEXP exposure_R = state->exposure_R;
     updateThetaAndValueAgLife_PoissonUseExp(object, y_R, exposure_R);
-    updateSigma_Varying(object);
-    updateBetas(object);
-    updateMu(object);
-    updatePriorsBetas(object);
-    updateMeansBetas(object);
-    updateVariancesBetas(object);
+    updateModelStateBetasAndPriors(state);
 }
 
 static __inline__ void
@@ -1372,55 +1289,68 @@ updateModelNotUseExp(SEXP object, SEXP y_R)
 void
 updateModelNotUseExp_Internal(SEXP object, SEXP y_R, int i_method_model)
 {
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_State(&state);
+}
+
+/* Same as 'updateModelNotUseExp_Internal', but with the slots of
+   the model already resolved, in a state that can be
+   reused across iterations */
+void
+updateModelNotUseExp_State(ModelState *state)
+{
+    int i_method_model = state->iMethodModel;
+
     switch(i_method_model)
     {
         case 4:
-            updateModelNotUseExp_NormalVaryingVarsigmaKnown_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaKnown_i(state);
             break;
         case 5:
-            updateModelNotUseExp_NormalVaryingVarsigmaUnknown_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaUnknown_i(state);
             break;
         case 6:
-            updateModelNotUseExp_PoissonVaryingNotUseExp_i(object, y_R);
+            updateModelNotUseExp_PoissonVaryingNotUseExp_i(state);
             break;
         case 12:
-            updateModelNotUseExp_NormalVaryingVarsigmaKnownAgCertain_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaKnownAgCertain_i(state);
             break;
         case 13:
-            updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgCertain_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgCertain_i(state);
             break;
         case 14:
-            updateModelNotUseExp_NormalVaryingVarsigmaKnownAgNormal_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaKnownAgNormal_i(state);
             break;
         case 15:
-            updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgNormal_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgNormal_i(state);
             break;
         case 16:
-            updateModelNotUseExp_PoissonVaryingNotUseExpAgCertain_i(object, y_R);
+            updateModelNotUseExp_PoissonVaryingNotUseExpAgCertain_i(state);
             break;
         case 17:
-            updateModelNotUseExp_PoissonVaryingNotUseExpAgNormal_i(object, y_R);
+            updateModelNotUseExp_PoissonVaryingNotUseExpAgNormal_i(state);
             break;
         case 22:
-            updateModelNotUseExp_PoissonVaryingNotUseExpAgPoisson_i(object, y_R);
+            updateModelNotUseExp_PoissonVaryingNotUseExpAgPoisson_i(state);
             break;
         case 24:
-            updateModelNotUseExp_NormalVaryingVarsigmaKnownAgFun_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaKnownAgFun_i(state);
             break;
         case 25:
-            updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgFun_i(object, y_R);
+            updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgFun_i(state);
             break;
         case 26:
-            updateModelNotUseExp_PoissonVaryingNotUseExpAgFun_i(object, y_R);
+            updateModelNotUseExp_PoissonVaryingNotUseExpAgFun_i(state);
             break;
         case 30:
-            updateModelNotUseExp_NormalFixedNotUseExp_i(object, y_R);
+            updateModelNotUseExp_NormalFixedNotUseExp_i(state->object_R, state->y_R);
             break;
         case 32:
-            updateModelNotUseExp_CMPVaryingNotUseExp_i(object, y_R);
+            updateModelNotUseExp_CMPVaryingNotUseExp_i(state);
             break;
         case 35:
-            updateModelNotUseExp_TFixedNotUseExp_i(object, y_R);
+            updateModelNotUseExp_TFixedNotUseExp_i(state->object_R, state->y_R);
             break;
         default:
             error("unknown i_method_model: %d", i_method_model);
@@ -1438,58 +1368,70 @@ updateModelUseExp(SEXP object, SEXP y_R, SEXP exposure_R)
 }
 
 void
-updateModelUseExp_Internal(SEXP object, SEXP y_R, SEXP exposure_R,
-                            int i_method_model)
+updateModelUseExp_Internal(SEXP object, SEXP y_R, SEXP exposure_R, int i_method_model)
+{
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_State(&state);
+}
+
+/* Same as 'updateModelUseExp_Internal', but with the slots of
+   the model already resolved, in a state that can be
+   reused across iterations */
+void
+updateModelUseExp_State(ModelState *state)
 {
+    int i_method_model = state->iMethodModel;
+
     switch(i_method_model)
     {
         case 9:
-            updateModelUseExp_BinomialVarying_i(object, y_R, exposure_R);
+            updateModelUseExp_BinomialVarying_i(state);
             break;
         case 10:
-            updateModelUseExp_PoissonVarying_i(object, y_R, exposure_R);
+            updateModelUseExp_PoissonVarying_i(state);
             break;
         case 11:
-            updateModelUseExp_PoissonBinomialMixture_i(object, y_R, exposure_R);
+            updateModelUseExp_PoissonBinomialMixture_i(state->object_R, state->y_R, state->exposure_R);
             break;
         case 18:
-        updateModelUseExp_BinomialVaryingAgCertain_i(object, y_R, exposure_R);
+        updateModelUseExp_BinomialVaryingAgCertain_i(state);
             break;
         case 19:
-            updateModelUseExp_BinomialVaryingAgNormal_i(object, y_R, exposure_R);
+            updateModelUseExp_BinomialVaryingAgNormal_i(state);
             break;
         case 20:
-            updateModelUseExp_PoissonVaryingUseExpAgCertain_i(object, y_R, exposure_R);
+            updateModelUseExp_PoissonVaryingUseExpAgCertain_i(state);
             break;
         case 21:
-            updateModelUseExp_PoissonVaryingUseExpAgNormal_i(object, y_R, exposure_R);
+            updateModelUseExp_PoissonVaryingUseExpAgNormal_i(state);
             break;
         case 23:
-            updateModelUseExp_PoissonVaryingUseExpAgPoisson_i(object, y_R, exposure_R);
+            updateModelUseExp_PoissonVaryingUseExpAgPoisson_i(state);
             break;
         case 27:
-            updateModelUseExp_BinomialVaryingAgFun_i(object, y_R, exposure_R);
+            updateModelUseExp_BinomialVaryingAgFun_i(state);
             break;
         case 28:
-            updateModelUseExp_PoissonVaryingUseExpAgFun_i(object, y_R, exposure_R);
+            updateModelUseExp_PoissonVaryingUseExpAgFun_i(state);
             break;
         case 29:
-            updateModelUseExp_PoissonVaryingUseExpAgLife_i(object, y_R, exposure_R);
+            updateModelUseExp_PoissonVaryingUseExpAgLife_i(state);
             break;
         case 31:
-            updateModelUseExp_NormalFixedUseExp_i(object, y_R, exposure_R);
+            updateModelUseExp_NormalFixedUseExp_i(state->object_R, state->y_R, state->exposure_R);
             break;
         case 33:
-            updateModelUseExp_CMPVaryingUseExp_i(object, y_R, exposure_R);
+            updateModelUseExp_CMPVaryingUseExp_i(state);
             break;
         case 34:
-            updateModelUseExp_Round3_i(object, y_R, exposure_R);
+            updateModelUseExp_Round3_i(state->object_R, state->y_R, state->exposure_R);
             break;
         case 36:
-            updateModelUseExp_TFixedUseExp_i(object, y_R, exposure_R);
+            updateModelUseExp_TFixedUseExp_i(state->object_R, state->y_R, state->exposure_R);
             break;
         case 37:
-            updateModelUseExp_LN2_i(object, y_R, exposure_R);
+            updateModelUseExp_LN2_i(state->object_R, state->y_R, state->exposure_R);
             break;
         default:
             error("unknown i_method_model: %d", i_method_model);
@@ -1501,89 +1443,114 @@ updateModelUseExp_Internal(SEXP object, SEXP y_R, SEXP exposure_R,
 void
 updateModelNotUseExp_CMPVaryingNotUseExp(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_CMPVaryingNotUseExp_i(object, y_R);
-
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_CMPVaryingNotUseExp_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaKnown(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaKnown_i(object, y_R);
-
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaKnown_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaUnknown(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaUnknown_i(object, y_R);
-
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaUnknown_i(&state);
 }
 
 void
 updateModelNotUseExp_PoissonVaryingNotUseExp(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_PoissonVaryingNotUseExp_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_PoissonVaryingNotUseExp_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaKnownAgCertain(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaKnownAgCertain_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaKnownAgCertain_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgCertain(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgCertain_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgCertain_i(&state);
 }
 
 void
 updateModelNotUseExp_PoissonVaryingNotUseExpAgCertain(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_PoissonVaryingNotUseExpAgCertain_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_PoissonVaryingNotUseExpAgCertain_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaKnownAgNormal(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaKnownAgNormal_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaKnownAgNormal_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgNormal(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgNormal_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgNormal_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaKnownAgFun(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaKnownAgFun_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaKnownAgFun_i(&state);
 }
 
 void
 updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgFun(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgFun_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_NormalVaryingVarsigmaUnknownAgFun_i(&state);
 }
 
 void
 updateModelNotUseExp_PoissonVaryingNotUseExpAgNormal(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_PoissonVaryingNotUseExpAgNormal_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_PoissonVaryingNotUseExpAgNormal_i(&state);
 }
 
 void
 updateModelNotUseExp_PoissonVaryingNotUseExpAgFun(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_PoissonVaryingNotUseExpAgFun_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_PoissonVaryingNotUseExpAgFun_i(&state);
 }
 
 
 void
 updateModelNotUseExp_PoissonVaryingNotUseExpAgPoisson(SEXP object, SEXP y_R)
 {
-    updateModelNotUseExp_PoissonVaryingNotUseExpAgPoisson_i(object, y_R);
+    ModelState state;
+    initModelState(&state, object, y_R, R_NilValue);
+    updateModelNotUseExp_PoissonVaryingNotUseExpAgPoisson_i(&state);
 }
 
 void
@@ -1602,22 +1569,26 @@ updateModelNotUseExp_TFixedNotUseExp(SEXP object, SEXP y_R)
 void
 updateModelUseExp_CMPVaryingUseExp(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_CMPVaryingUseExp_i(object, y_R, exposure_R);
-
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_CMPVaryingUseExp_i(&state);
 }
 
 void
 updateModelUseExp_BinomialVarying(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_BinomialVarying_i(object, y_R, exposure_R);
-
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_BinomialVarying_i(&state);
 }
 
 
 void
 updateModelUseExp_PoissonVarying(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_PoissonVarying_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_PoissonVarying_i(&state);
 }
 
 void
@@ -1634,59 +1605,67 @@ updateModelUseExp_Round3(SEXP object, SEXP y_R, SEXP exposure_R)
 }
 
 void
-updateModelUseExp_BinomialVaryingAgCertain
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_BinomialVaryingAgCertain(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_BinomialVaryingAgCertain_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_BinomialVaryingAgCertain_i(&state);
 }
 
 void
-updateModelUseExp_BinomialVaryingAgNormal
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_BinomialVaryingAgNormal(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_BinomialVaryingAgNormal_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_BinomialVaryingAgNormal_i(&state);
 }
 
 void
-updateModelUseExp_BinomialVaryingAgFun
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_BinomialVaryingAgFun(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_BinomialVaryingAgFun_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_BinomialVaryingAgFun_i(&state);
 }
 
 void
-updateModelUseExp_PoissonVaryingUseExpAgCertain
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgCertain(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_PoissonVaryingUseExpAgCertain_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_PoissonVaryingUseExpAgCertain_i(&state);
 }
 
 void
-updateModelUseExp_PoissonVaryingUseExpAgNormal
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgNormal(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_PoissonVaryingUseExpAgNormal_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_PoissonVaryingUseExpAgNormal_i(&state);
 }
 
 void
-updateModelUseExp_PoissonVaryingUseExpAgFun
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgFun(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_PoissonVaryingUseExpAgFun_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_PoissonVaryingUseExpAgFun_i(&state);
 }
 
 void
-updateModelUseExp_PoissonVaryingUseExpAgPoisson
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgPoisson(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_PoissonVaryingUseExpAgPoisson_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_PoissonVaryingUseExpAgPoisson_i(&state);
 }
 
 void
-updateModelUseExp_PoissonVaryingUseExpAgLife
-                                (SEXP object, SEXP y_R, SEXP exposure_R)
+updateModelUseExp_PoissonVaryingUseExpAgLife(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-    updateModelUseExp_PoissonVaryingUseExpAgLife_i(object, y_R, exposure_R);
+    ModelState state;
+    initModelState(&state, object, y_R, exposure_R);
+    updateModelUseExp_PoissonVaryingUseExpAgLife_i(&state);
 }
 
 void
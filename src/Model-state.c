@@ -0,0 +1,830 @@
+#include "model-state.h"
+#include "model-methods.h"
+#include "update-nongeneric.h"
+#include "helper-functions.h"
+#include "demest.h"
+
+
+/* File "Model-state.c" contains functions for setting up and
+ * updating the native view of a model object defined in
+ * "model-state.h". */
+
+extern SEXP
+  Data_sym,  /* used for .Data slot */
+  iMethodPrior_sym,
+  Z_sym,
+  beta_sym,
+  eta_sym,
+  gamma_sym,
+  lower_sym,
+  tau_sym,
+  tauMax_sym,
+  upper_sym,
+  order_sym,
+  iteratorBeta_sym,
+  iWithin_sym,
+  nWithin_sym,
+  iBetween_sym,
+  nBetween_sym,
+  incrementBetween_sym,
+  indices_sym,
+  initial_sym,
+  dimIterators_sym,
+  strideLengths_sym,
+  nStrides_sym,
+  dimBefore_sym,
+  dimAfter_sym,
+  posDim_sym,
+  lengthDim_sym,
+  iMethodModel_sym,
+  meansBetas_sym,
+  variancesBetas_sym,
+  betaEqualsMean_sym,
+  acceptBeta_sym,
+  priorsBetas_sym,
+  logPostPriorsBetas_sym,
+  logPostBetas_sym,
+  logPostSigma_sym,
+  logPostTheta_sym,
+  logPostVarsigma_sym,
+  theta_sym,
+  thetaTransformed_sym,
+  cellInLik_sym,
+  mu_sym,
+  sigma_sym,
+  sigmaMax_sym,
+  ASigma_sym,
+  nuSigma_sym,
+  varsigma_sym,
+  varsigmaMax_sym,
+  varsigmaSetToZero_sym,
+  AVarsigma_sym,
+  nuVarsigma_sym,
+  w_sym,
+  scaleTheta_sym,
+  scaleThetaMultiplier_sym,
+  nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
+  betas_sym,
+  priors_sym,
+  iteratorBetas_sym,
+  dims_sym,
+  prob_sym,
+  ADelta0_sym,
+  meanDelta0_sym,
+
+  mean_sym,
+  sd_sym,
+
+  tolerance_sym,
+  betaIsPredicted_sym,
+  nFailedPropTheta_sym,
+  nFailedPropYStar_sym,
+  maxAttempt_sym,
+  valueAg_sym,
+  weightAg_sym,
+  transformAg_sym,
+  meanAg_sym,
+  sdAg_sym,
+  scaleAg_sym,
+  nAcceptAg_sym,
+  nFailedPropValueAg_sym,
+  funAg_sym,
+  xArgsAg_sym,
+  weightsArgsAg_sym,
+  mxAg_sym,
+  axAg_sym,
+  nxAg_sym,
+  nAgeAg_sym,
+  transformThetaToMxAg_sym,
+  subtotals_sym,
+  transformSubtotals_sym,
+  subtotalsNet_sym,
+  slotsToExtract_sym,
+  iMethodCombined_sym,
+  model_sym,
+  exposure_sym,
+  y_sym,
+  dataModels_sym,
+  datasets_sym,
+  transforms_sym,
+  seriesIndices_sym,
+  updateComponent_sym,
+  updateDataModel_sym,
+  updateSystemModel_sym,
+
+  J_sym,
+
+  UC_sym,
+  DC_sym,
+  UR_sym,
+  DCInv_sym,
+  DRInv_sym,
+  CC_sym,
+  a_sym,
+  R_sym,
+  priorsW_sym,
+  v_sym,
+  forward_sym,
+  offsetsBetas_sym,
+  offsetsPriorsBetas_sym,
+  offsetsSigma_sym,
+  offsetsVarsigma_sym,
+  m0_sym,
+  C0_sym,
+  phi_sym,
+  w_sym,
+  iteratorGamma_sym,
+  iteratorV_sym,
+  delta_sym,
+  phiKnown_sym,
+  /* description */
+  nTime_sym,
+  stepTime_sym,
+  hasAge_sym,
+  hasSex_sym,
+  iSexDominant_sym,
+  stepSexCurrent_sym,
+  stepSexTarget_sym,
+  nAge_sym,
+  stepAge_sym,
+  length_sym,
+  stepTriangle_sym,
+  stepDirection_sym,
+  nBetweenVec_sym,
+  stepBetweenVec_sym,
+  nWithinVec_sym,
+  stepWithinVec_sym,
+  /* cohort iterators */
+  i_sym,
+  iTime_sym,
+  iAge_sym,
+  iTriangle_sym,
+  finished_sym,
+  iVec_sym,
+  lengthVec_sym,
+  increment_sym,
+  lastAgeGroupOpen_sym,
+  /* mappings */
+  hasParCh_sym,
+  isOneToOne_sym,
+  nSharedVec_sym,
+  stepSharedCurrentVec_sym,
+  stepSharedCurrentExposureVec_sym,
+  stepSharedTargetVec_sym,
+  nTimeCurrent_sym,
+  stepTimeCurrent_sym,
+  stepTimeTarget_sym,
+  nAgeCurrent_sym,
+  nAgeTarget_sym,
+  stepAgeCurrent_sym,
+  stepAgeTarget_sym,
+  stepTriangleCurrent_sym,
+  stepTriangleTarget_sym,
+  nOrigDestVec_sym,
+  stepOrigCurrentVec_sym,
+  stepDestCurrentVec_sym,
+  stepOrigDestTargetVec_sym,
+  iMinAge_sym,
+
+  /*new priors*/
+  ATau_sym,
+  nuTau_sym,
+  hasAlphaDLM_sym,
+  hasAlphaICAR_sym,
+  hasAlphaMix_sym,
+  hasCovariates_sym,
+  hasAlphaKnown_sym,
+  hasMean_sym,
+  hasSeason_sym,
+  isKnownUncertain_sym,
+  isNorm_sym,
+  isRobust_sym,
+  isZeroVar_sym,
+  alphaDLM_sym,
+  alphaICAR_sym,
+  alphaMix_sym,
+  iteratorState_sym,
+  iteratorStateOld_sym,
+  K_sym,
+  L_sym,
+  s_sym,
+  UBeta_sym,
+  nuBeta_sym,
+  isSaturated_sym,
+  allStrucZero_sym,
+  alongAllStrucZero_sym,
+  strucZeroArray_sym,
+  mNoTrend_sym,
+  m0NoTrend_sym,
+  CNoTrend_sym,
+  aNoTrend_sym,
+  RNoTrend_sym,
+  GWithTrend_sym,
+  mWithTrend_sym,
+  m0WithTrend_sym,
+  CWithTrend_sym,
+  aWithTrend_sym,
+  hasLevel_sym,
+  omegaAlpha_sym,
+  omegaAlphaMax_sym,
+  AAlpha_sym,
+  nuAlpha_sym,
+  deltaDLM_sym,
+  omegaDelta_sym,
+  omegaDeltaMax_sym,
+  nuDelta_sym,
+  ADelta_sym,
+  minPhi_sym,
+  maxPhi_sym,
+  shape1Phi_sym,
+  shape2Phi_sym,
+  WSqrt_sym,
+  WSqrtInvG_sym,
+  exposureAg_sym,
+  P_sym,
+  AEtaIntercept_sym,
+  AEtaCoef_sym,
+  nuEtaCoef_sym,
+  meanEtaCoef_sym,
+  UEtaCoef_sym,
+  nSeason_sym,
+  ASeason_sym,
+  omegaSeason_sym,
+  omegaSeasonMax_sym,
+  nuSeason_sym,
+  mSeason_sym,
+  m0Season_sym,
+  CSeason_sym,
+  aSeason_sym,
+  RSeason_sym,
+  JOld_sym,
+  /* new priors Jan 2017 */
+  sumsWeightsMix_sym,
+  weightMix_sym,
+  latentWeightMix_sym,
+  foundIndexClassMaxPossibleMix_sym,
+  indexClassMaxPossibleMix_sym,
+  indexClassProbMix_sym,
+  componentWeightMix_sym,
+  latentComponentWeightMix_sym,
+  levelComponentWeightMix_sym,
+  levelComponentWeightOldMix_sym,
+  meanLevelComponentWeightMix_sym,
+  indexClassMix_sym,
+  indexClassMaxMix_sym,
+  indexClassMaxUsedMix_sym,
+  omegaComponentWeightMix_sym,
+  omegaComponentWeightMaxMix_sym,
+  omegaLevelComponentWeightMix_sym,
+  omegaLevelComponentWeightMaxMix_sym,
+  iteratorsDimsMix_sym,
+  iAlong_sym,
+  dimBeta_sym,
+  dimBetaOld_sym,
+  phiMix_sym,
+  mMix_sym,
+  CMix_sym,
+  aMix_sym,
+  RMix_sym,
+  prodVectorsMix_sym,
+  posProdVectors1Mix_sym,
+  posProdVectors2Mix_sym,
+  nBetaNoAlongMix_sym,
+  vectorsMix_sym,
+  omegaVectorsMix_sym,
+  iteratorProdVectorMix_sym,
+  yXMix_sym,
+  XXMix_sym,
+  priorMeanLevelComponentWeightMix_sym,
+  priorSDLevelComponentWeightMix_sym,
+  AComponentWeightMix_sym,
+  nuComponentWeightMix_sym,
+  omegaVectorsMix_sym,
+  omegaVectorsMaxMix_sym,
+  AVectorsMix_sym,
+  nuVectorsMix_sym,
+  minLevelComponentWeight_sym,
+  maxLevelComponentWeight_sym,
+  updateSeriesDLM_sym,
+  ALevelComponentWeightMix_sym,
+  nuLevelComponentWeightMix_sym,
+
+  nuCMP_sym,
+  sdLogNuCMP_sym,
+  sdLogNuMaxCMP_sym,
+  meanMeanLogNuCMP_sym,
+  sdMeanLogNuCMP_sym,
+  meanLogNuCMP_sym,
+  ASDLogNuCMP_sym,
+  nuSDLogNuCMP_sym,
+  nu_sym,
+
+  alphaKnown_sym,
+  AKnownVec_sym,
+
+  /* skeleton */
+  first_sym,
+  last_sym,
+
+  /* Box-Cox */
+  boxCoxParam_sym,
+
+  /* accounts  and combined accounts*/
+  account_sym,
+  population_sym,
+  accession_sym,
+  components_sym,
+  descriptions_sym,
+  iteratorPopn_sym,
+  iteratorAcc_sym,
+  iteratorExposure_sym,
+  transformsExpToComp_sym,
+  transformExpToBirths_sym,
+  iCell_sym,
+  iCellOther_sym,
+  iComp_sym,
+  iPopnNext_sym,
+  iPopnNextOther_sym,
+  iAccNext_sym,
+  iAccNextOther_sym,
+  iOrigDest_sym,
+  iPool_sym,
+  iIntNet_sym,
+  iBirths_sym,
+  iParCh_sym,
+  diffProp_sym,
+  isIncrement_sym,
+  isNet_sym,
+  scaleNoise_sym,
+  usePriorPopn_sym,
+  systemModels_sym,
+  modelUsesExposure_sym,
+  mappingsFromExp_sym,
+  mappingsToExp_sym,
+  mappingsToPopn_sym,
+  mappingsToAcc_sym,
+  iExpFirst_sym,
+  iExpFirstOther_sym,
+  ageTimeStep_sym,
+  iteratorsComp_sym,
+  expectedExposure_sym,
+  iExposure_sym,
+  iExposureOther_sym,
+  isLowerTriangle_sym,
+  isOldestAgeGroup_sym,
+  generatedNewProposal_sym,
+  probSmallUpdate_sym,
+  isSmallUpdate_sym,
+  isSmallUpdateFinal_sym,
+  probPopn_sym,
+  cumProbComp_sym,
+  nCellAccount_sym,
+  /* LN@ */
+  alphaLN2_sym,
+  transformLN2_sym,
+  constraintLN2_sym,
+  nCellBeforeLN2_sym;
+
+extern SEXP (*dembase_Collapse_R)(SEXP ,SEXP);
+extern SEXP (*dembase_Extend_R)(SEXP ,SEXP);
+extern int (*dembase_getIAfter)(int, SEXP);
+extern SEXP (*dembase_getIBefore)(int, SEXP);
+extern SEXP (*dembase_getIShared)(int, SEXP);
+
+
+/* ******************************************************************************** */
+/* Functions for setting up model states ****************************************** */
+/* ******************************************************************************** */
+
+/* models whose complete update, including theta, is carried
+   out on the native arrays held in the state */
+int
+usesModelState(int i_method_model)
+{
+    switch(i_method_model)
+    {
+        case 4: case 5: case 6: case 9: case 10:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Varying models, which have betas, priors, and mu,
+   and so have these slots resolved in the state */
+int
+modelHasBetas(int i_method_model)
+{
+    switch(i_method_model)
+    {
+        case 4: case 5: case 6: case 9: case 10:
+        case 12: case 13: case 14: case 15: case 16: case 17:
+        case 18: case 19: case 20: case 21: case 22: case 23:
+        case 24: case 25: case 26: case 27: case 28: case 29:
+        case 32: case 33:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static double *
+getOptionalDoublePtr(SEXP object_R, SEXP sym)
+{
+    if (R_has_slot(object_R, sym))
+        return REAL(GET_SLOT(object_R, sym));
+    else
+        return NULL;
+}
+
+static int *
+getOptionalIntPtr(SEXP object_R, SEXP sym)
+{
+    if (R_has_slot(object_R, sym))
+        return INTEGER(GET_SLOT(object_R, sym));
+    else
+        return NULL;
+}
+
+/* Record which values of y are missing, and classify each
+   cell as observed, missing and part of a subtotal, missing
+   and drawn from the prior, or a structural zero - which
+   is how 'updateTheta_PoissonVaryingUseExpInternal' and
+   'updateTheta_PoissonVaryingNotUseExpInternal' treat it.
+   Structural zeros are cells that are not in the likelihood
+   and have observed values of 0. */
+static void
+classifyCells(ModelState *state)
+{
+    int n_theta = state->nTheta;
+    int *cellInLik = state->cellInLik;
+    int *yInt = state->yInt;
+    double *yReal = state->yReal;
+    int has_subtotals = state->hasSubtotals;
+    TransformIndex *subtotalsIndex = state->subtotalsIndex;
+
+    int *yMissing = (int *)R_alloc(n_theta, sizeof(int));
+    int *cellKind = (int *)R_alloc(n_theta, sizeof(int));
+    int *iAfterSubtotal = (int *)R_alloc(n_theta, sizeof(int));
+    int *cellsActive = (int *)R_alloc(n_theta, sizeof(int));
+    int n_cell_active = 0;
+
+    for (int i = 0; i < n_theta; ++i) {
+        int y_is_missing;
+        int y_is_zero;
+        if (yInt) {
+            int this_y = yInt[i];
+            y_is_missing = ( this_y == NA_INTEGER || ISNA(this_y) );
+            y_is_zero = (this_y == 0);
+        }
+        else {
+            double this_y = yReal[i];
+            y_is_missing = ( this_y == NA_REAL || ISNA(this_y) );
+            y_is_zero = (this_y == 0);
+        }
+        int ir_after = 0;
+        if (y_is_missing && has_subtotals) {
+            ir_after = subtotalsIndex->iAfter[i] + 1;
+        }
+        int kind;
+        if (y_is_missing) {
+            kind = (ir_after > 0) ? CELL_MISSING_SUBTOTAL : CELL_MISSING_PRIOR;
+        }
+        else if (!cellInLik[i] && y_is_zero) {
+            kind = CELL_STRUC_ZERO;
+        }
+        else {
+            kind = CELL_OBSERVED;
+        }
+        yMissing[i] = y_is_missing;
+        cellKind[i] = kind;
+        iAfterSubtotal[i] = ir_after;
+        ++state->nCellKind[kind];
+        if (kind != CELL_STRUC_ZERO) {
+            cellsActive[n_cell_active] = i;
+            ++n_cell_active;
+        }
+    }
+
+    state->yMissing = yMissing;
+    state->cellKind = cellKind;
+    state->iAfterSubtotal = iAfterSubtotal;
+    state->nCellActive = n_cell_active;
+    state->cellsActive = cellsActive;
+    state->sqResid = (double *)R_alloc(n_theta, sizeof(double));
+}
+
+/* 'y_R' and 'exposure_R' can be R_NilValue if the state is
+   only used for updating sigma, betas, mu, and priors. If
+   'object_R' is not a Varying model, only 'object_R', 'y_R',
+   'exposure_R', and 'iMethodModel' are set. */
+void
+initModelState(ModelState *state, SEXP object_R, SEXP y_R, SEXP exposure_R)
+{
+    int i_method_model = *INTEGER(GET_SLOT(object_R, iMethodModel_sym));
+    if (!modelHasBetas(i_method_model)) {
+        memset(state, 0, sizeof(ModelState));
+        state->object_R = object_R;
+        state->y_R = y_R;
+        state->exposure_R = exposure_R;
+        state->iMethodModel = i_method_model;
+        return;
+    }
+    state->object_R = object_R;
+    state->y_R = y_R;
+    state->exposure_R = exposure_R;
+    state->iMethodModel = i_method_model;
+
+    /* cells */
+    SEXP theta_R = GET_SLOT(object_R, theta_sym);
+    int n_theta = LENGTH(theta_R);
+    state->nTheta = n_theta;
+    state->theta = REAL(theta_R);
+    state->thetaTransformed = REAL(GET_SLOT(object_R, thetaTransformed_sym));
+    state->mu = REAL(GET_SLOT(object_R, mu_sym));
+    state->cellInLik = LOGICAL(GET_SLOT(object_R, cellInLik_sym));
+
+    state->yInt = NULL;
+    state->yReal = NULL;
+    state->yMissing = NULL;
+    state->cellKind = NULL;
+    state->iAfterSubtotal = NULL;
+    state->nCellActive = 0;
+    state->cellsActive = NULL;
+    state->sqResid = NULL;
+    memset(state->nCellKind, 0, sizeof(state->nCellKind));
+    state->hasSubtotals = 0;
+    state->transformSubtotals_R = R_NilValue;
+    state->subtotalsIndex = NULL;
+    state->subtotalsNet = NULL;
+    if (y_R != R_NilValue) {
+        if (TYPEOF(y_R) == INTSXP)
+            state->yInt = INTEGER(y_R);
+        else
+            state->yReal = REAL(y_R);
+        if (R_has_slot(y_R, subtotals_sym)) {
+            state->hasSubtotals = 1;
+            state->transformSubtotals_R = GET_SLOT(y_R, transformSubtotals_sym);
+            state->subtotalsIndex = (TransformIndex *)R_alloc(1, sizeof(TransformIndex));
+            makeCollapseTransformIndex(state->subtotalsIndex,
+                                       state->transformSubtotals_R);
+            state->subtotalsNet = INTEGER(GET_SLOT(y_R, subtotalsNet_sym));
+        }
+        classifyCells(state);
+    }
+    state->exposureInt = NULL;
+    state->exposureReal = NULL;
+    if (exposure_R != R_NilValue) {
+        if (TYPEOF(exposure_R) == INTSXP)
+            state->exposureInt = INTEGER(exposure_R);
+        else
+            state->exposureReal = REAL(exposure_R);
+    }
+
+    /* constants */
+    double *lower = getOptionalDoublePtr(object_R, lower_sym);
+    double *upper = getOptionalDoublePtr(object_R, upper_sym);
+    double *tolerance = getOptionalDoublePtr(object_R, tolerance_sym);
+    int *maxAttempt = getOptionalIntPtr(object_R, maxAttempt_sym);
+    double *boxCoxParam = getOptionalDoublePtr(object_R, boxCoxParam_sym);
+    state->lower = lower ? *lower : R_NegInf;
+    state->upper = upper ? *upper : R_PosInf;
+    state->tolerance = tolerance ? *tolerance : 0;
+    state->maxAttempt = maxAttempt ? *maxAttempt : 0;
+    state->boxCoxParam = boxCoxParam ? *boxCoxParam : 0;
+    state->sigmaMax = *REAL(GET_SLOT(object_R, sigmaMax_sym));
+    state->ASigma = *REAL(GET_SLOT(object_R, ASigma_sym));
+    state->nuSigma = *REAL(GET_SLOT(object_R, nuSigma_sym));
+    state->w = getOptionalDoublePtr(object_R, w_sym);
+
+    /* scalar slots */
+    state->sigma = REAL(GET_SLOT(object_R, sigma_sym));
+    state->varsigma = getOptionalDoublePtr(object_R, varsigma_sym);
+    if (R_has_slot(object_R, varsigmaSetToZero_sym))
+        state->varsigmaSetToZero = LOGICAL(GET_SLOT(object_R, varsigmaSetToZero_sym));
+    else
+        state->varsigmaSetToZero = NULL;
+    state->scaleTheta = getOptionalDoublePtr(object_R, scaleTheta_sym);
+    state->scaleThetaMultiplier = getOptionalDoublePtr(object_R, scaleThetaMultiplier_sym);
+    state->nAcceptTheta = getOptionalIntPtr(object_R, nAcceptTheta_sym);
+    state->nAcceptThetaAdapt = getOptionalDoublePtr(object_R, nAcceptThetaAdapt_sym);
+    state->nFailedPropTheta = getOptionalIntPtr(object_R, nFailedPropTheta_sym);
+
+    /* betas and priors */
+    SEXP betas_R = GET_SLOT(object_R, betas_sym);
+    SEXP meansBetas_R = GET_SLOT(object_R, meansBetas_sym);
+    SEXP variancesBetas_R = GET_SLOT(object_R, variancesBetas_sym);
+    SEXP priorsBetas_R = GET_SLOT(object_R, priorsBetas_sym);
+    int n_beta = LENGTH(betas_R);
+    state->nBeta = n_beta;
+    state->iteratorBetas_R = GET_SLOT(object_R, iteratorBetas_sym);
+    state->betaEqualsMean = LOGICAL(GET_SLOT(object_R, betaEqualsMean_sym));
+    state->J = (int *)R_alloc(n_beta, sizeof(int));
+    state->betas = (double **)R_alloc(n_beta, sizeof(double *));
+    state->meansBetas = (double **)R_alloc(n_beta, sizeof(double *));
+    state->variancesBetas = (double **)R_alloc(n_beta, sizeof(double *));
+    state->allStrucZero = (int **)R_alloc(n_beta, sizeof(int *));
+    state->priors = (SEXP *)R_alloc(n_beta, sizeof(SEXP));
+    int max_J = 0;
+    for (int i_beta = 0; i_beta < n_beta; ++i_beta) {
+        SEXP prior_R = VECTOR_ELT(priorsBetas_R, i_beta);
+        int J = *INTEGER(GET_SLOT(prior_R, J_sym));
+        state->J[i_beta] = J;
+        state->betas[i_beta] = REAL(VECTOR_ELT(betas_R, i_beta));
+        state->meansBetas[i_beta] = REAL(VECTOR_ELT(meansBetas_R, i_beta));
+        state->variancesBetas[i_beta] = REAL(VECTOR_ELT(variancesBetas_R, i_beta));
+        state->allStrucZero[i_beta] = LOGICAL(GET_SLOT(prior_R, allStrucZero_sym));
+        state->priors[i_beta] = prior_R;
+        if (J > max_J)
+            max_J = J;
+    }
+    state->maxJ = max_J;
+    /* set up by 'getBetaIndices', the first time the betas are updated */
+    state->betaIndices = NULL;
+    state->workTheta = NULL;
+    state->vbar = NULL;
+    state->nVec = NULL;
+    state->betaDelta = NULL;
+
+    /* running quantities */
+    state->sumSqResid = 0;
+    state->nSumSqResid = 0;
+    state->hasSumSqResid = 0;
+    /* a state used for a single update recalculates mu
+       from scratch, as the separate update functions do */
+    state->nUpdateMu = K_N_UPDATE_REFRESH_MU - 1;
+}
+
+/* Table giving, for each cell, the position of the element
+   of each beta that contributes to mu, plus work space for
+   sweeping through the betas. Only needed when the betas
+   are updated, so built the first time it is asked for,
+   and then kept for the life of the state. */
+int *
+getBetaIndices(ModelState *state)
+{
+    if (state->betaIndices == NULL) {
+        int n_theta = state->nTheta;
+        int n_beta = state->nBeta;
+        int max_J = state->maxJ;
+        state->betaIndices = (int *)R_alloc(n_theta * n_beta, sizeof(int));
+        makeBetaIndices(state->betaIndices, state->iteratorBetas_R, n_theta, n_beta);
+        state->workTheta = (double *)R_alloc(n_theta, sizeof(double));
+        state->vbar = (double *)R_alloc(max_J, sizeof(double));
+        state->nVec = (int *)R_alloc(max_J, sizeof(int));
+        state->betaDelta = (double *)R_alloc(max_J, sizeof(double));
+    }
+    return state->betaIndices;
+}
+
+
+/* Set up 'state' for repeated calls to 'updateModelState',
+   within a single .Call. The state is built once, before
+   the loop over iterations, and then passed to each update. */
+void
+prepareModelState(ModelState *state, SEXP object_R, SEXP y_R, SEXP exposure_R)
+{
+    initModelState(state, object_R, y_R, exposure_R);
+    if (modelHasBetas(state->iMethodModel)) {
+        /* remove any drift in mu left by earlier calls */
+        updateMuInternal(state);
+        state->nUpdateMu = 0;
+    }
+}
+
+/* Point 'state' at a new exposure, with the same length as
+   the old one, as happens with data models, where the
+   exposure is a collapsed series that can be recreated
+   at each iteration. */
+void
+setModelStateExposure(ModelState *state, SEXP exposure_R)
+{
+    state->exposure_R = exposure_R;
+    if (!modelHasBetas(state->iMethodModel))
+        return;
+    state->exposureInt = NULL;
+    state->exposureReal = NULL;
+    if (TYPEOF(exposure_R) == INTSXP)
+        state->exposureInt = INTEGER(exposure_R);
+    else
+        state->exposureReal = REAL(exposure_R);
+}
+
+
+/* ******************************************************************************** */
+/* Functions for updating model states ******************************************** */
+/* ******************************************************************************** */
+
+/* mu is updated along with the betas, and only
+   recalculated from scratch every K_N_UPDATE_REFRESH_MU
+   updates, to stop rounding errors accumulating */
+void
+updateModelStateBetasAndPriors(ModelState *state)
+{
+    updateSigma_VaryingInternal(state);
+    updateBetasAndMuInternal(state);
+    ++state->nUpdateMu;
+    if (state->nUpdateMu >= K_N_UPDATE_REFRESH_MU) {
+        updateMuInternal(state);
+        state->nUpdateMu = 0;
+    }
+    updatePriorsBetasInternal(state);
+    updateMeansBetasInternal(state);
+    updateVariancesBetasInternal(state);
+}
+
+/* Whether the theta update for 'state' can run in a parallel
+   task, which requires that it not call the R API. */
+int
+thetaUpdateIsThreadSafe(ModelState *state)
+{
+    return usesModelState(state->iMethodModel);
+}
+
+/* The first part of 'updateModelState', which only touches
+   the arrays held in 'state', and so, if
+   'thetaUpdateIsThreadSafe' is true, can run in parallel
+   with the theta updates of other models. Must be followed
+   by 'updateModelStateRest'. */
+void
+updateModelStateTheta(ModelState *state)
+{
+    int i_method_model = state->iMethodModel;
+    switch(i_method_model)
+    {
+        case 4:
+            if (!(*state->varsigmaSetToZero)) {
+                updateTheta_NormalVaryingInternal(state);
+            }
+            break;
+        case 5:
+            updateTheta_NormalVaryingInternal(state);
+            break;
+        case 6:
+            updateTheta_PoissonVaryingNotUseExpInternal(state);
+            break;
+        case 9:
+            updateTheta_BinomialVaryingInternal(state);
+            break;
+        case 10:
+            updateTheta_PoissonVaryingUseExpInternal(state);
+            break;
+        default:
+            error("model with iMethodModel %d does not use model state",
+                  i_method_model);
+    }
+}
+
+/* The rest of 'updateModelState', after 'updateModelStateTheta' */
+void
+updateModelStateRest(ModelState *state)
+{
+    if (state->iMethodModel == 5)
+        updateVarsigma(state->object_R, state->y_R);
+    updateModelStateBetasAndPriors(state);
+}
+
+/* Non-zero while the scales of the proposals for theta are
+   being adapted, ie during a block of burnin updates that will
+   be followed by a call to 'adaptScalesTheta'. Set by the
+   wrappers for 'updateCombined', 'updateSystemModels' and
+   'updateDataModels*', from their 'adapt' arguments. */
+static int adaptingTheta = 0;
+
+void
+setAdaptingTheta(int adapting)
+{
+    adaptingTheta = adapting;
+}
+
+/* Add the proposals for theta accepted in the most recent
+   update to the total used by 'adaptScaleTheta', if the
+   scales are being adapted. Equivalent to R code
+   'if (adapt) model <- recordAcceptTheta(model)'. */
+void
+recordModelStateAccept(ModelState *state)
+{
+    if (adaptingTheta && state->nAcceptThetaAdapt && state->nAcceptTheta)
+        *state->nAcceptThetaAdapt += *state->nAcceptTheta;
+}
+
+/* Equivalent to 'updateModelNotUseExp' or 'updateModelUseExp'.
+   For models where 'usesModelState' is true, everything is
+   done on the arrays held in 'state'. For other Varying
+   models, theta is updated by the model-specific functions,
+   and the rest by 'updateModelStateBetasAndPriors'. */
+void
+updateModelState(ModelState *state)
+{
+    if (usesModelState(state->iMethodModel)) {
+        updateModelStateTheta(state);
+        updateModelStateRest(state);
+    }
+    else {
+        if (state->exposure_R == R_NilValue)
+            updateModelNotUseExp_State(state);
+        else
+            updateModelUseExp_State(state);
+    }
+}
@@ -0,0 +1,1539 @@
+#include "account-batch.h"
+#include "iterators-methods.h"
+#include "transform-index.h"
+#include "random-streams.h"
+#include "log-factorial.h"
+#include "demest.h"
+
+
+/* File "account-batch.c" contains functions for updating
+ * the account in batches of population proposals, described
+ * in "account-batch.h". */
+
+extern SEXP
+  Data_sym,  /* used for .Data slot */
+  iMethodPrior_sym,
+  Z_sym,
+  beta_sym,
+  eta_sym,
+  gamma_sym,
+  lower_sym,
+  tau_sym,
+  tauMax_sym,
+  upper_sym,
+  order_sym,
+  iteratorBeta_sym,
+  iWithin_sym,
+  nWithin_sym,
+  iBetween_sym,
+  nBetween_sym,
+  incrementBetween_sym,
+  indices_sym,
+  initial_sym,
+  dimIterators_sym,
+  strideLengths_sym,
+  nStrides_sym,
+  dimBefore_sym,
+  dimAfter_sym,
+  posDim_sym,
+  lengthDim_sym,
+  iMethodModel_sym,
+  meansBetas_sym,
+  variancesBetas_sym,
+  betaEqualsMean_sym,
+  acceptBeta_sym,
+  priorsBetas_sym,
+  logPostPriorsBetas_sym,
+  logPostBetas_sym,
+  logPostSigma_sym,
+  logPostTheta_sym,
+  logPostVarsigma_sym,
+  theta_sym,
+  thetaTransformed_sym,
+  cellInLik_sym,
+  mu_sym,
+  sigma_sym,
+  sigmaMax_sym,
+  ASigma_sym,
+  nuSigma_sym,
+  varsigma_sym,
+  varsigmaMax_sym,
+  varsigmaSetToZero_sym,
+  AVarsigma_sym,
+  nuVarsigma_sym,
+  w_sym,
+  scaleTheta_sym,
+  scaleThetaMultiplier_sym,
+  nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
+  betas_sym,
+  priors_sym,
+  iteratorBetas_sym,
+  dims_sym,
+  prob_sym,
+  ADelta0_sym,
+  meanDelta0_sym,
+
+  mean_sym,
+  sd_sym,
+
+  tolerance_sym,
+  betaIsPredicted_sym,
+  nFailedPropTheta_sym,
+  nFailedPropYStar_sym,
+  maxAttempt_sym,
+  valueAg_sym,
+  weightAg_sym,
+  transformAg_sym,
+  meanAg_sym,
+  sdAg_sym,
+  scaleAg_sym,
+  nAcceptAg_sym,
+  nFailedPropValueAg_sym,
+  funAg_sym,
+  xArgsAg_sym,
+  weightsArgsAg_sym,
+  mxAg_sym,
+  axAg_sym,
+  nxAg_sym,
+  nAgeAg_sym,
+  transformThetaToMxAg_sym,
+  subtotals_sym,
+  transformSubtotals_sym,
+  subtotalsNet_sym,
+  slotsToExtract_sym,
+  iMethodCombined_sym,
+  model_sym,
+  exposure_sym,
+  y_sym,
+  dataModels_sym,
+  datasets_sym,
+  transforms_sym,
+  seriesIndices_sym,
+  updateComponent_sym,
+  updateDataModel_sym,
+  updateSystemModel_sym,
+
+  J_sym,
+
+  UC_sym,
+  DC_sym,
+  UR_sym,
+  DCInv_sym,
+  DRInv_sym,
+  CC_sym,
+  a_sym,
+  R_sym,
+  priorsW_sym,
+  v_sym,
+  forward_sym,
+  offsetsBetas_sym,
+  offsetsPriorsBetas_sym,
+  offsetsSigma_sym,
+  offsetsVarsigma_sym,
+  m0_sym,
+  C0_sym,
+  phi_sym,
+  w_sym,
+  iteratorGamma_sym,
+  iteratorV_sym,
+  delta_sym,
+  phiKnown_sym,
+  /* description */
+  nTime_sym,
+  stepTime_sym,
+  hasAge_sym,
+  hasSex_sym,
+  iSexDominant_sym,
+  stepSexCurrent_sym,
+  stepSexTarget_sym,
+  nAge_sym,
+  stepAge_sym,
+  length_sym,
+  stepTriangle_sym,
+  stepDirection_sym,
+  nBetweenVec_sym,
+  stepBetweenVec_sym,
+  nWithinVec_sym,
+  stepWithinVec_sym,
+  /* cohort iterators */
+  i_sym,
+  iTime_sym,
+  iAge_sym,
+  iTriangle_sym,
+  finished_sym,
+  iVec_sym,
+  lengthVec_sym,
+  increment_sym,
+  lastAgeGroupOpen_sym,
+  /* mappings */
+  hasParCh_sym,
+  isOneToOne_sym,
+  nSharedVec_sym,
+  stepSharedCurrentVec_sym,
+  stepSharedCurrentExposureVec_sym,
+  stepSharedTargetVec_sym,
+  nTimeCurrent_sym,
+  stepTimeCurrent_sym,
+  stepTimeTarget_sym,
+  nAgeCurrent_sym,
+  nAgeTarget_sym,
+  stepAgeCurrent_sym,
+  stepAgeTarget_sym,
+  stepTriangleCurrent_sym,
+  stepTriangleTarget_sym,
+  nOrigDestVec_sym,
+  stepOrigCurrentVec_sym,
+  stepDestCurrentVec_sym,
+  stepOrigDestTargetVec_sym,
+  iMinAge_sym,
+
+  /*new priors*/
+  ATau_sym,
+  nuTau_sym,
+  hasAlphaDLM_sym,
+  hasAlphaICAR_sym,
+  hasAlphaMix_sym,
+  hasCovariates_sym,
+  hasAlphaKnown_sym,
+  hasMean_sym,
+  hasSeason_sym,
+  isKnownUncertain_sym,
+  isNorm_sym,
+  isRobust_sym,
+  isZeroVar_sym,
+  alphaDLM_sym,
+  alphaICAR_sym,
+  alphaMix_sym,
+  iteratorState_sym,
+  iteratorStateOld_sym,
+  K_sym,
+  L_sym,
+  s_sym,
+  UBeta_sym,
+  nuBeta_sym,
+  isSaturated_sym,
+  allStrucZero_sym,
+  alongAllStrucZero_sym,
+  strucZeroArray_sym,
+  mNoTrend_sym,
+  m0NoTrend_sym,
+  CNoTrend_sym,
+  aNoTrend_sym,
+  RNoTrend_sym,
+  GWithTrend_sym,
+  mWithTrend_sym,
+  m0WithTrend_sym,
+  CWithTrend_sym,
+  aWithTrend_sym,
+  hasLevel_sym,
+  omegaAlpha_sym,
+  omegaAlphaMax_sym,
+  AAlpha_sym,
+  nuAlpha_sym,
+  deltaDLM_sym,
+  omegaDelta_sym,
+  omegaDeltaMax_sym,
+  nuDelta_sym,
+  ADelta_sym,
+  minPhi_sym,
+  maxPhi_sym,
+  shape1Phi_sym,
+  shape2Phi_sym,
+  WSqrt_sym,
+  WSqrtInvG_sym,
+  exposureAg_sym,
+  P_sym,
+  AEtaIntercept_sym,
+  AEtaCoef_sym,
+  nuEtaCoef_sym,
+  meanEtaCoef_sym,
+  UEtaCoef_sym,
+  nSeason_sym,
+  ASeason_sym,
+  omegaSeason_sym,
+  omegaSeasonMax_sym,
+  nuSeason_sym,
+  mSeason_sym,
+  m0Season_sym,
+  CSeason_sym,
+  aSeason_sym,
+  RSeason_sym,
+  JOld_sym,
+  /* new priors Jan 2017 */
+  sumsWeightsMix_sym,
+  weightMix_sym,
+  latentWeightMix_sym,
+  foundIndexClassMaxPossibleMix_sym,
+  indexClassMaxPossibleMix_sym,
+  indexClassProbMix_sym,
+  componentWeightMix_sym,
+  latentComponentWeightMix_sym,
+  levelComponentWeightMix_sym,
+  levelComponentWeightOldMix_sym,
+  meanLevelComponentWeightMix_sym,
+  indexClassMix_sym,
+  indexClassMaxMix_sym,
+  indexClassMaxUsedMix_sym,
+  omegaComponentWeightMix_sym,
+  omegaComponentWeightMaxMix_sym,
+  omegaLevelComponentWeightMix_sym,
+  omegaLevelComponentWeightMaxMix_sym,
+  iteratorsDimsMix_sym,
+  iAlong_sym,
+  dimBeta_sym,
+  dimBetaOld_sym,
+  phiMix_sym,
+  mMix_sym,
+  CMix_sym,
+  aMix_sym,
+  RMix_sym,
+  prodVectorsMix_sym,
+  posProdVectors1Mix_sym,
+  posProdVectors2Mix_sym,
+  nBetaNoAlongMix_sym,
+  vectorsMix_sym,
+  omegaVectorsMix_sym,
+  iteratorProdVectorMix_sym,
+  yXMix_sym,
+  XXMix_sym,
+  priorMeanLevelComponentWeightMix_sym,
+  priorSDLevelComponentWeightMix_sym,
+  AComponentWeightMix_sym,
+  nuComponentWeightMix_sym,
+  omegaVectorsMix_sym,
+  omegaVectorsMaxMix_sym,
+  AVectorsMix_sym,
+  nuVectorsMix_sym,
+  minLevelComponentWeight_sym,
+  maxLevelComponentWeight_sym,
+  updateSeriesDLM_sym,
+  ALevelComponentWeightMix_sym,
+  nuLevelComponentWeightMix_sym,
+
+  nuCMP_sym,
+  sdLogNuCMP_sym,
+  sdLogNuMaxCMP_sym,
+  meanMeanLogNuCMP_sym,
+  sdMeanLogNuCMP_sym,
+  meanLogNuCMP_sym,
+  ASDLogNuCMP_sym,
+  nuSDLogNuCMP_sym,
+  nu_sym,
+
+  alphaKnown_sym,
+  AKnownVec_sym,
+
+  /* skeleton */
+  first_sym,
+  last_sym,
+
+  /* Box-Cox */
+  boxCoxParam_sym,
+
+  /* accounts  and combined accounts*/
+  account_sym,
+  population_sym,
+  accession_sym,
+  components_sym,
+  descriptions_sym,
+  iteratorPopn_sym,
+  iteratorAcc_sym,
+  iteratorExposure_sym,
+  transformsExpToComp_sym,
+  transformExpToBirths_sym,
+  iCell_sym,
+  iCellOther_sym,
+  iComp_sym,
+  iPopnNext_sym,
+  iPopnNextOther_sym,
+  iAccNext_sym,
+  iAccNextOther_sym,
+  iOrigDest_sym,
+  iPool_sym,
+  iIntNet_sym,
+  iBirths_sym,
+  iParCh_sym,
+  diffProp_sym,
+  isIncrement_sym,
+  isNet_sym,
+  scaleNoise_sym,
+  usePriorPopn_sym,
+  systemModels_sym,
+  modelUsesExposure_sym,
+  mappingsFromExp_sym,
+  mappingsToExp_sym,
+  mappingsToPopn_sym,
+  mappingsToAcc_sym,
+  iExpFirst_sym,
+  iExpFirstOther_sym,
+  ageTimeStep_sym,
+  iteratorsComp_sym,
+  expectedExposure_sym,
+  iExposure_sym,
+  iExposureOther_sym,
+  isLowerTriangle_sym,
+  isOldestAgeGroup_sym,
+  generatedNewProposal_sym,
+  probSmallUpdate_sym,
+  isSmallUpdate_sym,
+  isSmallUpdateFinal_sym,
+  probPopn_sym,
+  cumProbComp_sym,
+  nCellAccount_sym,
+  /* LN@ */
+  alphaLN2_sym,
+  transformLN2_sym,
+  constraintLN2_sym,
+  nCellBeforeLN2_sym;
+
+extern SEXP (*dembase_Collapse_R)(SEXP ,SEXP);
+extern SEXP (*dembase_Extend_R)(SEXP ,SEXP);
+extern int (*dembase_getIAfter)(int, SEXP);
+extern SEXP (*dembase_getIBefore)(int, SEXP);
+extern SEXP (*dembase_getIShared)(int, SEXP);
+
+
+/* ******************************************************************************** */
+/* Workspace ********************************************************************** */
+/* ******************************************************************************** */
+
+/* A dataset attached to the population, with the slots of its
+   data model that 'logLikelihood' uses. Pointers into R objects
+   are refreshed at the start of each call to
+   'updateAccountInBatches'. */
+typedef struct BatchDataset {
+    int iMethodModel;
+    SEXP model_R;
+    SEXP dataset_R;
+    SEXP transform_R;
+    TransformIndex *index;
+    int *dataset;
+    int *collapsed; /* cached collapsed population, or NULL */
+    int *stamp;     /* last proposal to use each cell, length nAfter */
+    int *iAlpha;    /* LN2 only: C-style index into 'alpha' for each cell */
+    double *theta;
+    double *nu;     /* nuCMP */
+    double *prob;
+    double *mean;
+    double *sd;
+    double *nuT;    /* nu for TFixedUseExp */
+    double *alpha;
+    double *varsigma;
+} BatchDataset;
+
+#define BATCH_EXP_ONE_COMP 0
+#define BATCH_EXP_PAR_CH_POOL 1
+#define BATCH_EXP_BIRTHS 2
+
+/* A component whose system model uses exposure */
+typedef struct BatchComponent {
+    int iComp; /* C-style index into 'components' */
+    int kind;  /* one of the BATCH_EXP_ values */
+    SEXP component_R;
+    SEXP model_R;
+    SEXP mappingFromExp_R;
+    SEXP mappingToExp_R;
+    int *component;
+    double *theta;
+    int *strucZeroArray;
+    CohortCursor cursor; /* 'iteratorsComp' element, not reset */
+} BatchComponent;
+
+/* status of a move after evaluation */
+#define BATCH_OK 0
+#define BATCH_NEG_EXPOSURE_PAR_CH_POOL 1
+#define BATCH_NEG_EXPOSURE_ONE_COMP 2
+
+typedef struct BatchMove {
+    int id;
+    int iCell_r;
+    int iPopnNext_r;
+    int iAccNext_r;
+    int iExpFirst_r;
+    int diffProp;
+    CohortSpan span;  /* population cohort, starting at 'iCell_r' */
+    int *iCellComp;   /* R-style, one per batch component, 0 if none */
+    int *iExpStart;   /* R-style, one per batch component */
+    /* results */
+    double diffLogLik;
+    double diffLogDens;
+    int status;
+    double errExposureProp;
+    double errExposureCurr;
+    int errIsFinal;
+    int errIsUpper;
+    int errICell;
+    int errCompCurr;
+} BatchMove;
+
+static int batchActive = 0;
+
+static int hasAgeBatch;
+static int usePriorPopnBatch;
+static double ageTimeStepBatch;
+
+static int nCellPopnBatch;
+static int stepTimePopn, nTimePopn, stepAgePopn, nAgePopn;
+static int stepTimeAcc, nTimeAcc, stepAgeAcc, nAgeAcc;
+static CohortCursor cursorExposure;
+
+static int *population = NULL;
+static int *accession = NULL;
+static double *exposure = NULL;
+static double *thetaPopn = NULL;
+static int *strucZeroPopn = NULL;
+
+static int *stampPopn = NULL;
+static int *stampAcc = NULL;
+static int *stampExp = NULL;
+static int nCellAccBatch = 0;
+static int nCellExpBatch = 0;
+
+static int nDatasetBatch = 0;
+static BatchDataset *datasetsBatch = NULL;
+static int nComponentBatch = 0;
+static BatchComponent *componentsBatch = NULL;
+
+static BatchMove movesBatch[K_MAX_ACCOUNT_BATCH];
+static int *iCellCompBatch = NULL;
+static int *iExpStartBatch = NULL;
+static int nMoveBatch = 0;
+
+/* proposals are numbered from 1, and a cell belongs to the
+   current batch if its stamp is at least 'idFirstInBatch' */
+static int idNext = 1;
+static int idFirstInBatch = 1;
+
+static int
+batchSupportsModel(int iMethodModel)
+{
+    switch(iMethodModel)
+    {
+        case 9: case 18: case 19: case 118: case 119:
+        case 10: case 20: case 21: case 120: case 121:
+        case 11: case 31: case 33: case 34: case 36: case 37:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void
+beginAccountBatches(SEXP combined_R)
+{
+    endAccountBatches();
+
+    if (!usesCounterRNG())
+        return;
+
+    SEXP account_R = GET_SLOT(combined_R, account_sym);
+    SEXP population_R = GET_SLOT(account_R, population_sym);
+    SEXP components_R = GET_SLOT(account_R, components_sym);
+    SEXP iteratorPopn_R = GET_SLOT(combined_R, iteratorPopn_sym);
+    SEXP dataModels_R = GET_SLOT(combined_R, dataModels_sym);
+    SEXP datasets_R = GET_SLOT(combined_R, datasets_sym);
+    SEXP transforms_R = GET_SLOT(combined_R, transforms_sym);
+    int *seriesIndices = INTEGER(GET_SLOT(combined_R, seriesIndices_sym));
+    SEXP systemModels_R = GET_SLOT(combined_R, systemModels_sym);
+    SEXP iteratorsComp_R = GET_SLOT(combined_R, iteratorsComp_sym);
+    int *modelUsesExposure = LOGICAL(GET_SLOT(combined_R, modelUsesExposure_sym));
+    SEXP mappingsFromExp_R = GET_SLOT(combined_R, mappingsFromExp_sym);
+    SEXP mappingsToExp_R = GET_SLOT(combined_R, mappingsToExp_sym);
+    int iOrigDest_r = *INTEGER(GET_SLOT(combined_R, iOrigDest_sym));
+    int iPool_r = *INTEGER(GET_SLOT(combined_R, iPool_sym));
+    int iBirths_r = *INTEGER(GET_SLOT(combined_R, iBirths_sym));
+    SEXP exposure_R = GET_SLOT(combined_R, exposure_sym);
+
+    nCellPopnBatch = LENGTH(population_R);
+    if (nCellPopnBatch == 0)
+        return;
+
+    /* check that all datasets attached to the population can be handled */
+    int nDatasets = LENGTH(datasets_R);
+    int nDatasetPopn = 0;
+    for (int i = 0; i < nDatasets; ++i) {
+        if (seriesIndices[i] == 0) {
+            SEXP model_R = VECTOR_ELT(dataModels_R, i);
+            SEXP transform_R = VECTOR_ELT(transforms_R, i);
+            int iMethodModel = *INTEGER(GET_SLOT(model_R, iMethodModel_sym));
+            TransformIndex *index = findTransformIndex(transform_R);
+            if (!batchSupportsModel(iMethodModel) || !index || !index->iAfter)
+                return;
+            ++nDatasetPopn;
+        }
+    }
+
+    hasAgeBatch = *LOGICAL(GET_SLOT(combined_R, hasAge_sym));
+    usePriorPopnBatch = *INTEGER(GET_SLOT(combined_R, usePriorPopn_sym));
+    ageTimeStepBatch = *REAL(GET_SLOT(combined_R, ageTimeStep_sym));
+
+    stepTimePopn = *INTEGER(GET_SLOT(iteratorPopn_R, stepTime_sym));
+    nTimePopn = *INTEGER(GET_SLOT(iteratorPopn_R, nTime_sym));
+    stepAgePopn = 0;
+    nAgePopn = 0;
+    nCellAccBatch = 0;
+    if (hasAgeBatch) {
+        SEXP accession_R = GET_SLOT(combined_R, accession_sym);
+        SEXP iteratorAcc_R = GET_SLOT(combined_R, iteratorAcc_sym);
+        stepAgePopn = *INTEGER(GET_SLOT(iteratorPopn_R, stepAge_sym));
+        nAgePopn = *INTEGER(GET_SLOT(iteratorPopn_R, nAge_sym));
+        stepTimeAcc = *INTEGER(GET_SLOT(iteratorAcc_R, stepTime_sym));
+        nTimeAcc = *INTEGER(GET_SLOT(iteratorAcc_R, nTime_sym));
+        stepAgeAcc = *INTEGER(GET_SLOT(iteratorAcc_R, stepAge_sym));
+        nAgeAcc = *INTEGER(GET_SLOT(iteratorAcc_R, nAge_sym));
+        nCellAccBatch = LENGTH(accession_R);
+    }
+    initCohortCursor(&cursorExposure, GET_SLOT(combined_R, iteratorExposure_sym));
+    nCellExpBatch = LENGTH(exposure_R);
+
+    stampPopn = R_Calloc(nCellPopnBatch, int);
+    stampAcc = R_Calloc(nCellAccBatch > 0 ? nCellAccBatch : 1, int);
+    stampExp = R_Calloc(nCellExpBatch > 0 ? nCellExpBatch : 1, int);
+
+    /* datasets */
+    nDatasetBatch = nDatasetPopn;
+    datasetsBatch = R_Calloc(nDatasetPopn > 0 ? nDatasetPopn : 1, BatchDataset);
+    for (int i = 0, k = 0; i < nDatasets; ++i) {
+        if (seriesIndices[i] != 0)
+            continue;
+        BatchDataset *ds = datasetsBatch + k;
+        ++k;
+        ds->model_R = VECTOR_ELT(dataModels_R, i);
+        ds->dataset_R = VECTOR_ELT(datasets_R, i);
+        ds->transform_R = VECTOR_ELT(transforms_R, i);
+        ds->iMethodModel = *INTEGER(GET_SLOT(ds->model_R, iMethodModel_sym));
+        ds->index = findTransformIndex(ds->transform_R);
+        int nAfter = ds->index->nAfter;
+        ds->stamp = R_Calloc(nAfter > 0 ? nAfter : 1, int);
+        ds->iAlpha = NULL;
+        if (ds->iMethodModel == 37) {
+            SEXP transformLN2_R = GET_SLOT(ds->model_R, transformLN2_sym);
+            int nData = LENGTH(ds->dataset_R);
+            ds->iAlpha = R_Calloc(nData > 0 ? nData : 1, int);
+            for (int j = 0; j < nData; ++j)
+                ds->iAlpha[j] = dembase_getIAfter(j + 1, transformLN2_R) - 1;
+        }
+    }
+
+    /* components whose models use exposure */
+    int nComponents = LENGTH(components_R);
+    int nCompExp = 0;
+    for (int i = 0; i < nComponents; ++i) {
+        if (modelUsesExposure[i + 1])
+            ++nCompExp;
+    }
+    nComponentBatch = nCompExp;
+    componentsBatch = R_Calloc(nCompExp > 0 ? nCompExp : 1, BatchComponent);
+    for (int i = 0, k = 0; i < nComponents; ++i) {
+        if (!modelUsesExposure[i + 1])
+            continue;
+        BatchComponent *comp = componentsBatch + k;
+        ++k;
+        int i_r = i + 1;
+        comp->iComp = i;
+        if ((i_r == iOrigDest_r) || (i_r == iPool_r))
+            comp->kind = BATCH_EXP_PAR_CH_POOL;
+        else if (i_r == iBirths_r)
+            comp->kind = BATCH_EXP_BIRTHS;
+        else
+            comp->kind = BATCH_EXP_ONE_COMP;
+        comp->component_R = VECTOR_ELT(components_R, i);
+        comp->model_R = VECTOR_ELT(systemModels_R, i_r);
+        comp->mappingFromExp_R = VECTOR_ELT(mappingsFromExp_R, i);
+        comp->mappingToExp_R = VECTOR_ELT(mappingsToExp_R, i);
+        initCohortCursor(&comp->cursor, VECTOR_ELT(iteratorsComp_R, i));
+    }
+
+    int nPerMove = (nCompExp > 0) ? nCompExp : 1;
+    iCellCompBatch = R_Calloc(K_MAX_ACCOUNT_BATCH * nPerMove, int);
+    iExpStartBatch = R_Calloc(K_MAX_ACCOUNT_BATCH * nPerMove, int);
+    for (int k = 0; k < K_MAX_ACCOUNT_BATCH; ++k) {
+        movesBatch[k].iCellComp = iCellCompBatch + k * nPerMove;
+        movesBatch[k].iExpStart = iExpStartBatch + k * nPerMove;
+    }
+
+    nMoveBatch = 0;
+    idNext = 1;
+    idFirstInBatch = 1;
+    batchActive = 1;
+}
+
+void
+endAccountBatches(void)
+{
+    if (batchActive) {
+        for (int k = 0; k < nDatasetBatch; ++k) {
+            R_Free(datasetsBatch[k].stamp);
+            if (datasetsBatch[k].iAlpha)
+                R_Free(datasetsBatch[k].iAlpha);
+        }
+        R_Free(datasetsBatch);
+        R_Free(componentsBatch);
+        R_Free(stampPopn);
+        R_Free(stampAcc);
+        R_Free(stampExp);
+        R_Free(iCellCompBatch);
+        R_Free(iExpStartBatch);
+    }
+    batchActive = 0;
+    nDatasetBatch = 0;
+    nComponentBatch = 0;
+    nMoveBatch = 0;
+    datasetsBatch = NULL;
+    componentsBatch = NULL;
+    stampPopn = NULL;
+    stampAcc = NULL;
+    stampExp = NULL;
+    iCellCompBatch = NULL;
+    iExpStartBatch = NULL;
+}
+
+/* Update pointers into the slots of 'combined_R', which the
+   other updates may have replaced, and make sure that the
+   proposal numbers cannot overflow during this call. */
+static void
+refreshAccountBatches(SEXP combined_R, int nProposal)
+{
+    SEXP account_R = GET_SLOT(combined_R, account_sym);
+    SEXP systemModels_R = GET_SLOT(combined_R, systemModels_sym);
+    SEXP thisSystemModel_R = VECTOR_ELT(systemModels_R, 0);
+
+    population = INTEGER(GET_SLOT(account_R, population_sym));
+    accession = hasAgeBatch ? INTEGER(GET_SLOT(combined_R, accession_sym)) : NULL;
+    exposure = REAL(GET_SLOT(combined_R, exposure_sym));
+    thetaPopn = REAL(GET_SLOT(thisSystemModel_R, theta_sym));
+    strucZeroPopn = INTEGER(GET_SLOT(thisSystemModel_R, strucZeroArray_sym));
+
+    for (int k = 0; k < nDatasetBatch; ++k) {
+        BatchDataset *ds = datasetsBatch + k;
+        SEXP model_R = ds->model_R;
+        SEXP collapsed_R = getCollapsedSeries(ds->transform_R, 0);
+        ds->dataset = INTEGER(ds->dataset_R);
+        ds->collapsed = isNull(collapsed_R) ? NULL : INTEGER(collapsed_R);
+        ds->theta = NULL;
+        ds->nu = NULL;
+        ds->prob = NULL;
+        ds->mean = NULL;
+        ds->sd = NULL;
+        ds->nuT = NULL;
+        ds->alpha = NULL;
+        ds->varsigma = NULL;
+        switch(ds->iMethodModel)
+        {
+            case 9: case 18: case 19: case 118: case 119:
+            case 10: case 20: case 21: case 120: case 121:
+                ds->theta = REAL(GET_SLOT(model_R, theta_sym));
+                break;
+            case 11:
+                ds->prob = REAL(GET_SLOT(model_R, prob_sym));
+                break;
+            case 31:
+                ds->mean = REAL(GET_SLOT(model_R, mean_sym));
+                ds->sd = REAL(GET_SLOT(model_R, sd_sym));
+                break;
+            case 33:
+                ds->theta = REAL(GET_SLOT(model_R, theta_sym));
+                ds->nu = REAL(GET_SLOT(model_R, nuCMP_sym));
+                break;
+            case 36:
+                ds->mean = REAL(GET_SLOT(model_R, mean_sym));
+                ds->sd = REAL(GET_SLOT(model_R, sd_sym));
+                ds->nuT = REAL(GET_SLOT(model_R, nu_sym));
+                break;
+            case 37:
+                ds->alpha = REAL(GET_SLOT(model_R, alphaLN2_sym));
+                ds->varsigma = REAL(GET_SLOT(model_R, varsigma_sym));
+                break;
+            default:
+                break;
+        }
+    }
+
+    for (int k = 0; k < nComponentBatch; ++k) {
+        BatchComponent *comp = componentsBatch + k;
+        comp->component = INTEGER(comp->component_R);
+        comp->theta = REAL(GET_SLOT(comp->model_R, theta_sym));
+        comp->strucZeroArray = INTEGER(GET_SLOT(comp->model_R, strucZeroArray_sym));
+    }
+
+    if (idNext > INT_MAX - nProposal - 1) {
+        memset(stampPopn, 0, nCellPopnBatch * sizeof(int));
+        memset(stampAcc, 0, (nCellAccBatch > 0 ? nCellAccBatch : 1) * sizeof(int));
+        memset(stampExp, 0, (nCellExpBatch > 0 ? nCellExpBatch : 1) * sizeof(int));
+        for (int k = 0; k < nDatasetBatch; ++k) {
+            int nAfter = datasetsBatch[k].index->nAfter;
+            memset(datasetsBatch[k].stamp, 0, (nAfter > 0 ? nAfter : 1) * sizeof(int));
+        }
+        idNext = 1;
+    }
+    nMoveBatch = 0;
+    idFirstInBatch = idNext;
+}
+
+
+/* ******************************************************************************** */
+/* Footprints ********************************************************************* */
+/* ******************************************************************************** */
+
+/* Work out the cells that a population proposal starting at
+   'iCell_r' would use. Does not depend on the account. */
+static void
+setMoveCells(BatchMove *move, SEXP combined_R, int iCell_r)
+{
+    SEXP descriptions_R = GET_SLOT(combined_R, descriptions_sym);
+    SEXP description_R = VECTOR_ELT(descriptions_R, 0);
+
+    move->iCell_r = iCell_r;
+    move->iExpFirst_r = getIExpFirstFromPopn(iCell_r, description_R);
+    move->iAccNext_r = hasAgeBatch ? getIAccNextFromPopn(iCell_r, description_R) : 0;
+    makeCohortSpan(&move->span, iCell_r, stepTimePopn, nTimePopn,
+                   hasAgeBatch, stepAgePopn, nAgePopn);
+
+    int iExpFirst_r = move->iExpFirst_r;
+    for (int k = 0; k < nComponentBatch; ++k) {
+        BatchComponent *comp = componentsBatch + k;
+        if (comp->kind == BATCH_EXP_BIRTHS) {
+            int iCellComp_r = getICellBirthsFromExp(iExpFirst_r, comp->mappingFromExp_R, 1);
+            move->iCellComp[k] = iCellComp_r;
+            move->iExpStart[k] = (iCellComp_r > 0)
+                ? getIExposureFromBirths(iCellComp_r, comp->mappingToExp_R) : 0;
+        }
+        else {
+            move->iCellComp[k] = getICellCompFromExp(iExpFirst_r, comp->mappingFromExp_R);
+            move->iExpStart[k] = iExpFirst_r;
+        }
+    }
+}
+
+/* If 'mark' is 0, return 1 if cell 'i' is used by an earlier
+   proposal in the batch, and otherwise 0. If 'mark' is 1, record
+   that cell 'i' is used by proposal 'id'. */
+static __inline__ int
+visitCell(int *stamp, int i, int id, int mark)
+{
+    if (mark) {
+        stamp[i] = id;
+        return 0;
+    }
+    else {
+        int s = stamp[i];
+        return (s >= idFirstInBatch) && (s != id);
+    }
+}
+
+static int
+visitExposureCohort(int iExp_r, int id, int mark)
+{
+    int ans = 0;
+    CohortCursor cursor = cursorExposure;
+    resetCohortCursor(&cursor, iExp_r);
+    for (;;) {
+        ans += visitCell(stampExp, cursor.i - 1, id, mark);
+        if (cursor.finished)
+            break;
+        advanceCohortCursor(&cursor);
+    }
+    return ans;
+}
+
+/* Visit every cell in the footprint of 'move': the population
+   cohort, the dataset cells it contributes to, the accessions
+   that limit or are changed by the proposal, and the exposure
+   cells that are changed or read. Returns the number of cells
+   used by earlier proposals in the batch (if 'mark' is 0). */
+static int
+visitFootprint(BatchMove *move, int mark)
+{
+    int id = move->id;
+    int ans = 0;
+    CohortSpan *span = &move->span;
+    int i = span->i;
+    int iTimeFirst = (i / stepTimePopn) % nTimePopn;
+
+    for (int k = 0; k <= span->nStep; ++k) {
+        ans += visitCell(stampPopn, i, id, mark);
+        for (int d = 0; d < nDatasetBatch; ++d) {
+            BatchDataset *ds = datasetsBatch + d;
+            int iAfter = ds->index->iAfter[i];
+            if (iAfter >= 0)
+                ans += visitCell(ds->stamp, iAfter, id, mark);
+        }
+        if (hasAgeBatch && (cohortSpanAge(span, k) == nAgePopn)
+            && ((iTimeFirst + k) > 0)) {
+            int nTimeAccPopn = nTimePopn - 1;
+            int iAcc = (i % (stepTimePopn * nTimePopn)
+                        - stepTimePopn
+                        + (i / (stepTimePopn * nTimePopn)) * (stepTimePopn * nTimeAccPopn));
+            ans += visitCell(stampAcc, iAcc, id, mark);
+        }
+        if (k < span->nStep)
+            i += cohortSpanStride(span, k);
+    }
+
+    if (hasAgeBatch && (move->iAccNext_r > 0)) {
+        CohortSpan spanAcc;
+        makeCohortSpan(&spanAcc, move->iAccNext_r, stepTimeAcc, nTimeAcc,
+                       1, stepAgeAcc, nAgeAcc);
+        int iAcc = spanAcc.i;
+        for (int k = 0; k <= spanAcc.nStep; ++k) {
+            ans += visitCell(stampAcc, iAcc, id, mark);
+            if (k < spanAcc.nStep)
+                iAcc += cohortSpanStride(&spanAcc, k);
+        }
+    }
+
+    ans += visitExposureCohort(move->iExpFirst_r, id, mark);
+    for (int k = 0; k < nComponentBatch; ++k) {
+        int iExpStart_r = move->iExpStart[k];
+        if ((iExpStart_r > 0) && (iExpStart_r != move->iExpFirst_r))
+            ans += visitExposureCohort(iExpStart_r, id, mark);
+    }
+
+    return ans;
+}
+
+
+/* ******************************************************************************** */
+/* Evaluating proposals *********************************************************** */
+/* ******************************************************************************** */
+
+/* The functions in this section must not use the R API, apart
+   from the distribution functions, since they run in parallel. */
+
+/* equivalent to 'logLikelihood', with C-style 'i' */
+static double
+logLikelihoodBatch(BatchDataset *ds, int count, int i)
+{
+    double x = ds->dataset[i];
+    double ans = 0;
+    switch(ds->iMethodModel)
+    {
+        case 9: case 18: case 19: case 118: case 119:
+            ans = dbinom(x, count, ds->theta[i], USE_LOG);
+            break;
+        case 10: case 20: case 21: case 120: case 121:
+            ans = dpois(x, (ds->theta[i]) * count, USE_LOG);
+            break;
+        case 11:
+            ans = dpoibin1(x, count, *ds->prob, USE_LOG);
+            break;
+        case 31:
+            ans = dnorm(x, count * ds->mean[i], ds->sd[i], USE_LOG);
+            break;
+        case 33:
+        {
+            double gamma = (ds->theta[i]) * count;
+            double nu = ds->nu[i];
+            ans = nu * (x * log(gamma) - lgammafn(x + 1));
+            break;
+        }
+        case 34:
+        {
+            int diff = fabs(x - count);
+            if (diff > 2)
+                ans = R_NegInf;
+            else if (diff == 2)
+                ans = -log(3);
+            else if (diff == 1)
+                ans = log(2) - log(3);
+            else
+                ans = 0;
+            break;
+        }
+        case 36:
+        {
+            double thisMean = count * ds->mean[i];
+            double thisSd = ds->sd[i];
+            double x_rescaled = (x - thisMean)/thisSd;
+            ans = dt(x_rescaled, *ds->nuT, USE_LOG) - log(thisSd);
+            break;
+        }
+        case 37:
+        {
+            double xLog = log1p(ds->dataset[i]);
+            double mean = log1p(count) + ds->alpha[ds->iAlpha[i]];
+            ans = dnorm(xLog, mean, *ds->varsigma, USE_LOG);
+            break;
+        }
+        default:
+            break;
+    }
+    return ans;
+}
+
+/* equivalent to 'diffLogLikPopnOneCell' (and so to
+   'diffLogLikCountOneCell'), with C-style 'iAfter' */
+static double
+diffLogLikCellBatch(BatchDataset *ds, int iAfter, int diff)
+{
+    double retValue = 0;
+    int *dataset = ds->dataset;
+    int cellHasNoData = (dataset[iAfter] == NA_INTEGER);
+    if (!cellHasNoData) {
+        int totalPopnCurr = 0;
+        if (ds->collapsed) {
+            totalPopnCurr = ds->collapsed[iAfter];
+        }
+        else {
+            int *rowStart = ds->index->rowStart;
+            int *iBefore = ds->index->iBefore;
+            for (int k = rowStart[iAfter]; k < rowStart[iAfter + 1]; ++k)
+                totalPopnCurr += population[iBefore[k]];
+        }
+        int totalPopnProp = totalPopnCurr + diff;
+        int x = dataset[iAfter];
+        switch(ds->iMethodModel)
+        {
+            case 10: case 20: case 21: case 120: case 121:
+            {
+                double lambdaProp = ds->theta[iAfter] * totalPopnProp;
+                double lambdaCurr = ds->theta[iAfter] * totalPopnCurr;
+                if ((x >= 0) && (lambdaProp > 0) && (lambdaCurr > 0)
+                    && R_finite(lambdaProp) && R_finite(lambdaCurr))
+                    return diffLogDensPoisLambda(x, lambdaProp, lambdaCurr);
+                break;
+            }
+            case 9: case 18: case 19: case 118: case 119:
+            {
+                double prob = ds->theta[iAfter];
+                if ((x >= 0) && (totalPopnProp >= x) && (totalPopnCurr >= x)
+                    && (prob > 0) && (prob < 1))
+                    return diffLogDensBinomSize(x, totalPopnProp, totalPopnCurr, prob);
+                break;
+            }
+            default:
+                break;
+        }
+        double logLikProp = logLikelihoodBatch(ds, totalPopnProp, iAfter);
+        double logLikCurr = logLikelihoodBatch(ds, totalPopnCurr, iAfter);
+        if (R_finite(logLikProp) || R_finite(logLikCurr)) {
+            retValue = logLikProp - logLikCurr;
+        }
+        else {
+            double diffProp = abs(totalPopnProp - dataset[iAfter]);
+            double diffCurr = abs(totalPopnCurr - dataset[iAfter]);
+            if (diffProp > diffCurr)
+                retValue = -1000000;
+            else
+                retValue = 1000000;
+        }
+    }
+    return retValue;
+}
+
+/* equivalent to 'diffLogLikPopn' */
+static double
+diffLogLikMoveBatch(BatchMove *move)
+{
+    double ans = 0;
+    int diff = move->diffProp;
+    CohortSpan *span = &move->span;
+    for (int d = 0; d < nDatasetBatch; ++d) {
+        BatchDataset *ds = datasetsBatch + d;
+        int *iAfterVec = ds->index->iAfter;
+        double diffLogLik = 0;
+        int i = span->i;
+        for (int k = 0; k <= span->nStep; ++k) {
+            int iAfter = iAfterVec[i];
+            if (iAfter >= 0)
+                diffLogLik += diffLogLikCellBatch(ds, iAfter, diff);
+            if (k < span->nStep)
+                i += cohortSpanStride(span, k);
+        }
+        if (R_finite(diffLogLik)) {
+            ans += diffLogLik;
+        }
+        else {
+            ans = diffLogLik;
+            break;
+        }
+    }
+    return ans;
+}
+
+/* equivalent to 'diffLogDensPopnOneCohort' */
+static double
+diffLogDensPopnBatch(BatchMove *move)
+{
+    double ans = 0;
+    int diff = move->diffProp;
+    CohortSpan *span = &move->span;
+    int i = span->i;
+    for (int k = 0; k <= span->nStep; ++k) {
+        int isStrucZero = strucZeroPopn[i] == 0;
+        if (!isStrucZero) {
+            int valCurr = population[i];
+            int valProp = valCurr + diff;
+            double lambda = thetaPopn[i];
+            ans += diffLogDensPoisCount(valProp, valCurr, lambda);
+        }
+        if (k < span->nStep)
+            i += cohortSpanStride(span, k);
+    }
+    return ans;
+}
+
+/* change in exposure for a cell in a cohort, after a
+   change of 'diff' in the population at the start */
+static __inline__ double
+diffExposureBatch(CohortCursor *cursorComp, int diff)
+{
+    double diffExposure = 0;
+    if (hasAgeBatch) {
+        int isFinal = cursorComp->iAge == cursorComp->nAge;
+        int isUpper = cursorComp->iTriangle == 2;
+        if (isFinal && cursorComp->lastAgeGroupOpen && isUpper)
+            diffExposure += ageTimeStepBatch * diff;
+        else
+            diffExposure += 0.5 * ageTimeStepBatch * diff;
+    }
+    else {
+        diffExposure += ageTimeStepBatch * diff;
+    }
+    return diffExposure;
+}
+
+/* equivalent to 'diffLogDensExpOneOrigDestParChPool', with
+   'updatedPopn' true and 'updatedBirths', 'firstOnly', and
+   'isSmallUpdateFinal' false */
+static double
+diffLogDensExpParChPoolBatch(BatchMove *move, BatchComponent *comp,
+                             int iCell_r, int iExpFirst_r)
+{
+    double ans = 0;
+    int diff = move->diffProp;
+    int *component = comp->component;
+    double *theta = comp->theta;
+    int *strucZeroArray = comp->strucZeroArray;
+    CohortCursor cursorComp = comp->cursor;
+    CohortCursor cursorExp = cursorExposure;
+    resetCohortCursor(&cursorComp, iCell_r);
+    resetCohortCursor(&cursorExp, iExpFirst_r);
+    double tolExposure = 0.000001;
+    int keepGoing = 1;
+    while (keepGoing) {
+        int iExp_r = cursorExp.i;
+        double diffExposure = diffExposureBatch(&cursorComp, diff);
+        double exposureCurr = exposure[iExp_r - 1];
+        double exposureProp = exposureCurr + diffExposure;
+        if (exposureProp < tolExposure) {
+            if (exposureProp > -1 * tolExposure)
+                exposureProp = 0;
+            else {
+                if (exposureCurr < 0) {
+                    ans = R_NegInf;
+                    keepGoing = 0;
+                }
+                else {
+                    move->status = BATCH_NEG_EXPOSURE_PAR_CH_POOL;
+                    move->errExposureProp = exposureProp;
+                    return 0;
+                }
+            }
+        }
+        int j = 0;
+        while (j < cursorComp.lengthVec && keepGoing) {
+            int iComp = cohortCursorCell(&cursorComp, j) - 1;
+            int isStrucZero = strucZeroArray[iComp] == 0;
+            if (!isStrucZero) {
+                int compCurr = component[iComp];
+                if ((compCurr > 0) && !(exposureProp > 0)) {
+                    ans = R_NegInf;
+                    keepGoing = 0;
+                }
+                else {
+                    double thetaCurr = theta[iComp];
+                    double lambdaProp = thetaCurr * exposureProp;
+                    double lambdaCurr = thetaCurr * exposureCurr;
+                    double diffLogLik = diffLogDensPoisLambda(compCurr, lambdaProp,
+                                                              lambdaCurr);
+                    ans += diffLogLik;
+                }
+            }
+            ++j;
+        }
+        if (keepGoing) {
+            if (cursorComp.finished) {
+                keepGoing = 0;
+            }
+            else {
+                advanceCohortCursor(&cursorComp);
+                advanceCohortCursor(&cursorExp);
+            }
+        }
+    }
+    return ans;
+}
+
+/* equivalent to 'diffLogDensExpOneComp', with 'updatedPopn'
+   true and 'updatedBirths', 'firstOnly', and
+   'isSmallUpdateFinal' false */
+static double
+diffLogDensExpOneCompBatch(BatchMove *move, BatchComponent *comp,
+                           int iCell_r, int iExpFirst_r)
+{
+    double ans = 0;
+    int diff = move->diffProp;
+    int *component = comp->component;
+    double *theta = comp->theta;
+    int *strucZeroArray = comp->strucZeroArray;
+    CohortCursor cursorComp = comp->cursor;
+    CohortCursor cursorExp = cursorExposure;
+    resetCohortCursor(&cursorComp, iCell_r);
+    resetCohortCursor(&cursorExp, iExpFirst_r);
+    double tolExposure = 0.000001;
+    int keepGoing = 1;
+    while (keepGoing) {
+        int iExp = cursorExp.i - 1;
+        int iComp = cursorComp.i - 1;
+        int isStrucZero = strucZeroArray[iComp] == 0;
+        if (!isStrucZero) {
+            int compCurr = component[iComp];
+            double diffExposure = diffExposureBatch(&cursorComp, diff);
+            double exposureCurr = exposure[iExp];
+            double exposureProp = exposureCurr + diffExposure;
+            if (exposureProp < tolExposure) {
+                if (exposureProp > -1 * tolExposure)
+                    exposureProp = 0;
+                else {
+                    if (exposureCurr < 0) {
+                        ans = R_NegInf;
+                        keepGoing = 0;
+                    }
+                    else {
+                        move->status = BATCH_NEG_EXPOSURE_ONE_COMP;
+                        move->errExposureProp = exposureProp;
+                        move->errExposureCurr = exposureCurr;
+                        move->errIsFinal = hasAgeBatch && (cursorComp.iAge == cursorComp.nAge);
+                        move->errIsUpper = hasAgeBatch && (cursorComp.iTriangle == 2);
+                        move->errICell = iCell_r;
+                        move->errCompCurr = compCurr;
+                        return 0;
+                    }
+                }
+            }
+            if ((compCurr > 0) && !(exposureProp > 0)) {
+                ans = R_NegInf;
+                keepGoing = 0;
+            }
+            if (keepGoing) {
+                double thetaCurr = theta[iComp];
+                double lambdaProp = thetaCurr * exposureProp;
+                double lambdaCurr = thetaCurr * exposureCurr;
+                double diffLogLik = diffLogDensPoisLambda(compCurr, lambdaProp,
+                                                          lambdaCurr);
+                ans += diffLogLik;
+            }
+        }
+        if (keepGoing) {
+            if (cursorComp.finished) {
+                keepGoing = 0;
+            }
+            else {
+                advanceCohortCursor(&cursorComp);
+                advanceCohortCursor(&cursorExp);
+            }
+        }
+    }
+    return ans;
+}
+
+/* equivalent to 'diffLogDensExpPopn' */
+static double
+diffLogDensExpMoveBatch(BatchMove *move)
+{
+    double ans = 0;
+    for (int k = 0; k < nComponentBatch; ++k) {
+        BatchComponent *comp = componentsBatch + k;
+        int iCell_r = move->iCellComp[k];
+        int iExpStart_r = move->iExpStart[k];
+        double diffLog = 0;
+        switch(comp->kind)
+        {
+            case BATCH_EXP_PAR_CH_POOL:
+                diffLog = diffLogDensExpParChPoolBatch(move, comp, iCell_r, iExpStart_r);
+                break;
+            case BATCH_EXP_BIRTHS:
+                if (iCell_r > 0)
+                    diffLog = diffLogDensExpParChPoolBatch(move, comp, iCell_r, iExpStart_r);
+                break;
+            default:
+                diffLog = diffLogDensExpOneCompBatch(move, comp, iCell_r, iExpStart_r);
+                break;
+        }
+        if (move->status != BATCH_OK)
+            return 0;
+        if (R_finite(diffLog)) {
+            ans += diffLog;
+        }
+        else {
+            ans = diffLog;
+            break;
+        }
+    }
+    return ans;
+}
+
+static void
+evaluateMoveBatch(BatchMove *move)
+{
+    move->status = BATCH_OK;
+    move->diffLogLik = diffLogLikMoveBatch(move);
+    double diffDensPopn = 0;
+    if (usePriorPopnBatch)
+        diffDensPopn = diffLogDensPopnBatch(move);
+    double diffDensExp = diffLogDensExpMoveBatch(move);
+    move->diffLogDens = diffDensPopn + diffDensExp;
+}
+
+
+/* ******************************************************************************** */
+/* Updating *********************************************************************** */
+/* ******************************************************************************** */
+
+/* the accept-reject step from 'updateAccount' */
+static int
+acceptProposalBatch(double diffLogLik, double diffLogDens, double scaleNoise)
+{
+    int accept = 0;
+    int isInvalid = (!R_finite(diffLogLik)
+                     && !R_finite(diffLogDens)
+                     && ((diffLogLik > diffLogDens) || (diffLogLik < diffLogDens)));
+    if (!isInvalid) {
+        double log_r = diffLogLik + diffLogDens;
+        if (scaleNoise > 0) {
+            log_r += scaleNoise * rt(1);
+        }
+        accept = ( log_r > 0 ) || ( runif(0,1) < exp(log_r) );
+    }
+    return accept;
+}
+
+/* Evaluate the first 'n' proposals in the batch, in parallel */
+static void
+evaluateBatch(int n)
+{
+    int use_threads = usesCounterRNGTasks(n);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) if(use_threads) num_threads(nCounterRNGThreads())
+#endif
+    for (int k = 0; k < n; ++k)
+        evaluateMoveBatch(movesBatch + k);
+}
+
+/* Evaluate the proposals in the batch, in parallel, then
+   accept or reject them, in order, and start a new batch. */
+static void
+finishBatch(SEXP combined_R, double scaleNoise)
+{
+    int n = nMoveBatch;
+
+    evaluateBatch(n);
+
+    for (int k = 0; k < n; ++k) {
+        BatchMove *move = movesBatch + k;
+        if (move->status == BATCH_NEG_EXPOSURE_PAR_CH_POOL) {
+            error("negative value for 'exposureProp' : %f", move->errExposureProp);
+        }
+        else if (move->status == BATCH_NEG_EXPOSURE_ONE_COMP) {
+            error("negative value for 'exposureProp' : %f, 'exposureCurr'=%f, diff=%d, isFinal=%d, isUpper=%d, iCell_r=%d, firstOnly=%d, compCurr=%d, updatedPopn=%d, updatedBirths=%d",
+                  move->errExposureProp, move->errExposureCurr, move->diffProp,
+                  move->errIsFinal, move->errIsUpper, move->errICell, 0,
+                  move->errCompCurr, 1, 0);
+        }
+        int accept = acceptProposalBatch(move->diffLogLik, move->diffLogDens,
+                                         scaleNoise);
+        if (accept) {
+            SET_INTSCALE_SLOT(combined_R, iComp_sym, 0);
+            setProposalAccountMovePopn(combined_R, 1, move->iCell_r,
+                                       move->iPopnNext_r, move->iAccNext_r, 0,
+                                       move->iExpFirst_r, move->diffProp);
+            updateValuesAccount(combined_R);
+        }
+    }
+
+    nMoveBatch = 0;
+    idFirstInBatch = idNext;
+}
+
+int
+updateAccountInBatches(SEXP combined_R)
+{
+    if (!batchActive)
+        return 0;
+
+    int nCellAccount = *INTEGER(GET_SLOT(combined_R, nCellAccount_sym));
+    double scaleNoise = *REAL(GET_SLOT(combined_R, scaleNoise_sym));
+    double probPopn = *REAL(GET_SLOT(combined_R, probPopn_sym));
+    int nProposal = 2 * nCellAccount;
+
+    refreshAccountBatches(combined_R, nProposal);
+
+    for (int i = 0; i < nProposal; ++i) {
+
+        double u = runif(0, 1);
+        int updatePopn = (u < probPopn);
+
+        if (updatePopn) {
+            SET_INTSCALE_SLOT(combined_R, iComp_sym, 0);
+            int iCell_r = 0;
+            int foundCell = chooseICellAccountMovePopn(&iCell_r, combined_R);
+            BatchMove *move = movesBatch + nMoveBatch;
+            if (foundCell) {
+                setMoveCells(move, combined_R, iCell_r);
+                move->id = idNext;
+                if (visitFootprint(move, 0) > 0) {
+                    finishBatch(combined_R, scaleNoise);
+                    move = movesBatch;
+                    setMoveCells(move, combined_R, iCell_r);
+                    move->id = idNext;
+                }
+                visitFootprint(move, 1);
+                ++idNext;
+            }
+            /* the proposal is drawn only once any earlier
+               proposals that share its cells have been dealt with */
+            updateProposalAccountMovePopnCell(combined_R, iCell_r, foundCell);
+            int generatedNewProposal = *LOGICAL(GET_SLOT(combined_R, generatedNewProposal_sym));
+            if (generatedNewProposal) {
+                move->iPopnNext_r = *INTEGER(GET_SLOT(combined_R, iPopnNext_sym));
+                move->diffProp = *INTEGER(GET_SLOT(combined_R, diffProp_sym));
+                ++nMoveBatch;
+                if (nMoveBatch == K_MAX_ACCOUNT_BATCH)
+                    finishBatch(combined_R, scaleNoise);
+            }
+        }
+        else {
+            finishBatch(combined_R, scaleNoise);
+            updateProposalAccountComp_CombinedAccountMovements(combined_R);
+            int generatedNewProposal = *LOGICAL(GET_SLOT(combined_R, generatedNewProposal_sym));
+            if (generatedNewProposal) {
+                double diffLogLik = diffLogLikAccount(combined_R);
+                double diffLogDens = diffLogDensAccount(combined_R);
+                if (acceptProposalBatch(diffLogLik, diffLogDens, scaleNoise))
+                    updateValuesAccount(combined_R);
+            }
+        }
+    }
+
+    finishBatch(combined_R, scaleNoise);
+    return 1;
+}
+
+
+/* ******************************************************************************** */
+/* Functions called from R ******************************************************** */
+/* ******************************************************************************** */
+
+typedef struct BatchTestArgs {
+    SEXP combined_R;
+    int *iCell;
+    int *diffProp;
+    int n;
+    double *ans;
+} BatchTestArgs;
+
+static SEXP
+diffLogAccountBatch_i(void *data)
+{
+    BatchTestArgs *args = (BatchTestArgs *)data;
+    SEXP combined_R = args->combined_R;
+    int *iCell = args->iCell;
+    int *diffProp = args->diffProp;
+    int n = args->n;
+    double *ans = args->ans;
+
+    SEXP descriptions_R = GET_SLOT(combined_R, descriptions_sym);
+    SEXP description_R = VECTOR_ELT(descriptions_R, 0);
+    SEXP population_R = GET_SLOT(GET_SLOT(combined_R, account_sym), population_sym);
+    int *seriesIndices = INTEGER(GET_SLOT(combined_R, seriesIndices_sym));
+    int nDatasets = LENGTH(GET_SLOT(combined_R, datasets_sym));
+    int hasAge = *LOGICAL(GET_SLOT(combined_R, hasAge_sym));
+
+    /* in batches, with the caches that 'updateCombined' uses */
+    beginTransformIndexCache(GET_SLOT(combined_R, transforms_sym));
+    for (int i = 0; i < nDatasets; ++i) {
+        if (seriesIndices[i] == 0)
+            cacheCollapsedSeries(i, population_R);
+    }
+    beginAccountBatches(combined_R);
+    if (!batchActive)
+        error("account cannot be updated in batches");
+    refreshAccountBatches(combined_R, n);
+    for (int first = 0; first < n; first += K_MAX_ACCOUNT_BATCH) {
+        int nMove = n - first;
+        if (nMove > K_MAX_ACCOUNT_BATCH)
+            nMove = K_MAX_ACCOUNT_BATCH;
+        for (int k = 0; k < nMove; ++k) {
+            BatchMove *move = movesBatch + k;
+            int iCell_r = iCell[first + k];
+            setMoveCells(move, combined_R, iCell_r);
+            move->id = idNext;
+            ++idNext;
+            move->iPopnNext_r = getIPopnNextFromPopn(iCell_r, description_R);
+            move->diffProp = diffProp[first + k];
+        }
+        nMoveBatch = nMove;
+        evaluateBatch(nMove);
+        for (int k = 0; k < nMove; ++k) {
+            BatchMove *move = movesBatch + k;
+            if (move->status != BATCH_OK)
+                error("negative value for 'exposureProp' : %f", move->errExposureProp);
+            ans[first + k] = move->diffLogLik;
+            ans[n + first + k] = move->diffLogDens;
+        }
+        nMoveBatch = 0;
+        idFirstInBatch = idNext;
+    }
+    endAccountBatches();
+    endTransformIndexCache();
+
+    /* one at a time, without the caches */
+    for (int i = 0; i < n; ++i) {
+        int iCell_r = iCell[i];
+        int iPopnNext_r = getIPopnNextFromPopn(iCell_r, description_R);
+        int iAccNext_r = hasAge ? getIAccNextFromPopn(iCell_r, description_R) : 0;
+        int iExpFirst_r = getIExpFirstFromPopn(iCell_r, description_R);
+        SET_INTSCALE_SLOT(combined_R, iComp_sym, 0);
+        setProposalAccountMovePopn(combined_R, 1, iCell_r, iPopnNext_r, iAccNext_r,
+                                   0, iExpFirst_r, diffProp[i]);
+        ans[2 * n + i] = diffLogLikAccount(combined_R);
+        ans[3 * n + i] = diffLogDensAccount(combined_R);
+    }
+    return R_NilValue;
+}
+
+static void
+endDiffLogAccountBatch(void *data)
+{
+    endAccountBatches();
+    endTransformIndexCache();
+}
+
+/* Evaluate population proposals starting at cells 'iCell_R'
+   (R-style), with changes 'diffProp_R', in batches, as in
+   'finishBatch', and then one at a time, using
+   'diffLogLikAccount' and 'diffLogDensAccount'. The account
+   is not changed. Returns a matrix with one row per proposal,
+   and columns giving diffLogLik and diffLogDens from the
+   batches, then diffLogLik and diffLogDens from the
+   one-at-a-time functions. Requires counter-based random
+   numbers. Used to test the batch functions. */
+SEXP
+diffLogAccountBatch_R(SEXP combined_R, SEXP iCell_R, SEXP diffProp_R)
+{
+    int n = LENGTH(iCell_R);
+    SEXP ans_R;
+    PROTECT(combined_R = duplicate(combined_R));
+    PROTECT(ans_R = allocMatrix(REALSXP, n, 4));
+    BatchTestArgs args;
+    args.combined_R = combined_R;
+    args.iCell = INTEGER(iCell_R);
+    args.diffProp = INTEGER(diffProp_R);
+    args.n = n;
+    args.ans = REAL(ans_R);
+    R_ExecWithCleanup(diffLogAccountBatch_i, &args, endDiffLogAccountBatch, NULL);
+    UNPROTECT(2);
+    return ans_R;
+}
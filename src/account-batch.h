@@ -0,0 +1,48 @@
+#ifndef __ACCOUNT_BATCH_H__
+#define __ACCOUNT_BATCH_H__
+
+    #include <Rinternals.h>
+
+    /* maximum number of population proposals evaluated together */
+    #define K_MAX_ACCOUNT_BATCH 64
+
+    /* Batches of population proposals, for 'updateAccount'.
+     *
+     * Most of the time in 'updateAccount' goes on working out
+     * the log-likelihood and log-density of proposals that
+     * change a population cohort. The cell that a population
+     * proposal starts from is chosen without looking at the
+     * account, and the proposal only reads and writes the
+     * population, accession, exposure, and dataset cells along
+     * the cohort (its 'footprint'). Two proposals whose
+     * footprints do not overlap can therefore be evaluated at
+     * the same time, against the same state of the account,
+     * and then accepted or rejected one after the other, with
+     * exactly the same result as evaluating each one after
+     * the previous one had been accepted or rejected.
+     *
+     * 'updateAccountInBatches' collects consecutive population
+     * proposals into a batch for as long as their footprints
+     * are disjoint, evaluates the batch in parallel, using
+     * only native copies of the slots it needs, and then does
+     * the accept-reject steps, in order. A proposal that
+     * overlaps an earlier one in the batch, or a proposal for
+     * a component, causes the batch to be finished first.
+     * Proposals are still drawn in the same order, and from
+     * the same distributions, as in 'updateAccount', but the
+     * random numbers are used in a different order, so
+     * batching is only used with counter-based random numbers.
+     *
+     * The batch workspace is set up for a combined account
+     * object by 'beginAccountBatches' and released by
+     * 'endAccountBatches'. 'updateAccountInBatches' returns 0,
+     * without doing anything, if there is no workspace, or
+     * if the object contains a data model or dataset that
+     * batching does not support, in which case the caller
+     * should update the account as usual. Memory is allocated
+     * using R_Calloc. */
+    void beginAccountBatches(SEXP combined_R);
+    void endAccountBatches(void);
+    int updateAccountInBatches(SEXP combined_R);
+
+#endif
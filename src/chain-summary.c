@@ -0,0 +1,501 @@
+#include "chain-summary.h"
+#include "demest.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+
+/* File "chain-summary.c" contains functions for accumulating,
+ * writing, and reading summaries of draws, described in
+ * "chain-summary.h". */
+
+#define SUMMARY_MAGIC "DEMESTSM"
+
+/* groups of draws: first half, second half, and middle draw */
+#define N_SUMMARY_GROUPS 3
+
+static const double summaryProbs[K_N_SUMMARY_PROBS] = { 0.025, 0.5, 0.975 };
+
+typedef struct SummaryHeader {
+    char magic[8];
+    int version;
+    int lengthIter;
+    int nChain;
+    int nIterChain;
+} SummaryHeader;
+
+typedef struct ValueSummary {
+    double n[N_SUMMARY_GROUPS];
+    double mean[N_SUMMARY_GROUPS];
+    double m2[N_SUMMARY_GROUPS];
+    double nNA;
+    double shift; /* first draw, subtracted before forming products */
+    double sumShifted;
+    double sumLag[K_N_SUMMARY_LAGS];
+    double head[K_N_SUMMARY_LAGS]; /* first draws, shifted */
+    double tail[K_N_SUMMARY_LAGS]; /* latest draws, shifted, by iteration mod K_N_SUMMARY_LAGS */
+    double height[K_N_SUMMARY_PROBS][5]; /* P-squared markers */
+    double position[K_N_SUMMARY_PROBS][5];
+} ValueSummary;
+
+struct ChainSummary {
+    int lengthIter;
+    int nIterChain;
+    int iIter;
+    ValueSummary *values;
+};
+
+
+static char *
+makeSummaryName(const char *filename)
+{
+    size_t nChar = strlen(filename);
+    size_t nSuffix = strlen(K_SUMMARY_SUFFIX);
+    char *ans = (char *)R_alloc(nChar + nSuffix + 1, sizeof(char));
+    memcpy(ans, filename, nChar);
+    memcpy(ans + nChar, K_SUMMARY_SUFFIX, nSuffix + 1);
+    return ans;
+}
+
+/* Returns 0 if the file does not start with a valid header */
+static int
+readSummaryHeader(SummaryHeader *header, FILE *fp)
+{
+    return (fread(header, sizeof(SummaryHeader), 1, fp) == 1)
+        && (memcmp(header->magic, SUMMARY_MAGIC, 8) == 0)
+        && (header->version == K_SUMMARY_VERSION)
+        && (header->lengthIter >= 0)
+        && (header->nChain >= 1)
+        && (header->nIterChain >= 0);
+}
+
+static void
+makeSummaryHeader(SummaryHeader *header, int lengthIter, int nChain,
+                  int nIterChain)
+{
+    memset(header, 0, sizeof(SummaryHeader));
+    memcpy(header->magic, SUMMARY_MAGIC, 8);
+    header->version = K_SUMMARY_VERSION;
+    header->lengthIter = lengthIter;
+    header->nChain = nChain;
+    header->nIterChain = nIterChain;
+}
+
+
+/* P-squared update of the five markers for quantile 'p', given
+ * that 'nBefore' draws have already been seen. The first five
+ * draws are stored, and then sorted to form the initial markers. */
+static void
+addToQuantile(double *height, double *position, double x, int nBefore,
+              double p)
+{
+    if (nBefore < 5) {
+        height[nBefore] = x;
+        if (nBefore == 4) {
+            for (int i = 1; i < 5; ++i) {
+                double h = height[i];
+                int j = i - 1;
+                for (; (j >= 0) && (height[j] > h); --j)
+                    height[j + 1] = height[j];
+                height[j + 1] = h;
+            }
+            for (int i = 0; i < 5; ++i)
+                position[i] = i + 1;
+        }
+        return;
+    }
+    int k = 0;
+    if (x < height[0]) {
+        height[0] = x;
+    }
+    else if (x >= height[4]) {
+        height[4] = x;
+        k = 3;
+    }
+    else {
+        while (x >= height[k + 1])
+            ++k;
+    }
+    for (int i = k + 1; i < 5; ++i)
+        position[i] += 1;
+    double n = nBefore + 1;
+    double desired[5] = { 1, 1 + (n - 1) * p / 2, 1 + (n - 1) * p,
+                          1 + (n - 1) * (1 + p) / 2, n };
+    for (int i = 1; i < 4; ++i) {
+        double d = desired[i] - position[i];
+        if (((d >= 1) && (position[i + 1] - position[i] > 1))
+            || ((d <= -1) && (position[i - 1] - position[i] < -1))) {
+            int ds = (d > 0) ? 1 : -1;
+            double parabolic = height[i] + ds / (position[i + 1] - position[i - 1])
+                * ((position[i] - position[i - 1] + ds)
+                   * (height[i + 1] - height[i]) / (position[i + 1] - position[i])
+                   + (position[i + 1] - position[i] - ds)
+                   * (height[i] - height[i - 1]) / (position[i] - position[i - 1]));
+            if ((height[i - 1] < parabolic) && (parabolic < height[i + 1]))
+                height[i] = parabolic;
+            else
+                height[i] += ds * (height[i + ds] - height[i])
+                    / (position[i + ds] - position[i]);
+            position[i] += ds;
+        }
+    }
+}
+
+/* 'x' is the draw from iteration 't' (counting from 0) */
+static void
+addValue(ValueSummary *s, double x, int t, int nIterChain)
+{
+    if (ISNAN(x)) {
+        s->nNA += 1;
+        return;
+    }
+    int nBefore = (int)(s->n[0] + s->n[1] + s->n[2]);
+    int nHalf = nIterChain / 2;
+    int g = (t < nHalf) ? 0 : ((t >= nIterChain - nHalf) ? 1 : 2);
+    s->n[g] += 1;
+    double delta = x - s->mean[g];
+    s->mean[g] += delta / s->n[g];
+    s->m2[g] += delta * (x - s->mean[g]);
+    if (t == 0)
+        s->shift = x;
+    double y = x - s->shift;
+    for (int k = 1; (k <= K_N_SUMMARY_LAGS) && (k <= t); ++k)
+        s->sumLag[k - 1] += y * s->tail[(t - k) % K_N_SUMMARY_LAGS];
+    s->tail[t % K_N_SUMMARY_LAGS] = y;
+    if (t < K_N_SUMMARY_LAGS)
+        s->head[t] = y;
+    s->sumShifted += y;
+    for (int i = 0; i < K_N_SUMMARY_PROBS; ++i)
+        addToQuantile(s->height[i], s->position[i], x, nBefore, summaryProbs[i]);
+}
+
+
+ChainSummary *
+makeChainSummary(int lengthIter, int nIterChain)
+{
+    ChainSummary *summary = R_Calloc(1, ChainSummary);
+    summary->lengthIter = lengthIter;
+    summary->nIterChain = nIterChain;
+    summary->iIter = 0;
+    summary->values = R_Calloc(lengthIter > 0 ? lengthIter : 1, ValueSummary);
+    return summary;
+}
+
+/* 'values' holds one iteration */
+void
+addToChainSummary(ChainSummary *summary, const double *values)
+{
+    for (int j = 0; j < summary->lengthIter; ++j)
+        addValue(summary->values + j, values[j], summary->iIter,
+                 summary->nIterChain);
+    summary->iIter++;
+}
+
+/* Returns 0 if the write was unsuccessful */
+int
+writeChainSummary(ChainSummary *summary, const char *filename)
+{
+    const char *nameSummary = makeSummaryName(filename);
+    FILE *fp = fopen(nameSummary, "wb");
+    if (fp == NULL)
+        return 0;
+    SummaryHeader header;
+    makeSummaryHeader(&header, summary->lengthIter, 1, summary->nIterChain);
+    int ok = (fwrite(&header, sizeof(SummaryHeader), 1, fp) == 1)
+        && (fwrite(summary->values, sizeof(ValueSummary), summary->lengthIter, fp)
+            == (size_t)summary->lengthIter);
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (!ok)
+        remove(nameSummary);
+    return ok;
+}
+
+void
+freeChainSummary(ChainSummary *summary)
+{
+    R_Free(summary->values);
+    R_Free(summary);
+}
+
+
+/* Returns 0, and leaves no summary file for the results, if any
+ * chain lacks a valid summary file, or if the files for the chains
+ * do not match. The files for the chains are removed. */
+int
+joinSummaryFiles(const char *filename, const char **chainFilenames, int nChain)
+{
+    const char *nameSummary = makeSummaryName(filename);
+    remove(nameSummary);
+    const char **namesChain = (const char **)R_alloc(nChain, sizeof(char *));
+    SummaryHeader header, headerFirst;
+    int ok = (nChain > 0);
+    for (int i = 0; i < nChain; ++i) {
+        namesChain[i] = makeSummaryName(chainFilenames[i]);
+        if (!ok)
+            continue;
+        FILE *fp = fopen(namesChain[i], "rb");
+        ok = (fp != NULL) && readSummaryHeader(&header, fp) && (header.nChain == 1);
+        if (fp != NULL)
+            fclose(fp);
+        if (ok && (i == 0))
+            headerFirst = header;
+        if (ok && (i > 0))
+            ok = (header.lengthIter == headerFirst.lengthIter)
+                && (header.nIterChain == headerFirst.nIterChain);
+    }
+    if (ok) {
+        FILE *fpOut = fopen(nameSummary, "wb");
+        ok = (fpOut != NULL);
+        if (ok) {
+            makeSummaryHeader(&header, headerFirst.lengthIter, nChain,
+                              headerFirst.nIterChain);
+            ok = (fwrite(&header, sizeof(SummaryHeader), 1, fpOut) == 1);
+            ValueSummary buffer[64];
+            for (int i = 0; ok && (i < nChain); ++i) {
+                FILE *fpIn = fopen(namesChain[i], "rb");
+                ok = (fpIn != NULL) && readSummaryHeader(&header, fpIn);
+                int nLeft = headerFirst.lengthIter;
+                while (ok && (nLeft > 0)) {
+                    int nBlock = (nLeft < 64) ? nLeft : 64;
+                    ok = (fread(buffer, sizeof(ValueSummary), nBlock, fpIn) == (size_t)nBlock)
+                        && (fwrite(buffer, sizeof(ValueSummary), nBlock, fpOut) == (size_t)nBlock);
+                    nLeft -= nBlock;
+                }
+                if (fpIn != NULL)
+                    fclose(fpIn);
+            }
+            if (fclose(fpOut) != 0)
+                ok = 0;
+            if (!ok)
+                remove(nameSummary);
+        }
+    }
+    for (int i = 0; i < nChain; ++i)
+        remove(namesChain[i]);
+    return ok;
+}
+
+/* 'values' holds draws 'first' to 'last' (counting from 1) for
+ * every iteration, one iteration after another. If the summary
+ * file does not match 'nIteration', it is removed. */
+void
+resummariseInFile(const char *filename, const double *values,
+                  int first, int last, int nIteration)
+{
+    const char *nameSummary = makeSummaryName(filename);
+    FILE *fp = fopen(nameSummary, "r+b");
+    if (fp == NULL)
+        return;
+    SummaryHeader header;
+    int nPos = last - first + 1;
+    if (!readSummaryHeader(&header, fp)
+        || ((int64_t)header.nChain * header.nIterChain != nIteration)
+        || (first < 1) || (nPos < 0) || (last > header.lengthIter)) {
+        fclose(fp);
+        remove(nameSummary);
+        return;
+    }
+    int nIterChain = header.nIterChain;
+    ValueSummary *records = (ValueSummary *)R_alloc(nPos > 0 ? nPos : 1,
+                                                    sizeof(ValueSummary));
+    int ok = 1;
+    for (int c = 0; ok && (c < header.nChain); ++c) {
+        memset(records, 0, nPos * sizeof(ValueSummary));
+        for (int t = 0; t < nIterChain; ++t) {
+            const double *iter = values + ((int64_t)c * nIterChain + t) * nPos;
+            for (int jj = 0; jj < nPos; ++jj)
+                addValue(records + jj, iter[jj], t, nIterChain);
+        }
+        int64_t offset = (int64_t)sizeof(SummaryHeader)
+            + ((int64_t)c * header.lengthIter + (first - 1))
+            * (int64_t)sizeof(ValueSummary);
+        ok = (fseek64(fp, offset, SEEK_SET) == 0)
+            && (fwrite(records, sizeof(ValueSummary), nPos, fp) == (size_t)nPos);
+    }
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (!ok) {
+        remove(nameSummary);
+        error("unsuccessful write to file %s", nameSummary);
+    }
+}
+
+
+/* quantile 'p' of 'n' draws, sorted in place, as in type 7 of 'quantile' */
+static double
+quantileSorted(double *x, int n, double p)
+{
+    if (n == 0)
+        return NA_REAL;
+    for (int i = 1; i < n; ++i) {
+        double h = x[i];
+        int j = i - 1;
+        for (; (j >= 0) && (x[j] > h); --j)
+            x[j + 1] = x[j];
+        x[j + 1] = h;
+    }
+    double h = (n - 1) * p;
+    int lo = (int)h;
+    if (lo + 1 >= n)
+        return x[n - 1];
+    return x[lo] + (h - lo) * (x[lo + 1] - x[lo]);
+}
+
+/* lag-k autocorrelations, defined as in 'acf' */
+static void
+makeAutocorr(double *ans, ValueSummary *s)
+{
+    double n = s->n[0] + s->n[1] + s->n[2];
+    double mean = 0;
+    for (int g = 0; g < N_SUMMARY_GROUPS; ++g)
+        mean += s->n[g] * s->mean[g];
+    mean = (n > 0) ? mean / n : 0;
+    double m2 = 0;
+    for (int g = 0; g < N_SUMMARY_GROUPS; ++g)
+        m2 += s->m2[g] + s->n[g] * (s->mean[g] - mean) * (s->mean[g] - mean);
+    double gamma0 = m2 / n;
+    double my = mean - s->shift;
+    double sum = s->sumShifted;
+    double headSum = 0;
+    for (int k = 1; k <= K_N_SUMMARY_LAGS; ++k) {
+        if (k >= n) {
+            ans[k - 1] = NA_REAL;
+            continue;
+        }
+        headSum += s->head[k - 1];
+        double tailSum = 0;
+        for (int t = (int)n - k; t < (int)n; ++t)
+            tailSum += s->tail[t % K_N_SUMMARY_LAGS];
+        double gamma = (s->sumLag[k - 1] - my * (sum - headSum)
+                        - my * (sum - tailSum) + (n - k) * my * my) / n;
+        ans[k - 1] = gamma / gamma0;
+    }
+}
+
+/* Returns NULL if 'filename' has no valid summary file, or if
+ * values 'first' to 'last' are not in it. Otherwise returns the
+ * means and variances of the first and second halves of each
+ * chain, in the order used by 'foldMCMCList', the number of
+ * draws in each half, lag autocorrelations for each chain, and
+ * quantiles for each chain. Values with missing draws get NA. */
+SEXP
+readSummaryFile_R(SEXP filename_R, SEXP first_R, SEXP last_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int first = *INTEGER(first_R);
+    int last = *INTEGER(last_R);
+    int nPos = last - first + 1;
+    const char *nameSummary = makeSummaryName(filename);
+    FILE *fp = fopen(nameSummary, "rb");
+    if (fp == NULL)
+        return R_NilValue;
+    SummaryHeader header;
+    if (!readSummaryHeader(&header, fp) || (first < 1) || (nPos < 1)
+        || (last > header.lengthIter)) {
+        fclose(fp);
+        return R_NilValue;
+    }
+    int nChain = header.nChain;
+    ValueSummary *records = (ValueSummary *)R_alloc((size_t)nPos * nChain,
+                                                    sizeof(ValueSummary));
+    for (int c = 0; c < nChain; ++c) {
+        int64_t offset = (int64_t)sizeof(SummaryHeader)
+            + ((int64_t)c * header.lengthIter + (first - 1))
+            * (int64_t)sizeof(ValueSummary);
+        if ((fseek64(fp, offset, SEEK_SET) != 0)
+            || (fread(records + (size_t)c * nPos, sizeof(ValueSummary), nPos, fp)
+                != (size_t)nPos)) {
+            fclose(fp);
+            error("could not successfully read file %s", nameSummary);
+        }
+    }
+    fclose(fp);
+
+    SEXP ans_R, mean_R, var_R, autocorr_R, quantile_R, names_R;
+    PROTECT(ans_R = allocVector(VECSXP, 5));
+    PROTECT(mean_R = allocMatrix(REALSXP, nPos, 2 * nChain));
+    PROTECT(var_R = allocMatrix(REALSXP, nPos, 2 * nChain));
+    PROTECT(autocorr_R = alloc3DArray(REALSXP, nPos, K_N_SUMMARY_LAGS, nChain));
+    PROTECT(quantile_R = alloc3DArray(REALSXP, nPos, K_N_SUMMARY_PROBS, nChain));
+    double *mean = REAL(mean_R);
+    double *var = REAL(var_R);
+    double *autocorr = REAL(autocorr_R);
+    double *quantile = REAL(quantile_R);
+
+    for (int c = 0; c < nChain; ++c) {
+        for (int jj = 0; jj < nPos; ++jj) {
+            ValueSummary *s = records + (size_t)c * nPos + jj;
+            int hasNA = (s->nNA > 0);
+            for (int h = 0; h < 2; ++h) {
+                size_t i = (size_t)(2 * c + h) * nPos + jj;
+                mean[i] = hasNA ? NA_REAL : s->mean[h];
+                var[i] = (hasNA || (s->n[h] < 2)) ? NA_REAL : s->m2[h] / (s->n[h] - 1);
+            }
+            double ac[K_N_SUMMARY_LAGS];
+            makeAutocorr(ac, s);
+            for (int k = 0; k < K_N_SUMMARY_LAGS; ++k)
+                autocorr[((size_t)c * K_N_SUMMARY_LAGS + k) * nPos + jj] =
+                    hasNA ? NA_REAL : ac[k];
+            int nSeen = (int)(s->n[0] + s->n[1] + s->n[2]);
+            for (int p = 0; p < K_N_SUMMARY_PROBS; ++p) {
+                double q;
+                if (hasNA)
+                    q = NA_REAL;
+                else if (nSeen >= 5)
+                    q = s->height[p][2];
+                else
+                    q = quantileSorted(s->height[p], nSeen, summaryProbs[p]);
+                quantile[((size_t)c * K_N_SUMMARY_PROBS + p) * nPos + jj] = q;
+            }
+        }
+    }
+
+    SET_VECTOR_ELT(ans_R, 0, mean_R);
+    SET_VECTOR_ELT(ans_R, 1, var_R);
+    SET_VECTOR_ELT(ans_R, 2, ScalarInteger(header.nIterChain / 2));
+    SET_VECTOR_ELT(ans_R, 3, autocorr_R);
+    SET_VECTOR_ELT(ans_R, 4, quantile_R);
+    PROTECT(names_R = allocVector(STRSXP, 5));
+    SET_STRING_ELT(names_R, 0, mkChar("mean"));
+    SET_STRING_ELT(names_R, 1, mkChar("var"));
+    SET_STRING_ELT(names_R, 2, mkChar("nHalf"));
+    SET_STRING_ELT(names_R, 3, mkChar("autocorr"));
+    SET_STRING_ELT(names_R, 4, mkChar("quantile"));
+    setAttrib(ans_R, R_NamesSymbol, names_R);
+    UNPROTECT(6);
+    return ans_R;
+}
+
+SEXP
+joinSummaryFiles_R(SEXP filename_R, SEXP chainFilenames_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int nChain = LENGTH(chainFilenames_R);
+    const char **chainFilenames = (const char **)R_alloc(nChain > 0 ? nChain : 1,
+                                                         sizeof(char *));
+    for (int i = 0; i < nChain; ++i)
+        chainFilenames[i] = CHAR(STRING_ELT(chainFilenames_R, i));
+    return ScalarLogical(joinSummaryFiles(filename, chainFilenames, nChain));
+}
+
+SEXP
+resummariseInFile_R(SEXP filename_R, SEXP values_R, SEXP first_R,
+                    SEXP last_R, SEXP nIteration_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int first = *INTEGER(first_R);
+    int last = *INTEGER(last_R);
+    int nIteration = *INTEGER(nIteration_R);
+    if ((R_xlen_t)(last - first + 1) * nIteration != XLENGTH(values_R))
+        error("'%s' has wrong length", "values");
+    resummariseInFile(filename, REAL(values_R), first, last, nIteration);
+    return R_NilValue;
+}
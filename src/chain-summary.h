@@ -0,0 +1,66 @@
+#ifndef __CHAIN_SUMMARY_H__
+#define __CHAIN_SUMMARY_H__
+
+    #include <Rinternals.h>
+
+    /* version of the format of summary files */
+    #define K_SUMMARY_VERSION 1
+
+    /* autocorrelations are kept for lags 1 to K_N_SUMMARY_LAGS */
+    #define K_N_SUMMARY_LAGS 5
+
+    /* quantiles kept: 0.025, 0.5, 0.975 */
+    #define K_N_SUMMARY_PROBS 3
+
+    /* appended to the name of a results file, or of the file
+     * for a chain, to give the name of its summary file */
+    #define K_SUMMARY_SUFFIX "_summary"
+
+    /* Summaries of draws, accumulated during sampling.
+     *
+     * A 'ChainSummary' keeps, for every value recorded by a
+     * chain, statistics that can be updated one iteration at a
+     * time: the number of draws, the mean, and the sum of
+     * squared deviations (using Welford's method), separately
+     * for the first half and the second half of the chain, as
+     * split by 'foldMCMCList', and for the middle draw, if the
+     * number of draws is odd; sums of products of draws 1 to
+     * K_N_SUMMARY_LAGS iterations apart, from which the
+     * autocorrelations can be calculated; and estimates of
+     * quantiles, using the P-squared algorithm of Jain and
+     * Chlamtac (1985), which keeps five markers per quantile.
+     * 'nIterChain' is the number of iterations that the chain
+     * will record, which is needed to split it in half.
+     *
+     * Each chain writes its summaries to a file with
+     * K_SUMMARY_SUFFIX added to the name of the chain's file.
+     * 'joinSummaryFiles' combines the files for the chains into
+     * a file for the results, in the order of the chains, so
+     * that summaries can be had without reading the draws.
+     * 'resummariseInFile' recalculates the summaries for a
+     * range of values from all their draws, after the draws
+     * in the results file have been changed. 'readSummaryFile_R'
+     * calculates split-chain means and variances, lag
+     * autocorrelations, and quantiles for a range of values.
+     *
+     * The file consists of a header, giving the version, the
+     * number of values per iteration, the number of chains,
+     * and the number of iterations per chain, followed by one
+     * record per value for the first chain, then one record
+     * per value for the second chain, and so on. Records are
+     * written as raw bytes, so files are only good for the
+     * machine that wrote them. Memory is allocated using
+     * R_Calloc. */
+    typedef struct ChainSummary ChainSummary;
+
+    ChainSummary * makeChainSummary(int lengthIter, int nIterChain);
+    void addToChainSummary(ChainSummary *summary, const double *values);
+    int writeChainSummary(ChainSummary *summary, const char *filename);
+    void freeChainSummary(ChainSummary *summary);
+
+    int joinSummaryFiles(const char *filename, const char **chainFilenames,
+                         int nChain);
+    void resummariseInFile(const char *filename, const double *values,
+                           int first, int last, int nIteration);
+
+#endif
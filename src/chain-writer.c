@@ -0,0 +1,484 @@
+#include "chain-writer.h"
+#include "chain-summary.h"
+#include "results-file.h"
+#include "demest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#define CHAIN_WRITER_USE_THREAD
+#endif
+
+
+/* File "chain-writer.c" contains functions for writing draws
+ * from chains, described in "chain-writer.h". */
+
+extern SEXP
+  Data_sym,  /* used for .Data slot */
+  slotsToExtract_sym;
+
+struct ChainWriter {
+    FILE *fp;
+    const char *filename; /* owned by caller */
+    R_xlen_t lengthIter;
+    unsigned char *types; /* 'lengthIter' types (see "results-file.h") */
+    R_xlen_t bytesIter; /* bytes per iteration */
+    double *row; /* values from latest iteration */
+    R_xlen_t capacity; /* bytes per buffer */
+    unsigned char *stored[K_N_CHAIN_WRITER_BUFFERS];
+    R_xlen_t nBytes[K_N_CHAIN_WRITER_BUFFERS];
+    int full[K_N_CHAIN_WRITER_BUFFERS]; /* waiting to be written */
+    int iFilling; /* buffer being filled by main thread */
+    int iWriting; /* next buffer to be written */
+    int failed;
+    ChainSummary *summary; /* NULL if not summarising */
+#ifdef CHAIN_WRITER_USE_THREAD
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    int stopping;
+#endif
+};
+
+
+/* Copies the values to be recorded into 'ans', if 'ans' is not
+ * NULL, and returns the number of values. Follows the same path
+ * through the object as 'extractValues', and, like 'extractValues',
+ * converts missing integers and logicals to NA_REAL. If 'ans' is not NULL, it has space for 'room' values,
+ * and an error is raised if there are more. */
+static R_xlen_t
+copyValues(double *ans, R_xlen_t room, SEXP object_R)
+{
+    if (IS_S4_OBJECT(object_R)) {
+        if (R_has_slot(object_R, slotsToExtract_sym)) {
+            SEXP slots_to_extract = GET_SLOT(object_R, slotsToExtract_sym);
+            R_xlen_t n = 0;
+            for (int i = 0; i < LENGTH(slots_to_extract); i++) {
+                const char *sym_name = CHAR(STRING_ELT(slots_to_extract, i));
+                SEXP slot_R = GET_SLOT(object_R, install(sym_name));
+                n += copyValues(ans ? ans + n : NULL, room - n, slot_R);
+            }
+            return n;
+        }
+        else if (R_has_slot(object_R, Data_sym)) {
+            return copyValues(ans, room, GET_SLOT(object_R, Data_sym));
+        }
+        else {
+            error("copyValues cannot handle object_R of class \"%s\"",
+                  CHAR(STRING_ELT(GET_SLOT((object_R), R_ClassSymbol), 0)));
+        }
+    }
+    R_xlen_t n = XLENGTH(object_R);
+    if (ans && (TYPEOF(object_R) != VECSXP) && (n > room))
+        error("number of values to write has increased");
+    switch(TYPEOF(object_R)) {
+        case REALSXP:
+            if (ans) {
+                double *object = REAL(object_R);
+                for (R_xlen_t i = 0; i < n; ++i)
+                    ans[i] = object[i];
+            }
+            return n;
+        case INTSXP:
+        case LGLSXP:
+            if (ans) {
+                int *object = (TYPEOF(object_R) == INTSXP) ? INTEGER(object_R)
+                                                           : LOGICAL(object_R);
+                for (R_xlen_t i = 0; i < n; ++i)
+                    ans[i] = (object[i] == NA_INTEGER) ? NA_REAL : (double)object[i];
+            }
+            return n;
+        case VECSXP:
+            {
+                R_xlen_t nAll = 0;
+                for (R_xlen_t i = 0; i < n; i++)
+                    nAll += copyValues(ans ? ans + nAll : NULL, room - nAll,
+                                       VECTOR_ELT(object_R, i));
+                return nAll;
+            }
+        default:
+            error("copyValues cannot handle object_R type '%s' (%d).\n",
+                  type2char(TYPEOF(object_R)), TYPEOF(object_R));
+    }
+    return 0; /* not reached */
+}
+
+/* Records in 'types', if 'types' is not NULL, the types used to
+ * store the values that 'copyValues' copies, and returns the number
+ * of values. Integers and logicals keep their own types. Doubles
+ * are stored as doubles, except that, if 'singlePrecision' is
+ * non-zero, doubles in slots called "theta" are stored as floats.
+ * 'asFloat' is non-zero within such slots. */
+static R_xlen_t
+findValueTypes(unsigned char *types, SEXP object_R, int singlePrecision,
+               int asFloat)
+{
+    if (IS_S4_OBJECT(object_R)) {
+        if (R_has_slot(object_R, slotsToExtract_sym)) {
+            SEXP slots_to_extract = GET_SLOT(object_R, slotsToExtract_sym);
+            R_xlen_t n = 0;
+            for (int i = 0; i < LENGTH(slots_to_extract); i++) {
+                const char *sym_name = CHAR(STRING_ELT(slots_to_extract, i));
+                SEXP slot_R = GET_SLOT(object_R, install(sym_name));
+                int isTheta = singlePrecision && (strcmp(sym_name, "theta") == 0);
+                n += findValueTypes(types ? types + n : NULL, slot_R,
+                                    singlePrecision, isTheta);
+            }
+            return n;
+        }
+        else if (R_has_slot(object_R, Data_sym)) {
+            return findValueTypes(types, GET_SLOT(object_R, Data_sym),
+                                  singlePrecision, asFloat);
+        }
+        else {
+            error("findValueTypes cannot handle object_R of class \"%s\"",
+                  CHAR(STRING_ELT(GET_SLOT((object_R), R_ClassSymbol), 0)));
+        }
+    }
+    R_xlen_t n = XLENGTH(object_R);
+    int type = K_VALUE_DOUBLE;
+    switch(TYPEOF(object_R)) {
+        case REALSXP:
+            type = asFloat ? K_VALUE_FLOAT : K_VALUE_DOUBLE;
+            break;
+        case INTSXP:
+            type = K_VALUE_INT;
+            break;
+        case LGLSXP:
+            type = K_VALUE_LOGICAL;
+            break;
+        case VECSXP:
+            {
+                R_xlen_t nAll = 0;
+                for (R_xlen_t i = 0; i < n; i++)
+                    nAll += findValueTypes(types ? types + nAll : NULL,
+                                           VECTOR_ELT(object_R, i),
+                                           singlePrecision, asFloat);
+                return nAll;
+            }
+        default:
+            error("findValueTypes cannot handle object_R type '%s' (%d).\n",
+                  type2char(TYPEOF(object_R)), TYPEOF(object_R));
+    }
+    if (types)
+        memset(types, type, (size_t)n);
+    return n;
+}
+
+static int
+writeBuffer(ChainWriter *writer, int i)
+{
+    R_xlen_t n = writer->nBytes[i];
+    return (fwrite(writer->stored[i], 1, n, writer->fp) == (size_t)n);
+}
+
+
+#ifdef CHAIN_WRITER_USE_THREAD
+
+/* body of background thread: writes full buffers, in order,
+ * until told to stop and there is nothing left to write */
+static void *
+writeBuffers(void *arg)
+{
+    ChainWriter *writer = (ChainWriter *)arg;
+    pthread_mutex_lock(&writer->mutex);
+    for (;;) {
+        while (!writer->full[writer->iWriting] && !writer->stopping)
+            pthread_cond_wait(&writer->changed, &writer->mutex);
+        int i = writer->iWriting;
+        if (!writer->full[i])
+            break;
+        pthread_mutex_unlock(&writer->mutex);
+        int ok = writeBuffer(writer, i);
+        pthread_mutex_lock(&writer->mutex);
+        if (!ok)
+            writer->failed = 1;
+        writer->nBytes[i] = 0;
+        writer->full[i] = 0;
+        writer->iWriting = (i + 1) % K_N_CHAIN_WRITER_BUFFERS;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+#endif
+
+/* Passes the buffer being filled to the writer, and waits
+ * until the next buffer is free. Returns non-zero if any write
+ * so far has failed. 'failed' is set by the background thread,
+ * so is only read while holding the mutex. */
+static int
+handOver(ChainWriter *writer)
+{
+    int i = writer->iFilling;
+    int next = (i + 1) % K_N_CHAIN_WRITER_BUFFERS;
+#ifdef CHAIN_WRITER_USE_THREAD
+    pthread_mutex_lock(&writer->mutex);
+    writer->full[i] = 1;
+    pthread_cond_broadcast(&writer->changed);
+    while (writer->full[next])
+        pthread_cond_wait(&writer->changed, &writer->mutex);
+    int failed = writer->failed;
+    pthread_mutex_unlock(&writer->mutex);
+#else
+    if (!writeBuffer(writer, i))
+        writer->failed = 1;
+    writer->nBytes[i] = 0;
+    int failed = writer->failed;
+#endif
+    writer->iFilling = next;
+    return failed;
+}
+
+/* Writes out remaining values, stops the thread, closes the file,
+ * and frees the writer, without raising errors. Returns 0 if any
+ * write was unsuccessful. */
+static int
+shutDownChainWriter(ChainWriter *writer)
+{
+    if (writer->nBytes[writer->iFilling] > 0)
+        handOver(writer);
+#ifdef CHAIN_WRITER_USE_THREAD
+    pthread_mutex_lock(&writer->mutex);
+    writer->stopping = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+    pthread_cond_destroy(&writer->changed);
+    pthread_mutex_destroy(&writer->mutex);
+#endif
+    int ok = !writer->failed; /* thread has finished */
+    if (fclose(writer->fp) != 0)
+        ok = 0;
+    if (writer->summary != NULL)
+        freeChainSummary(writer->summary);
+    for (int i = 0; i < K_N_CHAIN_WRITER_BUFFERS; ++i)
+        R_Free(writer->stored[i]);
+    R_Free(writer->row);
+    R_Free(writer->types);
+    R_Free(writer);
+    return ok;
+}
+
+
+/* Adds the draws already in 'filename' to the summaries.
+ * Returns 0 if the file could not be read. */
+static int
+summariseExistingDraws(ChainSummary *summary, const char *filename,
+                       R_xlen_t lengthIter, const unsigned char *types)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return 0;
+    R_xlen_t bytesIter = sizeOfValues(types, lengthIter);
+    unsigned char *stored = (unsigned char *)R_alloc(bytesIter > 0 ? bytesIter : 1,
+                                                     sizeof(unsigned char));
+    double *iter = (double *)R_alloc(lengthIter > 0 ? lengthIter : 1, sizeof(double));
+    while (fread(stored, 1, bytesIter, fp) == (size_t)bytesIter) {
+        if (lengthIter == 0)
+            break;
+        decodeValues(iter, stored, types, lengthIter);
+        addToChainSummary(summary, iter);
+    }
+    int ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+ChainWriter *
+openChainWriter(const char *filename, SEXP combined_R, int append,
+                int nIterSummary, int singlePrecision)
+{
+    R_xlen_t lengthIter = findValueTypes(NULL, combined_R, singlePrecision, 0);
+    unsigned char *types = R_Calloc(lengthIter > 0 ? lengthIter : 1, unsigned char);
+    findValueTypes(types, combined_R, singlePrecision, 0);
+    R_xlen_t bytesIter = sizeOfValues(types, lengthIter);
+    R_xlen_t nIterBuffer = K_SIZE_CHAIN_WRITER_BUFFER
+        / (bytesIter > 0 ? bytesIter : 1);
+    if (nIterBuffer < 1)
+        nIterBuffer = 1;
+    ChainSummary *summary = NULL;
+    if (nIterSummary > 0) {
+        summary = makeChainSummary(lengthIter, nIterSummary);
+        if (append && !summariseExistingDraws(summary, filename, lengthIter, types)) {
+            freeChainSummary(summary);
+            R_Free(types);
+            error("could not successfully read file %s", filename);
+        }
+    }
+    FILE *fp = fopen(filename, append ? "ab" : "wb");
+    if (fp == NULL) {
+        if (summary != NULL)
+            freeChainSummary(summary);
+        R_Free(types);
+        error("could not open file %s", filename); /* terminates now */
+    }
+
+    ChainWriter *writer = R_Calloc(1, ChainWriter);
+    writer->fp = fp;
+    writer->filename = filename;
+    writer->lengthIter = lengthIter;
+    writer->types = types;
+    writer->bytesIter = bytesIter;
+    writer->row = R_Calloc(lengthIter > 0 ? lengthIter : 1, double);
+    writer->capacity = nIterBuffer * bytesIter;
+    writer->summary = summary;
+    for (int i = 0; i < K_N_CHAIN_WRITER_BUFFERS; ++i)
+        writer->stored[i] = R_Calloc(writer->capacity > 0 ? writer->capacity : 1,
+                                     unsigned char);
+#ifdef CHAIN_WRITER_USE_THREAD
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    if (pthread_create(&writer->thread, NULL, writeBuffers, writer) != 0) {
+        pthread_cond_destroy(&writer->changed);
+        pthread_mutex_destroy(&writer->mutex);
+        fclose(fp);
+        if (summary != NULL)
+            freeChainSummary(summary);
+        for (int i = 0; i < K_N_CHAIN_WRITER_BUFFERS; ++i)
+            R_Free(writer->stored[i]);
+        R_Free(writer->row);
+        R_Free(writer->types);
+        R_Free(writer);
+        error("could not start thread to write to file %s", filename);
+    }
+#endif
+    return writer;
+}
+
+void
+appendToChainWriter(ChainWriter *writer, SEXP combined_R)
+{
+    int i = writer->iFilling;
+    double *row = writer->row;
+    if (copyValues(row, writer->lengthIter, combined_R) != writer->lengthIter)
+        error("number of values to write has decreased");
+    encodeValues(writer->stored[i] + writer->nBytes[i], row, writer->types,
+                 writer->lengthIter);
+    if (writer->summary != NULL)
+        addToChainSummary(writer->summary, row);
+    writer->nBytes[i] += writer->bytesIter;
+    if ((writer->nBytes[i] + writer->bytesIter > writer->capacity)
+        && handOver(writer))
+        error("unsuccessful write to file %s", writer->filename);
+}
+
+void
+flushChainWriter(ChainWriter *writer)
+{
+    if (writer->nBytes[writer->iFilling] > 0)
+        handOver(writer);
+#ifdef CHAIN_WRITER_USE_THREAD
+    pthread_mutex_lock(&writer->mutex);
+    for (int i = 0; i < K_N_CHAIN_WRITER_BUFFERS; ++i) {
+        while (writer->full[i])
+            pthread_cond_wait(&writer->changed, &writer->mutex);
+    }
+#endif
+    if (fflush(writer->fp) != 0)
+        writer->failed = 1;
+    int failed = writer->failed;
+#ifdef CHAIN_WRITER_USE_THREAD
+    pthread_mutex_unlock(&writer->mutex);
+#endif
+    if (failed)
+        error("unsuccessful write to file %s", writer->filename);
+}
+
+void
+closeChainWriter(ChainWriter *writer)
+{
+    const char *filename = writer->filename;
+    ChainSummary *summary = writer->summary;
+    writer->summary = NULL;
+    int ok = shutDownChainWriter(writer);
+    if (ok && (summary != NULL))
+        ok = writeChainSummary(summary, filename);
+    if (summary != NULL)
+        freeChainSummary(summary);
+    if (!ok)
+        error("unsuccessful write to file %s", filename);
+}
+
+
+/* Writers are passed to R as external pointers, which keep the
+ * name of the file in their 'protected' field. A writer that is
+ * not closed explicitly, for instance because of an error during
+ * estimation, is shut down when the pointer is garbage-collected. */
+
+static void
+finalizeChainWriter(SEXP writer_R)
+{
+    ChainWriter *writer = (ChainWriter *)R_ExternalPtrAddr(writer_R);
+    if (writer != NULL) {
+        R_ClearExternalPtr(writer_R);
+        shutDownChainWriter(writer);
+    }
+}
+
+static ChainWriter *
+getChainWriter(SEXP writer_R)
+{
+    ChainWriter *writer = (ChainWriter *)R_ExternalPtrAddr(writer_R);
+    if (writer == NULL)
+        error("chain writer has been closed");
+    return writer;
+}
+
+SEXP
+makeValueTypes_R(SEXP combined_R, SEXP singlePrecision_R)
+{
+    int singlePrecision = *LOGICAL(singlePrecision_R);
+    R_xlen_t n = findValueTypes(NULL, combined_R, singlePrecision, 0);
+    SEXP ans_R;
+    PROTECT(ans_R = allocVector(RAWSXP, n));
+    findValueTypes(RAW(ans_R), combined_R, singlePrecision, 0);
+    UNPROTECT(1);
+    return ans_R;
+}
+
+SEXP
+openChainWriter_R(SEXP filename_R, SEXP combined_R, SEXP append_R,
+                  SEXP nIterSummary_R, SEXP singlePrecision_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int append = *LOGICAL(append_R);
+    int nIterSummary = *INTEGER(nIterSummary_R);
+    int singlePrecision = *LOGICAL(singlePrecision_R);
+    ChainWriter *writer = openChainWriter(filename, combined_R, append,
+                                          nIterSummary, singlePrecision);
+    SEXP writer_R;
+    PROTECT(writer_R = R_MakeExternalPtr(writer, R_NilValue, filename_R));
+    R_RegisterCFinalizerEx(writer_R, finalizeChainWriter, TRUE);
+    UNPROTECT(1);
+    return writer_R;
+}
+
+SEXP
+appendToChainWriter_R(SEXP writer_R, SEXP combined_R)
+{
+    appendToChainWriter(getChainWriter(writer_R), combined_R);
+    return R_NilValue;
+}
+
+SEXP
+flushChainWriter_R(SEXP writer_R)
+{
+    flushChainWriter(getChainWriter(writer_R));
+    return R_NilValue;
+}
+
+/* does nothing if the writer has already been closed */
+SEXP
+closeChainWriter_R(SEXP writer_R)
+{
+    ChainWriter *writer = (ChainWriter *)R_ExternalPtrAddr(writer_R);
+    if (writer != NULL) {
+        R_ClearExternalPtr(writer_R);
+        closeChainWriter(writer);
+    }
+    return R_NilValue;
+}
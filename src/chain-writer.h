@@ -0,0 +1,54 @@
+#ifndef __CHAIN_WRITER_H__
+#define __CHAIN_WRITER_H__
+
+    #include <Rinternals.h>
+
+    /* number of buffers that draws are collected in */
+    #define K_N_CHAIN_WRITER_BUFFERS 2
+
+    /* target size, in bytes, of each buffer */
+    #define K_SIZE_CHAIN_WRITER_BUFFER 4194304
+
+    /* Writing the draws from a chain.
+     *
+     * 'appendToChainWriter' copies the values to be recorded
+     * from the combined object into a buffer, in the same order as
+     * 'extractValues', storing each value in the format for its
+     * type (see "results-file.h"). Integers and logicals keep their
+     * own types. If 'singlePrecision' is non-zero, doubles in slots
+     * called "theta" are stored as floats, and other doubles as
+     * doubles. Copying has to happen on the main thread, since it
+     * uses the R API, but writing does not. When a buffer is full
+     * it is handed to a background thread, which writes it to the
+     * file with a single call to 'fwrite', while the sampler
+     * carries on filling the next buffer. The sampler only waits
+     * if every buffer is full, or waiting to be written. Each
+     * buffer holds as many whole iterations as fit in
+     * K_SIZE_CHAIN_WRITER_BUFFER bytes, and at least one.
+     *
+     * 'flushChainWriter' waits until every value collected so far
+     * is in the file, as is needed before a checkpoint is written.
+     * 'closeChainWriter' flushes the writer, stops the thread, and
+     * closes the file. Errors in the background thread are
+     * recorded, and raised the next time the main thread hands
+     * over a full buffer, flushes the writer, or closes it.
+     * Where threads are not available the buffers are written on
+     * the main thread as they fill.
+     *
+     * If 'nIterSummary' is positive, the writer also accumulates
+     * summaries of the draws (see "chain-summary.h"), for a chain
+     * that records 'nIterSummary' iterations, and writes them out
+     * when it is closed. When appending to an existing file, the
+     * draws already in the file are added to the summaries first.
+     * Summaries of new draws use the values before any conversion
+     * to floats. Memory is allocated using R_Calloc. */
+    typedef struct ChainWriter ChainWriter;
+
+    ChainWriter * openChainWriter(const char *filename, SEXP combined_R,
+                                  int append, int nIterSummary,
+                                  int singlePrecision);
+    void appendToChainWriter(ChainWriter *writer, SEXP combined_R);
+    void flushChainWriter(ChainWriter *writer);
+    void closeChainWriter(ChainWriter *writer);
+
+#endif
@@ -0,0 +1,268 @@
+#include "checkpoint.h"
+#include "random-streams.h"
+#include "demest.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+
+/* File "checkpoint.c" contains functions for writing and reading
+ * the checkpoints described in "checkpoint.h". */
+
+#define CHECKPOINT_MAGIC "DEMESTCK"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+typedef struct CheckpointHeader {
+    char magic[8];
+    int version;
+    int progress[K_LENGTH_CHECKPOINT_PROGRESS];
+    unsigned int counterRNG[K_LENGTH_COUNTER_RNG_STATE];
+    int nSeed; /* length of .Random.seed, or 0 if it does not exist */
+    uint64_t hash; /* types and lengths of vectors, in order */
+    int64_t nByte; /* bytes of vector values */
+} CheckpointHeader;
+
+typedef enum { WALK_HASH, WALK_WRITE, WALK_READ } WalkMode;
+
+typedef struct CheckpointWalk {
+    WalkMode mode;
+    FILE *fp;
+    uint64_t hash;
+    int64_t nByte;
+    int ok;
+} CheckpointWalk;
+
+
+static void
+hashInt(CheckpointWalk *walk, int64_t x)
+{
+    for (int i = 0; i < 8; ++i) {
+        walk->hash ^= (uint64_t)((x >> (8 * i)) & 0xFF);
+        walk->hash *= FNV_PRIME;
+    }
+}
+
+static void
+walkValues(CheckpointWalk *walk, void *values, size_t size, R_xlen_t n)
+{
+    walk->nByte += (int64_t)size * (int64_t)n;
+    if (n == 0 || !walk->ok)
+        return;
+    if (walk->mode == WALK_WRITE)
+        walk->ok = (fwrite(values, size, n, walk->fp) == (size_t)n);
+    else if (walk->mode == WALK_READ)
+        walk->ok = (fread(values, size, n, walk->fp) == (size_t)n);
+}
+
+/* Visits the vectors in 'object_R' in a fixed order: the
+ * values of the object itself, if it is an integer, logical,
+ * or double vector, then the elements, if it is a list, then
+ * the attributes, which include the slots of S4 objects. */
+static void
+walkObject(SEXP object_R, CheckpointWalk *walk)
+{
+    int type = TYPEOF(object_R);
+    switch (type) {
+    case INTSXP:
+        hashInt(walk, type);
+        hashInt(walk, XLENGTH(object_R));
+        walkValues(walk, INTEGER(object_R), sizeof(int), XLENGTH(object_R));
+        break;
+    case LGLSXP:
+        hashInt(walk, type);
+        hashInt(walk, XLENGTH(object_R));
+        walkValues(walk, LOGICAL(object_R), sizeof(int), XLENGTH(object_R));
+        break;
+    case REALSXP:
+        hashInt(walk, type);
+        hashInt(walk, XLENGTH(object_R));
+        walkValues(walk, REAL(object_R), sizeof(double), XLENGTH(object_R));
+        break;
+    case VECSXP:
+        hashInt(walk, type);
+        hashInt(walk, XLENGTH(object_R));
+        for (R_xlen_t i = 0; i < XLENGTH(object_R); ++i)
+            walkObject(VECTOR_ELT(object_R, i), walk);
+        break;
+    default:
+        break;
+    }
+    for (SEXP a = ATTRIB(object_R); a != R_NilValue; a = CDR(a)) {
+        SEXP tag = TAG(a);
+        if (tag == R_NamesSymbol || tag == R_DimSymbol
+            || tag == R_DimNamesSymbol || tag == R_ClassSymbol)
+            continue;
+        walkObject(CAR(a), walk);
+    }
+}
+
+static void
+hashCombined(SEXP combined_R, uint64_t *hash, int64_t *nByte)
+{
+    CheckpointWalk walk = { WALK_HASH, NULL, FNV_OFFSET, 0, 1 };
+    walkObject(combined_R, &walk);
+    *hash = walk.hash;
+    *nByte = walk.nByte;
+}
+
+
+void
+writeCheckpoint(const char *filename, SEXP combined_R, int *progress)
+{
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(CheckpointHeader));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.version = K_CHECKPOINT_VERSION;
+    for (int i = 0; i < K_LENGTH_CHECKPOINT_PROGRESS; ++i)
+        header.progress[i] = progress[i];
+    getCounterRNGState(header.counterRNG);
+    hashCombined(combined_R, &header.hash, &header.nByte);
+
+    SEXP seed_R = findVarInFrame(R_GlobalEnv, install(".Random.seed"));
+    int hasSeed = (seed_R != R_UnboundValue) && (TYPEOF(seed_R) == INTSXP);
+    header.nSeed = hasSeed ? LENGTH(seed_R) : 0;
+
+    size_t nChar = strlen(filename);
+    char *tmpname = (char *)R_alloc(nChar + 5, sizeof(char));
+    memcpy(tmpname, filename, nChar);
+    memcpy(tmpname + nChar, ".tmp", 5);
+
+    FILE *fp = fopen(tmpname, "wb");
+    if (fp == NULL)
+        error("could not open file %s", tmpname);
+    int ok = (fwrite(&header, sizeof(CheckpointHeader), 1, fp) == 1);
+    if (ok && hasSeed)
+        ok = (fwrite(INTEGER(seed_R), sizeof(int), header.nSeed, fp)
+              == (size_t)header.nSeed);
+    if (ok) {
+        CheckpointWalk walk = { WALK_WRITE, fp, FNV_OFFSET, 0, 1 };
+        walkObject(combined_R, &walk);
+        ok = walk.ok;
+    }
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (!ok) {
+        remove(tmpname);
+        error("unsuccessful write to file %s", tmpname);
+    }
+#ifdef _WIN32
+    remove(filename); /* 'rename' does not replace existing files */
+#endif
+    if (rename(tmpname, filename) != 0)
+        error("could not rename file %s to %s", tmpname, filename);
+}
+
+static FILE *
+openCheckpoint(CheckpointHeader *header, const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return NULL;
+    if (fread(header, sizeof(CheckpointHeader), 1, fp) != 1
+        || memcmp(header->magic, CHECKPOINT_MAGIC, 8) != 0) {
+        fclose(fp);
+        error("file %s is not a checkpoint", filename);
+    }
+    if (header->version != K_CHECKPOINT_VERSION) {
+        fclose(fp);
+        error("checkpoint %s has version %d, but current version is %d",
+              filename, header->version, K_CHECKPOINT_VERSION);
+    }
+    return fp;
+}
+
+/* Returns 0 if 'filename' does not exist */
+int
+readCheckpointProgress(int *progress, const char *filename)
+{
+    CheckpointHeader header;
+    FILE *fp = openCheckpoint(&header, filename);
+    if (fp == NULL)
+        return 0;
+    fclose(fp);
+    for (int i = 0; i < K_LENGTH_CHECKPOINT_PROGRESS; ++i)
+        progress[i] = header.progress[i];
+    return 1;
+}
+
+/* Modifies 'combined_R' in place, and sets R's random seed
+ * and the counter-based generator. */
+void
+readCheckpoint(SEXP combined_R, const char *filename)
+{
+    CheckpointHeader header;
+    FILE *fp = openCheckpoint(&header, filename);
+    if (fp == NULL)
+        error("could not open file %s", filename);
+
+    uint64_t hash;
+    int64_t nByte;
+    hashCombined(combined_R, &hash, &nByte);
+    if ((hash != header.hash) || (nByte != header.nByte)) {
+        fclose(fp);
+        error("checkpoint %s does not match the structure of the model", filename);
+    }
+
+    SEXP seed_R = R_NilValue;
+    int ok = 1;
+    if (header.nSeed > 0) {
+        PROTECT(seed_R = allocVector(INTSXP, header.nSeed));
+        ok = (fread(INTEGER(seed_R), sizeof(int), header.nSeed, fp)
+              == (size_t)header.nSeed);
+    }
+    if (ok) {
+        CheckpointWalk walk = { WALK_READ, fp, FNV_OFFSET, 0, 1 };
+        walkObject(combined_R, &walk);
+        ok = walk.ok;
+    }
+    fclose(fp);
+    if (!ok)
+        error("unsuccessful read from file %s", filename);
+
+    if (header.nSeed > 0) {
+        defineVar(install(".Random.seed"), seed_R, R_GlobalEnv);
+        UNPROTECT(1);
+    }
+    setCounterRNGState(header.counterRNG);
+}
+
+
+SEXP
+writeCheckpoint_R(SEXP combined_R, SEXP filename_R, SEXP progress_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    if (LENGTH(progress_R) != K_LENGTH_CHECKPOINT_PROGRESS)
+        error("'%s' does not have length %d", "progress",
+              K_LENGTH_CHECKPOINT_PROGRESS);
+    writeCheckpoint(filename, combined_R, INTEGER(progress_R));
+    return R_NilValue;
+}
+
+SEXP
+readCheckpoint_R(SEXP combined_R, SEXP filename_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    SEXP ans_R;
+    PROTECT(ans_R = duplicate(combined_R));
+    readCheckpoint(ans_R, filename);
+    UNPROTECT(1);
+    return ans_R;
+}
+
+/* Returns NULL if 'filename' does not exist */
+SEXP
+readCheckpointProgress_R(SEXP filename_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int progress[K_LENGTH_CHECKPOINT_PROGRESS];
+    if (!readCheckpointProgress(progress, filename))
+        return R_NilValue;
+    SEXP ans_R;
+    PROTECT(ans_R = allocVector(INTSXP, K_LENGTH_CHECKPOINT_PROGRESS));
+    memcpy(INTEGER(ans_R), progress, K_LENGTH_CHECKPOINT_PROGRESS * sizeof(int));
+    UNPROTECT(1);
+    return ans_R;
+}
@@ -0,0 +1,43 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+    #include <Rinternals.h>
+
+    /* version of the checkpoint file format */
+    #define K_CHECKPOINT_VERSION 1
+
+    /* nBurnin, nSim, nThin, updates of burnin done, draws written */
+    #define K_LENGTH_CHECKPOINT_PROGRESS 5
+
+    /* Checkpoints for chains.
+     *
+     * A checkpoint holds the state of a chain, so that an
+     * estimation that is interrupted can carry on from the
+     * last checkpoint rather than starting again. The state
+     * consists of every integer, logical, and double vector
+     * that can be reached from the combined object through
+     * its slots and list elements, in a fixed order, together
+     * with R's random seed and the state of the counter-based
+     * generator. Character vectors, names, dims, and dimnames
+     * do not change during estimation, and are not saved.
+     *
+     * Values are written as raw bytes, with no conversion,
+     * so checkpoints are only good for the machine that wrote
+     * them. Rather than describing the layout of the object,
+     * the file contains a hash of the types and lengths of
+     * the vectors, in order. 'readCheckpoint' copies values
+     * into an object with the same layout, such as a freshly
+     * initialised version of the combined object, and raises
+     * an error if the hashes differ.
+     *
+     * 'progress' has length K_LENGTH_CHECKPOINT_PROGRESS, and
+     * records how far the chain had got. The file is written
+     * under a temporary name and then renamed, so a chain
+     * stopped part way through writing leaves the previous
+     * checkpoint in place. */
+    void writeCheckpoint(const char *filename, SEXP combined_R,
+                         int *progress);
+    void readCheckpoint(SEXP combined_R, const char *filename);
+    int readCheckpointProgress(int *progress, const char *filename);
+
+#endif
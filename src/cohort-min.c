@@ -0,0 +1,1011 @@
+#include "cohort-min.h"
+#include "iterators-methods.h"
+#include "demest.h"
+
+
+/* File "cohort-min.c" contains functions for finding minimum
+ * values along cohorts, described in "cohort-min.h". */
+
+extern SEXP
+  Data_sym,  /* used for .Data slot */
+  iMethodPrior_sym,
+  Z_sym,
+  beta_sym,
+  eta_sym,
+  gamma_sym,
+  lower_sym,
+  tau_sym,
+  tauMax_sym,
+  upper_sym,
+  order_sym,
+  iteratorBeta_sym,
+  iWithin_sym,
+  nWithin_sym,
+  iBetween_sym,
+  nBetween_sym,
+  incrementBetween_sym,
+  indices_sym,
+  initial_sym,
+  dimIterators_sym,
+  strideLengths_sym,
+  nStrides_sym,
+  dimBefore_sym,
+  dimAfter_sym,
+  posDim_sym,
+  lengthDim_sym,
+  iMethodModel_sym,
+  meansBetas_sym,
+  variancesBetas_sym,
+  betaEqualsMean_sym,
+  acceptBeta_sym,
+  priorsBetas_sym,
+  logPostPriorsBetas_sym,
+  logPostBetas_sym,
+  logPostSigma_sym,
+  logPostTheta_sym,
+  logPostVarsigma_sym,
+  theta_sym,
+  thetaTransformed_sym,
+  cellInLik_sym,
+  mu_sym,
+  sigma_sym,
+  sigmaMax_sym,
+  ASigma_sym,
+  nuSigma_sym,
+  varsigma_sym,
+  varsigmaMax_sym,
+  varsigmaSetToZero_sym,
+  AVarsigma_sym,
+  nuVarsigma_sym,
+  w_sym,
+  scaleTheta_sym,
+  scaleThetaMultiplier_sym,
+  nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
+  betas_sym,
+  priors_sym,
+  iteratorBetas_sym,
+  dims_sym,
+  prob_sym,
+  ADelta0_sym,
+  meanDelta0_sym,
+
+  mean_sym,
+  sd_sym,
+
+  tolerance_sym,
+  betaIsPredicted_sym,
+  nFailedPropTheta_sym,
+  nFailedPropYStar_sym,
+  maxAttempt_sym,
+  valueAg_sym,
+  weightAg_sym,
+  transformAg_sym,
+  meanAg_sym,
+  sdAg_sym,
+  scaleAg_sym,
+  nAcceptAg_sym,
+  nFailedPropValueAg_sym,
+  funAg_sym,
+  xArgsAg_sym,
+  weightsArgsAg_sym,
+  mxAg_sym,
+  axAg_sym,
+  nxAg_sym,
+  nAgeAg_sym,
+  transformThetaToMxAg_sym,
+  subtotals_sym,
+  transformSubtotals_sym,
+  subtotalsNet_sym,
+  slotsToExtract_sym,
+  iMethodCombined_sym,
+  model_sym,
+  exposure_sym,
+  y_sym,
+  dataModels_sym,
+  datasets_sym,
+  transforms_sym,
+  seriesIndices_sym,
+  updateComponent_sym,
+  updateDataModel_sym,
+  updateSystemModel_sym,
+
+  J_sym,
+
+  UC_sym,
+  DC_sym,
+  UR_sym,
+  DCInv_sym,
+  DRInv_sym,
+  CC_sym,
+  a_sym,
+  R_sym,
+  priorsW_sym,
+  v_sym,
+  forward_sym,
+  offsetsBetas_sym,
+  offsetsPriorsBetas_sym,
+  offsetsSigma_sym,
+  offsetsVarsigma_sym,
+  m0_sym,
+  C0_sym,
+  phi_sym,
+  w_sym,
+  iteratorGamma_sym,
+  iteratorV_sym,
+  delta_sym,
+  phiKnown_sym,
+  /* description */
+  nTime_sym,
+  stepTime_sym,
+  hasAge_sym,
+  hasSex_sym,
+  iSexDominant_sym,
+  stepSexCurrent_sym,
+  stepSexTarget_sym,
+  nAge_sym,
+  stepAge_sym,
+  length_sym,
+  stepTriangle_sym,
+  stepDirection_sym,
+  nBetweenVec_sym,
+  stepBetweenVec_sym,
+  nWithinVec_sym,
+  stepWithinVec_sym,
+  /* cohort iterators */
+  i_sym,
+  iTime_sym,
+  iAge_sym,
+  iTriangle_sym,
+  finished_sym,
+  iVec_sym,
+  lengthVec_sym,
+  increment_sym,
+  lastAgeGroupOpen_sym,
+  /* mappings */
+  hasParCh_sym,
+  isOneToOne_sym,
+  nSharedVec_sym,
+  stepSharedCurrentVec_sym,
+  stepSharedCurrentExposureVec_sym,
+  stepSharedTargetVec_sym,
+  nTimeCurrent_sym,
+  stepTimeCurrent_sym,
+  stepTimeTarget_sym,
+  nAgeCurrent_sym,
+  nAgeTarget_sym,
+  stepAgeCurrent_sym,
+  stepAgeTarget_sym,
+  stepTriangleCurrent_sym,
+  stepTriangleTarget_sym,
+  nOrigDestVec_sym,
+  stepOrigCurrentVec_sym,
+  stepDestCurrentVec_sym,
+  stepOrigDestTargetVec_sym,
+  iMinAge_sym,
+
+  /*new priors*/
+  ATau_sym,
+  nuTau_sym,
+  hasAlphaDLM_sym,
+  hasAlphaICAR_sym,
+  hasAlphaMix_sym,
+  hasCovariates_sym,
+  hasAlphaKnown_sym,
+  hasMean_sym,
+  hasSeason_sym,
+  isKnownUncertain_sym,
+  isNorm_sym,
+  isRobust_sym,
+  isZeroVar_sym,
+  alphaDLM_sym,
+  alphaICAR_sym,
+  alphaMix_sym,
+  iteratorState_sym,
+  iteratorStateOld_sym,
+  K_sym,
+  L_sym,
+  s_sym,
+  UBeta_sym,
+  nuBeta_sym,
+  isSaturated_sym,
+  allStrucZero_sym,
+  alongAllStrucZero_sym,
+  strucZeroArray_sym,
+  mNoTrend_sym,
+  m0NoTrend_sym,
+  CNoTrend_sym,
+  aNoTrend_sym,
+  RNoTrend_sym,
+  GWithTrend_sym,
+  mWithTrend_sym,
+  m0WithTrend_sym,
+  CWithTrend_sym,
+  aWithTrend_sym,
+  hasLevel_sym,
+  omegaAlpha_sym,
+  omegaAlphaMax_sym,
+  AAlpha_sym,
+  nuAlpha_sym,
+  deltaDLM_sym,
+  omegaDelta_sym,
+  omegaDeltaMax_sym,
+  nuDelta_sym,
+  ADelta_sym,
+  minPhi_sym,
+  maxPhi_sym,
+  shape1Phi_sym,
+  shape2Phi_sym,
+  WSqrt_sym,
+  WSqrtInvG_sym,
+  exposureAg_sym,
+  P_sym,
+  AEtaIntercept_sym,
+  AEtaCoef_sym,
+  nuEtaCoef_sym,
+  meanEtaCoef_sym,
+  UEtaCoef_sym,
+  nSeason_sym,
+  ASeason_sym,
+  omegaSeason_sym,
+  omegaSeasonMax_sym,
+  nuSeason_sym,
+  mSeason_sym,
+  m0Season_sym,
+  CSeason_sym,
+  aSeason_sym,
+  RSeason_sym,
+  JOld_sym,
+  /* new priors Jan 2017 */
+  sumsWeightsMix_sym,
+  weightMix_sym,
+  latentWeightMix_sym,
+  foundIndexClassMaxPossibleMix_sym,
+  indexClassMaxPossibleMix_sym,
+  indexClassProbMix_sym,
+  componentWeightMix_sym,
+  latentComponentWeightMix_sym,
+  levelComponentWeightMix_sym,
+  levelComponentWeightOldMix_sym,
+  meanLevelComponentWeightMix_sym,
+  indexClassMix_sym,
+  indexClassMaxMix_sym,
+  indexClassMaxUsedMix_sym,
+  omegaComponentWeightMix_sym,
+  omegaComponentWeightMaxMix_sym,
+  omegaLevelComponentWeightMix_sym,
+  omegaLevelComponentWeightMaxMix_sym,
+  iteratorsDimsMix_sym,
+  iAlong_sym,
+  dimBeta_sym,
+  dimBetaOld_sym,
+  phiMix_sym,
+  mMix_sym,
+  CMix_sym,
+  aMix_sym,
+  RMix_sym,
+  prodVectorsMix_sym,
+  posProdVectors1Mix_sym,
+  posProdVectors2Mix_sym,
+  nBetaNoAlongMix_sym,
+  vectorsMix_sym,
+  omegaVectorsMix_sym,
+  iteratorProdVectorMix_sym,
+  yXMix_sym,
+  XXMix_sym,
+  priorMeanLevelComponentWeightMix_sym,
+  priorSDLevelComponentWeightMix_sym,
+  AComponentWeightMix_sym,
+  nuComponentWeightMix_sym,
+  omegaVectorsMix_sym,
+  omegaVectorsMaxMix_sym,
+  AVectorsMix_sym,
+  nuVectorsMix_sym,
+  minLevelComponentWeight_sym,
+  maxLevelComponentWeight_sym,
+  updateSeriesDLM_sym,
+  ALevelComponentWeightMix_sym,
+  nuLevelComponentWeightMix_sym,
+
+  nuCMP_sym,
+  sdLogNuCMP_sym,
+  sdLogNuMaxCMP_sym,
+  meanMeanLogNuCMP_sym,
+  sdMeanLogNuCMP_sym,
+  meanLogNuCMP_sym,
+  ASDLogNuCMP_sym,
+  nuSDLogNuCMP_sym,
+  nu_sym,
+
+  alphaKnown_sym,
+  AKnownVec_sym,
+
+  /* skeleton */
+  first_sym,
+  last_sym,
+
+  /* Box-Cox */
+  boxCoxParam_sym,
+
+  /* accounts  and combined accounts*/
+  account_sym,
+  population_sym,
+  accession_sym,
+  components_sym,
+  descriptions_sym,
+  iteratorPopn_sym,
+  iteratorAcc_sym,
+  iteratorExposure_sym,
+  transformsExpToComp_sym,
+  transformExpToBirths_sym,
+  iCell_sym,
+  iCellOther_sym,
+  iComp_sym,
+  iPopnNext_sym,
+  iPopnNextOther_sym,
+  iAccNext_sym,
+  iAccNextOther_sym,
+  iOrigDest_sym,
+  iPool_sym,
+  iIntNet_sym,
+  iBirths_sym,
+  iParCh_sym,
+  diffProp_sym,
+  isIncrement_sym,
+  isNet_sym,
+  scaleNoise_sym,
+  usePriorPopn_sym,
+  systemModels_sym,
+  modelUsesExposure_sym,
+  mappingsFromExp_sym,
+  mappingsToExp_sym,
+  mappingsToPopn_sym,
+  mappingsToAcc_sym,
+  iExpFirst_sym,
+  iExpFirstOther_sym,
+  ageTimeStep_sym,
+  iteratorsComp_sym,
+  expectedExposure_sym,
+  iExposure_sym,
+  iExposureOther_sym,
+  isLowerTriangle_sym,
+  isOldestAgeGroup_sym,
+  generatedNewProposal_sym,
+  probSmallUpdate_sym,
+  isSmallUpdate_sym,
+  isSmallUpdateFinal_sym,
+  probPopn_sym,
+  cumProbComp_sym,
+  nCellAccount_sym,
+  /* LN@ */
+  alphaLN2_sym,
+  transformLN2_sym,
+  constraintLN2_sym,
+  nCellBeforeLN2_sym;
+
+extern SEXP (*dembase_Collapse_R)(SEXP ,SEXP);
+extern SEXP (*dembase_Extend_R)(SEXP ,SEXP);
+extern int (*dembase_getIAfter)(int, SEXP);
+extern SEXP (*dembase_getIBefore)(int, SEXP);
+extern SEXP (*dembase_getIShared)(int, SEXP);
+
+
+/* ******************************************************************************** */
+/* Segment trees ****************************************************************** */
+/* ******************************************************************************** */
+
+/* A tree over positions 'lo' to 'hi' of a chain is stored
+   in 'tree' and 'add', with the root at node 1, and the
+   children of node k at nodes 2k and 2k+1. 'add[k]' is an
+   amount that has been added to every position below node
+   k, and 'tree[k]' is the minimum over those positions,
+   including 'add[k]' but not additions made higher up. */
+
+static int
+buildTree(int *tree, int *add, int node, int lo, int hi, int *values)
+{
+    add[node] = 0;
+    if (lo == hi) {
+        tree[node] = values[lo];
+    }
+    else {
+        int mid = (lo + hi) / 2;
+        int left = buildTree(tree, add, 2 * node, lo, mid, values);
+        int right = buildTree(tree, add, 2 * node + 1, mid + 1, hi, values);
+        tree[node] = (left < right) ? left : right;
+    }
+    return tree[node];
+}
+
+static void
+addToTree(int *tree, int *add, int node, int lo, int hi,
+          int from, int to, int diff)
+{
+    if ((to < lo) || (hi < from))
+        return;
+    if ((from <= lo) && (hi <= to)) {
+        tree[node] += diff;
+        add[node] += diff;
+        return;
+    }
+    int mid = (lo + hi) / 2;
+    addToTree(tree, add, 2 * node, lo, mid, from, to, diff);
+    addToTree(tree, add, 2 * node + 1, mid + 1, hi, from, to, diff);
+    int left = tree[2 * node];
+    int right = tree[2 * node + 1];
+    tree[node] = ((left < right) ? left : right) + add[node];
+}
+
+/* at least one position from 'from' to 'to' must lie
+   between 'lo' and 'hi' */
+static int
+minOfTree(int *tree, int *add, int node, int lo, int hi, int from, int to)
+{
+    if ((from <= lo) && (hi <= to))
+        return tree[node];
+    int mid = (lo + hi) / 2;
+    int ans;
+    if (to <= mid)
+        ans = minOfTree(tree, add, 2 * node, lo, mid, from, to);
+    else if (from > mid)
+        ans = minOfTree(tree, add, 2 * node + 1, mid + 1, hi, from, to);
+    else {
+        int left = minOfTree(tree, add, 2 * node, lo, mid, from, to);
+        int right = minOfTree(tree, add, 2 * node + 1, mid + 1, hi, from, to);
+        ans = (left < right) ? left : right;
+    }
+    return ans + add[node];
+}
+
+
+/* ******************************************************************************** */
+/* Chains ************************************************************************* */
+/* ******************************************************************************** */
+
+typedef struct CohortChains {
+    int nChain;
+    int *start;   /* first node of each chain's tree in 'tree' and 'add' */
+    int *length;  /* number of cells in each chain */
+    int *chainOf; /* chain that each cell belongs to, or -1 */
+    int *posOf;   /* position of each cell within its chain */
+    int *tree;
+    int *add;
+} CohortChains;
+
+typedef struct CohortSeries {
+    int *series; /* NULL if nothing cached */
+    int nCell;
+    int stepTime;
+    int nTime;
+    int hasAge;
+    int stepAge;
+    int nAge;
+    CohortChains diag; /* along time and age, nChain is 0 if no age */
+    CohortChains row;  /* along time, in oldest age group if has age */
+} CohortSeries;
+
+static CohortSeries cachedPopn;
+static CohortSeries cachedAcc;
+/* accession subtracted from oldest age group of population */
+static int *cachedPopnAccession = NULL;
+/* population and accession objects, preserved while cached,
+   so that their data cannot be freed and the memory reused
+   for another series */
+static SEXP cachedPopnObject = NULL;
+static SEXP cachedAccObject = NULL;
+
+/* 'i' is C-style, and the result is -1 if 'i' is the end of a chain */
+static int
+nextCellInChain(CohortSeries *s, int isDiag, int i)
+{
+    int iTime = (i / s->stepTime) % s->nTime;
+    if (iTime == s->nTime - 1)
+        return -1;
+    if (isDiag) {
+        int iAge = (i / s->stepAge) % s->nAge;
+        if (iAge == s->nAge - 1)
+            return -1;
+        return i + s->stepTime + s->stepAge;
+    }
+    return i + s->stepTime;
+}
+
+static int
+isStartOfChain(CohortSeries *s, int isDiag, int i)
+{
+    int iTime = (i / s->stepTime) % s->nTime;
+    if (isDiag) {
+        int iAge = (i / s->stepAge) % s->nAge;
+        return (iTime == 0) || (iAge == 0);
+    }
+    if (s->hasAge) {
+        int iAge = (i / s->stepAge) % s->nAge;
+        return (iTime == 0) && (iAge == s->nAge - 1);
+    }
+    return (iTime == 0);
+}
+
+/* 'values' gives the value for each cell of the series */
+static void
+makeChains(CohortChains *chains, CohortSeries *s, int isDiag, int *values)
+{
+    int nCell = s->nCell;
+    int *first = R_Calloc(nCell, int);
+    int *length = R_Calloc(nCell, int);
+    int *chainOf = R_Calloc(nCell, int);
+    int *posOf = R_Calloc(nCell, int);
+    int nChain = 0;
+    for (int i = 0; i < nCell; ++i)
+        chainOf[i] = -1;
+    for (int i = 0; i < nCell; ++i) {
+        if (!isStartOfChain(s, isDiag, i))
+            continue;
+        int n = 0;
+        for (int j = i; j >= 0; j = nextCellInChain(s, isDiag, j)) {
+            chainOf[j] = nChain;
+            posOf[j] = n;
+            ++n;
+        }
+        first[nChain] = i;
+        length[nChain] = n;
+        ++nChain;
+    }
+    int *start = R_Calloc(nChain + 1, int);
+    int nNode = 0;
+    for (int c = 0; c < nChain; ++c) {
+        int size = 1;
+        while (size < length[c])
+            size *= 2;
+        start[c] = nNode;
+        nNode += 2 * size;
+    }
+    int *tree = R_Calloc(nNode + 1, int);
+    int *add = R_Calloc(nNode + 1, int);
+    int *chainValues = R_Calloc(s->nTime, int);
+    for (int c = 0; c < nChain; ++c) {
+        int n = 0;
+        for (int j = first[c]; j >= 0; j = nextCellInChain(s, isDiag, j)) {
+            chainValues[n] = values[j];
+            ++n;
+        }
+        buildTree(tree + start[c], add + start[c], 1, 0, length[c] - 1, chainValues);
+    }
+    R_Free(chainValues);
+    R_Free(first);
+    chains->nChain = nChain;
+    chains->start = start;
+    chains->length = length;
+    chains->chainOf = chainOf;
+    chains->posOf = posOf;
+    chains->tree = tree;
+    chains->add = add;
+}
+
+static void
+freeChains(CohortChains *chains)
+{
+    if (chains->chainOf) {
+        R_Free(chains->start);
+        R_Free(chains->length);
+        R_Free(chains->chainOf);
+        R_Free(chains->posOf);
+        R_Free(chains->tree);
+        R_Free(chains->add);
+    }
+    memset(chains, 0, sizeof(CohortChains));
+}
+
+/* minimum from cell 'i' (C-style) to end of its chain */
+static int
+minRestOfChain(CohortChains *chains, int i)
+{
+    int c = chains->chainOf[i];
+    int n = chains->length[c];
+    int offset = chains->start[c];
+    return minOfTree(chains->tree + offset, chains->add + offset, 1, 0, n - 1,
+                     chains->posOf[i], n - 1);
+}
+
+/* add 'diff' from cell 'i' (C-style) to end of its chain,
+   or just to cell 'i', if 'toEnd' is false. Does nothing if
+   'i' does not belong to a chain. */
+static void
+addToChain(CohortChains *chains, int i, int diff, int toEnd)
+{
+    if (!chains->chainOf)
+        return;
+    int c = chains->chainOf[i];
+    if (c < 0)
+        return;
+    int n = chains->length[c];
+    int offset = chains->start[c];
+    int pos = chains->posOf[i];
+    addToTree(chains->tree + offset, chains->add + offset, 1, 0, n - 1,
+              pos, toEnd ? (n - 1) : pos, diff);
+}
+
+/* C-style index of accession cell for population cell 'i',
+   which must not be in the first time period */
+static int
+getIAccFromIPopn(int i)
+{
+    int stepTime = cachedPopn.stepTime;
+    int nTimePopn = cachedPopn.nTime;
+    int nTimeAcc = nTimePopn - 1;
+    return (i % (stepTime * nTimePopn)
+            - stepTime
+            + (i / (stepTime * nTimePopn)) * (stepTime * nTimeAcc));
+}
+
+/* inverse of 'getIAccFromIPopn' */
+static int
+getIPopnFromIAcc(int i)
+{
+    int stepTime = cachedPopn.stepTime;
+    int nTimePopn = cachedPopn.nTime;
+    int nTimeAcc = nTimePopn - 1;
+    return (i % (stepTime * nTimeAcc)
+            + stepTime
+            + (i / (stepTime * nTimeAcc)) * (stepTime * nTimePopn));
+}
+
+/* record a change of 'diff' in accession cell 'i' in the
+   population trees, which use population minus accession
+   in the oldest age group */
+static void
+noteAccessionChangeInPopn(int i, int diff)
+{
+    int iPopn = getIPopnFromIAcc(i);
+    int iAge = (iPopn / cachedPopn.stepAge) % cachedPopn.nAge;
+    if (iAge == cachedPopn.nAge - 1)
+        addToChain(&cachedPopn.diag, iPopn, -diff, 0);
+}
+
+
+/* ******************************************************************************** */
+/* Cache ************************************************************************** */
+/* ******************************************************************************** */
+
+void
+beginCohortMinCache(SEXP combined_R)
+{
+    SEXP account_R = GET_SLOT(combined_R, account_sym);
+    SEXP population_R = GET_SLOT(account_R, population_sym);
+    SEXP iteratorPopn_R = GET_SLOT(combined_R, iteratorPopn_sym);
+    int hasAge = *LOGICAL(GET_SLOT(iteratorPopn_R, hasAge_sym));
+    if (hasAge)
+        beginCohortMinCacheSeries(population_R,
+                                  GET_SLOT(combined_R, accession_sym),
+                                  iteratorPopn_R,
+                                  GET_SLOT(combined_R, iteratorAcc_sym));
+    else
+        beginCohortMinCacheSeries(population_R, R_NilValue, iteratorPopn_R,
+                                  R_NilValue);
+}
+
+/* As for 'beginCohortMinCache', but taking the population
+   and accession, and their cohort iterators, directly.
+   'accession_R' and 'iteratorAcc_R' are only used if the
+   population has age. */
+void
+beginCohortMinCacheSeries(SEXP population_R, SEXP accession_R,
+                          SEXP iteratorPopn_R, SEXP iteratorAcc_R)
+{
+    endCohortMinCache();
+
+    int *population = INTEGER(population_R);
+    int nCellPopn = LENGTH(population_R);
+    int hasAge = *LOGICAL(GET_SLOT(iteratorPopn_R, hasAge_sym));
+
+    if (nCellPopn == 0)
+        return;
+
+    R_PreserveObject(population_R);
+    cachedPopnObject = population_R;
+
+    cachedPopn.nCell = nCellPopn;
+    cachedPopn.stepTime = *INTEGER(GET_SLOT(iteratorPopn_R, stepTime_sym));
+    cachedPopn.nTime = *INTEGER(GET_SLOT(iteratorPopn_R, nTime_sym));
+    cachedPopn.hasAge = hasAge;
+
+    if (hasAge) {
+        int *accession = INTEGER(accession_R);
+        int nCellAcc = LENGTH(accession_R);
+
+        R_PreserveObject(accession_R);
+        cachedAccObject = accession_R;
+
+        cachedPopn.stepAge = *INTEGER(GET_SLOT(iteratorPopn_R, stepAge_sym));
+        cachedPopn.nAge = *INTEGER(GET_SLOT(iteratorPopn_R, nAge_sym));
+        int *values = R_Calloc(nCellPopn, int);
+        for (int i = 0; i < nCellPopn; ++i) {
+            int iTime = (i / cachedPopn.stepTime) % cachedPopn.nTime;
+            int iAge = (i / cachedPopn.stepAge) % cachedPopn.nAge;
+            values[i] = population[i];
+            if ((iAge == cachedPopn.nAge - 1) && (iTime > 0))
+                values[i] -= accession[getIAccFromIPopn(i)];
+        }
+        makeChains(&cachedPopn.diag, &cachedPopn, 1, values);
+        R_Free(values);
+        cachedPopn.series = population;
+        cachedPopnAccession = accession;
+
+        if (nCellAcc > 0) {
+            cachedAcc.nCell = nCellAcc;
+            cachedAcc.stepTime = *INTEGER(GET_SLOT(iteratorAcc_R, stepTime_sym));
+            cachedAcc.nTime = *INTEGER(GET_SLOT(iteratorAcc_R, nTime_sym));
+            cachedAcc.hasAge = 1;
+            cachedAcc.stepAge = *INTEGER(GET_SLOT(iteratorAcc_R, stepAge_sym));
+            cachedAcc.nAge = *INTEGER(GET_SLOT(iteratorAcc_R, nAge_sym));
+            makeChains(&cachedAcc.diag, &cachedAcc, 1, accession);
+            makeChains(&cachedAcc.row, &cachedAcc, 0, accession);
+            cachedAcc.series = accession;
+        }
+    }
+    else {
+        makeChains(&cachedPopn.row, &cachedPopn, 0, population);
+        cachedPopn.series = population;
+    }
+}
+
+void
+endCohortMinCache(void)
+{
+    freeChains(&cachedPopn.diag);
+    freeChains(&cachedPopn.row);
+    freeChains(&cachedAcc.diag);
+    freeChains(&cachedAcc.row);
+    memset(&cachedPopn, 0, sizeof(CohortSeries));
+    memset(&cachedAcc, 0, sizeof(CohortSeries));
+    cachedPopnAccession = NULL;
+    if (cachedPopnObject) {
+        R_ReleaseObject(cachedPopnObject);
+        cachedPopnObject = NULL;
+    }
+    if (cachedAccObject) {
+        R_ReleaseObject(cachedAccObject);
+        cachedAccObject = NULL;
+    }
+}
+
+/* Equivalent to 'getMinValCohortPopulationHasAge' or
+   'getMinValCohortPopulationNoAge', starting from
+   cell 'i_r'. Returns 0 if 'population' (and, if the
+   population has age, 'accession') is not cached,
+   and otherwise puts the value in 'ans' and returns 1. */
+int
+findCohortMinPopulation(int *ans, int i_r, int *population, int *accession)
+{
+    if (!cachedPopn.series || (population != cachedPopn.series))
+        return 0;
+    if (cachedPopn.hasAge) {
+        if (accession != cachedPopnAccession)
+            return 0;
+        *ans = minRestOfChain(&cachedPopn.diag, i_r - 1);
+    }
+    else {
+        *ans = minRestOfChain(&cachedPopn.row, i_r - 1);
+    }
+    return 1;
+}
+
+/* Equivalent to 'getMinValCohortAccession', starting from
+   cell 'i_r'. Return value as for 'findCohortMinPopulation'. */
+int
+findCohortMinAccession(int *ans, int i_r, int *accession)
+{
+    if (!cachedAcc.series || (accession != cachedAcc.series))
+        return 0;
+    CohortSpan span;
+    makeCohortSpan(&span, i_r, cachedAcc.stepTime, cachedAcc.nTime,
+                   1, cachedAcc.stepAge, cachedAcc.nAge);
+    int minVal = minRestOfChain(&cachedAcc.diag, span.i);
+    int reachesOldestAge = (span.iAge + span.nStepAged == span.nAge);
+    if (reachesOldestAge) {
+        int iOldest = span.i + span.nStepAged * span.strideAged;
+        int minOldest = minRestOfChain(&cachedAcc.row, iOldest);
+        if (minOldest < minVal)
+            minVal = minOldest;
+    }
+    *ans = minVal;
+    return 1;
+}
+
+/* Record that element 'i' (C-style) of 'series' has
+   changed by 'diff'. Does nothing unless 'series' is
+   the cached population or accession. */
+void
+noteCohortCellChange(int *series, int i, int diff)
+{
+    if (!series)
+        return;
+    if (series == cachedPopn.series) {
+        if (cachedPopn.hasAge)
+            addToChain(&cachedPopn.diag, i, diff, 0);
+        else
+            addToChain(&cachedPopn.row, i, diff, 0);
+    }
+    if (series == cachedAcc.series) {
+        addToChain(&cachedAcc.diag, i, diff, 0);
+        addToChain(&cachedAcc.row, i, diff, 0);
+    }
+    if (cachedPopn.series && (series == cachedPopnAccession))
+        noteAccessionChangeInPopn(i, diff);
+}
+
+/* Record that every element of 'series' along the cohort
+   starting at element 'i' (C-style), as visited by a
+   population or accession cohort iterator, has changed
+   by 'diff'. */
+void
+noteCohortPathChange(int *series, int i, int diff)
+{
+    if (!series)
+        return;
+    if (series == cachedPopn.series) {
+        if (cachedPopn.hasAge) {
+            CohortSpan span;
+            makeCohortSpan(&span, i + 1, cachedPopn.stepTime, cachedPopn.nTime,
+                           1, cachedPopn.stepAge, cachedPopn.nAge);
+            addToChain(&cachedPopn.diag, i, diff, 1);
+            /* after reaching the oldest age group, each cell
+               is the last cell of a different diagonal */
+            int iOldest = span.i + span.nStepAged * span.strideAged;
+            for (int k = span.nStepAged; k < span.nStep; ++k) {
+                iOldest += span.strideTime;
+                addToChain(&cachedPopn.diag, iOldest, diff, 0);
+            }
+        }
+        else {
+            addToChain(&cachedPopn.row, i, diff, 1);
+        }
+    }
+    if (series == cachedAcc.series) {
+        CohortSpan span;
+        makeCohortSpan(&span, i + 1, cachedAcc.stepTime, cachedAcc.nTime,
+                       1, cachedAcc.stepAge, cachedAcc.nAge);
+        addToChain(&cachedAcc.diag, i, diff, 1);
+        int reachesOldestAge = (span.iAge + span.nStepAged == span.nAge);
+        if (reachesOldestAge) {
+            int iOldest = span.i + span.nStepAged * span.strideAged;
+            int updatePopn = (cachedPopn.series && (series == cachedPopnAccession));
+            addToChain(&cachedAcc.row, iOldest, diff, 1);
+            for (int k = span.nStepAged; k <= span.nStep; ++k) {
+                /* the first of these cells is the last cell of the
+                   diagonal that starts at 'i', and the others are
+                   the last cells of different diagonals */
+                if (k > span.nStepAged)
+                    addToChain(&cachedAcc.diag, iOldest, diff, 0);
+                if (updatePopn)
+                    noteAccessionChangeInPopn(iOldest, diff);
+                iOldest += span.strideTime;
+            }
+        }
+    }
+}
+
+
+/* ******************************************************************************** */
+/* Functions called from R ******************************************************** */
+/* ******************************************************************************** */
+
+/* Apply a sequence of changes to copies of 'population_R'
+   and 'accession_R', reporting them to the cache, and
+   return a list with the cohort minimums for each cell
+   found using the cache ("cached") and by scanning the
+   cohorts after the cache has ended ("scanned"). Cells
+   of the population come first, then cells of the
+   accession. Change 'k' adds 'diff_R[k]' to cell 'i_R[k]'
+   (R-style) of the accession if 'isAcc_R[k]' is true, and
+   of the population otherwise, or, if 'isPath_R[k]' is
+   true, to every cell of the cohort starting there.
+   Cells where the scan is not defined are NA. Used to
+   test the cache. */
+SEXP
+findCohortMinAfterChanges_R(SEXP population_R, SEXP accession_R,
+                            SEXP iteratorPopn_R, SEXP iteratorAcc_R,
+                            SEXP isAcc_R, SEXP isPath_R, SEXP i_R, SEXP diff_R)
+{
+    int hasAge = *LOGICAL(GET_SLOT(iteratorPopn_R, hasAge_sym));
+    PROTECT(population_R = duplicate(population_R));
+    if (hasAge)
+        PROTECT(accession_R = duplicate(accession_R));
+    else
+        PROTECT(accession_R = allocVector(INTSXP, 0));
+    int *population = INTEGER(population_R);
+    int *accession = INTEGER(accession_R);
+    int nCellPopn = LENGTH(population_R);
+    int nCellAcc = LENGTH(accession_R);
+    int *isAcc = LOGICAL(isAcc_R);
+    int *isPath = LOGICAL(isPath_R);
+    int *iVec = INTEGER(i_R);
+    int *diffVec = INTEGER(diff_R);
+    int nChange = LENGTH(i_R);
+
+    /* population cells in the oldest age group in the first
+       period have no accession to subtract, so the scan is
+       not defined for them */
+    int *hasScan = (int *)R_alloc(nCellPopn, sizeof(int));
+    for (int i = 0; i < nCellPopn; ++i)
+        hasScan[i] = 1;
+    if (hasAge) {
+        int stepTime = *INTEGER(GET_SLOT(iteratorPopn_R, stepTime_sym));
+        int nTime = *INTEGER(GET_SLOT(iteratorPopn_R, nTime_sym));
+        int stepAge = *INTEGER(GET_SLOT(iteratorPopn_R, stepAge_sym));
+        int nAge = *INTEGER(GET_SLOT(iteratorPopn_R, nAge_sym));
+        for (int i = 0; i < nCellPopn; ++i) {
+            int iTime = (i / stepTime) % nTime;
+            int iAge = (i / stepAge) % nAge;
+            hasScan[i] = (iTime > 0) || (iAge < nAge - 1);
+        }
+    }
+
+    SEXP ans_R, cached_R, scanned_R, names_R;
+    PROTECT(ans_R = allocVector(VECSXP, 2));
+    PROTECT(cached_R = allocVector(INTSXP, nCellPopn + nCellAcc));
+    PROTECT(scanned_R = allocVector(INTSXP, nCellPopn + nCellAcc));
+    PROTECT(names_R = allocVector(STRSXP, 2));
+    int *cached = INTEGER(cached_R);
+    int *scanned = INTEGER(scanned_R);
+
+    beginCohortMinCacheSeries(population_R, accession_R, iteratorPopn_R, iteratorAcc_R);
+
+    for (int k = 0; k < nChange; ++k) {
+        int *series = isAcc[k] ? accession : population;
+        int diff = diffVec[k];
+        if (isPath[k]) {
+            CohortSpan span;
+            if (isAcc[k])
+                makeCohortSpanCA(&span, iteratorAcc_R, iVec[k]);
+            else
+                makeCohortSpanCP(&span, iteratorPopn_R, iVec[k]);
+            int i = span.i;
+            noteCohortPathChange(series, i, diff);
+            for (int j = 0; j <= span.nStep; ++j) {
+                series[i] += diff;
+                if (j < span.nStep)
+                    i += cohortSpanStride(&span, j);
+            }
+        }
+        else {
+            int i = iVec[k] - 1;
+            series[i] += diff;
+            noteCohortCellChange(series, i, diff);
+        }
+    }
+
+    for (int i = 0; i < nCellPopn; ++i) {
+        cached[i] = NA_INTEGER;
+        if (hasScan[i])
+            findCohortMinPopulation(cached + i, i + 1, population,
+                                    hasAge ? accession : NULL);
+    }
+    for (int i = 0; i < nCellAcc; ++i) {
+        cached[nCellPopn + i] = NA_INTEGER;
+        findCohortMinAccession(cached + nCellPopn + i, i + 1, accession);
+    }
+
+    endCohortMinCache();
+
+    for (int i = 0; i < nCellPopn; ++i) {
+        if (!hasScan[i])
+            scanned[i] = NA_INTEGER;
+        else if (hasAge)
+            scanned[i] = getMinValCohortPopulationHasAge(i + 1, population_R,
+                                                         accession_R, iteratorPopn_R);
+        else
+            scanned[i] = getMinValCohortPopulationNoAge(i + 1, population_R,
+                                                        iteratorPopn_R);
+    }
+    for (int i = 0; i < nCellAcc; ++i)
+        scanned[nCellPopn + i] = getMinValCohortAccession(i + 1, accession_R,
+                                                          iteratorAcc_R);
+
+    SET_VECTOR_ELT(ans_R, 0, cached_R);
+    SET_VECTOR_ELT(ans_R, 1, scanned_R);
+    SET_STRING_ELT(names_R, 0, mkChar("cached"));
+    SET_STRING_ELT(names_R, 1, mkChar("scanned"));
+    setAttrib(ans_R, R_NamesSymbol, names_R);
+    UNPROTECT(6);
+    return ans_R;
+}
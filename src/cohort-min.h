@@ -0,0 +1,41 @@
+#ifndef __COHORT_MIN_H__
+#define __COHORT_MIN_H__
+
+    #include <Rinternals.h>
+
+    /* Minimum values along cohorts, for account proposals.
+     *
+     * The lowest value a proposal can take is limited by the
+     * smallest population or accession in the rest of the
+     * cohort. Rather than walking the cohort each time, the
+     * cells of the population and accession series are split
+     * into chains that cohorts follow: diagonals, along which
+     * time and age both increase, and, where cohorts continue
+     * in the oldest age group, rows along time. Each chain has
+     * a segment tree over its values, so that the minimum of
+     * the rest of a chain can be found, and a change to the
+     * rest of a chain recorded, in O(log n) steps.
+     *
+     * The trees are built for the population and accession of
+     * a combined account object by 'beginCohortMinCache', and
+     * are used by the 'getMinValCohort' functions until
+     * 'endCohortMinCache' is called. All changes to the
+     * population and accession in between must be reported
+     * through 'noteCohortCellChange' or 'noteCohortPathChange'.
+     * Memory is allocated using R_Calloc, and the population
+     * and accession are preserved until 'endCohortMinCache',
+     * which callers must make sure runs even if an update
+     * fails. 'beginCohortMinCache' ends any earlier cache. */
+    void beginCohortMinCache(SEXP combined_R);
+    void beginCohortMinCacheSeries(SEXP population_R, SEXP accession_R,
+                                   SEXP iteratorPopn_R, SEXP iteratorAcc_R);
+    void endCohortMinCache(void);
+
+    int findCohortMinPopulation(int *ans, int i_r, int *population,
+                                int *accession);
+    int findCohortMinAccession(int *ans, int i_r, int *accession);
+
+    void noteCohortCellChange(int *series, int i, int diff);
+    void noteCohortPathChange(int *series, int i, int diff);
+
+#endif
@@ -617,8 +617,10 @@ void updateCombined_CombinedModelCMPNotHasExp(SEXP object_R, int nUpdate);
 void updateCombined_CombinedModelCMPHasExp(SEXP object_R, int nUpdate);
 void updateCombined_CombinedAccount(SEXP object_R, int nUpdate);
 void updateCombined(SEXP object_R, int nUpdate);
+void setAdaptingTheta(int adapting);
 
 void updateProposalAccount_CombinedAccountMovements(SEXP object_R);
+void updateProposalAccountComp_CombinedAccountMovements(SEXP object_R);
 void updateProposalAccount(SEXP object_R);
 double diffLogLikAccount_CombinedAccountMovements(SEXP object_R);
 double diffLogLikAccount(SEXP object_R);
@@ -644,6 +646,58 @@ void estimateOneChain(SEXP object_R, SEXP filename_R,
                 SEXP nBurnin_R, SEXP nSim_R, SEXP nThin_R,
                 SEXP continuing);
 
+/* counter-based random numbers */
+SEXP setCounterRNG_R(SEXP useCounter_R, SEXP seed_R);
+SEXP setCounterRNGThreads_R(SEXP nThread_R);
+SEXP setCounterRNGThreadsMax_R(SEXP nThreadMax_R);
+SEXP nCounterRNGThreads_R(void);
+SEXP counterRNGThreadsUsed_R(void);
+
+/* differences in Poisson and binomial log densities */
+SEXP diffLogDensPois_R(SEXP xProp_R, SEXP lambdaProp_R, SEXP xCurr_R,
+                       SEXP lambdaCurr_R);
+SEXP diffLogDensPoisCount_R(SEXP xProp_R, SEXP xCurr_R, SEXP lambda_R);
+SEXP diffLogDensPoisLambda_R(SEXP x_R, SEXP lambdaProp_R, SEXP lambdaCurr_R);
+SEXP diffLogDensBinomSize_R(SEXP x_R, SEXP sizeProp_R, SEXP sizeCurr_R,
+                            SEXP prob_R);
+
+/* account batches */
+SEXP diffLogAccountBatch_R(SEXP combined_R, SEXP iCell_R, SEXP diffProp_R);
+
+/* cohort minimums */
+SEXP findCohortMinAfterChanges_R(SEXP population_R, SEXP accession_R,
+                                 SEXP iteratorPopn_R, SEXP iteratorAcc_R,
+                                 SEXP isAcc_R, SEXP isPath_R, SEXP i_R,
+                                 SEXP diff_R);
+
+/* checkpoints */
+SEXP writeCheckpoint_R(SEXP combined_R, SEXP filename_R, SEXP progress_R);
+SEXP readCheckpoint_R(SEXP combined_R, SEXP filename_R);
+SEXP readCheckpointProgress_R(SEXP filename_R);
+
+/* chain writers */
+SEXP openChainWriter_R(SEXP filename_R, SEXP combined_R, SEXP append_R,
+                       SEXP nIterSummary_R, SEXP singlePrecision_R);
+SEXP makeValueTypes_R(SEXP combined_R, SEXP singlePrecision_R);
+SEXP appendToChainWriter_R(SEXP writer_R, SEXP combined_R);
+SEXP flushChainWriter_R(SEXP writer_R);
+SEXP closeChainWriter_R(SEXP writer_R);
+
+/* summaries of draws */
+SEXP readSummaryFile_R(SEXP filename_R, SEXP first_R, SEXP last_R);
+SEXP joinSummaryFiles_R(SEXP filename_R, SEXP chainFilenames_R);
+SEXP resummariseInFile_R(SEXP filename_R, SEXP values_R, SEXP first_R,
+                         SEXP last_R, SEXP nIteration_R);
+
+/* transposed results files */
+SEXP writeTransposedFile_R(SEXP filename_R, SEXP lengthIter_R,
+                           SEXP nIteration_R, SEXP nIterChunk_R);
+
+/* assembling results files */
+SEXP appendFiles_R(SEXP filename_R, SEXP filenamesIn_R);
+SEXP splitResultsFile_R(SEXP filename_R, SEXP filenamesOut_R,
+                        SEXP lengthIter_R, SEXP nIterFile_R, SEXP typesOut_R);
+
 /* get data from file */
 SEXP getOneIterFromFile_R(SEXP filename_R,
                         SEXP first_R, SEXP last_R,
@@ -698,6 +752,12 @@ double rcmp1(double mu, double nu, int maxAttempt);
 /* update-account */
 void updateAccount(SEXP combined_R);
 void updateProposalAccountMovePopn(SEXP combined_R);
+int chooseICellAccountMovePopn(int *iCell_r, SEXP combined_R);
+void updateProposalAccountMovePopnCell(SEXP combined_R, int iCell_r,
+                                       int generatedNewProposal);
+void setProposalAccountMovePopn(SEXP combined_R, int generatedNewProposal,
+                                int iCell_r, int iPopnNext_r, int iAccNext_r,
+                                int iExposure_r, int iExpFirst_r, int diffProp);
 void updateProposalAccountMoveBirths(SEXP combined_R);
 void updateProposalAccountMoveBirthsSmall(SEXP combined_R);
 void updateProposalAccountMoveOrigDest(SEXP combined_R);
@@ -717,6 +777,8 @@ double diffLogLikPopnOneDataset(int diff, int iFirst_r, SEXP iterator_R,
                         SEXP dataset_R, SEXP transform_R);
 double diffLogLikPopnOneCell(int iAfter_r, int diff, SEXP population_R,
                         SEXP model_R, SEXP dataset_R, SEXP transform_R);
+double diffLogLikCountOneCell(SEXP model_R, int countProp, int countCurr,
+                              SEXP dataset_R, int iAfter_r);
 double diffLogLikAccountMoveOrigDest(SEXP combined_R);
 double diffLogLikCellComp(int diff, int iComp_r, int iCell_r,
                         SEXP component_R, SEXP dataModels_R,
@@ -2,6 +2,10 @@
 #include "helper-functions.h"
 #include "iterators-methods.h"
 #include "Combined-methods.h"
+#include "random-streams.h"
+#include "transform-index.h"
+#include "cohort-min.h"
+#include "results-file.h"
 #include "demest.h"
 
 #include "R_ext/BLAS.h"
@@ -64,6 +68,7 @@ extern SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -542,7 +547,7 @@ rbinomTrunc1(int size, double prob, int lower, int upper, int maxAttempt)
         int i = 0;
         int prop_value = NA_INTEGER;
         while (!found && i < maxAttempt) {
-            prop_value = rbinom(size, prob);
+            prop_value = rbinomStream(size, prob);
             /* R's rbinom takes double args and returns double */
 
             found = ( !(lower > prop_value) && !(prop_value > upper) );
@@ -617,7 +622,7 @@ rmvnorm1_Internal(double *ans, double *mean, double *var, int n)
 
     /* get the rnorms and put into ans*/
     for (int i = 0; i < n; ++i) {
-        ans[i] = rnorm(0.0, 1.0);
+        ans[i] = rnormStream(0.0, 1.0);
     }
 
     /* dpotrf: compute the Cholesky factorization of a real sym-
@@ -845,16 +850,16 @@ rtnorm1(double mean, double sd, double lower, double upper)
     }
     else {
         if (fabs(u - l) > tol) {
-            double x = rnorm(0,1);
+            double x = rnormStream(0,1);
             while ( (x < l) || (x > u) ) {
-                x = rnorm(0,1);
+                x = rnormStream(0,1);
             }
             ans = x;
         }
         else {
             double pl = pnorm(l, 0, 1, 1, 0);
             double pu = pnorm(u, 0, 1, 1, 0);
-            double unif = runif(0,1);
+            double unif = runifStream(0,1);
             double trans = pl + (pu - pl) * unif;
             ans = qnorm(trans, 0, 1, 1, 0);
         }
@@ -867,13 +872,13 @@ double getRtnorm1_x(double bnd1, double bnd2)
 {
     double c = (bnd1 * bnd1) / 2;
     double f = expm1(c - (bnd2 * bnd2) / 2);
-    double x = c - log(1 + runif(0,1)*f);
+    double x = c - log(1 + runifStream(0,1)*f);
 
-    double u = runif(0,1);
+    double u = runifStream(0,1);
 
     while ( (u * u * x) > c) {
-        x = c - log(1 + runif(0,1)*f);
-        u = runif(0,1);
+        x = c - log(1 + runifStream(0,1)*f);
+        u = runifStream(0,1);
     }
 
     return x;
@@ -904,7 +909,7 @@ rpoisTrunc1(double lambda, int lower, int upper, int maxAttempt)
 
     if ( (lower == 0) && !finite_upper ) {
       found = 1;
-      retValue = rpois(lambda);
+      retValue = rpoisStream(lambda);
     }
 
     if (!found) {
@@ -916,7 +921,7 @@ rpoisTrunc1(double lambda, int lower, int upper, int maxAttempt)
 
       n_attempt += 1;
 
-      prop_value = rpois(lambda);
+      prop_value = rpoisStream(lambda);
 
       if (lower == 0) {     /* must have finite_upper is TRUE */
         found = !(prop_value > upper);
@@ -927,7 +932,7 @@ rpoisTrunc1(double lambda, int lower, int upper, int maxAttempt)
           m = 0;
         prop_value += m;
         found = ( !(prop_value < lower)
-              && (runif(0, 1) < (lower / prop_value)) );
+              && (runifStream(0, 1) < (lower / prop_value)) );
         if (finite_upper)
           found = found && !(prop_value > upper);
 
@@ -1985,6 +1990,57 @@ getVBarAndN(double *vbar, int *n_vec,
 
 
 
+/* Fill 'betaIndices', an n_theta x n_beta matrix stored by column,
+   with the (0-based) position within each beta of the element
+   that contributes to each cell of theta. The matrix is built by
+   stepping 'iteratorBetas_R' through all the cells once, after
+   which the iterator is back where it started. */
+void
+makeBetaIndices(int *betaIndices, SEXP iteratorBetas_R, int n_theta, int n_betas)
+{
+    resetB(iteratorBetas_R);
+    int *indices = INTEGER(GET_SLOT(iteratorBetas_R, indices_sym));
+
+    for (int i = 0; i < n_theta; ++i) {
+        for (int b = 0; b < n_betas; ++b) {
+            betaIndices[b * n_theta + i] = indices[b] - 1;
+        }
+        advanceB(iteratorBetas_R);
+    }
+}
+
+
+/* Equivalent to 'getVBarAndN', but working from 'residuals',
+   which holds thetaTransformed minus the contributions of all
+   betas other than the one being updated. 'index' is the
+   column of the matrix created by 'makeBetaIndices' for
+   the beta being updated. */
+void
+getVBarAndNFromResiduals(double *vbar, int *n_vec,
+                int len_vbar, int *cellInLik,
+                int *index, double *residuals, int n_theta)
+{
+    /* zero contents of vbar and n_vec*/
+    memset(vbar, 0, len_vbar * sizeof(double));
+    memset(n_vec, 0, len_vbar * sizeof(int));
+
+    for (int i = 0; i < n_theta; ++i) {
+        if (cellInLik[i]) {
+            int pos_ans = index[i];
+            vbar[pos_ans] += residuals[i];
+            ++n_vec[pos_ans];
+        }
+    }
+
+    for (int i = 0; i < len_vbar; ++i) {
+        if (n_vec[i] > 0L) {
+            vbar[i] /= n_vec[i];
+        }
+    }
+}
+
+
+
 
 double
 modePhiMix(double * level, double meanLevel, int nAlong,
@@ -2815,7 +2871,7 @@ diffLogLik(int *yProp, SEXP y_R,
             while (i_dataset < n_dataset ) {
 
                 SEXP this_transform_R = VECTOR_ELT(transforms_R, i_dataset);
-                int ir_cell_dataset = dembase_getIAfter(ir_cell_y, this_transform_R);
+                int ir_cell_dataset = getIAfterIndexed(ir_cell_y, this_transform_R);
 
                 if (ir_cell_dataset > 0) {
 
@@ -2833,18 +2889,8 @@ diffLogLik(int *yProp, SEXP y_R,
 
                         SEXP this_model_R = VECTOR_ELT(dataModels_R, i_dataset);
 
-                        SEXP i_contrib_to_cell_R;
-                        PROTECT( i_contrib_to_cell_R
-                                    = dembase_getIShared(ir_cell_y, this_transform_R) );
-                        int n_contrib_to_cell = LENGTH(i_contrib_to_cell_R);
-                        int *ir_contrib_to_cell = INTEGER(i_contrib_to_cell_R);
-
-                        int collapsed_y_curr = 0.0;
-                        for (int i = 0; i < n_contrib_to_cell; ++i) {
-                            collapsed_y_curr += y[ ir_contrib_to_cell[i] - 1 ];
-                        }
-
-                        UNPROTECT(1); /* i_contrib_to_cell_R */
+                        int collapsed_y_curr = sumOverIShared(y, ir_cell_y,
+                                                              this_transform_R);
 
                         int diff_prop_curr = yProp[i_element_indices_y]
                                                     - y[ir_cell_y - 1];
@@ -3086,59 +3132,56 @@ estimateOneChain(SEXP object_R, SEXP filename_R,
                 SEXP nBurnin_R, SEXP nSim_R, SEXP nThin_R,
                 SEXP continuing_R)
 {
-    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    /* draws are collected in memory and written by a background
+     * thread (see "chain-writer.h"); if an update fails, the
+     * writer is shut down when the pointer is garbage-collected */
+    SEXP writer_R;
+    PROTECT(writer_R = openChainWriter_R(filename_R, object_R,
+                                         ScalarLogical(FALSE),
+                                         ScalarInteger(0),
+                                         ScalarLogical(FALSE)));
 
-    FILE * fp;
-    fp = fopen (filename,"wb"); /* overwrite if exists */
+    int nBurnin = *INTEGER(nBurnin_R);
+    int nSim = *INTEGER(nSim_R);
+    int nThin = *INTEGER(nThin_R);
 
-    if ( NULL != fp ) {
+    int continuing = *LOGICAL(continuing_R);
 
-        int nBurnin = *INTEGER(nBurnin_R);
-        int nSim = *INTEGER(nSim_R);
-        int nThin = *INTEGER(nThin_R);
-
-        int continuing = *LOGICAL(continuing_R);
+    /* scales of proposals for theta are not adapted here */
+    setAdaptingTheta(0);
 
-        /* update nBurnin-1 times */
-        if (nBurnin > 1) {
-            updateCombined(object_R, nBurnin - 1);
-        }
+    /* update nBurnin-1 times */
+    if (nBurnin > 1) {
+        updateCombined(object_R, nBurnin - 1);
+    }
 
-        /* n.prod <- nSim %/% nThin */
+    /* n.prod <- nSim %/% nThin */
 
-        int n_prod = nSim/nThin; /* integer division */
+    int n_prod = nSim/nThin; /* integer division */
 
-        /* for (i in seq_len(n.prod)) {
-            ## when C versions of updateCombined are finished, change to useC = TRUE
-            if ((nBurnin == 0L) && (i == 1L) && !continuing)
-                combined <- updateCombined(combined, nUpdate = nThin - 1L)
-            else
-                combined <- updateCombined(combined, nUpdate = nThin) */
-        for (int i = 0; i < n_prod; ++i) {
-
-            if (!continuing && (nBurnin == 0) && (i == 0)) {
-                /* if nThin==1 nUpdate will be 0 and nothing actually happens
-                 * ie we go straight on to record the object */
-                updateCombined(object_R, nThin-1);
-            }
-            else { /* nBurnin > 0 or i > 0 or continuing */
-                updateCombined(object_R, nThin);
-            }
+    /* for (i in seq_len(n.prod)) {
+        ## when C versions of updateCombined are finished, change to useC = TRUE
+        if ((nBurnin == 0L) && (i == 1L) && !continuing)
+            combined <- updateCombined(combined, nUpdate = nThin - 1L)
+        else
+            combined <- updateCombined(combined, nUpdate = nThin) */
+    for (int i = 0; i < n_prod; ++i) {
 
-            writeValuesToFileBin(fp, object_R);
-            if (ferror (fp)) {
-                error("unsuccessful write to file %s", filename);
-                /* terminates on error
-                 * this is where we could choose to do something else
-                 * other than write the error */
-            }
+        if (!continuing && (nBurnin == 0) && (i == 0)) {
+            /* if nThin==1 nUpdate will be 0 and nothing actually happens
+             * ie we go straight on to record the object */
+            updateCombined(object_R, nThin-1);
+        }
+        else { /* nBurnin > 0 or i > 0 or continuing */
+            updateCombined(object_R, nThin);
         }
 
-        fclose(fp);
-    }
-    else {
-        error("could not open file %s", filename); /* terminates now */
+        /* raises an error if an earlier write was unsuccessful */
+        appendToChainWriter_R(writer_R, object_R);
     }
+
+    closeChainWriter_R(writer_R);
+    UNPROTECT(1); /* writer_R */
 }
 
 
@@ -3237,7 +3280,7 @@ addToFile(const char * filename, SEXP object_R)
     fp = fopen (filename,"ab"); /* add to file if exists */
     if (fp == NULL) success = 0;
     else {
-        writeValuesToFileBin(fp, object_R);
+        writeValuesToFileBin(fp, object_R, 0);
         if (ferror (fp)) success = 0;
         fclose (fp);
     }
@@ -3249,16 +3292,51 @@ addToFile(const char * filename, SEXP object_R)
 }
 
 
-/* Based on Brendan's code */
+/* number of logical values converted to bytes, or doubles
+ * converted to floats, at a time by writeValuesToFileBin */
+#define K_LENGTH_WRITE_BUFFER 1024
 
-/* more efficient than Brendan's original because it avoids individual
- * writes per value in integer and logical vectors, but it does mean
- * allocating the extra space temporarily for each temporary
- * vector of doubles.  But half the time on my tests doing it this way
- * (could use coerseVector instead but we still have to make a copy
- * and on my tests coerceVector actually took marginally longer)  */
-void
-writeValuesToFileBin(FILE *fp, SEXP object_R)
+/* The conversions go through a fixed buffer on the stack, one block
+ * at a time, rather than through a temporary vector from R_alloc,
+ * since memory from R_alloc is not released until the .Call returns,
+ * and estimateOneChain writes every iteration within a single .Call */
+static void
+writeLogicalsAsBytesToFileBin(FILE *fp, const int *values, int n)
+{
+    unsigned char buffer[K_LENGTH_WRITE_BUFFER];
+    for (int start = 0; start < n; start += K_LENGTH_WRITE_BUFFER) {
+        int nBlock = n - start;
+        if (nBlock > K_LENGTH_WRITE_BUFFER)
+            nBlock = K_LENGTH_WRITE_BUFFER;
+        for (int i = 0; i < nBlock; ++i) {
+            int value = values[start + i];
+            buffer[i] = (value == NA_LOGICAL) ? K_NA_LOGICAL_BYTE : (value != 0);
+        }
+        fwrite(buffer, 1, nBlock, fp);
+    }
+}
+
+static void
+writeDoublesAsFloatsToFileBin(FILE *fp, const double *values, int n)
+{
+    float buffer[K_LENGTH_WRITE_BUFFER];
+    for (int start = 0; start < n; start += K_LENGTH_WRITE_BUFFER) {
+        int nBlock = n - start;
+        if (nBlock > K_LENGTH_WRITE_BUFFER)
+            nBlock = K_LENGTH_WRITE_BUFFER;
+        for (int i = 0; i < nBlock; ++i) {
+            double value = values[start + i];
+            buffer[i] = ISNAN(value) ? (float)R_NaN : (float)value;
+        }
+        fwrite(buffer, sizeof(float), nBlock, fp);
+    }
+}
+
+/* 'asFloat' is non-zero within slots called "theta", if
+ * 'singlePrecision' is non-zero */
+static void
+writeValuesToFileBinInner(FILE *fp, SEXP object_R, int singlePrecision,
+                          int asFloat)
 {
 
     if (IS_S4_OBJECT(object_R)) {
@@ -3269,11 +3347,14 @@ writeValuesToFileBin(FILE *fp, SEXP object_R)
             for (int i=0; i<LENGTH(slots_to_extract); i++) {
 
                 const char *sym_name = CHAR(STRING_ELT(slots_to_extract, i));
-                writeValuesToFileBin(fp, GET_SLOT(object_R, install(sym_name)));
+                int isTheta = singlePrecision && (strcmp(sym_name, "theta") == 0);
+                writeValuesToFileBinInner(fp, GET_SLOT(object_R, install(sym_name)),
+                                          singlePrecision, isTheta);
             }
         }
         else if (R_has_slot(object_R, Data_sym)) {
-            writeValuesToFileBin(fp, GET_SLOT(object_R, Data_sym));
+            writeValuesToFileBinInner(fp, GET_SLOT(object_R, Data_sym),
+                                      singlePrecision, asFloat);
         }
         else {
             error("write_values_to_file cannot handle object_R of class \"%s\"",
@@ -3285,39 +3366,24 @@ writeValuesToFileBin(FILE *fp, SEXP object_R)
     else {
         switch(TYPEOF(object_R)) {
             case REALSXP:
-                fwrite(REAL(object_R), sizeof(double), LENGTH(object_R), fp);
+                if (asFloat)
+                    writeDoublesAsFloatsToFileBin(fp, REAL(object_R),
+                                                  LENGTH(object_R));
+                else
+                    fwrite(REAL(object_R), sizeof(double), LENGTH(object_R), fp);
                 break;
             case INTSXP:
-                {
-                    int n = LENGTH(object_R);
-                    double *tmpArray = (double *)R_alloc(n, sizeof(double));
-                    int *object = INTEGER(object_R);
-                    for (int i = 0; i < n; ++i) {
-                        tmpArray[i] = (double)object[i];
-                    }
-                    fwrite(tmpArray, sizeof(double), n, fp);
-                    fflush(fp); /* flush buffer - forces output to file */
-
-               }
+                /* NA_INTEGER is also the missing value in files */
+                fwrite(INTEGER(object_R), sizeof(int), LENGTH(object_R), fp);
                 break;
-
             case LGLSXP:
-                {
-                    int n = LENGTH(object_R);
-                    double *tmpArray = (double *)R_alloc(n, sizeof(double));
-                    int *object = LOGICAL(object_R);
-                    for (int i = 0; i < n; ++i) {
-                        tmpArray[i] = (double)object[i];
-
-                    }
-                    fwrite(tmpArray, sizeof(double), n, fp);
-                    fflush(fp); /* flush buffer - forces output to file */
-
-                }
+                writeLogicalsAsBytesToFileBin(fp, LOGICAL(object_R),
+                                              LENGTH(object_R));
                 break;
             case VECSXP:
                 for (int i=0; i<LENGTH(object_R); i++) {
-                    writeValuesToFileBin(fp, VECTOR_ELT(object_R, i));
+                    writeValuesToFileBinInner(fp, VECTOR_ELT(object_R, i),
+                                              singlePrecision, asFloat);
                 }
                 break;
             default:
@@ -3326,8 +3392,21 @@ writeValuesToFileBin(FILE *fp, SEXP object_R)
                   type2char(TYPEOF(object_R)), TYPEOF(object_R));
         }
     }
+}
 
+/* Based on Brendan's code */
 
+/* Writes values in the formats used in results files (see
+ * "results-file.h"), and in the same order, and with the same
+ * types, as the chain writer.  Integers are written straight from
+ * the vector, at their native width, and logicals as single
+ * bytes.  Doubles are written as doubles, except that, if
+ * 'singlePrecision' is non-zero, doubles in slots called "theta"
+ * are written as floats. */
+void
+writeValuesToFileBin(FILE *fp, SEXP object_R, int singlePrecision)
+{
+    writeValuesToFileBinInner(fp, object_R, singlePrecision, 0);
 }
 
 /* note that these getDataFromFile functions are only okay if
@@ -3473,13 +3552,9 @@ void getDataFromFile(double *ans,
 }
 #endif
 
-/* alternative version that does 1 read from file and
-* has to allocate the extra space for  a buffer to then
-* extract the desired data from.
-* Cheaper on io time to read the whole lot in
-* and sort it out from there
-* but at the expense of allocation of the buffer
-*/
+/* version that memory-maps the file, so that only the pages
+* holding the requested values are read from disk
+* (see "results-file.h") */
 
 #if(1)
 SEXP getDataFromFile_R(SEXP filename_R,
@@ -3490,12 +3565,6 @@ SEXP getDataFromFile_R(SEXP filename_R,
     /* strings are character vectors, in this case just one element */
     const char *filename = CHAR(STRING_ELT(filename_R,0));
 
-    FILE * fp = fopen(filename, "rb"); /* binary mode */
-
-    if (NULL == fp) {
-        error("could not open file %s", filename); /* terminates now */
-    }
-
     int first = *(INTEGER(first_R));
     int last = *(INTEGER(last_R));
     int lengthIter = *(INTEGER(lengthIter_R));
@@ -3503,85 +3572,14 @@ SEXP getDataFromFile_R(SEXP filename_R,
     int *iterations = INTEGER(iterations_R);
 
     int length_data = last - first + 1;
-    int length_gap = lengthIter - length_data;
-
-    /* find size of file in total */
-    fseek(fp, 0, SEEK_END);
-
-    long size = ftell(fp); /* Bytes in file*/
-
-    rewind (fp); /* return to start of file */
-
-    int sizeResultsBytes = 0;
-    int sizeAdjustmentsBytes = 0;
-
-    /* read the size of the results object */
-    size_t nReadRes = fread(&sizeResultsBytes, sizeof(int), 1, fp);
-
-    if (nReadRes < 1) {
-        error("could not successfully read file %s", filename);
-    }
-
-    /* read the size of the adjustments */
-    size_t nReadAdj = fread(&sizeAdjustmentsBytes, sizeof(int), 1, fp);
-
-    if (nReadAdj < 1) {
-        error("could not successfully read file %s", filename);
-    }
-
-    /* skip sizeResultsBytes bytes from current pos*/
-    fseek (fp , sizeResultsBytes , SEEK_CUR );
-
-    int n_skip = iterations[0] - 1; /* iterations to skip */
-
-    /* skip n_skip iterations of length lengthIter, and first -1 values */
-    long skipBytes = (n_skip * lengthIter + first - 1) * sizeof(double);
-
-    /* position this far into file, in bytes, from current pos */
-    fseek (fp , skipBytes , SEEK_CUR );
-
-    /* work out how many doubles to read and allocate a buffer */
-    long nDoubleRead = (size - sizeof(int) - sizeResultsBytes - sizeAdjustmentsBytes - skipBytes)
-                        /sizeof(double);
-
-    /* SHOULD THE PREVIOUS LINE BE... */
-    /* long nDoubleRead = (size - 2 * sizeof(int) - sizeResultsBytes - sizeAdjustmentsBytes - skipBytes) */
-    /*                     /sizeof(double); */
-    /* 2, because we record the size of the results object and the adjustments object */
-
-    double *buffer = (double*)R_alloc(nDoubleRead, sizeof(double));
-    size_t nRead2 = fread(buffer, sizeof(double), nDoubleRead, fp);
-
-    if (nRead2 != nDoubleRead) {
-        error("could not successfully read file %s", filename);
-    }
-
-    fclose(fp); /* close the file */
 
     SEXP ans_R;
-    PROTECT(ans_R = allocVector(REALSXP, n_iter*length_data));
+    PROTECT(ans_R = allocVector(REALSXP, (R_xlen_t)n_iter * length_data));
     double *ans = REAL(ans_R);
 
-    /* transfer length_data values to ans */
-    memcpy(ans, buffer, length_data*sizeof(double));
-
-    double *bufferPtr = buffer;
-    double *ansPtr = ans;
-
-    for (int i = 1; i < n_iter; ++i) {
-        /* move to end of last block in ans */
-        ansPtr += length_data;
-        /* calculations for start of next block of data */
-        n_skip = iterations[i] - iterations[i-1] - 1;
-
-        /* position of start of next block in buffer*/
-        bufferPtr += length_data + n_skip * lengthIter + length_gap;
-
-        /* transfer length_data values to ans */
-        memcpy(ansPtr, bufferPtr, length_data*sizeof(double));
-    }
+    readDrawsFromFile(ans, filename, 1, first - 1, length_data,
+                      lengthIter, n_iter, iterations);
 
-    //free(buffer);
     UNPROTECT(1); /* ans_R */
 
     return ans_R;
@@ -3736,38 +3734,8 @@ void getOneIterFromFile(double *ans,
         PrintValue(ScalarInteger(lengthIter));
     #endif
 
-    FILE * fp = fopen(filename, "rb"); /* binary mode */
-    if (NULL == fp) {
-        error("could not open file %s", filename); /* terminates now */
-    }
-
-    int n_skip = iteration - 1; /* iterations to skip */
-
-    /* skip n_skip iterations of length lengthIter, and first values */
-    long skipBytes = (n_skip * lengthIter + first ) * sizeof(double);
-
-    /* position this far into file, in bytes, from current pos */
-    fseek (fp , skipBytes , SEEK_CUR );
-
-    size_t nRead = fread(ans, sizeof(double), length_data, fp);
-
-    #ifdef DEBUGFILEREAD
-        PrintValue(mkString("n_skip"));
-        PrintValue(ScalarInteger(n_skip));
-        PrintValue(mkString("skipBytes"));
-        PrintValue(ScalarInteger(skipBytes));
-        PrintValue(mkString("nRead"));
-        PrintValue(ScalarInteger(nRead2));
-        PrintValue(mkString("ans"));
-        printDblArray(ans, length_data);
-    #endif
-
-
-    if (nRead != length_data) {
-        error("could not successfully read file %s", filename);
-    }
-
-    fclose(fp); /* close the file */
+    readDrawsFromFile(ans, filename, 0, first, length_data,
+                      lengthIter, 1, &iteration);
 }
 
 
@@ -4078,22 +4046,22 @@ getMinValCohortAccession(int i, SEXP series_R, SEXP iterator_R)
 {
     int *series = INTEGER(series_R);
 
-    int ans = series[i-1];
-
-    resetCA(iterator_R, i);
+    int ans;
+    if (findCohortMinAccession(&ans, i, series))
+        return ans;
 
-    int finished = *INTEGER(GET_SLOT(iterator_R, finished_sym));
+    CohortSpan span;
+    makeCohortSpanCA(&span, iterator_R, i);
 
-    while(!(finished)) {
-        advanceCA(iterator_R);
-        i = *INTEGER(GET_SLOT(iterator_R, i_sym));
-        int check = series[i - 1];
+    int i_c = span.i;
+    ans = series[i_c];
 
+    for (int k = 0; k < span.nStep; ++k) {
+        i_c += cohortSpanStride(&span, k);
+        int check = series[i_c];
         if (check < ans) {
             ans = check;
         }
-        finished = *INTEGER(GET_SLOT(iterator_R, finished_sym));
-
     }
     return ans;
 }
@@ -4105,43 +4073,35 @@ getMinValCohortPopulationHasAge(int i, SEXP population_R, SEXP accession_R, SEXP
     int *population = INTEGER(population_R);
     int *accession = INTEGER(accession_R);
 
-    int nAge = *INTEGER(GET_SLOT(iterator_R, nAge_sym));
+    int ans = 0;
+    if (findCohortMinPopulation(&ans, i, population, accession))
+        return ans;
+
     int stepTime = *INTEGER(GET_SLOT(iterator_R, stepTime_sym));
     int nTimePopn = *INTEGER(GET_SLOT(iterator_R, nTime_sym));
     int nTimeAcc = nTimePopn - 1;
 
-    int processedOldestAge = 0;
-    int firstIter = 1;
-    int keepGoing = 1;
-    int ans;
+    CohortSpan span;
+    makeCohortSpanCP(&span, iterator_R, i);
 
-    while (keepGoing) {
+    int i_c = span.i;
 
-      if (firstIter)
-	resetCP(iterator_R, i);
-      else
-	advanceCP(iterator_R);
-      i = *INTEGER(GET_SLOT(iterator_R, i_sym));
-      int populationCurrent = population[i - 1];
-      int iAge = *INTEGER(GET_SLOT(iterator_R, iAge_sym));
-      if (iAge == nAge) {
-	int iAcc = ((i - 1) % (stepTime * nTimePopn)
-		    - stepTime
-		    + ((i - 1) / (stepTime * nTimePopn) * (stepTime * nTimeAcc))); /* C-style */
-	populationCurrent -= accession[iAcc];
-	processedOldestAge = 1;
-      }
-      if (firstIter) {
-	ans = populationCurrent;
-	firstIter = 0;
-      }
-      else {
-	if (populationCurrent < ans) {
-	  ans = populationCurrent;
-	}
-      }
-      int finished = *INTEGER(GET_SLOT(iterator_R, finished_sym));
-      keepGoing = !processedOldestAge && !finished;
+    for (int k = 0; k <= span.nStep; ++k) {
+        int populationCurrent = population[i_c];
+        int isOldestAge = (cohortSpanAge(&span, k) == span.nAge);
+        if (isOldestAge) {
+            int iAcc = (i_c % (stepTime * nTimePopn)
+                        - stepTime
+                        + (i_c / (stepTime * nTimePopn) * (stepTime * nTimeAcc))); /* C-style */
+            populationCurrent -= accession[iAcc];
+        }
+        if ((k == 0) || (populationCurrent < ans)) {
+            ans = populationCurrent;
+        }
+        if (isOldestAge) {
+            break;
+        }
+        i_c += cohortSpanStride(&span, k);
     }
 
     return ans;
@@ -4154,30 +4114,29 @@ getMinValCohortPopulationNoAge(int i, SEXP series_R, SEXP iterator_R)
 {
     int *series = INTEGER(series_R);
 
-    int ans = series[i-1];
-
-    resetCP(iterator_R, i);
-
-    int finished = *INTEGER(GET_SLOT(iterator_R, finished_sym));
+    int ans;
+    if (findCohortMinPopulation(&ans, i, series, NULL))
+        return ans;
 
-    while(!(finished)) {
-        advanceCP(iterator_R);
-        i = *INTEGER(GET_SLOT(iterator_R, i_sym));
+    CohortSpan span;
+    makeCohortSpanCP(&span, iterator_R, i);
 
-        int check = series[i - 1];
+    int i_c = span.i;
+    ans = series[i_c];
 
+    for (int k = 0; k < span.nStep; ++k) {
+        i_c += cohortSpanStride(&span, k);
+        int check = series[i_c];
         if (check < ans) {
             ans = check;
         }
-        finished = *INTEGER(GET_SLOT(iterator_R, finished_sym));
-
     }
 
     return ans;
 }
 
-/*Need a file positioning op between input/output or output/input
- * eg use dummy like fseek(pFile,0,SEEK_CUR) */
+/* Values are converted to the types recorded in the header of the
+ * file. See "results-file.h". */
 SEXP
 overwriteValuesOnFile_R(SEXP object_R, SEXP skeleton_R,
               SEXP filename_R, SEXP nIteration_R, SEXP lengthIter_R)
@@ -4186,13 +4145,6 @@ overwriteValuesOnFile_R(SEXP object_R, SEXP skeleton_R,
     /* strings are character vectors, in this case just one element */
     const char *filename = CHAR(STRING_ELT(filename_R,0));
 
-    FILE * fp = fopen(filename, "r+b"); /* binary mode, with updating */
-    /* can only open if exists */
-
-    if (NULL == fp) {
-        error("could not open file %s", filename); /* terminates now */
-    }
-
     double *object = REAL(object_R);
 
     int first = *INTEGER(GET_SLOT(skeleton_R, first_sym));
@@ -4201,56 +4153,9 @@ overwriteValuesOnFile_R(SEXP object_R, SEXP skeleton_R,
     int lengthIter = *(INTEGER(lengthIter_R));
     int nIter = *INTEGER(nIteration_R);
 
-    /* read the size of the results and adjustment from the file */
-    int sizeResults = 0;
-    size_t nRead1 = fread(&sizeResults, sizeof(int), 1, fp);
-    if (nRead1 < 1) {
-        error("could not successfully read file %s", filename);
-    }
-
-    int sizeAdj = 0;
-    size_t nRead2 = fread(&sizeAdj, sizeof(int), 1, fp);
-    if (nRead2 < 1) {
-        error("could not successfully read file %s", filename);
-    }
-
-    /* skip sizeResults bytes from current pos*/
-    fseek (fp , sizeResults, SEEK_CUR );
-    /* even if no results, this meets requirements to use file
-     * a positioning operation between read and write */
-
-    int pos = 0; /* position in object */
-    int nWrite = last - first + 1; /* number of values to write each time */
-    int nComplete = 0;
-    if (lengthIter > last) {
-        nComplete = lengthIter - last;
-    }
-
-    for (int iIter = 0; iIter < nIter; ++iIter) {
-
-        if (ferror(fp)) {
-            error("error in file %s", filename);
-        }
-
-        /* skip first-1 values */
-        long skipBytes = (first - 1) * sizeof(double);
-        fseek (fp , skipBytes, SEEK_CUR );
-
-        fwrite( &object[pos], sizeof(double), nWrite, fp );
-        fflush(fp); /* flush buffer - forces output to file */
-        if (ferror(fp)) {
-            error("could not write to file %s", filename);
-        }
-
-        pos += nWrite;
-
-        long skipMoreBytes = (nComplete) * sizeof(double);
-        fseek (fp , skipMoreBytes, SEEK_CUR );
-        /* fseek always used, and may be a dummy fseek (fp , 0, SEEK_CUR ); */
-
-    }
-
-    fclose(fp); /* close the file */
+    /* 'first' counts from 0 */
+    overwriteDrawsInFile(filename, object, first - 1, last - first + 1,
+                         lengthIter, nIter);
 
     return R_NilValue;
 }
@@ -4281,11 +4186,11 @@ rcmpUnder(double mu, double nu, int maxAttempt)
 
     while ( !found && (i < maxAttempt) ) {
 
-        double ynew = rpois(mu);
+        double ynew = rpoisStream(mu);
         double logy = lgammafn(ynew + 1);
         double log_a = nuMinus1 * ( logMu * (ynew - fl) - logy + logfl);
 
-        double logu = log(runif(0, 1));
+        double logu = log(runifStream(0, 1));
 
         if (logu < log_a) {
             retValue = ynew;
@@ -4316,12 +4221,12 @@ rcmpOver(double mu, double nu, int maxAttempt)
 
     while ( !found && (i < maxAttempt) ) {
 
-        double ynew = rgeom(p);
+        double ynew = rgeomStream(p);
         double logy = lgammafn(ynew + 1);
         double log_a = (ynew - fl) * ( nuTimeslogMu - log1pMinusP)
                                                 + nu * (logfl - logy);
 
-        double logu = log(runif(0, 1));
+        double logu = log(runifStream(0, 1));
 
         if (logu < log_a) {
             retValue = ynew;
@@ -67,13 +67,20 @@
 		     double *thetaTransformed,
 		     int n_betas, int iBeta);
     
+    void makeBetaIndices(int *betaIndices, SEXP iteratorBetas_R,
+                         int n_theta, int n_betas);
+    
+    void getVBarAndNFromResiduals(double *vbar, int *n_vec,
+                    int len_vbar, int *cellInLik,
+                    int *index, double *residuals, int n_theta);
+    
     SEXP makeVBarAndN_R(SEXP object, SEXP iBeta_R);
     
     double logit(double x);
     
     double identity(double x);
     
-    void writeValuesToFileBin(FILE *fp, SEXP object_R);
+    void writeValuesToFileBin(FILE *fp, SEXP object_R, int singlePrecision);
     
     int makeNewFile(const char * filename);
     
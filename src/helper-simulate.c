@@ -64,6 +64,7 @@ extern SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -60,6 +60,7 @@ SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -612,6 +613,24 @@ SEXP (*dembase_getIShared)(int, SEXP);
     return ans_R;             \
     }
 
+/* As for UPDATEOBJECT_WRAPPER_R, but for functions that update
+ * models within a combined object, and take argument 'adapt'.
+ * If 'adapt' is TRUE, accepted proposals for theta are added
+ * to 'nAcceptThetaAdapt'. */
+#define UPDATEADAPTOBJECT_WRAPPER_R(name)         \
+    SEXP name##_R(SEXP object, SEXP adapt_R) {    \
+    int adapt = *LOGICAL(adapt_R);         \
+    SEXP ans_R;               \
+    PROTECT(ans_R = duplicate(object));   \
+    GetRNGstate();      \
+    setAdaptingTheta(adapt);      \
+    name(ans_R);          \
+    setAdaptingTheta(0);      \
+    PutRNGstate();          \
+    UNPROTECT(1);               \
+    return ans_R;             \
+    }
+
 /* Wrapper macro to use for the functions that returns an
  * updated object when using exposure.
  * No arguments to functions should be modified,
@@ -738,6 +757,25 @@ SEXP (*dembase_getIShared)(int, SEXP);
     }
 
 
+/* As for UPDATECOMBINEDOBJECT_WRAPPER_R, but for the 'updateCombined'
+ * functions, which also take argument 'adapt'. If 'adapt' is TRUE,
+ * accepted proposals for theta are added to 'nAcceptThetaAdapt'. */
+#define UPDATECOMBINEDADAPT_WRAPPER_R(name)      \
+    SEXP name##_R(SEXP object_R, SEXP nUpdate_R, SEXP adapt_R) {       \
+    int nUpdate = *INTEGER(nUpdate_R);         \
+    int adapt = *LOGICAL(adapt_R);         \
+    SEXP ans_R;         \
+    PROTECT(ans_R = duplicate(object_R));         \
+    GetRNGstate();      \
+    setAdaptingTheta(adapt);      \
+    name(ans_R, nUpdate);       \
+    setAdaptingTheta(0);      \
+    PutRNGstate();      \
+    UNPROTECT(1);       \
+    return ans_R;       \
+    }
+
+
 /* Wrapper macro to use for the log likelihood functions
  * No arguments to functions should be modified.
  * The wrapper puts a _R suffix on end of function name
@@ -1563,13 +1601,16 @@ makeIOther_R(SEXP i_R, SEXP transform_R)
 
 /* one off wrapper for updateDataModelsCounts_R */
 SEXP updateDataModelsCounts_R(SEXP y_R, SEXP dataModels_R,
-                        SEXP datasets_R, SEXP transforms_R)
+                        SEXP datasets_R, SEXP transforms_R, SEXP adapt_R)
 {
+    int adapt = *LOGICAL(adapt_R);
     SEXP ans_R;
     PROTECT(ans_R = duplicate(dataModels_R));
     GetRNGstate();
+    setAdaptingTheta(adapt);
     updateDataModelsCounts(y_R, ans_R,
                         datasets_R, transforms_R);
+    setAdaptingTheta(0);
     PutRNGstate();
 
     UNPROTECT(1); /* ans_R */
@@ -1578,12 +1619,15 @@ SEXP updateDataModelsCounts_R(SEXP y_R, SEXP dataModels_R,
 }
 
 /* one off wrapper for updateDataModelsAccount_R */
-SEXP updateDataModelsAccount_R(SEXP combined_R)
+SEXP updateDataModelsAccount_R(SEXP combined_R, SEXP adapt_R)
 {
+    int adapt = *LOGICAL(adapt_R);
     SEXP ans_R;
     PROTECT(ans_R = duplicate(combined_R));
     GetRNGstate();
+    setAdaptingTheta(adapt);
     updateDataModelsAccount(ans_R);
+    setAdaptingTheta(0);
     PutRNGstate();
 
     UNPROTECT(1); /* ans_R */
@@ -1783,18 +1827,19 @@ PREDICTCOMBINEDOBJECT_WRAPPER_R(predictCombined_CombinedCountsPoissonHasExp);
 PREDICTCOMBINEDOBJECT_WRAPPER_R(predictCombined);
 
 /* wrap repetitive update of combined model functions */
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedModelBinomial);
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedModelNormal);
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedModelPoissonNotHasExp);
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedModelPoissonHasExp);
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedModelCMPNotHasExp);
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedModelCMPHasExp);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedModelBinomial);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedModelNormal);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedModelPoissonNotHasExp);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedModelPoissonHasExp);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedModelCMPNotHasExp);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedModelCMPHasExp);
 
 /*  update combined CombinedAccount method */
 SEXP
-updateCombined_CombinedAccount_R(SEXP object_R, SEXP nUpdate_R)
+updateCombined_CombinedAccount_R(SEXP object_R, SEXP nUpdate_R, SEXP adapt_R)
 {
     int nUpdate = *INTEGER(nUpdate_R);
+    int adapt = *LOGICAL(adapt_R);
 
     SEXP ans_R;
     PROTECT(ans_R = duplicate(object_R));
@@ -1842,7 +1887,9 @@ updateCombined_CombinedAccount_R(SEXP object_R, SEXP nUpdate_R)
     }
 
     GetRNGstate();
+    setAdaptingTheta(adapt);
     updateCombined_CombinedAccount(ans_R, nUpdate);
+    setAdaptingTheta(0);
     PutRNGstate();
 
     if (hasIteratorPopn) {
@@ -1865,9 +1912,10 @@ updateCombined_CombinedAccount_R(SEXP object_R, SEXP nUpdate_R)
 
 /* generic update combined object method */
 SEXP
-updateCombined_R(SEXP object_R, SEXP nUpdate_R)
+updateCombined_R(SEXP object_R, SEXP nUpdate_R, SEXP adapt_R)
 {
     int nUpdate = *INTEGER(nUpdate_R);
+    int adapt = *LOGICAL(adapt_R);
 
     SEXP ans_R;
     PROTECT(ans_R = duplicate(object_R));
@@ -1918,7 +1966,9 @@ updateCombined_R(SEXP object_R, SEXP nUpdate_R)
         }
 
         GetRNGstate();
+        setAdaptingTheta(adapt);
         updateCombined(ans_R, nUpdate);
+        setAdaptingTheta(0);
         PutRNGstate();
 
         if (hasIteratorPopn) {
@@ -1936,7 +1986,9 @@ updateCombined_R(SEXP object_R, SEXP nUpdate_R)
     }
     else {
         GetRNGstate();
+        setAdaptingTheta(adapt);
         updateCombined(ans_R, nUpdate);
+        setAdaptingTheta(0);
         PutRNGstate();
     }
 
@@ -2045,13 +2097,13 @@ updateValuesAccount_CombinedAccountMovements_R(SEXP object_R)
 
 UPDATEOBJECT_NOPRNG_WRAPPER_R(updateExpectedExposure);
 UPDATEOBJECT_NOPRNG_WRAPPER_R(updateExpectedExposure_CombinedAccountMovements);
-UPDATEOBJECT_WRAPPER_R(updateSystemModels);
-UPDATEOBJECT_WRAPPER_R(updateSystemModels_CombinedAccountMovements);
+UPDATEADAPTOBJECT_WRAPPER_R(updateSystemModels);
+UPDATEADAPTOBJECT_WRAPPER_R(updateSystemModels_CombinedAccountMovements);
 
 /* wrap repetitive update of combined counts functions */
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedCountsPoissonNotHasExp);
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedCountsPoissonHasExp);
-UPDATECOMBINEDOBJECT_WRAPPER_R(updateCombined_CombinedCountsBinomial);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedCountsPoissonNotHasExp);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedCountsPoissonHasExp);
+UPDATECOMBINEDADAPT_WRAPPER_R(updateCombined_CombinedCountsBinomial);
 
 /* wrap loglikelihood functions */
 LOGLIKELIHOOD_WRAPPER_R(logLikelihood_Binomial);
@@ -2813,8 +2865,8 @@ R_CallMethodDef callMethods[] = {
   CALLDEF(updateCountsBinomial_R, 6),
 
   /* update dataModels and datasets */
-  CALLDEF(updateDataModelsCounts_R, 4),
-  CALLDEF(updateDataModelsAccount_R, 1),
+  CALLDEF(updateDataModelsCounts_R, 5),
+  CALLDEF(updateDataModelsAccount_R, 2),
 
   /* models */
   CALLDEF(logLikelihood_R, 4),
@@ -2924,18 +2976,18 @@ R_CallMethodDef callMethods[] = {
   CALLDEF(predictCombined_R, 4),
 
   /* update combined */
-  CALLDEF(updateCombined_CombinedModelBinomial_R, 2),
-  CALLDEF(updateCombined_CombinedModelNormal_R, 2),
-  CALLDEF(updateCombined_CombinedModelPoissonNotHasExp_R, 2),
-  CALLDEF(updateCombined_CombinedModelPoissonHasExp_R, 2),
-  CALLDEF(updateCombined_CombinedModelCMPNotHasExp_R, 2),
-  CALLDEF(updateCombined_CombinedModelCMPHasExp_R, 2),
-  CALLDEF(updateCombined_CombinedAccount_R, 2),
-  CALLDEF(updateCombined_R, 2),
-
-  CALLDEF(updateCombined_CombinedCountsPoissonNotHasExp_R, 2),
-  CALLDEF(updateCombined_CombinedCountsPoissonHasExp_R, 2),
-  CALLDEF(updateCombined_CombinedCountsBinomial_R, 2),
+  CALLDEF(updateCombined_CombinedModelBinomial_R, 3),
+  CALLDEF(updateCombined_CombinedModelNormal_R, 3),
+  CALLDEF(updateCombined_CombinedModelPoissonNotHasExp_R, 3),
+  CALLDEF(updateCombined_CombinedModelPoissonHasExp_R, 3),
+  CALLDEF(updateCombined_CombinedModelCMPNotHasExp_R, 3),
+  CALLDEF(updateCombined_CombinedModelCMPHasExp_R, 3),
+  CALLDEF(updateCombined_CombinedAccount_R, 3),
+  CALLDEF(updateCombined_R, 3),
+
+  CALLDEF(updateCombined_CombinedCountsPoissonNotHasExp_R, 3),
+  CALLDEF(updateCombined_CombinedCountsPoissonHasExp_R, 3),
+  CALLDEF(updateCombined_CombinedCountsBinomial_R, 3),
 
   CALLDEF(diffLogDensAccount_CombinedAccountMovements_R, 1),
   CALLDEF(diffLogDensAccount_R, 1),
@@ -2947,10 +2999,35 @@ R_CallMethodDef callMethods[] = {
   CALLDEF(updateValuesAccount_R, 1),
   CALLDEF(updateExpectedExposure_CombinedAccountMovements_R, 1),
   CALLDEF(updateExpectedExposure_R, 1),
-  CALLDEF(updateSystemModels_CombinedAccountMovements_R, 1),
-  CALLDEF(updateSystemModels_R, 1),
+  CALLDEF(updateSystemModels_CombinedAccountMovements_R, 2),
+  CALLDEF(updateSystemModels_R, 2),
 
   CALLDEF(estimateOneChain_R, 6),
+  CALLDEF(setCounterRNG_R, 2),
+  CALLDEF(setCounterRNGThreads_R, 1),
+  CALLDEF(setCounterRNGThreadsMax_R, 1),
+  CALLDEF(nCounterRNGThreads_R, 0),
+  CALLDEF(counterRNGThreadsUsed_R, 0),
+  CALLDEF(diffLogDensPois_R, 4),
+  CALLDEF(diffLogDensPoisCount_R, 3),
+  CALLDEF(diffLogDensPoisLambda_R, 3),
+  CALLDEF(diffLogDensBinomSize_R, 4),
+  CALLDEF(diffLogAccountBatch_R, 3),
+  CALLDEF(findCohortMinAfterChanges_R, 8),
+  CALLDEF(writeCheckpoint_R, 3),
+  CALLDEF(readCheckpoint_R, 2),
+  CALLDEF(readCheckpointProgress_R, 1),
+  CALLDEF(openChainWriter_R, 5),
+  CALLDEF(makeValueTypes_R, 2),
+  CALLDEF(appendToChainWriter_R, 2),
+  CALLDEF(flushChainWriter_R, 1),
+  CALLDEF(closeChainWriter_R, 1),
+  CALLDEF(readSummaryFile_R, 3),
+  CALLDEF(joinSummaryFiles_R, 2),
+  CALLDEF(resummariseInFile_R, 5),
+  CALLDEF(writeTransposedFile_R, 4),
+  CALLDEF(appendFiles_R, 2),
+  CALLDEF(splitResultsFile_R, 5),
 
   CALLDEF(getOneIterFromFile_R, 5),
   CALLDEF(getDataFromFile_R, 5),
@@ -3235,6 +3312,7 @@ R_init_demest(DllInfo *info)
   ADD_SYM(scaleTheta);
   ADD_SYM(scaleThetaMultiplier);
   ADD_SYM(nAcceptTheta);
+  ADD_SYM(nAcceptThetaAdapt);
   ADD_SYM(betas);
   ADD_SYM(iteratorBetas);
   ADD_SYM(dims);
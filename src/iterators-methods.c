@@ -1,4 +1,5 @@
 
+#include "iterators-methods.h"
 #include "demest.h"
 
 /* File "iterators-methods.c" contains C versions of functions 
@@ -59,6 +60,7 @@ extern SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -800,6 +802,58 @@ resetCP(SEXP iterator_R, int i)
     LOGICAL(finished_R)[0] = (iTime_R >= nTime);
 }
 
+/* 'i' is an R-style index */
+void
+makeCohortSpan(CohortSpan *span, int i, int stepTime, int nTime,
+               int hasAge, int stepAge, int nAge)
+{
+    int iTime_R = (((i - 1) / stepTime) % nTime) + 1; /* R-style */
+    int nStep = (iTime_R < nTime) ? (nTime - iTime_R) : 0;
+    span->i = i - 1;
+    span->nStep = nStep;
+    span->strideTime = stepTime;
+    if (hasAge) {
+        int iAge_R = (((i - 1) / stepAge) % nAge) + 1; /* R-style */
+        int nStepAged = nAge - iAge_R;
+        span->nStepAged = (nStepAged < nStep) ? nStepAged : nStep;
+        span->strideAged = stepTime + stepAge;
+        span->iAge = iAge_R;
+        span->nAge = nAge;
+    }
+    else {
+        span->nStepAged = 0;
+        span->strideAged = stepTime;
+        span->iAge = 0;
+        span->nAge = 0;
+    }
+}
+
+void
+makeCohortSpanCP(CohortSpan *span, SEXP iterator_R, int i)
+{
+    int stepTime = *INTEGER(GET_SLOT(iterator_R, stepTime_sym));
+    int nTime = *INTEGER(GET_SLOT(iterator_R, nTime_sym));
+    int hasAge = *LOGICAL(GET_SLOT(iterator_R, hasAge_sym));
+    int stepAge = 0;
+    int nAge = 0;
+    if (hasAge) {
+        stepAge = *INTEGER(GET_SLOT(iterator_R, stepAge_sym));
+        nAge = *INTEGER(GET_SLOT(iterator_R, nAge_sym));
+    }
+    makeCohortSpan(span, i, stepTime, nTime, hasAge, stepAge, nAge);
+}
+
+void
+makeCohortSpanCA(CohortSpan *span, SEXP iterator_R, int i)
+{
+    int stepTime = *INTEGER(GET_SLOT(iterator_R, stepTime_sym));
+    int stepAge = *INTEGER(GET_SLOT(iterator_R, stepAge_sym));
+    int nTime = *INTEGER(GET_SLOT(iterator_R, nTime_sym));
+    int nAge = *INTEGER(GET_SLOT(iterator_R, nAge_sym));
+    makeCohortSpan(span, i, stepTime, nTime, 1, stepAge, nAge);
+}
+
+
 
 void
 resetCC(SEXP iterator_R, int i)
@@ -871,6 +925,115 @@ resetCODPCP(SEXP iterator_R, int i)
 }
 
 
+/* Cohort cursors: see "iterators-methods.h" */
+void
+initCohortCursor(CohortCursor *cursor, SEXP iterator_R)
+{
+    cursor->stepTime = *INTEGER(GET_SLOT(iterator_R, stepTime_sym));
+    cursor->nTime = *INTEGER(GET_SLOT(iterator_R, nTime_sym));
+    cursor->hasAge = *LOGICAL(GET_SLOT(iterator_R, hasAge_sym));
+    cursor->stepAge = 0;
+    cursor->nAge = 0;
+    cursor->lastAgeGroupOpen = 0;
+    cursor->stepTriangle = 0;
+    if (cursor->hasAge) {
+        cursor->stepAge = *INTEGER(GET_SLOT(iterator_R, stepAge_sym));
+        cursor->nAge = *INTEGER(GET_SLOT(iterator_R, nAge_sym));
+        cursor->lastAgeGroupOpen = *INTEGER(GET_SLOT(iterator_R, lastAgeGroupOpen_sym));
+        cursor->stepTriangle = *INTEGER(GET_SLOT(iterator_R, stepTriangle_sym));
+    }
+    if (R_has_slot(iterator_R, increment_sym)) {
+        cursor->lengthVec = *INTEGER(GET_SLOT(iterator_R, lengthVec_sym));
+        cursor->increment = INTEGER(GET_SLOT(iterator_R, increment_sym));
+    }
+    else {
+        cursor->lengthVec = 1;
+        cursor->increment = NULL;
+    }
+    resetCohortCursor(cursor, 1);
+}
+
+/* equivalent to 'resetCC' */
+void
+resetCohortCursor(CohortCursor *cursor, int i)
+{
+    int iTime_R = ((i - 1) / cursor->stepTime) % cursor->nTime + 1;
+    int finished = 0;
+    cursor->i = i;
+    cursor->iTime = iTime_R;
+    if (cursor->hasAge) {
+        int nAge = cursor->nAge;
+        int iAge_R = (((i - 1) / cursor->stepAge) % nAge) + 1;
+        int iTriangle_R = (((i - 1) / cursor->stepTriangle) % 2) + 1;
+        cursor->iAge = iAge_R;
+        cursor->iTriangle = iTriangle_R;
+        if (iTriangle_R == 1) {
+            finished = (iTime_R == cursor->nTime);
+        }
+        else {
+            if (cursor->lastAgeGroupOpen)
+                finished = (iTime_R == cursor->nTime) && (iAge_R == nAge);
+            else
+                finished = (iAge_R == nAge);
+        }
+    }
+    else {
+        cursor->iAge = 0;
+        cursor->iTriangle = 0;
+        finished = (iTime_R == cursor->nTime);
+    }
+    cursor->finished = finished;
+}
+
+/* equivalent to 'advanceCC' */
+void
+advanceCohortCursor(CohortCursor *cursor)
+{
+    int i = cursor->i;
+    int iTime = cursor->iTime;
+    int nTime = cursor->nTime;
+    int finished = 0;
+    if (cursor->hasAge) {
+        int iAge = cursor->iAge;
+        int iTriangle = cursor->iTriangle;
+        int isLowerBefore = iTriangle == 1;
+        int isOldestAgeBefore = iAge == cursor->nAge;
+        if (isLowerBefore) {
+            ++iTime;
+            i += cursor->stepTime;
+            ++iTriangle;
+            i += cursor->stepTriangle;
+            if (cursor->lastAgeGroupOpen)
+                finished = (iTime == nTime) && isOldestAgeBefore;
+            else
+                finished = isOldestAgeBefore;
+        }
+        else {
+            if (isOldestAgeBefore) {
+                ++iTime;
+                i += cursor->stepTime;
+            }
+            else {
+                ++iAge;
+                i += cursor->stepAge;
+                --iTriangle;
+                i -= cursor->stepTriangle;
+            }
+            finished = (iTime == nTime);
+        }
+        cursor->iAge = iAge;
+        cursor->iTriangle = iTriangle;
+    }
+    else {
+        ++iTime;
+        i += cursor->stepTime;
+        finished = (iTime == nTime);
+    }
+    cursor->i = i;
+    cursor->iTime = iTime;
+    cursor->finished = finished;
+}
+
 /* ************** Margin iterators *************** */
 
 /* advance margin iterator */
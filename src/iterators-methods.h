@@ -24,4 +24,80 @@
     /* reset dims iterator */
     void resetD(SEXP iterator_R);
 
+    /* Cells visited by a CohortIteratorPopulation or
+     * CohortIteratorAccession, starting from a given cell.
+     * The path is fixed by the dimensions of the iterator:
+     * each step moves forward 'strideTime' cells, plus,
+     * for the first 'nStepAged' steps, a further 'stepAge'
+     * cells. Looping over a span gives the same cells as
+     * calling 'resetCP' or 'resetCA', then 'advanceCP' or
+     * 'advanceCA' until finished, but does not read or
+     * modify the slots of the iterator at each step. */
+    typedef struct CohortSpan {
+        int i;          /* C-style index of first cell */
+        int nStep;      /* number of steps after first cell */
+        int nStepAged;  /* number of steps that move up an age group */
+        int strideTime; /* stepTime */
+        int strideAged; /* stepTime + stepAge */
+        int iAge;       /* R-style age group of first cell, 0 if no age */
+        int nAge;       /* 0 if no age */
+    } CohortSpan;
+
+    void makeCohortSpan(CohortSpan *span, int i, int stepTime, int nTime,
+                        int hasAge, int stepAge, int nAge);
+    void makeCohortSpanCP(CohortSpan *span, SEXP iterator_R, int i);
+    void makeCohortSpanCA(CohortSpan *span, SEXP iterator_R, int i);
+
+    /* distance to next cell, from step 'k' (starting at 0) */
+    static __inline__ int
+    cohortSpanStride(const CohortSpan *span, int k)
+    {
+        return (k < span->nStepAged) ? span->strideAged : span->strideTime;
+    }
+
+    /* R-style age group of cell at step 'k' */
+    static __inline__ int
+    cohortSpanAge(const CohortSpan *span, int k)
+    {
+        return span->iAge + ((k < span->nStepAged) ? k : span->nStepAged);
+    }
+
+
+    /* Native copy of the state of a CohortIteratorComponent,
+     * or CohortIteratorOrigDestParChPool, for code that
+     * must not touch R objects, such as code run in
+     * parallel. 'initCohortCursor' reads the dimensions from
+     * the iterator; after that, 'resetCohortCursor' and
+     * 'advanceCohortCursor' behave like 'resetCC' and
+     * 'advanceCC' (or 'resetCODPCP' and 'advanceCODPCP'),
+     * but only change the cursor. Indices are R-style, as
+     * in the iterator. */
+    typedef struct CohortCursor {
+        int i;
+        int iTime;
+        int iAge;       /* 0 if no age */
+        int iTriangle;  /* 0 if no age */
+        int finished;
+        int stepTime;
+        int nTime;
+        int hasAge;
+        int stepAge;
+        int nAge;
+        int lastAgeGroupOpen;
+        int stepTriangle;
+        int lengthVec;  /* 1 unless iterator has 'increment' slot */
+        int *increment; /* NULL unless iterator has 'increment' slot */
+    } CohortCursor;
+
+    void initCohortCursor(CohortCursor *cursor, SEXP iterator_R);
+    void resetCohortCursor(CohortCursor *cursor, int i);
+    void advanceCohortCursor(CohortCursor *cursor);
+
+    /* element 'j' of 'iVec' for a CODPCP iterator, or 'i' */
+    static __inline__ int
+    cohortCursorCell(const CohortCursor *cursor, int j)
+    {
+        return cursor->increment ? (cursor->i + cursor->increment[j]) : cursor->i;
+    }
+
 #endif
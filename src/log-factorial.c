@@ -0,0 +1,198 @@
+#include "log-factorial.h"
+#include "demest.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* File "log-factorial.c" contains functions for differences
+ * in Poisson and binomial log densities, described in
+ * "log-factorial.h". */
+
+static double *logFactorialTable = NULL;
+static int nLogFactorialTable = 0;
+
+static int
+inParallelRegion(void)
+{
+#ifdef _OPENMP
+    return omp_in_parallel();
+#else
+    return 0;
+#endif
+}
+
+/* make sure that the table holds log(x!) for x = 0, ..., n */
+void
+reserveLogFactorial(int n)
+{
+    if (n >= K_MAX_LOG_FACTORIAL_TABLE)
+        n = K_MAX_LOG_FACTORIAL_TABLE - 1;
+    if (n < nLogFactorialTable)
+        return;
+    int nNew = (nLogFactorialTable > 0) ? nLogFactorialTable : 256;
+    while (nNew <= n)
+        nNew *= 2;
+    if (nNew > K_MAX_LOG_FACTORIAL_TABLE)
+        nNew = K_MAX_LOG_FACTORIAL_TABLE;
+    if (logFactorialTable)
+        logFactorialTable = R_Realloc(logFactorialTable, nNew, double);
+    else
+        logFactorialTable = R_Calloc(nNew, double);
+    for (int x = nLogFactorialTable; x < nNew; ++x)
+        logFactorialTable[x] = lgammafn(x + 1.0);
+    nLogFactorialTable = nNew;
+}
+
+/* log(x!), for x >= 0 */
+double
+logFactorial(int x)
+{
+    if (x < nLogFactorialTable)
+        return logFactorialTable[x];
+    if ((x < K_MAX_LOG_FACTORIAL_TABLE) && !inParallelRegion()) {
+        reserveLogFactorial(x);
+        return logFactorialTable[x];
+    }
+    return lgammafn(x + 1.0);
+}
+
+/* log(xProp!) - log(xCurr!), for xProp, xCurr >= 0 */
+double
+diffLogFactorial(int xProp, int xCurr)
+{
+    int diff = xProp - xCurr;
+    if (diff == 0)
+        return 0;
+    if ((diff <= K_MAX_DIFF_LOG_FACTORIAL_DIRECT)
+        && (diff >= -K_MAX_DIFF_LOG_FACTORIAL_DIRECT)) {
+        int lo = (diff > 0) ? xCurr : xProp;
+        int hi = (diff > 0) ? xProp : xCurr;
+        double ans = 0;
+        for (int x = lo + 1; x <= hi; ++x)
+            ans += log(x);
+        return (diff > 0) ? ans : -ans;
+    }
+    return logFactorial(xProp) - logFactorial(xCurr);
+}
+
+static __inline__ int
+isPositiveFinite(double x)
+{
+    return (x > 0) && R_FINITE(x);
+}
+
+double
+diffLogDensPois(int xProp, double lambdaProp, int xCurr, double lambdaCurr)
+{
+    if ((xProp >= 0) && (xCurr >= 0)
+        && isPositiveFinite(lambdaProp) && isPositiveFinite(lambdaCurr)) {
+        return xProp * log(lambdaProp) - xCurr * log(lambdaCurr)
+            - (lambdaProp - lambdaCurr)
+            - diffLogFactorial(xProp, xCurr);
+    }
+    return dpois(xProp, lambdaProp, USE_LOG) - dpois(xCurr, lambdaCurr, USE_LOG);
+}
+
+double
+diffLogDensPoisCount(int xProp, int xCurr, double lambda)
+{
+    if ((xProp >= 0) && (xCurr >= 0) && isPositiveFinite(lambda))
+        return (xProp - xCurr) * log(lambda) - diffLogFactorial(xProp, xCurr);
+    return dpois(xProp, lambda, USE_LOG) - dpois(xCurr, lambda, USE_LOG);
+}
+
+double
+diffLogDensPoisLambda(int x, double lambdaProp, double lambdaCurr)
+{
+    if ((x >= 0) && isPositiveFinite(lambdaProp) && isPositiveFinite(lambdaCurr))
+        return x * log(lambdaProp / lambdaCurr) - (lambdaProp - lambdaCurr);
+    return dpois(x, lambdaProp, USE_LOG) - dpois(x, lambdaCurr, USE_LOG);
+}
+
+double
+diffLogDensBinomSize(int x, int sizeProp, int sizeCurr, double prob)
+{
+    if ((x >= 0) && (sizeProp >= x) && (sizeCurr >= x)
+        && (prob > 0) && (prob < 1)) {
+        return diffLogFactorial(sizeProp, sizeCurr)
+            - diffLogFactorial(sizeProp - x, sizeCurr - x)
+            + (sizeProp - sizeCurr) * log1p(-prob);
+    }
+    return dbinom(x, sizeProp, prob, USE_LOG) - dbinom(x, sizeCurr, prob, USE_LOG);
+}
+
+
+/* ******************************************************************************** */
+/* Functions called from R ******************************************************** */
+/* ******************************************************************************** */
+
+/* Vectorised wrappers, used to test the functions above
+   against 'dpois' and 'dbinom'. The arguments all have
+   the same length. */
+
+SEXP
+diffLogDensPois_R(SEXP xProp_R, SEXP lambdaProp_R, SEXP xCurr_R, SEXP lambdaCurr_R)
+{
+    int n = LENGTH(xProp_R);
+    int *xProp = INTEGER(xProp_R);
+    double *lambdaProp = REAL(lambdaProp_R);
+    int *xCurr = INTEGER(xCurr_R);
+    double *lambdaCurr = REAL(lambdaCurr_R);
+    SEXP ans_R;
+    PROTECT(ans_R = allocVector(REALSXP, n));
+    double *ans = REAL(ans_R);
+    for (int i = 0; i < n; ++i)
+        ans[i] = diffLogDensPois(xProp[i], lambdaProp[i], xCurr[i], lambdaCurr[i]);
+    UNPROTECT(1);
+    return ans_R;
+}
+
+SEXP
+diffLogDensPoisCount_R(SEXP xProp_R, SEXP xCurr_R, SEXP lambda_R)
+{
+    int n = LENGTH(xProp_R);
+    int *xProp = INTEGER(xProp_R);
+    int *xCurr = INTEGER(xCurr_R);
+    double *lambda = REAL(lambda_R);
+    SEXP ans_R;
+    PROTECT(ans_R = allocVector(REALSXP, n));
+    double *ans = REAL(ans_R);
+    for (int i = 0; i < n; ++i)
+        ans[i] = diffLogDensPoisCount(xProp[i], xCurr[i], lambda[i]);
+    UNPROTECT(1);
+    return ans_R;
+}
+
+SEXP
+diffLogDensPoisLambda_R(SEXP x_R, SEXP lambdaProp_R, SEXP lambdaCurr_R)
+{
+    int n = LENGTH(x_R);
+    int *x = INTEGER(x_R);
+    double *lambdaProp = REAL(lambdaProp_R);
+    double *lambdaCurr = REAL(lambdaCurr_R);
+    SEXP ans_R;
+    PROTECT(ans_R = allocVector(REALSXP, n));
+    double *ans = REAL(ans_R);
+    for (int i = 0; i < n; ++i)
+        ans[i] = diffLogDensPoisLambda(x[i], lambdaProp[i], lambdaCurr[i]);
+    UNPROTECT(1);
+    return ans_R;
+}
+
+SEXP
+diffLogDensBinomSize_R(SEXP x_R, SEXP sizeProp_R, SEXP sizeCurr_R, SEXP prob_R)
+{
+    int n = LENGTH(x_R);
+    int *x = INTEGER(x_R);
+    int *sizeProp = INTEGER(sizeProp_R);
+    int *sizeCurr = INTEGER(sizeCurr_R);
+    double *prob = REAL(prob_R);
+    SEXP ans_R;
+    PROTECT(ans_R = allocVector(REALSXP, n));
+    double *ans = REAL(ans_R);
+    for (int i = 0; i < n; ++i)
+        ans[i] = diffLogDensBinomSize(x[i], sizeProp[i], sizeCurr[i], prob[i]);
+    UNPROTECT(1);
+    return ans_R;
+}
@@ -0,0 +1,46 @@
+#ifndef __LOG_FACTORIAL_H__
+#define __LOG_FACTORIAL_H__
+
+    #include <Rinternals.h>
+
+    /* largest table of log factorials that will be built */
+    #define K_MAX_LOG_FACTORIAL_TABLE 1048576
+
+    /* differences in counts up to this size are handled
+       by summing logs rather than using the table */
+    #define K_MAX_DIFF_LOG_FACTORIAL_DIRECT 8
+
+    /* Differences in Poisson log densities.
+     *
+     * The updates for accounts compare the log density of a
+     * proposed count with that of the current count, which,
+     * calling 'dpois' twice, requires two evaluations of
+     * lgamma. Since the normalising constants only depend on
+     * the counts, the difference can be calculated directly,
+     * using log(x!) from a table for moderate counts, or
+     * the sum of log(x+1), ..., log(x+d) when the counts
+     * differ by a small amount d. Where the lambdas are not
+     * positive and finite, or the counts are negative, the
+     * functions fall back on 'dpois', so results match those
+     * from 'dpois' in all cases, up to rounding.
+     *
+     * The table is held in memory allocated with R_Calloc,
+     * and is extended when a larger count is looked up, except
+     * inside a parallel region, where lgamma is used instead.
+     * 'reserveLogFactorial' extends the table ahead of time,
+     * and must not be called inside a parallel region. */
+    void reserveLogFactorial(int n);
+    double logFactorial(int x);
+    double diffLogFactorial(int xProp, int xCurr);
+
+    /* dpois(xProp, lambdaProp) - dpois(xCurr, lambdaCurr), on log scale */
+    double diffLogDensPois(int xProp, double lambdaProp,
+                           int xCurr, double lambdaCurr);
+    /* dpois(xProp, lambda) - dpois(xCurr, lambda), on log scale */
+    double diffLogDensPoisCount(int xProp, int xCurr, double lambda);
+    /* dpois(x, lambdaProp) - dpois(x, lambdaCurr), on log scale */
+    double diffLogDensPoisLambda(int x, double lambdaProp, double lambdaCurr);
+    /* dbinom(x, sizeProp, prob) - dbinom(x, sizeCurr, prob), on log scale */
+    double diffLogDensBinomSize(int x, int sizeProp, int sizeCurr, double prob);
+
+#endif
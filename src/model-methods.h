@@ -4,6 +4,7 @@
 
 
     #include <Rinternals.h>
+    #include "model-state.h"
 
     void predictModelNotUseExp_Internal(SEXP object, 
                                         SEXP y_R, 
@@ -23,6 +24,10 @@
                                     SEXP exposure_R,
                                     int i_method_model);
 
+    void updateModelNotUseExp_State(ModelState *state);
+
+    void updateModelUseExp_State(ModelState *state);
+
     void drawModelNotUseExp_Internal(SEXP object, 
                                         SEXP y_R, 
                                         int i_method_model);
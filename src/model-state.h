@@ -0,0 +1,162 @@
+#ifndef __MODEL_STATE_H__
+#define __MODEL_STATE_H__
+
+    #include <Rinternals.h>
+    #include "transform-index.h"
+
+    /* number of updates between full recalculations of mu */
+    #define K_N_UPDATE_REFRESH_MU 100
+
+    /* how theta updaters treat a cell */
+    #define CELL_OBSERVED 0
+    #define CELL_MISSING_SUBTOTAL 1 /* y missing, but included in a subtotal */
+    #define CELL_MISSING_PRIOR 2 /* y missing, theta drawn from prior */
+    #define CELL_STRUC_ZERO 3
+
+    /* Native view of a model object.
+     *
+     * Resolving the slots of a model and its betas through
+     * GET_SLOT is expensive relative to the arithmetic in the
+     * update functions.  'initModelState' does the slot lookups
+     * once, and the update functions then work with the typed
+     * pointers and scalars held in a 'ModelState'.
+     *
+     * The priors are not converted.  Apart from 'J' and
+     * 'allStrucZero', which are copied into the state, their
+     * slots are still looked up by 'updatePriorBeta' and
+     * 'betaHat' at every update, through the prior objects
+     * held in 'priors'.
+     *
+     * All pointers point into the slots of 'object_R', 'y_R',
+     * and 'exposure_R', which are modified in place, so nothing
+     * needs to be copied back into the R objects once updating
+     * is finished.  Constant slots are copied into scalars.
+     * Memory is allocated using R_alloc, and so is released
+     * at the end of the .Call.
+     *
+     * Which values of y are missing, and which cells are
+     * structural zeros, does not change during estimation,
+     * so cells are classified once, when the state is set up.
+     * A state should therefore be set up once per .Call,
+     * using 'prepareModelState', and then passed to each
+     * update, rather than being set up again for every
+     * iteration. */
+    typedef struct ModelState {
+        SEXP object_R;
+        SEXP y_R;
+        SEXP exposure_R; /* R_NilValue if model does not use exposure */
+        int iMethodModel;
+
+        /* cells */
+        int nTheta;
+        double *theta;
+        double *thetaTransformed;
+        double *mu;
+        int *cellInLik;
+        int *yInt;          /* NULL if 'y_R' is double */
+        double *yReal;      /* NULL if 'y_R' is integer */
+        int *exposureInt;   /* NULL unless exposure is integer */
+        double *exposureReal; /* NULL unless exposure is double */
+        int *yMissing;      /* 1 if y missing, length nTheta */
+        int *cellKind;      /* one of the CELL_ values, length nTheta */
+        int *iAfterSubtotal; /* R index of subtotal, or 0, length nTheta */
+        int nCellActive;    /* cells that are not structural zeros */
+        int *cellsActive;   /* C indices of those cells, in order */
+        int nCellKind[4];   /* number of cells of each kind */
+        double *sqResid;    /* squared residual for each cell, set by
+                               theta updates, and summed serially so
+                               that the sum does not depend on the
+                               number of threads; NULL if no y */
+
+        /* subtotals */
+        int hasSubtotals;
+        SEXP transformSubtotals_R;
+        TransformIndex *subtotalsIndex; /* compiled 'transformSubtotals_R' */
+        int *subtotalsNet;
+
+        /* constants */
+        double lower;
+        double upper;
+        double tolerance;
+        int maxAttempt;
+        double boxCoxParam; /* 0 unless Poisson model */
+        double sigmaMax;
+        double ASigma;
+        double nuSigma;
+        double *w; /* NULL unless normal model */
+
+        /* scalar slots, updated in place */
+        double *sigma;
+        double *varsigma; /* NULL unless normal model */
+        int *varsigmaSetToZero; /* NULL unless slot exists */
+        double *scaleTheta; /* NULL for normal model */
+        double *scaleThetaMultiplier; /* NULL for normal model */
+        int *nAcceptTheta; /* NULL for normal model */
+        double *nAcceptThetaAdapt; /* NULL for normal model */
+        int *nFailedPropTheta;
+
+        /* betas and priors */
+        int nBeta;
+        int maxJ;
+        int *J;
+        double **betas;
+        double **meansBetas;
+        double **variancesBetas;
+        int **allStrucZero;
+        SEXP *priors; /* prior objects, with slots not resolved */
+        int *betaEqualsMean;
+        SEXP iteratorBetas_R;
+        /* NULL until set up by 'getBetaIndices' */
+        int *betaIndices; /* nTheta x nBeta, from 'makeBetaIndices' */
+        double *workTheta; /* work space, length nTheta */
+        double *vbar; /* work space, length maxJ */
+        int *nVec;    /* work space, length maxJ */
+        double *betaDelta; /* work space, length maxJ */
+
+        /* running quantities */
+        double sumSqResid; /* sum of (thetaTransformed - mu)^2 over cells in likelihood */
+        int nSumSqResid;
+        int hasSumSqResid; /* 1 if set by theta update and not yet used */
+        int nUpdateMu; /* updates since mu last calculated from scratch */
+    } ModelState;
+
+    int usesModelState(int i_method_model);
+
+    int modelHasBetas(int i_method_model);
+
+    void initModelState(ModelState *state, SEXP object_R,
+                        SEXP y_R, SEXP exposure_R);
+
+    int * getBetaIndices(ModelState *state);
+
+    void prepareModelState(ModelState *state, SEXP object_R,
+                           SEXP y_R, SEXP exposure_R);
+
+    void setModelStateExposure(ModelState *state, SEXP exposure_R);
+
+    void updateModelState(ModelState *state);
+
+    void updateModelStateBetasAndPriors(ModelState *state);
+
+    int thetaUpdateIsThreadSafe(ModelState *state);
+
+    void updateModelStateTheta(ModelState *state);
+
+    void updateModelStateRest(ModelState *state);
+
+    void recordModelStateAccept(ModelState *state);
+
+    /* functions from update-nongeneric.c */
+    void updateBetasInternal(ModelState *state);
+    void updateBetasAndMuInternal(ModelState *state);
+    void updateMeansBetasInternal(ModelState *state);
+    void updateMuInternal(ModelState *state);
+    void updatePriorsBetasInternal(ModelState *state);
+    void updateSigma_VaryingInternal(ModelState *state);
+    void updateTheta_BinomialVaryingInternal(ModelState *state);
+    void updateTheta_NormalVaryingInternal(ModelState *state);
+    void updateTheta_PoissonVaryingNotUseExpInternal(ModelState *state);
+    void updateTheta_PoissonVaryingUseExpInternal(ModelState *state);
+    void updateVariancesBetasInternal(ModelState *state);
+
+#endif
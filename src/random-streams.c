@@ -0,0 +1,401 @@
+#include "random-streams.h"
+#include "demest.h"
+
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+/* File "random-streams.c" contains the counter-based random
+ * number generator described in "random-streams.h". */
+
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_N_ROUND 10
+
+/* cell used for draws made outside 'setStreamCell' */
+#define STREAM_CELL_SERIAL 0xFFFFFFFFU
+
+/* The high word of the stage is zero unless there have been
+   2^32 stages, so inside a task its upper bits hold the task,
+   and its lower bits the stage within the task */
+#define STREAM_TASK_SHIFT 20
+#define STREAM_TASK_STAGE_MASK 0xFFFFFU
+
+typedef struct RngStream {
+    uint32_t counter[4]; /* cell, block, stage (low), stage (high) */
+    uint32_t output[4];
+    int nLeft; /* unused values in 'output' */
+} RngStream;
+
+static int rngUseCounter = 0;
+static int rngNThread = 0; /* 0 if using OpenMP's default */
+static int rngNThreadMax = 0; /* 0 if no limit */
+static int rngThreadsUsed = 0; /* whether threads have been started */
+static uint32_t rngKey[2] = {0U, 0U};
+static uint64_t rngStage = 0U;
+static __thread RngStream rngCurrent;
+static __thread uint32_t rngTask = 0U; /* 0 if not in a task, otherwise task + 1 */
+static __thread uint32_t rngTaskStage = 0U;
+
+
+static __inline__ void
+mulhilo32(uint32_t a, uint32_t b, uint32_t *hi, uint32_t *lo)
+{
+    uint64_t product = (uint64_t)a * (uint64_t)b;
+    *hi = (uint32_t)(product >> 32);
+    *lo = (uint32_t)product;
+}
+
+static void
+philox4x32(const uint32_t *counter, uint32_t *ans)
+{
+    uint32_t x0 = counter[0], x1 = counter[1], x2 = counter[2], x3 = counter[3];
+    uint32_t k0 = rngKey[0], k1 = rngKey[1];
+    for (int r = 0; r < PHILOX_N_ROUND; ++r) {
+        uint32_t hi0, lo0, hi1, lo1;
+        mulhilo32(PHILOX_M0, x0, &hi0, &lo0);
+        mulhilo32(PHILOX_M1, x2, &hi1, &lo1);
+        x0 = hi1 ^ x1 ^ k0;
+        x1 = lo1;
+        x2 = hi0 ^ x3 ^ k1;
+        x3 = lo0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    ans[0] = x0;
+    ans[1] = x1;
+    ans[2] = x2;
+    ans[3] = x3;
+}
+
+static void
+resetStream(RngStream *stream, uint32_t cell)
+{
+    stream->counter[0] = cell;
+    stream->counter[1] = 0U;
+    stream->counter[2] = (uint32_t)rngStage;
+    stream->counter[3] = (uint32_t)(rngStage >> 32);
+    if (rngTask > 0U)
+        stream->counter[3] ^= ((rngTask << STREAM_TASK_SHIFT)
+                               | (rngTaskStage & STREAM_TASK_STAGE_MASK));
+    stream->nLeft = 0;
+}
+
+static __inline__ uint32_t
+nextUint32(void)
+{
+    RngStream *stream = &rngCurrent;
+    if (stream->nLeft == 0) {
+        philox4x32(stream->counter, stream->output);
+        ++stream->counter[1];
+        stream->nLeft = 4;
+    }
+    --stream->nLeft;
+    return stream->output[stream->nLeft];
+}
+
+/* uniform on (0, 1), with 53 bits of precision */
+static __inline__ double
+nextUnif(void)
+{
+    uint32_t a = nextUint32() >> 5;
+    uint32_t b = nextUint32() >> 6;
+    return (a * 67108864.0 + b + 0.5) / 9007199254740992.0;
+}
+
+/* Marsaglia and Tsang (2000) */
+static double
+nextGamma(double shape)
+{
+    if (shape < 1) {
+        double u = nextUnif();
+        return nextGamma(1 + shape) * pow(u, 1 / shape);
+    }
+    double d = shape - 1.0 / 3.0;
+    double c = 1 / sqrt(9 * d);
+    while (1) {
+        double x, v;
+        do {
+            x = qnorm(nextUnif(), 0, 1, 1, 0);
+            v = 1 + c * x;
+        } while (v <= 0);
+        v = v * v * v;
+        double u = nextUnif();
+        if (u < 1 - 0.0331 * x * x * x * x)
+            return d * v;
+        if (log(u) < 0.5 * x * x + d * (1 - v + log(v)))
+            return d * v;
+    }
+}
+
+
+/* ******************************************************************************** */
+/* Setting up streams ************************************************************* */
+/* ******************************************************************************** */
+
+void
+setCounterRNG(int use_counter, unsigned int seed_1, unsigned int seed_2)
+{
+    rngUseCounter = use_counter;
+    rngKey[0] = (uint32_t)seed_1;
+    rngKey[1] = (uint32_t)seed_2;
+    rngStage = 0U;
+    resetStream(&rngCurrent, STREAM_CELL_SERIAL);
+}
+
+int
+usesCounterRNG(void)
+{
+    return rngUseCounter;
+}
+
+/* Set the number of threads used by parallel regions.
+   If 'n_thread' is 0, OpenMP's default is used. */
+void
+setCounterRNGThreads(int n_thread)
+{
+    rngNThread = n_thread;
+}
+
+/* Set the largest number of threads used by parallel
+   regions, whatever 'setCounterRNGThreads' asks for.
+   If 'n_thread_max' is 0, there is no limit. */
+void
+setCounterRNGThreadsMax(int n_thread_max)
+{
+    rngNThreadMax = n_thread_max;
+}
+
+int
+nCounterRNGThreads(void)
+{
+#ifdef _OPENMP
+    int ans = (rngNThread > 0) ? rngNThread : omp_get_max_threads();
+#else
+    int ans = 1;
+#endif
+    if ((rngNThreadMax > 0) && (ans > rngNThreadMax))
+        ans = rngNThreadMax;
+    return ans;
+}
+
+/* The 'n_cell' cells of a model can be updated by parallel
+   threads if counter-based streams are being used, the update
+   is not already running as a task, more than one thread is
+   available, and there are enough cells to make it worthwhile. */
+int
+usesCounterRNGThreads(int n_cell)
+{
+    int ans = (rngUseCounter
+               && (rngTask == 0U)
+               && (n_cell >= K_MIN_CELLS_THREADS)
+               && (nCounterRNGThreads() > 1));
+    if (ans)
+        rngThreadsUsed = 1;
+    return ans;
+}
+
+/* The 'n_task' tasks can be run by parallel threads if there
+   is more than one of them, and more than one thread is
+   available. */
+int
+usesCounterRNGTasks(int n_task)
+{
+    int ans = (n_task > 1) && (nCounterRNGThreads() > 1);
+    if (ans)
+        rngThreadsUsed = 1;
+    return ans;
+}
+
+int
+counterRNGThreadsUsed(void)
+{
+    return rngThreadsUsed;
+}
+
+/* Must not be called from inside a parallel region,
+   except within a task. */
+void
+newStreamStage(void)
+{
+    if (rngUseCounter) {
+        if (rngTask > 0U)
+            ++rngTaskStage;
+        else
+            ++rngStage;
+        resetStream(&rngCurrent, STREAM_CELL_SERIAL);
+    }
+}
+
+void
+setStreamCell(int i)
+{
+    if (rngUseCounter)
+        resetStream(&rngCurrent, (uint32_t)i);
+}
+
+/* 'task' is between 0 and 4094. The caller starts a new
+   stage before the tasks, so tasks run as part of
+   different updates do not share streams. */
+void
+beginStreamTask(int task)
+{
+    if (rngUseCounter) {
+        rngTask = (uint32_t)task + 1U;
+        rngTaskStage = 0U;
+        resetStream(&rngCurrent, STREAM_CELL_SERIAL);
+    }
+}
+
+void
+endStreamTask(void)
+{
+    if (rngUseCounter) {
+        rngTask = 0U;
+        rngTaskStage = 0U;
+        resetStream(&rngCurrent, STREAM_CELL_SERIAL);
+    }
+}
+
+void
+getCounterRNGState(unsigned int *state)
+{
+    state[0] = (unsigned int)rngUseCounter;
+    state[1] = rngKey[0];
+    state[2] = rngKey[1];
+    state[3] = (unsigned int)rngStage;
+    state[4] = (unsigned int)(rngStage >> 32);
+    for (int i = 0; i < 4; ++i) {
+        state[5 + i] = rngCurrent.counter[i];
+        state[9 + i] = rngCurrent.output[i];
+    }
+    state[13] = (unsigned int)rngCurrent.nLeft;
+    state[14] = 0U; /* reserved */
+}
+
+void
+setCounterRNGState(const unsigned int *state)
+{
+    rngUseCounter = (int)state[0];
+    rngKey[0] = state[1];
+    rngKey[1] = state[2];
+    rngStage = ((uint64_t)state[4] << 32) | (uint64_t)state[3];
+    rngTask = 0U;
+    rngTaskStage = 0U;
+    for (int i = 0; i < 4; ++i) {
+        rngCurrent.counter[i] = state[5 + i];
+        rngCurrent.output[i] = state[9 + i];
+    }
+    rngCurrent.nLeft = (int)state[13];
+}
+
+SEXP
+setCounterRNG_R(SEXP useCounter_R, SEXP seed_R)
+{
+    int use_counter = *LOGICAL(useCounter_R);
+    int *seed = INTEGER(seed_R);
+    setCounterRNG(use_counter, (unsigned int)seed[0], (unsigned int)seed[1]);
+    return R_NilValue;
+}
+
+SEXP
+setCounterRNGThreads_R(SEXP nThread_R)
+{
+    int n_thread = *INTEGER(nThread_R);
+    setCounterRNGThreads(n_thread);
+    return R_NilValue;
+}
+
+SEXP
+setCounterRNGThreadsMax_R(SEXP nThreadMax_R)
+{
+    int n_thread_max = *INTEGER(nThreadMax_R);
+    setCounterRNGThreadsMax(n_thread_max);
+    return R_NilValue;
+}
+
+SEXP
+nCounterRNGThreads_R(void)
+{
+    return ScalarInteger(nCounterRNGThreads());
+}
+
+SEXP
+counterRNGThreadsUsed_R(void)
+{
+    return ScalarLogical(counterRNGThreadsUsed());
+}
+
+
+/* ******************************************************************************** */
+/* Drawing values ***************************************************************** */
+/* ******************************************************************************** */
+
+/* The counter-based versions use inversion where Rmath supplies
+   a quantile function, which keeps the number of uniforms
+   used per draw fixed. */
+
+double
+runifStream(double a, double b)
+{
+    if (rngUseCounter)
+        return a + (b - a) * nextUnif();
+    else
+        return runif(a, b);
+}
+
+double
+rnormStream(double mean, double sd)
+{
+    if (rngUseCounter) {
+        if (sd == 0)
+            return mean;
+        return mean + sd * qnorm(nextUnif(), 0, 1, 1, 0);
+    }
+    else
+        return rnorm(mean, sd);
+}
+
+double
+rpoisStream(double lambda)
+{
+    if (rngUseCounter)
+        return qpois(nextUnif(), lambda, 1, 0);
+    else
+        return rpois(lambda);
+}
+
+double
+rbinomStream(double size, double prob)
+{
+    if (rngUseCounter)
+        return qbinom(nextUnif(), size, prob, 1, 0);
+    else
+        return rbinom(size, prob);
+}
+
+double
+rgammaStream(double shape, double scale)
+{
+    if (rngUseCounter)
+        return scale * nextGamma(shape);
+    else
+        return rgamma(shape, scale);
+}
+
+double
+rgeomStream(double prob)
+{
+    if (rngUseCounter) {
+        if (prob == 1)
+            return 0;
+        return floor(log(nextUnif()) / log1p(-prob));
+    }
+    else
+        return rgeom(prob);
+}
@@ -0,0 +1,81 @@
+#ifndef __RANDOM_STREAMS_H__
+#define __RANDOM_STREAMS_H__
+
+    #include <Rinternals.h>
+
+    /* Random numbers for the samplers.
+     *
+     * By default, the functions below are thin wrappers around
+     * R's own generators (rnorm, runif, etc), so that results are
+     * the same as if R's generators had been called directly.
+     *
+     * After a call to 'setCounterRNG' with 'use_counter' true,
+     * they instead use a counter-based generator (Philox4x32-10,
+     * Salmon et al 2011). Each draw is a deterministic function of
+     * the key (set from the chain's seed), the stage, the cell,
+     * and the position of the draw within the cell. A new stage
+     * is started, serially, by each update step that uses the
+     * generator, so stages also count iterations. Code that updates
+     * cells in parallel calls 'setStreamCell' before drawing values
+     * for a cell, which makes the draws independent of how cells
+     * are divided between threads.
+     *
+     * Independent updates, such as those for the system models
+     * of an account, can also run side by side as tasks. Code
+     * running a task calls 'beginStreamTask' and 'endStreamTask'
+     * around it. Inside a task, stages are counted separately
+     * for that task, and draws are keyed by the task as well as
+     * the stage and cell, so each task has its own streams.
+     *
+     * The stream being drawn from is held per thread.
+     *
+     * Parallel regions use the number of threads set by
+     * 'setCounterRNGThreads', or OpenMP's default if none has
+     * been set, but no more than the limit set by
+     * 'setCounterRNGThreadsMax', which is used when several
+     * chains share the cores. Cells are only updated by parallel
+     * threads if there are at least K_MIN_CELLS_THREADS of them:
+     * for smaller models, starting and joining the threads costs
+     * more than the updates themselves. Tasks are only run in
+     * parallel if there is more than one of them.
+     *
+     * A forked copy of a process that has already started OpenMP
+     * threads cannot reliably start threads of its own, so
+     * 'counterRNGThreadsUsed' records whether any have been
+     * started. */
+
+    /* number of words in the state saved by 'getCounterRNGState' */
+    #define K_LENGTH_COUNTER_RNG_STATE 15
+
+    /* smallest number of cells updated by parallel threads */
+    #define K_MIN_CELLS_THREADS 1000
+
+    void setCounterRNG(int use_counter, unsigned int seed_1,
+                       unsigned int seed_2);
+    int usesCounterRNG(void);
+    void setCounterRNGThreads(int n_thread);
+    void setCounterRNGThreadsMax(int n_thread_max);
+    int nCounterRNGThreads(void);
+    int usesCounterRNGThreads(int n_cell);
+    int usesCounterRNGTasks(int n_task);
+    int counterRNGThreadsUsed(void);
+    void newStreamStage(void);
+    void setStreamCell(int i);
+    void beginStreamTask(int task);
+    void endStreamTask(void);
+
+    /* Copy the state of the counter-based generator, including
+     * the position in the current serial stream, to or from
+     * 'state', which has length K_LENGTH_COUNTER_RNG_STATE.
+     * Must not be called from inside a task or parallel region. */
+    void getCounterRNGState(unsigned int *state);
+    void setCounterRNGState(const unsigned int *state);
+
+    double runifStream(double a, double b);
+    double rnormStream(double mean, double sd);
+    double rpoisStream(double lambda);
+    double rbinomStream(double size, double prob);
+    double rgammaStream(double shape, double scale);
+    double rgeomStream(double prob);
+
+#endif
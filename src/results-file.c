@@ -0,0 +1,801 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for copy_file_range */
+#endif
+
+#include "results-file.h"
+#include "demest.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define RESULTS_FILE_USE_MMAP
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) \
+    && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 27)))
+#define RESULTS_FILE_USE_COPY_RANGE
+#endif
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+
+/* File "results-file.c" contains functions for converting values
+ * to and from the formats used in files of draws, for reading and
+ * overwriting draws in results files, for writing and reading transposed
+ * companions to results files, and for assembling and splitting
+ * results files, described in "results-file.h". */
+
+#define TRANSPOSED_MAGIC "DEMESTTR"
+
+typedef struct TransposedHeader {
+    char magic[8];
+    int version;
+    int lengthIter;
+    int nIteration;
+    int nIterChunk;
+    int64_t startDraws; /* offset of draws in results file */
+    int64_t sizeResultsFile; /* when companion was written */
+} TransposedHeader;
+
+/* first value in the header of a results file from version 2 on */
+#define RESULTS_FILE_MARKER -1
+
+/* sizes, in bytes, of the types of values, indexed by type */
+static const int64_t sizeOfType[] = { sizeof(double), sizeof(int), 1, sizeof(float) };
+
+/* Where the draws lie in a file, and how they are stored. The
+ * range, in bytes from the start of the file, that requests must
+ * lie in ends at the end of the file, rather than the start of the
+ * adjustments, since the recorded size of the adjustments is not
+ * always accurate while a file is being built. */
+typedef struct DrawsLayout {
+    int64_t start;
+    int64_t end;
+    int lengthIter; /* -1 if not recorded in file */
+    unsigned char *types; /* NULL if every value is a double */
+} DrawsLayout;
+
+static __inline__ const unsigned char *
+typesFrom(const unsigned char *types, int first)
+{
+    return (types == NULL) ? NULL : types + first;
+}
+
+/* Reads the header from the start of 'fp', which has 'size' bytes,
+ * leaving 'fp' at the start of the results object. Returns 0 if the
+ * header is not valid. */
+static int
+readHeader(DrawsLayout *layout, FILE *fp, int64_t size)
+{
+    int fields[5];
+    layout->end = size;
+    layout->lengthIter = -1;
+    layout->types = NULL;
+    if (fread(fields, sizeof(int), 2, fp) != 2)
+        return 0;
+    if (fields[0] >= 0) { /* version 1 */
+        layout->start = 2 * (int64_t)sizeof(int) + (int64_t)fields[0];
+        return layout->start <= layout->end;
+    }
+    if ((fields[0] != RESULTS_FILE_MARKER)
+        || (fields[1] != K_RESULTS_FILE_VERSION)
+        || (fread(fields + 2, sizeof(int), 3, fp) != 3)
+        || (fields[2] < 0) || (fields[4] < 0))
+        return 0;
+    int lengthIter = fields[4];
+    unsigned char *types = (unsigned char *)R_alloc(lengthIter > 0 ? lengthIter : 1,
+                                                    sizeof(unsigned char));
+    if (fread(types, 1, lengthIter, fp) != (size_t)lengthIter)
+        return 0;
+    for (int i = 0; i < lengthIter; ++i) {
+        if (types[i] > K_VALUE_FLOAT)
+            return 0;
+    }
+    layout->lengthIter = lengthIter;
+    layout->types = types;
+    layout->start = 5 * (int64_t)sizeof(int) + (int64_t)lengthIter
+        + (int64_t)fields[2];
+    return layout->start <= layout->end;
+}
+
+/* Returns 0 if every requested value lies within the draws */
+static int
+findInvalidRequest(DrawsLayout *layout, int first, int lengthData,
+                   int lengthIter, int nIter, const int *iterations)
+{
+    if ((first < 0) || (lengthData < 0) || (first + lengthData > lengthIter)
+        || ((layout->lengthIter >= 0) && (layout->lengthIter != lengthIter)))
+        return -1;
+    int64_t nIterFile = (layout->end - layout->start)
+        / sizeOfValues(layout->types, lengthIter);
+    for (int i = 0; i < nIter; ++i) {
+        if ((iterations[i] < 1) || (iterations[i] > nIterFile))
+            return iterations[i];
+    }
+    return 0;
+}
+
+static void
+errorInvalidRequest(int invalid, const char *filename, int first,
+                    int lengthData)
+{
+    if (invalid == -1)
+        error("invalid request for values %d to %d from file %s",
+              first + 1, first + lengthData, filename);
+    else
+        error("file %s does not contain iteration %d", filename, invalid);
+}
+
+static __inline__ int64_t
+offsetDraws(DrawsLayout *layout, int64_t bytesBefore, int64_t bytesIter,
+            int iteration)
+{
+    return layout->start + (int64_t)(iteration - 1) * bytesIter + bytesBefore;
+}
+
+int64_t
+sizeOfValues(const unsigned char *types, int64_t n)
+{
+    if (types == NULL)
+        return n * (int64_t)sizeof(double);
+    int64_t ans = 0;
+    for (int64_t i = 0; i < n; ++i)
+        ans += sizeOfType[types[i]];
+    return ans;
+}
+
+void
+encodeValues(unsigned char *to, const double *from,
+             const unsigned char *types, int64_t n)
+{
+    if (types == NULL) {
+        memcpy(to, from, (size_t)n * sizeof(double));
+        return;
+    }
+    for (int64_t i = 0; i < n; ++i) {
+        double x = from[i];
+        switch(types[i]) {
+            case K_VALUE_INT:
+                {
+                    int value = ISNAN(x) ? NA_INTEGER : (int)x;
+                    memcpy(to, &value, sizeof(int));
+                    to += sizeof(int);
+                }
+                break;
+            case K_VALUE_LOGICAL:
+                *to = ISNAN(x) ? K_NA_LOGICAL_BYTE : (x != 0);
+                ++to;
+                break;
+            case K_VALUE_FLOAT:
+                {
+                    float value = ISNAN(x) ? (float)R_NaN : (float)x;
+                    memcpy(to, &value, sizeof(float));
+                    to += sizeof(float);
+                }
+                break;
+            default:
+                memcpy(to, &x, sizeof(double));
+                to += sizeof(double);
+        }
+    }
+}
+
+void
+decodeValues(double *to, const unsigned char *from,
+             const unsigned char *types, int64_t n)
+{
+    if (types == NULL) {
+        memcpy(to, from, (size_t)n * sizeof(double));
+        return;
+    }
+    for (int64_t i = 0; i < n; ++i) {
+        switch(types[i]) {
+            case K_VALUE_INT:
+                {
+                    int value;
+                    memcpy(&value, from, sizeof(int));
+                    to[i] = (value == NA_INTEGER) ? NA_REAL : (double)value;
+                    from += sizeof(int);
+                }
+                break;
+            case K_VALUE_LOGICAL:
+                to[i] = (*from == K_NA_LOGICAL_BYTE) ? NA_REAL : (double)*from;
+                ++from;
+                break;
+            case K_VALUE_FLOAT:
+                {
+                    float value;
+                    memcpy(&value, from, sizeof(float));
+                    to[i] = ISNAN(value) ? NA_REAL : (double)value;
+                    from += sizeof(float);
+                }
+                break;
+            default:
+                memcpy(to + i, from, sizeof(double));
+                from += sizeof(double);
+        }
+    }
+}
+
+static char *
+makeTransposedName(const char *filename)
+{
+    size_t nChar = strlen(filename);
+    size_t nSuffix = strlen(K_TRANSPOSED_SUFFIX);
+    char *ans = (char *)R_alloc(nChar + nSuffix + 1, sizeof(char));
+    memcpy(ans, filename, nChar);
+    memcpy(ans + nChar, K_TRANSPOSED_SUFFIX, nSuffix + 1);
+    return ans;
+}
+
+/* Returns -1 if 'filename' cannot be opened */
+static int64_t
+sizeOfFile(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return -1;
+    fseek64(fp, 0, SEEK_END);
+    int64_t ans = (int64_t)ftell64(fp);
+    fclose(fp);
+    return ans;
+}
+
+static __inline__ int64_t
+offsetTransposed(TransposedHeader *header, int j, int iteration)
+{
+    int iterStart = ((iteration - 1) / header->nIterChunk) * header->nIterChunk;
+    int nInChunk = header->nIteration - iterStart;
+    if (nInChunk > header->nIterChunk)
+        nInChunk = header->nIterChunk;
+    return (int64_t)sizeof(TransposedHeader)
+        + ((int64_t)iterStart * (int64_t)header->lengthIter
+           + (int64_t)j * (int64_t)nInChunk
+           + (int64_t)(iteration - 1 - iterStart))
+        * (int64_t)sizeof(double);
+}
+
+/* Returns 0 if the header does not describe an up-to-date
+ * companion holding every requested value */
+static int
+isUsableTransposed(TransposedHeader *header, const char *filename,
+                   int first, int lengthData, int lengthIter,
+                   int nIter, const int *iterations)
+{
+    if ((memcmp(header->magic, TRANSPOSED_MAGIC, 8) != 0)
+        || (header->version != K_TRANSPOSED_VERSION)
+        || (header->lengthIter != lengthIter)
+        || (header->nIterChunk < 1)
+        || (header->sizeResultsFile != sizeOfFile(filename)))
+        return 0;
+    if ((first < 0) || (lengthData < 0) || (first + lengthData > lengthIter))
+        return 0;
+    for (int i = 0; i < nIter; ++i) {
+        if ((iterations[i] < 1) || (iterations[i] > header->nIteration))
+            return 0;
+        if ((i > 0) && (iterations[i] < iterations[i - 1]))
+            return 0;
+    }
+    return 1;
+}
+
+/* Returns 0, without reading anything, if 'filename' does not
+ * have a usable transposed companion. Otherwise, for each
+ * parameter, reads the run of draws from the first to the last
+ * requested iteration within each chunk, in one go. */
+static int
+readDrawsFromTransposed(double *ans, const char *filename, int first,
+                        int lengthData, int lengthIter, int nIter,
+                        const int *iterations)
+{
+    const char *nameTr = makeTransposedName(filename);
+    FILE *fp = fopen(nameTr, "rb");
+    if (fp == NULL)
+        return 0;
+    TransposedHeader header;
+    if ((fread(&header, sizeof(TransposedHeader), 1, fp) != 1)
+        || !isUsableTransposed(&header, filename, first, lengthData,
+                               lengthIter, nIter, iterations)) {
+        fclose(fp);
+        return 0;
+    }
+    int nIterChunk = header.nIterChunk;
+    double *run = (double *)R_alloc(nIterChunk, sizeof(double));
+    for (int jj = 0; jj < lengthData; ++jj) {
+        int i = 0;
+        while (i < nIter) {
+            int iChunk = (iterations[i] - 1) / nIterChunk;
+            int iEnd = i + 1;
+            while ((iEnd < nIter) && ((iterations[iEnd] - 1) / nIterChunk == iChunk))
+                ++iEnd;
+            int iterFirst = iterations[i];
+            int nRun = iterations[iEnd - 1] - iterFirst + 1;
+            int64_t offset = offsetTransposed(&header, first + jj, iterFirst);
+            if ((fseek64(fp, offset, SEEK_SET) != 0)
+                || (fread(run, sizeof(double), nRun, fp) != (size_t)nRun)) {
+                fclose(fp);
+                error("could not successfully read file %s", nameTr);
+            }
+            for (; i < iEnd; ++i)
+                ans[(int64_t)i * lengthData + jj] = run[iterations[i] - iterFirst];
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+
+void
+writeTransposedFile(const char *filename, int lengthIter,
+                    int nIteration, int nIterChunk)
+{
+    if ((lengthIter < 1) || (nIteration < 0) || (nIterChunk < 1))
+        error("invalid request to transpose file %s", filename);
+    if (nIterChunk > nIteration)
+        nIterChunk = (nIteration > 0) ? nIteration : 1;
+
+    int64_t size = sizeOfFile(filename);
+    FILE *fpIn = fopen(filename, "rb");
+    if (fpIn == NULL)
+        error("could not open file %s", filename); /* terminates now */
+    DrawsLayout layout;
+    if (!readHeader(&layout, fpIn, size)
+        || ((layout.lengthIter >= 0) && (layout.lengthIter != lengthIter))
+        || (layout.end - layout.start
+            < (int64_t)nIteration * sizeOfValues(layout.types, lengthIter))
+        || (fseek64(fpIn, layout.start, SEEK_SET) != 0)) {
+        fclose(fpIn);
+        error("could not successfully read file %s", filename);
+    }
+    int64_t bytesIter = sizeOfValues(layout.types, lengthIter);
+
+    TransposedHeader header;
+    memset(&header, 0, sizeof(TransposedHeader));
+    memcpy(header.magic, TRANSPOSED_MAGIC, 8);
+    header.version = K_TRANSPOSED_VERSION;
+    header.lengthIter = lengthIter;
+    header.nIteration = nIteration;
+    header.nIterChunk = nIterChunk;
+    header.startDraws = layout.start;
+    header.sizeResultsFile = size;
+
+    const char *nameTr = makeTransposedName(filename);
+    size_t nChar = strlen(nameTr);
+    char *tmpname = (char *)R_alloc(nChar + 5, sizeof(char));
+    memcpy(tmpname, nameTr, nChar);
+    memcpy(tmpname + nChar, ".tmp", 5);
+
+    FILE *fpOut = fopen(tmpname, "wb");
+    if (fpOut == NULL) {
+        fclose(fpIn);
+        error("could not open file %s", tmpname);
+    }
+    size_t nBuffer = (size_t)nIterChunk * (size_t)lengthIter;
+    double *iterMajor = (double *)R_alloc(nBuffer, sizeof(double));
+    double *paramMajor = (double *)R_alloc(nBuffer, sizeof(double));
+    unsigned char *stored = (unsigned char *)R_alloc((size_t)nIterChunk * (size_t)bytesIter,
+                                                     sizeof(unsigned char));
+    int ok = (fwrite(&header, sizeof(TransposedHeader), 1, fpOut) == 1);
+    for (int iterStart = 0; ok && (iterStart < nIteration); iterStart += nIterChunk) {
+        int nInChunk = nIteration - iterStart;
+        if (nInChunk > nIterChunk)
+            nInChunk = nIterChunk;
+        size_t nValue = (size_t)nInChunk * (size_t)lengthIter;
+        size_t nBytes = (size_t)nInChunk * (size_t)bytesIter;
+        ok = (fread(stored, 1, nBytes, fpIn) == nBytes);
+        if (ok) {
+            for (int i = 0; i < nInChunk; ++i)
+                decodeValues(iterMajor + (size_t)i * lengthIter,
+                             stored + (size_t)i * bytesIter,
+                             layout.types, lengthIter);
+            for (int j = 0; j < lengthIter; ++j) {
+                double *to = paramMajor + (size_t)j * nInChunk;
+                const double *from = iterMajor + j;
+                for (int i = 0; i < nInChunk; ++i)
+                    to[i] = from[(size_t)i * lengthIter];
+            }
+            ok = (fwrite(paramMajor, sizeof(double), nValue, fpOut) == nValue);
+        }
+    }
+    fclose(fpIn);
+    if (fclose(fpOut) != 0)
+        ok = 0;
+    if (!ok) {
+        remove(tmpname);
+        error("unsuccessful transposition of file %s", filename);
+    }
+#ifdef _WIN32
+    remove(nameTr); /* 'rename' does not replace existing files */
+#endif
+    if (rename(tmpname, nameTr) != 0)
+        error("could not rename file %s to %s", tmpname, nameTr);
+}
+
+
+#ifdef RESULTS_FILE_USE_MMAP
+
+void
+readDrawsFromFile(double *ans, const char *filename,
+                  int hasHeader, int first, int lengthData,
+                  int lengthIter, int nIter, const int *iterations)
+{
+    if ((nIter == 0) || (lengthData == 0))
+        return;
+    if (hasHeader && readDrawsFromTransposed(ans, filename, first, lengthData,
+                                             lengthIter, nIter, iterations))
+        return;
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        error("could not open file %s", filename); /* terminates now */
+    struct stat st;
+    if ((fstat(fileno(fp), &st) != 0) || (st.st_size == 0)) {
+        fclose(fp);
+        error("could not successfully read file %s", filename);
+    }
+    int64_t size = (int64_t)st.st_size;
+    DrawsLayout layout = { 0, size, -1, NULL };
+    if (hasHeader && !readHeader(&layout, fp, size)) {
+        fclose(fp);
+        error("could not successfully read file %s", filename);
+    }
+    void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    fclose(fp); /* mapping stays valid */
+    if (map == MAP_FAILED)
+        error("could not map file %s", filename);
+    const unsigned char *bytes = (const unsigned char *)map;
+
+    int invalid = findInvalidRequest(&layout, first, lengthData, lengthIter,
+                                     nIter, iterations);
+    if (invalid != 0) {
+        munmap(map, (size_t)size);
+        errorInvalidRequest(invalid, filename, first, lengthData);
+    }
+
+    /* if the gaps between blocks span at least a page, only the
+       pages holding the blocks need to be read, and read-ahead
+       would waste effort */
+    const unsigned char *typesData = typesFrom(layout.types, first);
+    int64_t bytesBefore = sizeOfValues(layout.types, first);
+    int64_t bytesData = sizeOfValues(typesData, lengthData);
+    int64_t bytesIter = sizeOfValues(layout.types, lengthIter);
+    int64_t bytesGap = bytesIter - bytesData;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    madvise(map, (size_t)size,
+            (bytesGap >= pageSize) ? MADV_RANDOM : MADV_SEQUENTIAL);
+
+    for (int i = 0; i < nIter; ++i) {
+        int64_t offset = offsetDraws(&layout, bytesBefore, bytesIter, iterations[i]);
+        decodeValues(ans + (int64_t)i * lengthData, bytes + offset,
+                     typesData, lengthData);
+    }
+    munmap(map, (size_t)size);
+}
+
+#else
+
+void
+readDrawsFromFile(double *ans, const char *filename,
+                  int hasHeader, int first, int lengthData,
+                  int lengthIter, int nIter, const int *iterations)
+{
+    if ((nIter == 0) || (lengthData == 0))
+        return;
+    if (hasHeader && readDrawsFromTransposed(ans, filename, first, lengthData,
+                                             lengthIter, nIter, iterations))
+        return;
+    FILE *fp = fopen(filename, "rb"); /* binary mode */
+    if (NULL == fp)
+        error("could not open file %s", filename); /* terminates now */
+    _fseeki64(fp, 0, SEEK_END);
+    int64_t size = _ftelli64(fp);
+    rewind(fp);
+
+    DrawsLayout layout = { 0, size, -1, NULL };
+    if (hasHeader && !readHeader(&layout, fp, size)) {
+        fclose(fp);
+        error("could not successfully read file %s", filename);
+    }
+    int invalid = findInvalidRequest(&layout, first, lengthData, lengthIter,
+                                     nIter, iterations);
+    if (invalid != 0) {
+        fclose(fp);
+        errorInvalidRequest(invalid, filename, first, lengthData);
+    }
+
+    const unsigned char *typesData = typesFrom(layout.types, first);
+    int64_t bytesBefore = sizeOfValues(layout.types, first);
+    int64_t bytesData = sizeOfValues(typesData, lengthData);
+    int64_t bytesIter = sizeOfValues(layout.types, lengthIter);
+    unsigned char *stored = (unsigned char *)R_alloc(bytesData, sizeof(unsigned char));
+    for (int i = 0; i < nIter; ++i) {
+        int64_t offset = offsetDraws(&layout, bytesBefore, bytesIter, iterations[i]);
+        _fseeki64(fp, offset, SEEK_SET);
+        size_t nRead = fread(stored, 1, bytesData, fp);
+        if (nRead != (size_t)bytesData) {
+            fclose(fp);
+            error("could not successfully read file %s", filename);
+        }
+        decodeValues(ans + (int64_t)i * lengthData, stored, typesData, lengthData);
+    }
+    fclose(fp);
+}
+
+#endif
+
+
+void
+overwriteDrawsInFile(const char *filename, const double *values,
+                     int first, int lengthData, int lengthIter, int nIter)
+{
+    int64_t size = sizeOfFile(filename);
+    FILE *fp = fopen(filename, "r+b"); /* binary mode, with updating */
+    if (fp == NULL)
+        error("could not open file %s", filename); /* terminates now */
+    DrawsLayout layout;
+    if (!readHeader(&layout, fp, size)) {
+        fclose(fp);
+        error("could not successfully read file %s", filename);
+    }
+    if ((first < 0) || (lengthData < 0) || (first + lengthData > lengthIter)
+        || ((layout.lengthIter >= 0) && (layout.lengthIter != lengthIter))) {
+        fclose(fp);
+        errorInvalidRequest(-1, filename, first, lengthData);
+    }
+    const unsigned char *typesData = typesFrom(layout.types, first);
+    int64_t bytesBefore = sizeOfValues(layout.types, first);
+    int64_t bytesData = sizeOfValues(typesData, lengthData);
+    int64_t bytesIter = sizeOfValues(layout.types, lengthIter);
+    if (layout.end - layout.start < (int64_t)nIter * bytesIter) {
+        fclose(fp);
+        error("file %s does not contain iteration %d", filename, nIter);
+    }
+    unsigned char *stored = (unsigned char *)R_alloc(bytesData > 0 ? bytesData : 1,
+                                                     sizeof(unsigned char));
+    int ok = 1;
+    for (int i = 0; ok && (i < nIter); ++i) {
+        encodeValues(stored, values + (int64_t)i * lengthData, typesData, lengthData);
+        int64_t offset = offsetDraws(&layout, bytesBefore, bytesIter, i + 1);
+        ok = ((fseek64(fp, offset, SEEK_SET) == 0)
+              && (fwrite(stored, 1, bytesData, fp) == (size_t)bytesData));
+    }
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (!ok)
+        error("could not write to file %s", filename);
+}
+
+
+/* Copies 'nBytes' bytes from the current position in 'fpIn' to
+ * the current position in 'fpOut', or, if 'nBytes' is negative,
+ * everything up to the end of 'fpIn'. 'buffer' must have space for
+ * K_SIZE_COPY_BUFFER bytes. Returns the number of bytes copied, or
+ * -1 if reading or writing failed. */
+static int64_t
+copyBytes(FILE *fpIn, FILE *fpOut, int64_t nBytes, char *buffer)
+{
+    int64_t nCopied = 0;
+#ifdef RESULTS_FILE_USE_COPY_RANGE
+    /* Ask the kernel to do the copying, which avoids passing the
+     * bytes through user space, and, on file systems that support
+     * it, shares the underlying blocks instead of duplicating them.
+     * If the kernel or file system cannot do the copy, fall back
+     * to the buffer, starting from wherever the kernel stopped. */
+    if (fflush(fpOut) != 0)
+        return -1;
+    off_t offsetIn = ftello(fpIn);
+    off_t offsetOut = ftello(fpOut);
+    if ((offsetIn >= 0) && (offsetOut >= 0)) {
+        int finished = 0;
+        while (!finished) {
+            size_t nWant = (size_t)1 << 30;
+            if ((nBytes >= 0) && (nBytes - nCopied < (int64_t)nWant))
+                nWant = (size_t)(nBytes - nCopied);
+            if (nWant == 0)
+                break;
+            ssize_t n = copy_file_range(fileno(fpIn), &offsetIn,
+                                        fileno(fpOut), &offsetOut, nWant, 0);
+            if (n <= 0) {
+                finished = (n == 0); /* end of 'fpIn' */
+                break;
+            }
+            nCopied += n;
+        }
+        if ((fseeko(fpIn, offsetIn, SEEK_SET) != 0)
+            || (fseeko(fpOut, offsetOut, SEEK_SET) != 0))
+            return -1;
+        if (finished)
+            return nCopied;
+    }
+#endif
+    while ((nBytes < 0) || (nCopied < nBytes)) {
+        size_t nWant = K_SIZE_COPY_BUFFER;
+        if ((nBytes >= 0) && (nBytes - nCopied < (int64_t)nWant))
+            nWant = (size_t)(nBytes - nCopied);
+        size_t nRead = fread(buffer, 1, nWant, fpIn);
+        if ((nRead > 0) && (fwrite(buffer, 1, nRead, fpOut) != nRead))
+            return -1;
+        nCopied += nRead;
+        if (nRead < nWant)
+            return ferror(fpIn) ? -1 : nCopied;
+    }
+    return nCopied;
+}
+
+void
+appendFiles(const char *filename, const char **filenamesIn, int nFile)
+{
+    /* not opened in append mode, which 'copy_file_range' rejects */
+    FILE *fpOut = fopen(filename, "r+b");
+    if (fpOut == NULL)
+        error("could not open file %s", filename); /* terminates now */
+    if (fseek64(fpOut, 0, SEEK_END) != 0) {
+        fclose(fpOut);
+        error("could not successfully read file %s", filename);
+    }
+    char *buffer = (char *)R_alloc(K_SIZE_COPY_BUFFER, sizeof(char));
+    for (int i = 0; i < nFile; ++i) {
+        FILE *fpIn = fopen(filenamesIn[i], "rb");
+        if (fpIn == NULL) {
+            fclose(fpOut);
+            error("could not open file %s", filenamesIn[i]);
+        }
+        int64_t nCopied = copyBytes(fpIn, fpOut, -1, buffer);
+        int readOK = !ferror(fpIn);
+        fclose(fpIn);
+        if (nCopied < 0) {
+            fclose(fpOut);
+            if (readOK)
+                error("unsuccessful write to file %s", filename);
+            else
+                error("could not successfully read file %s", filenamesIn[i]);
+        }
+        remove(filenamesIn[i]);
+    }
+    if (fclose(fpOut) != 0)
+        error("unsuccessful write to file %s", filename);
+}
+
+/* Returns 1 if 'n' values with types 'typesIn' are stored in
+ * the same way as values with types 'typesOut' */
+static int
+isSameTypes(const unsigned char *typesIn, const unsigned char *typesOut, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        int typeIn = (typesIn == NULL) ? K_VALUE_DOUBLE : typesIn[i];
+        int typeOut = (typesOut == NULL) ? K_VALUE_DOUBLE : typesOut[i];
+        if (typeIn != typeOut)
+            return 0;
+    }
+    return 1;
+}
+
+/* Copies 'nIter' iterations from 'fpIn' to 'fpOut', converting
+ * them from 'typesIn' to 'typesOut'. Returns 0 if reading or
+ * writing failed. */
+static int
+convertIterations(FILE *fpIn, FILE *fpOut, int nIter, int lengthIter,
+                  const unsigned char *typesIn, const unsigned char *typesOut)
+{
+    int64_t bytesIn = sizeOfValues(typesIn, lengthIter);
+    int64_t bytesOut = sizeOfValues(typesOut, lengthIter);
+    unsigned char *storedIn = (unsigned char *)R_alloc(bytesIn, sizeof(unsigned char));
+    unsigned char *storedOut = (unsigned char *)R_alloc(bytesOut, sizeof(unsigned char));
+    double *values = (double *)R_alloc(lengthIter, sizeof(double));
+    for (int i = 0; i < nIter; ++i) {
+        if (fread(storedIn, 1, bytesIn, fpIn) != (size_t)bytesIn)
+            return 0;
+        decodeValues(values, storedIn, typesIn, lengthIter);
+        encodeValues(storedOut, values, typesOut, lengthIter);
+        if (fwrite(storedOut, 1, bytesOut, fpOut) != (size_t)bytesOut)
+            return 0;
+    }
+    return 1;
+}
+
+void
+splitResultsFile(const char *filename, const char **filenamesOut,
+                 int nFile, int lengthIter, int nIterFile,
+                 const unsigned char *typesOut)
+{
+    int64_t size = sizeOfFile(filename);
+    FILE *fpIn = fopen(filename, "rb");
+    if (fpIn == NULL)
+        error("could not open file %s", filename); /* terminates now */
+    DrawsLayout layout;
+    if ((lengthIter < 1)
+        || !readHeader(&layout, fpIn, size)
+        || ((layout.lengthIter >= 0) && (layout.lengthIter != lengthIter))
+        || (layout.end - layout.start
+            < (int64_t)nFile * (int64_t)nIterFile * sizeOfValues(layout.types, lengthIter))
+        || (fseek64(fpIn, layout.start, SEEK_SET) != 0)) {
+        fclose(fpIn);
+        error("could not successfully read file %s", filename);
+    }
+    int isSame = isSameTypes(layout.types, typesOut, lengthIter);
+    int64_t bytesFile = (int64_t)nIterFile * sizeOfValues(layout.types, lengthIter);
+    char *buffer = (char *)R_alloc(K_SIZE_COPY_BUFFER, sizeof(char));
+    for (int i = 0; i < nFile; ++i) {
+        FILE *fpOut = fopen(filenamesOut[i], "wb");
+        if (fpOut == NULL) {
+            fclose(fpIn);
+            error("could not open file %s", filenamesOut[i]);
+        }
+        int ok;
+        if (isSame)
+            ok = (copyBytes(fpIn, fpOut, bytesFile, buffer) == bytesFile);
+        else
+            ok = convertIterations(fpIn, fpOut, nIterFile, lengthIter,
+                                   layout.types, typesOut);
+        if (fclose(fpOut) != 0)
+            ok = 0;
+        if (!ok) {
+            fclose(fpIn);
+            error("unsuccessful write to file %s", filenamesOut[i]);
+        }
+    }
+    fclose(fpIn);
+}
+
+
+SEXP
+writeTransposedFile_R(SEXP filename_R, SEXP lengthIter_R,
+                      SEXP nIteration_R, SEXP nIterChunk_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int lengthIter = *INTEGER(lengthIter_R);
+    int nIteration = *INTEGER(nIteration_R);
+    int nIterChunk = *INTEGER(nIterChunk_R);
+    writeTransposedFile(filename, lengthIter, nIteration, nIterChunk);
+    return R_NilValue;
+}
+
+SEXP
+appendFiles_R(SEXP filename_R, SEXP filenamesIn_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int nFile = LENGTH(filenamesIn_R);
+    const char **filenamesIn = (const char **)R_alloc(nFile > 0 ? nFile : 1,
+                                                      sizeof(char *));
+    for (int i = 0; i < nFile; ++i)
+        filenamesIn[i] = CHAR(STRING_ELT(filenamesIn_R, i));
+    appendFiles(filename, filenamesIn, nFile);
+    return R_NilValue;
+}
+
+SEXP
+splitResultsFile_R(SEXP filename_R, SEXP filenamesOut_R,
+                   SEXP lengthIter_R, SEXP nIterFile_R, SEXP typesOut_R)
+{
+    const char *filename = CHAR(STRING_ELT(filename_R, 0));
+    int nFile = LENGTH(filenamesOut_R);
+    int lengthIter = *INTEGER(lengthIter_R);
+    int nIterFile = *INTEGER(nIterFile_R);
+    const unsigned char *typesOut = NULL; /* doubles */
+    if (!isNull(typesOut_R)) {
+        if (LENGTH(typesOut_R) != lengthIter)
+            error("'%s' does not have length %d", "typesOut", lengthIter);
+        typesOut = RAW(typesOut_R);
+        for (int i = 0; i < lengthIter; ++i) {
+            if (typesOut[i] > K_VALUE_FLOAT)
+                error("'%s' has invalid type", "typesOut");
+        }
+    }
+    const char **filenamesOut = (const char **)R_alloc(nFile > 0 ? nFile : 1,
+                                                       sizeof(char *));
+    for (int i = 0; i < nFile; ++i)
+        filenamesOut[i] = CHAR(STRING_ELT(filenamesOut_R, i));
+    splitResultsFile(filename, filenamesOut, nFile, lengthIter, nIterFile,
+                     typesOut);
+    return R_NilValue;
+}
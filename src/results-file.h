@@ -0,0 +1,143 @@
+#ifndef __RESULTS_FILE_H__
+#define __RESULTS_FILE_H__
+
+    #include <Rinternals.h>
+    #include <stdint.h>
+
+    /* version of the format of results files */
+    #define K_RESULTS_FILE_VERSION 2
+
+    /* version of the format of transposed files */
+    #define K_TRANSPOSED_VERSION 1
+
+    /* appended to the name of a results file to give the name
+     * of its transposed companion */
+    #define K_TRANSPOSED_SUFFIX "_transposed"
+
+    /* size, in bytes, of the buffer used when copying draws
+     * between files */
+    #define K_SIZE_COPY_BUFFER 8388608
+
+    /* Types of values in files of draws.
+     *
+     * Each value is stored at its native width: doubles take 8
+     * bytes, integers 4 bytes, with missing values stored as
+     * NA_INTEGER, and logicals 1 byte, with missing values stored
+     * as K_NA_LOGICAL_BYTE. Doubles can also be stored as 4-byte
+     * floats, in which case NA and NaN are both stored as NaN, and
+     * both read back as NA. Every iteration has the same types, so
+     * the types of one iteration, an array of 'lengthIter' codes,
+     * describe the whole file. A NULL array of types means that
+     * every value is a double.
+     *
+     * 'sizeOfValues' gives the number of bytes taken by 'n' values.
+     * 'encodeValues' converts 'n' doubles to the stored format, and
+     * 'decodeValues' converts them back. */
+    #define K_VALUE_DOUBLE 0
+    #define K_VALUE_INT 1
+    #define K_VALUE_LOGICAL 2
+    #define K_VALUE_FLOAT 3
+    #define K_NA_LOGICAL_BYTE 255
+
+    int64_t sizeOfValues(const unsigned char *types, int64_t n);
+    void encodeValues(unsigned char *to, const double *from,
+                      const unsigned char *types, int64_t n);
+    void decodeValues(double *to, const unsigned char *from,
+                      const unsigned char *types, int64_t n);
+
+    /* Reading draws from a file of results.
+     *
+     * Draws are stored one iteration after another, each iteration
+     * having 'lengthIter' values. A results file made by
+     * 'makeResultsFile' starts with a header. In version 2, the
+     * header holds -1 (which cannot be the first value of a version
+     * 1 header), the version, the sizes, in bytes, of the
+     * serialised results object and of the serialised adjustments,
+     * 'lengthIter', and the types of the values in an iteration,
+     * one byte each. The header is followed by the results object,
+     * then the draws, and then the adjustments. In version 1, the
+     * header holds just the two sizes, and every value is a double.
+     * A file written by 'estimateOneChain' holds just the draws.
+     *
+     * 'readDrawsFromFile' copies values 'first' to
+     * 'first' + 'lengthData' - 1 (counting from 0) of each of the
+     * 'nIter' iterations in 'iterations' (counting from 1, in
+     * increasing order) into 'ans', which must have space for
+     * 'nIter' * 'lengthData' values, converting them to doubles.
+     * If 'hasHeader' is 0, the file holds only doubles. Where the
+     * platform allows it, the file is memory-mapped, so that only
+     * the pages holding the requested values are read. Otherwise
+     * each block of values is read with a separate seek and read.
+     * Offsets are calculated with 64-bit integers. An error is
+     * raised if any of the requested values lies beyond the end
+     * of the file, or if the file records a different
+     * 'lengthIter'.
+     *
+     * If a results file has an up-to-date transposed companion,
+     * 'readDrawsFromFile' reads from the companion instead.
+     *
+     * 'overwriteDrawsInFile' replaces values 'first' to
+     * 'first' + 'lengthData' - 1 of each of the first 'nIter'
+     * iterations of a results file with the values in 'values',
+     * converting them to the types recorded in the header. */
+    void readDrawsFromFile(double *ans, const char *filename,
+                           int hasHeader, int first, int lengthData,
+                           int lengthIter, int nIter,
+                           const int *iterations);
+    void overwriteDrawsInFile(const char *filename, const double *values,
+                              int first, int lengthData, int lengthIter,
+                              int nIter);
+
+    /* Transposed companions to results files.
+     *
+     * Fetching a small batch of parameters from the
+     * iteration-major results file means visiting every
+     * iteration. 'writeTransposedFile' makes a companion file
+     * in which the draws are instead grouped by parameter. The
+     * iterations are divided into chunks of 'nIterChunk'
+     * iterations. Within each chunk, the draws for the first
+     * parameter come first, then the draws for the second
+     * parameter, and so on, so that the draws for a parameter
+     * are contiguous within each chunk. Chunks can be written
+     * one at a time, from a buffer holding 'nIterChunk'
+     * iterations, and a single chunk as large as the number of
+     * iterations gives a fully parameter-major file.
+     *
+     * The companion starts with a small index recording the
+     * version, 'lengthIter', the number of iterations, the
+     * chunk size, and the size of the results file when the
+     * companion was written. The companion is ignored, and the
+     * results file used instead, if the results file has since
+     * changed size, or if the index does not match the request.
+     * Functions that change the draws in the results file
+     * remove the companion. Draws in the companion are always
+     * stored as doubles. */
+    void writeTransposedFile(const char *filename, int lengthIter,
+                             int nIteration, int nIterChunk);
+
+    /* Assembling and splitting results files.
+     *
+     * 'appendFiles' adds the contents of each of the 'nFile' files
+     * in 'filenamesIn', in turn, to the end of 'filename', and
+     * removes each one once it has been copied, so that, at any
+     * time, at most one extra copy of a chain's draws is on disk.
+     * 'splitResultsFile' copies the draws in results file
+     * 'filename' into the 'nFile' files in 'filenamesOut', the
+     * first 'nIterFile' iterations going to the first file, the
+     * next 'nIterFile' iterations to the second, and so on,
+     * converting them to the types in 'typesOut' if these differ
+     * from the types recorded in the header.
+     *
+     * Where the platform provides 'copy_file_range', the copying
+     * is done by the kernel, which, on file systems that support
+     * it, shares blocks between the files rather than duplicating
+     * them. Otherwise bytes are copied through a buffer of
+     * K_SIZE_COPY_BUFFER bytes. Draws that have to be converted
+     * are copied one iteration at a time. */
+    void appendFiles(const char *filename, const char **filenamesIn,
+                     int nFile);
+    void splitResultsFile(const char *filename, const char **filenamesOut,
+                          int nFile, int lengthIter, int nIterFile,
+                          const unsigned char *typesOut);
+
+#endif
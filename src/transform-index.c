@@ -0,0 +1,882 @@
+#include "transform-index.h"
+#include "demest.h"
+
+
+/* File "transform-index.c" contains functions for compiling
+ * dembase transforms into the native form described in
+ * "transform-index.h", and for applying them. */
+
+extern SEXP
+  Data_sym,  /* used for .Data slot */
+  iMethodPrior_sym,
+  Z_sym,
+  beta_sym,
+  eta_sym,
+  gamma_sym,
+  lower_sym,
+  tau_sym,
+  tauMax_sym,
+  upper_sym,
+  order_sym,
+  iteratorBeta_sym,
+  iWithin_sym,
+  nWithin_sym,
+  iBetween_sym,
+  nBetween_sym,
+  incrementBetween_sym,
+  indices_sym,
+  initial_sym,
+  dimIterators_sym,
+  strideLengths_sym,
+  nStrides_sym,
+  dimBefore_sym,
+  dimAfter_sym,
+  posDim_sym,
+  lengthDim_sym,
+  iMethodModel_sym,
+  meansBetas_sym,
+  variancesBetas_sym,
+  betaEqualsMean_sym,
+  acceptBeta_sym,
+  priorsBetas_sym,
+  logPostPriorsBetas_sym,
+  logPostBetas_sym,
+  logPostSigma_sym,
+  logPostTheta_sym,
+  logPostVarsigma_sym,
+  theta_sym,
+  thetaTransformed_sym,
+  cellInLik_sym,
+  mu_sym,
+  sigma_sym,
+  sigmaMax_sym,
+  ASigma_sym,
+  nuSigma_sym,
+  varsigma_sym,
+  varsigmaMax_sym,
+  varsigmaSetToZero_sym,
+  AVarsigma_sym,
+  nuVarsigma_sym,
+  w_sym,
+  scaleTheta_sym,
+  scaleThetaMultiplier_sym,
+  nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
+  betas_sym,
+  priors_sym,
+  iteratorBetas_sym,
+  dims_sym,
+  prob_sym,
+  ADelta0_sym,
+  meanDelta0_sym,
+
+  mean_sym,
+  sd_sym,
+
+  tolerance_sym,
+  betaIsPredicted_sym,
+  nFailedPropTheta_sym,
+  nFailedPropYStar_sym,
+  maxAttempt_sym,
+  valueAg_sym,
+  weightAg_sym,
+  transformAg_sym,
+  meanAg_sym,
+  sdAg_sym,
+  scaleAg_sym,
+  nAcceptAg_sym,
+  nFailedPropValueAg_sym,
+  funAg_sym,
+  xArgsAg_sym,
+  weightsArgsAg_sym,
+  mxAg_sym,
+  axAg_sym,
+  nxAg_sym,
+  nAgeAg_sym,
+  transformThetaToMxAg_sym,
+  subtotals_sym,
+  transformSubtotals_sym,
+  subtotalsNet_sym,
+  slotsToExtract_sym,
+  iMethodCombined_sym,
+  model_sym,
+  exposure_sym,
+  y_sym,
+  dataModels_sym,
+  datasets_sym,
+  transforms_sym,
+  seriesIndices_sym,
+  updateComponent_sym,
+  updateDataModel_sym,
+  updateSystemModel_sym,
+
+  J_sym,
+
+  UC_sym,
+  DC_sym,
+  UR_sym,
+  DCInv_sym,
+  DRInv_sym,
+  CC_sym,
+  a_sym,
+  R_sym,
+  priorsW_sym,
+  v_sym,
+  forward_sym,
+  offsetsBetas_sym,
+  offsetsPriorsBetas_sym,
+  offsetsSigma_sym,
+  offsetsVarsigma_sym,
+  m0_sym,
+  C0_sym,
+  phi_sym,
+  w_sym,
+  iteratorGamma_sym,
+  iteratorV_sym,
+  delta_sym,
+  phiKnown_sym,
+  /* description */
+  nTime_sym,
+  stepTime_sym,
+  hasAge_sym,
+  hasSex_sym,
+  iSexDominant_sym,
+  stepSexCurrent_sym,
+  stepSexTarget_sym,
+  nAge_sym,
+  stepAge_sym,
+  length_sym,
+  stepTriangle_sym,
+  stepDirection_sym,
+  nBetweenVec_sym,
+  stepBetweenVec_sym,
+  nWithinVec_sym,
+  stepWithinVec_sym,
+  /* cohort iterators */
+  i_sym,
+  iTime_sym,
+  iAge_sym,
+  iTriangle_sym,
+  finished_sym,
+  iVec_sym,
+  lengthVec_sym,
+  increment_sym,
+  lastAgeGroupOpen_sym,
+  /* mappings */
+  hasParCh_sym,
+  isOneToOne_sym,
+  nSharedVec_sym,
+  stepSharedCurrentVec_sym,
+  stepSharedCurrentExposureVec_sym,
+  stepSharedTargetVec_sym,
+  nTimeCurrent_sym,
+  stepTimeCurrent_sym,
+  stepTimeTarget_sym,
+  nAgeCurrent_sym,
+  nAgeTarget_sym,
+  stepAgeCurrent_sym,
+  stepAgeTarget_sym,
+  stepTriangleCurrent_sym,
+  stepTriangleTarget_sym,
+  nOrigDestVec_sym,
+  stepOrigCurrentVec_sym,
+  stepDestCurrentVec_sym,
+  stepOrigDestTargetVec_sym,
+  iMinAge_sym,
+
+  /*new priors*/
+  ATau_sym,
+  nuTau_sym,
+  hasAlphaDLM_sym,
+  hasAlphaICAR_sym,
+  hasAlphaMix_sym,
+  hasCovariates_sym,
+  hasAlphaKnown_sym,
+  hasMean_sym,
+  hasSeason_sym,
+  isKnownUncertain_sym,
+  isNorm_sym,
+  isRobust_sym,
+  isZeroVar_sym,
+  alphaDLM_sym,
+  alphaICAR_sym,
+  alphaMix_sym,
+  iteratorState_sym,
+  iteratorStateOld_sym,
+  K_sym,
+  L_sym,
+  s_sym,
+  UBeta_sym,
+  nuBeta_sym,
+  isSaturated_sym,
+  allStrucZero_sym,
+  alongAllStrucZero_sym,
+  strucZeroArray_sym,
+  mNoTrend_sym,
+  m0NoTrend_sym,
+  CNoTrend_sym,
+  aNoTrend_sym,
+  RNoTrend_sym,
+  GWithTrend_sym,
+  mWithTrend_sym,
+  m0WithTrend_sym,
+  CWithTrend_sym,
+  aWithTrend_sym,
+  hasLevel_sym,
+  omegaAlpha_sym,
+  omegaAlphaMax_sym,
+  AAlpha_sym,
+  nuAlpha_sym,
+  deltaDLM_sym,
+  omegaDelta_sym,
+  omegaDeltaMax_sym,
+  nuDelta_sym,
+  ADelta_sym,
+  minPhi_sym,
+  maxPhi_sym,
+  shape1Phi_sym,
+  shape2Phi_sym,
+  WSqrt_sym,
+  WSqrtInvG_sym,
+  exposureAg_sym,
+  P_sym,
+  AEtaIntercept_sym,
+  AEtaCoef_sym,
+  nuEtaCoef_sym,
+  meanEtaCoef_sym,
+  UEtaCoef_sym,
+  nSeason_sym,
+  ASeason_sym,
+  omegaSeason_sym,
+  omegaSeasonMax_sym,
+  nuSeason_sym,
+  mSeason_sym,
+  m0Season_sym,
+  CSeason_sym,
+  aSeason_sym,
+  RSeason_sym,
+  JOld_sym,
+  /* new priors Jan 2017 */
+  sumsWeightsMix_sym,
+  weightMix_sym,
+  latentWeightMix_sym,
+  foundIndexClassMaxPossibleMix_sym,
+  indexClassMaxPossibleMix_sym,
+  indexClassProbMix_sym,
+  componentWeightMix_sym,
+  latentComponentWeightMix_sym,
+  levelComponentWeightMix_sym,
+  levelComponentWeightOldMix_sym,
+  meanLevelComponentWeightMix_sym,
+  indexClassMix_sym,
+  indexClassMaxMix_sym,
+  indexClassMaxUsedMix_sym,
+  omegaComponentWeightMix_sym,
+  omegaComponentWeightMaxMix_sym,
+  omegaLevelComponentWeightMix_sym,
+  omegaLevelComponentWeightMaxMix_sym,
+  iteratorsDimsMix_sym,
+  iAlong_sym,
+  dimBeta_sym,
+  dimBetaOld_sym,
+  phiMix_sym,
+  mMix_sym,
+  CMix_sym,
+  aMix_sym,
+  RMix_sym,
+  prodVectorsMix_sym,
+  posProdVectors1Mix_sym,
+  posProdVectors2Mix_sym,
+  nBetaNoAlongMix_sym,
+  vectorsMix_sym,
+  omegaVectorsMix_sym,
+  iteratorProdVectorMix_sym,
+  yXMix_sym,
+  XXMix_sym,
+  priorMeanLevelComponentWeightMix_sym,
+  priorSDLevelComponentWeightMix_sym,
+  AComponentWeightMix_sym,
+  nuComponentWeightMix_sym,
+  omegaVectorsMix_sym,
+  omegaVectorsMaxMix_sym,
+  AVectorsMix_sym,
+  nuVectorsMix_sym,
+  minLevelComponentWeight_sym,
+  maxLevelComponentWeight_sym,
+  updateSeriesDLM_sym,
+  ALevelComponentWeightMix_sym,
+  nuLevelComponentWeightMix_sym,
+
+  nuCMP_sym,
+  sdLogNuCMP_sym,
+  sdLogNuMaxCMP_sym,
+  meanMeanLogNuCMP_sym,
+  sdMeanLogNuCMP_sym,
+  meanLogNuCMP_sym,
+  ASDLogNuCMP_sym,
+  nuSDLogNuCMP_sym,
+  nu_sym,
+
+  alphaKnown_sym,
+  AKnownVec_sym,
+
+  /* skeleton */
+  first_sym,
+  last_sym,
+
+  /* Box-Cox */
+  boxCoxParam_sym,
+
+  /* accounts  and combined accounts*/
+  account_sym,
+  population_sym,
+  accession_sym,
+  components_sym,
+  descriptions_sym,
+  iteratorPopn_sym,
+  iteratorAcc_sym,
+  iteratorExposure_sym,
+  transformsExpToComp_sym,
+  transformExpToBirths_sym,
+  iCell_sym,
+  iCellOther_sym,
+  iComp_sym,
+  iPopnNext_sym,
+  iPopnNextOther_sym,
+  iAccNext_sym,
+  iAccNextOther_sym,
+  iOrigDest_sym,
+  iPool_sym,
+  iIntNet_sym,
+  iBirths_sym,
+  iParCh_sym,
+  diffProp_sym,
+  isIncrement_sym,
+  isNet_sym,
+  scaleNoise_sym,
+  usePriorPopn_sym,
+  systemModels_sym,
+  modelUsesExposure_sym,
+  mappingsFromExp_sym,
+  mappingsToExp_sym,
+  mappingsToPopn_sym,
+  mappingsToAcc_sym,
+  iExpFirst_sym,
+  iExpFirstOther_sym,
+  ageTimeStep_sym,
+  iteratorsComp_sym,
+  expectedExposure_sym,
+  iExposure_sym,
+  iExposureOther_sym,
+  isLowerTriangle_sym,
+  isOldestAgeGroup_sym,
+  generatedNewProposal_sym,
+  probSmallUpdate_sym,
+  isSmallUpdate_sym,
+  isSmallUpdateFinal_sym,
+  probPopn_sym,
+  cumProbComp_sym,
+  nCellAccount_sym,
+  /* LN@ */
+  alphaLN2_sym,
+  transformLN2_sym,
+  constraintLN2_sym,
+  nCellBeforeLN2_sym;
+
+extern SEXP (*dembase_Collapse_R)(SEXP ,SEXP);
+extern SEXP (*dembase_Extend_R)(SEXP ,SEXP);
+extern int (*dembase_getIAfter)(int, SEXP);
+extern SEXP (*dembase_getIBefore)(int, SEXP);
+extern SEXP (*dembase_getIShared)(int, SEXP);
+
+
+/* ******************************************************************************** */
+/* Compiling transforms *********************************************************** */
+/* ******************************************************************************** */
+
+/* Fill in 'rowStart' and 'iBefore' from 'iAfter', which gives
+   the (C-style) cell of the result that each cell of the input
+   belongs to, or -1 if the cell is not used. */
+static void
+makeTransformIndexFromIAfter(TransformIndex *ans, int *iAfter,
+                             int n_before, int n_after)
+{
+    int *rowStart = (int *)R_alloc(n_after + 1, sizeof(int));
+    memset(rowStart, 0, (n_after + 1) * sizeof(int));
+    for (int i = 0; i < n_before; ++i) {
+        if (iAfter[i] >= 0)
+            ++rowStart[iAfter[i] + 1];
+    }
+    for (int j = 0; j < n_after; ++j)
+        rowStart[j + 1] += rowStart[j];
+    int n_entry = rowStart[n_after];
+    int *iBefore = (int *)R_alloc(n_entry > 0 ? n_entry : 1, sizeof(int));
+    int *pos = (int *)R_alloc(n_after > 0 ? n_after : 1, sizeof(int));
+    memcpy(pos, rowStart, n_after * sizeof(int));
+    for (int i = 0; i < n_before; ++i) {
+        int j = iAfter[i];
+        if (j >= 0) {
+            iBefore[pos[j]] = i;
+            ++pos[j];
+        }
+    }
+    ans->nBefore = n_before;
+    ans->nAfter = n_after;
+    ans->rowStart = rowStart;
+    ans->iBefore = iBefore;
+    ans->iAfter = iAfter;
+}
+
+static int
+productOfDims(int *dim, int n_dim)
+{
+    int ans = 1;
+    for (int d = 0; d < n_dim; ++d)
+        ans *= dim[d];
+    return ans;
+}
+
+/* 'transform_R' is a "CollapseTransform" (or a
+   "CollapseTransformExtra"). Element 'd' of 'indices' maps
+   positions along dimension 'd' of the input onto positions
+   along dimension 'dims[d]' of the result, with 0 meaning
+   that the position is dropped. 'dims[d]' is 0 if dimension
+   'd' is collapsed away. */
+void
+makeCollapseTransformIndex(TransformIndex *ans, SEXP transform_R)
+{
+    SEXP indices_R = GET_SLOT(transform_R, indices_sym);
+    int *dims = INTEGER(GET_SLOT(transform_R, dims_sym));
+    SEXP dimBefore_R = GET_SLOT(transform_R, dimBefore_sym);
+    SEXP dimAfter_R = GET_SLOT(transform_R, dimAfter_sym);
+    int n_dim_before = LENGTH(dimBefore_R);
+    int n_dim_after = LENGTH(dimAfter_R);
+    int *dimBefore = INTEGER(dimBefore_R);
+    int *dimAfter = INTEGER(dimAfter_R);
+
+    int n_before = productOfDims(dimBefore, n_dim_before);
+    int n_after = productOfDims(dimAfter, n_dim_after);
+
+    int *strideAfter = (int *)R_alloc(n_dim_after + 1, sizeof(int));
+    strideAfter[0] = 1;
+    for (int d = 0; d < n_dim_after; ++d)
+        strideAfter[d + 1] = strideAfter[d] * dimAfter[d];
+
+    int **index = (int **)R_alloc(n_dim_before, sizeof(int *));
+    for (int d = 0; d < n_dim_before; ++d)
+        index[d] = INTEGER(VECTOR_ELT(indices_R, d));
+
+    int *iAfter = (int *)R_alloc(n_before > 0 ? n_before : 1, sizeof(int));
+    int *pos = (int *)R_alloc(n_dim_before + 1, sizeof(int));
+    memset(pos, 0, (n_dim_before + 1) * sizeof(int));
+
+    for (int i = 0; i < n_before; ++i) {
+        int i_after = 0;
+        for (int d = 0; d < n_dim_before; ++d) {
+            int i_along = index[d][pos[d]];
+            if (i_along == 0) {
+                i_after = -1;
+                break;
+            }
+            if (dims[d] > 0)
+                i_after += (i_along - 1) * strideAfter[dims[d] - 1];
+        }
+        iAfter[i] = i_after;
+        /* move to next cell of input */
+        for (int d = 0; d < n_dim_before; ++d) {
+            ++pos[d];
+            if (pos[d] < dimBefore[d])
+                break;
+            pos[d] = 0;
+        }
+    }
+
+    makeTransformIndexFromIAfter(ans, iAfter, n_before, n_after);
+}
+
+/* 'transform_R' is an "ExtendTransform". Element 'e' of
+   'indices' maps positions along dimension 'e' of the result
+   onto positions along dimension 'dims[e]' of the input, with
+   'dims[e]' equal to 0 if dimension 'e' is not in the input. */
+void
+makeExtendTransformIndex(TransformIndex *ans, SEXP transform_R)
+{
+    SEXP indices_R = GET_SLOT(transform_R, indices_sym);
+    int *dims = INTEGER(GET_SLOT(transform_R, dims_sym));
+    SEXP dimBefore_R = GET_SLOT(transform_R, dimBefore_sym);
+    SEXP dimAfter_R = GET_SLOT(transform_R, dimAfter_sym);
+    int n_dim_before = LENGTH(dimBefore_R);
+    int n_dim_after = LENGTH(dimAfter_R);
+    int *dimBefore = INTEGER(dimBefore_R);
+    int *dimAfter = INTEGER(dimAfter_R);
+
+    int n_before = productOfDims(dimBefore, n_dim_before);
+    int n_after = productOfDims(dimAfter, n_dim_after);
+
+    int *strideBefore = (int *)R_alloc(n_dim_before + 1, sizeof(int));
+    strideBefore[0] = 1;
+    for (int d = 0; d < n_dim_before; ++d)
+        strideBefore[d + 1] = strideBefore[d] * dimBefore[d];
+
+    int **index = (int **)R_alloc(n_dim_after, sizeof(int *));
+    for (int e = 0; e < n_dim_after; ++e)
+        index[e] = INTEGER(VECTOR_ELT(indices_R, e));
+
+    int *rowStart = (int *)R_alloc(n_after + 1, sizeof(int));
+    int *iBefore = (int *)R_alloc(n_after > 0 ? n_after : 1, sizeof(int));
+    int *pos = (int *)R_alloc(n_dim_after + 1, sizeof(int));
+    memset(pos, 0, (n_dim_after + 1) * sizeof(int));
+
+    for (int j = 0; j < n_after; ++j) {
+        int i_before = 0;
+        for (int e = 0; e < n_dim_after; ++e) {
+            if (dims[e] > 0)
+                i_before += (index[e][pos[e]] - 1) * strideBefore[dims[e] - 1];
+        }
+        rowStart[j] = j;
+        iBefore[j] = i_before;
+        /* move to next cell of result */
+        for (int e = 0; e < n_dim_after; ++e) {
+            ++pos[e];
+            if (pos[e] < dimAfter[e])
+                break;
+            pos[e] = 0;
+        }
+    }
+    rowStart[n_after] = n_after;
+
+    ans->nBefore = n_before;
+    ans->nAfter = n_after;
+    ans->rowStart = rowStart;
+    ans->iBefore = iBefore;    ans->iAfter = NULL;
+}
+
+/* Combine 'first' and 'second' into a single transform
+   that is equivalent to applying 'first' then 'second'. */
+void
+composeTransformIndex(TransformIndex *ans, TransformIndex *first,
+                      TransformIndex *second)
+{
+    int n_after = second->nAfter;
+    int *rowStart = (int *)R_alloc(n_after + 1, sizeof(int));
+    rowStart[0] = 0;
+    for (int j = 0; j < n_after; ++j) {
+        int n_entry = 0;
+        for (int k = second->rowStart[j]; k < second->rowStart[j + 1]; ++k) {
+            int i_mid = second->iBefore[k];
+            n_entry += first->rowStart[i_mid + 1] - first->rowStart[i_mid];
+        }
+        rowStart[j + 1] = rowStart[j] + n_entry;
+    }
+    int n_entry = rowStart[n_after];
+    int *iBefore = (int *)R_alloc(n_entry > 0 ? n_entry : 1, sizeof(int));
+    int pos = 0;
+    for (int j = 0; j < n_after; ++j) {
+        for (int k = second->rowStart[j]; k < second->rowStart[j + 1]; ++k) {
+            int i_mid = second->iBefore[k];
+            for (int m = first->rowStart[i_mid]; m < first->rowStart[i_mid + 1]; ++m) {
+                iBefore[pos] = first->iBefore[m];
+                ++pos;
+            }
+        }
+    }
+    ans->nBefore = first->nBefore;
+    ans->nAfter = n_after;
+    ans->rowStart = rowStart;
+    ans->iBefore = iBefore;    ans->iAfter = NULL;
+}
+
+
+/* ******************************************************************************** */
+/* Applying transforms ************************************************************ */
+/* ******************************************************************************** */
+
+/* Overwrite the contents of 'ans_R' with the result of applying
+   'index' to 'x_R'. 'ans_R' and 'x_R' have the same type, which
+   is integer or double, and 'ans_R' has length 'index->nAfter'.
+   As with 'dembase_Collapse_R', integer sums involving NA are NA. */
+void
+applyTransformIndex(SEXP ans_R, SEXP x_R, TransformIndex *index)
+{
+    int n_after = index->nAfter;
+    int *rowStart = index->rowStart;
+    int *iBefore = index->iBefore;
+    if (TYPEOF(x_R) == REALSXP) {
+        double *x = REAL(x_R);
+        double *ans = REAL(ans_R);
+        for (int j = 0; j < n_after; ++j) {
+            double sum = 0;
+            for (int k = rowStart[j]; k < rowStart[j + 1]; ++k)
+                sum += x[iBefore[k]];
+            ans[j] = sum;
+        }
+    }
+    else {
+        int *x = INTEGER(x_R);
+        int *ans = INTEGER(ans_R);
+        for (int j = 0; j < n_after; ++j) {
+            int sum = 0;
+            for (int k = rowStart[j]; k < rowStart[j + 1]; ++k) {
+                int x_k = x[iBefore[k]];
+                if (x_k == NA_INTEGER) {
+                    sum = NA_INTEGER;
+                    break;
+                }
+                sum += x_k;
+            }
+            ans[j] = sum;
+        }
+    }
+}
+
+
+/* ******************************************************************************** */
+/* Cache of compiled transforms *************************************************** */
+/* ******************************************************************************** */
+
+/* Transforms are identified by address. The list holding them
+   is preserved while it is in the cache, so the addresses stay
+   valid even if an update is interrupted by an error before
+   'endTransformIndexCache' is called. The compiled transforms
+   are held in memory allocated with R_Calloc for the same
+   reason.
+
+   Each entry can also hold the series that the transform is
+   applied to, collapsed, as integers and as doubles. The
+   collapsed values are kept up to date by 'noteSeriesChange'.
+   The series itself is stored in 'cachedCollapsedList', which
+   is preserved, so that its data pointer, which is what
+   'noteSeriesChange' and 'sumOverIBefore' match on, cannot be
+   reused by another object while the cache is active.
+
+   Callers must make sure that 'endTransformIndexCache' is
+   called however the update finishes, eg with
+   'R_ExecWithCleanup'. 'beginTransformIndexCache' also clears
+   anything left over from an earlier call. */
+typedef struct TransformCacheEntry {
+    SEXP transform_R; /* NULL if not a collapse transform */
+    TransformIndex index;
+    int *series; /* NULL unless collapsed series cached */
+    SEXP collapsedInt_R;
+    SEXP collapsedReal_R;
+} TransformCacheEntry;
+
+/* elements of 'cachedCollapsedList' for each entry */
+#define N_CACHED_PER_ENTRY 3
+
+static int nCachedTransforms = 0;
+static SEXP cachedList = NULL;
+static SEXP cachedCollapsedList = NULL; /* holds series and collapsed series */
+static TransformCacheEntry *cachedEntries = NULL;
+
+static void
+copyIntsToHeap(int **ptr, int n)
+{
+    int *ans = R_Calloc(n > 0 ? n : 1, int);
+    memcpy(ans, *ptr, n * sizeof(int));
+    *ptr = ans;
+}
+
+/* Elements of 'transforms_R' that are not collapse
+   transforms (eg NULL) are skipped. */
+void
+beginTransformIndexCache(SEXP transforms_R)
+{
+    endTransformIndexCache();
+    int n = LENGTH(transforms_R);
+    if (n == 0)
+        return;
+    R_PreserveObject(transforms_R);
+    cachedList = transforms_R;
+    cachedCollapsedList = allocVector(VECSXP, N_CACHED_PER_ENTRY * n);
+    R_PreserveObject(cachedCollapsedList);
+    cachedEntries = R_Calloc(n, TransformCacheEntry);
+    nCachedTransforms = n;
+    for (int i = 0; i < n; ++i) {
+        TransformCacheEntry *entry = cachedEntries + i;
+        SEXP transform_R = VECTOR_ELT(transforms_R, i);
+        entry->transform_R = NULL;
+        entry->series = NULL;
+        entry->collapsedInt_R = R_NilValue;
+        entry->collapsedReal_R = R_NilValue;
+        if (isNull(transform_R) || !R_has_slot(transform_R, dims_sym))
+            continue;
+        TransformIndex *index = &entry->index;
+        makeCollapseTransformIndex(index, transform_R);
+        copyIntsToHeap(&index->rowStart, index->nAfter + 1);
+        copyIntsToHeap(&index->iBefore, index->rowStart[index->nAfter]);
+        copyIntsToHeap(&index->iAfter, index->nBefore);
+        entry->transform_R = transform_R;
+    }
+}
+
+void
+endTransformIndexCache(void)
+{
+    for (int i = 0; i < nCachedTransforms; ++i) {
+        TransformCacheEntry *entry = cachedEntries + i;
+        if (entry->transform_R) {
+            R_Free(entry->index.rowStart);
+            R_Free(entry->index.iBefore);
+            R_Free(entry->index.iAfter);
+        }
+    }
+    if (cachedList) {
+        R_Free(cachedEntries);
+        R_ReleaseObject(cachedCollapsedList);
+        R_ReleaseObject(cachedList);
+    }
+    nCachedTransforms = 0;
+    cachedList = NULL;
+    cachedCollapsedList = NULL;
+    cachedEntries = NULL;
+}
+
+static TransformCacheEntry *
+findCacheEntry(SEXP transform_R)
+{
+    for (int i = 0; i < nCachedTransforms; ++i) {
+        if (cachedEntries[i].transform_R == transform_R)
+            return cachedEntries + i;
+    }
+    return NULL;
+}
+
+/* Returns NULL if 'transform_R' is not in the cache. */
+TransformIndex *
+findTransformIndex(SEXP transform_R)
+{
+    TransformCacheEntry *entry = findCacheEntry(transform_R);
+    return entry ? &entry->index : NULL;
+}
+
+/* Collapse 'series_R', which is an integer vector, using
+   element 'i' of the list passed to 'beginTransformIndexCache',
+   and keep the result up to date as 'series_R' changes. All
+   changes to 'series_R' while the cache is active must be
+   reported through 'noteSeriesChange'. */
+void
+cacheCollapsedSeries(int i, SEXP series_R)
+{
+    if (i >= nCachedTransforms)
+        return;
+    TransformCacheEntry *entry = cachedEntries + i;
+    if (!entry->transform_R)
+        return;
+    TransformIndex *index = &entry->index;
+    SET_VECTOR_ELT(cachedCollapsedList, N_CACHED_PER_ENTRY * i, series_R);
+    SEXP collapsedInt_R = allocVector(INTSXP, index->nAfter);
+    SET_VECTOR_ELT(cachedCollapsedList, N_CACHED_PER_ENTRY * i + 1, collapsedInt_R);
+    SEXP collapsedReal_R = allocVector(REALSXP, index->nAfter);
+    SET_VECTOR_ELT(cachedCollapsedList, N_CACHED_PER_ENTRY * i + 2, collapsedReal_R);
+    applyTransformIndex(collapsedInt_R, series_R, index);
+    int *collapsedInt = INTEGER(collapsedInt_R);
+    double *collapsedReal = REAL(collapsedReal_R);
+    for (int j = 0; j < index->nAfter; ++j)
+        collapsedReal[j] = (collapsedInt[j] == NA_INTEGER) ? NA_REAL : collapsedInt[j];
+    entry->series = INTEGER(series_R);
+    entry->collapsedInt_R = collapsedInt_R;
+    entry->collapsedReal_R = collapsedReal_R;
+}
+
+/* Record that element 'i' (C-style) of 'series' has
+   changed by 'diff'. Does nothing if no collapsed
+   versions of 'series' are being cached. Collapsed
+   cells that are NA, because one of the cells they
+   are made from is NA, stay NA. */
+void
+noteSeriesChange(int *series, int i, int diff)
+{
+    for (int k = 0; k < nCachedTransforms; ++k) {
+        TransformCacheEntry *entry = cachedEntries + k;
+        if (entry->series == series) {
+            int j = entry->index.iAfter[i];
+            if (j >= 0) {
+                int *collapsedInt = INTEGER(entry->collapsedInt_R);
+                if (collapsedInt[j] != NA_INTEGER) {
+                    collapsedInt[j] += diff;
+                    REAL(entry->collapsedReal_R)[j] += diff;
+                }
+            }
+        }
+    }
+}
+
+/* The cached collapsed version of the series that
+   'transform_R' applies to, as doubles if 'useDouble'
+   is true, or R_NilValue if there is none. The result
+   must not be modified. */
+SEXP
+getCollapsedSeries(SEXP transform_R, int useDouble)
+{
+    TransformCacheEntry *entry = findCacheEntry(transform_R);
+    if (entry && entry->series)
+        return useDouble ? entry->collapsedReal_R : entry->collapsedInt_R;
+    else
+        return R_NilValue;
+}
+
+/* Equivalent to 'dembase_getIAfter(i_r, transform_R)' */
+int
+getIAfterIndexed(int i_r, SEXP transform_R)
+{
+    TransformIndex *index = findTransformIndex(transform_R);
+    if (index)
+        return index->iAfter[i_r - 1] + 1;
+    else
+        return dembase_getIAfter(i_r, transform_R);
+}
+
+/* Sum of the elements of 'x' at the positions given by
+   'dembase_getIBefore(iAfter_r, transform_R)' */
+int
+sumOverIBefore(int *x, int iAfter_r, SEXP transform_R)
+{
+    int ans = 0;
+    TransformCacheEntry *entry = findCacheEntry(transform_R);
+    if (entry && (entry->series == x)) {
+        ans = INTEGER(entry->collapsedInt_R)[iAfter_r - 1];
+    }
+    else if (entry) {
+        TransformIndex *index = &entry->index;
+        int *rowStart = index->rowStart;
+        int *iBefore = index->iBefore;
+        int iAfter = iAfter_r - 1;
+        for (int k = rowStart[iAfter]; k < rowStart[iAfter + 1]; ++k)
+            ans += x[iBefore[k]];
+    }
+    else {
+        SEXP iBefore_R;
+        PROTECT(iBefore_R = dembase_getIBefore(iAfter_r, transform_R));
+        int n_before = LENGTH(iBefore_R);
+        int *iBefore = INTEGER(iBefore_R);
+        for (int k = 0; k < n_before; ++k)
+            ans += x[iBefore[k] - 1];
+        UNPROTECT(1); /* iBefore_R */
+    }
+    return ans;
+}
+
+/* Sum of the elements of 'x' at the positions given by
+   'dembase_getIShared(i_r, transform_R)' */
+int
+sumOverIShared(int *x, int i_r, SEXP transform_R)
+{
+    int ans = 0;
+    TransformIndex *index = findTransformIndex(transform_R);
+    if (index) {
+        int iAfter = index->iAfter[i_r - 1];
+        if (iAfter >= 0)
+            ans = sumOverIBefore(x, iAfter + 1, transform_R);
+    }
+    else {
+        SEXP iShared_R;
+        PROTECT(iShared_R = dembase_getIShared(i_r, transform_R));
+        int n_shared = LENGTH(iShared_R);
+        int *iShared = INTEGER(iShared_R);
+        for (int k = 0; k < n_shared; ++k)
+            ans += x[iShared[k] - 1];
+        UNPROTECT(1); /* iShared_R */
+    }
+    return ans;
+}
@@ -0,0 +1,62 @@
+#ifndef __TRANSFORM_INDEX_H__
+#define __TRANSFORM_INDEX_H__
+
+    #include <Rinternals.h>
+
+    /* Native version of a dembase transform.
+     *
+     * Applying a CollapseTransform or ExtendTransform through
+     * 'dembase_Collapse_R' or 'dembase_Extend_R' works out the
+     * mapping between cells afresh, and allocates a new R
+     * vector, each time. A 'TransformIndex' holds the mapping,
+     * worked out once, in compressed sparse row form: cell 'j'
+     * of the result is the sum of cells
+     * 'iBefore[rowStart[j]]', ..., 'iBefore[rowStart[j+1] - 1]'
+     * of the input (using C-style indices). For an extend
+     * transform each row has exactly one entry, and for a
+     * collapse transform each input cell appears in at
+     * most one row. For a collapse transform, 'iAfter' gives
+     * the cell of the result that each cell of the input
+     * belongs to, or -1, so that, with R-style indices,
+     * 'dembase_getIAfter(i, transform)' is 'iAfter[i-1] + 1',
+     * 'dembase_getIBefore(j, transform)' is row 'j-1', and
+     * 'dembase_getIShared(i, transform)' is row 'iAfter[i-1]'.
+     *
+     * Memory is allocated using R_alloc. */
+    typedef struct TransformIndex {
+        int nBefore;
+        int nAfter;
+        int *rowStart; /* length nAfter + 1 */
+        int *iBefore;  /* length rowStart[nAfter] */
+        int *iAfter;   /* length nBefore, NULL unless collapse transform */
+    } TransformIndex;
+
+    void makeCollapseTransformIndex(TransformIndex *ans, SEXP transform_R);
+
+    void makeExtendTransformIndex(TransformIndex *ans, SEXP transform_R);
+
+    void composeTransformIndex(TransformIndex *ans, TransformIndex *first,
+                               TransformIndex *second);
+
+    void applyTransformIndex(SEXP ans_R, SEXP x_R, TransformIndex *index);
+
+    /* Compiled versions of the collapse transforms in a list,
+     * such as the 'transforms' slot of a combined object, can
+     * be cached for the duration of an update. While the cache
+     * is active, the functions below use the compiled versions
+     * of cached transforms, and otherwise fall back to the
+     * dembase functions. Collapsed versions of the series
+     * that the transforms apply to can be cached too. */
+    void beginTransformIndexCache(SEXP transforms_R);
+    void endTransformIndexCache(void);
+    TransformIndex * findTransformIndex(SEXP transform_R);
+
+    void cacheCollapsedSeries(int i, SEXP series_R);
+    void noteSeriesChange(int *series, int i, int diff);
+    SEXP getCollapsedSeries(SEXP transform_R, int useDouble);
+
+    int getIAfterIndexed(int i_r, SEXP transform_R);
+    int sumOverIBefore(int *x, int iAfter_r, SEXP transform_R);
+    int sumOverIShared(int *x, int i_r, SEXP transform_R);
+
+#endif
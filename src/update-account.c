@@ -1,5 +1,10 @@
 #include "mapping-functions.h"
 #include "helper-functions.h"
+#include "transform-index.h"
+#include "iterators-methods.h"
+#include "cohort-min.h"
+#include "account-batch.h"
+#include "log-factorial.h"
 #include "demest.h"
 
 /* File "update-accounts.c" contains C versions of functions
@@ -60,6 +65,7 @@ extern SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -391,6 +397,8 @@ extern SEXP (*dembase_getIShared)(int, SEXP);
 void
 updateAccount(SEXP object_R)
 {
+    if (updateAccountInBatches(object_R))
+        return;
     int nCellAccount = *INTEGER(GET_SLOT(object_R, nCellAccount_sym));
     double scaleNoise = *REAL(GET_SLOT(object_R, scaleNoise_sym));
     for (int i = 0; i < (2 * nCellAccount); ++i) {
@@ -421,6 +429,48 @@ updateAccount(SEXP object_R)
 
 void
 updateProposalAccountMovePopn(SEXP combined_R)
+{
+    int iCell_r = 0;
+    int generatedNewProposal = chooseICellAccountMovePopn(&iCell_r, combined_R);
+    updateProposalAccountMovePopnCell(combined_R, iCell_r, generatedNewProposal);
+}
+
+/* Choose the population cell for a proposal, trying
+   up to 'maxAttempt' times to find a cell that is not
+   a structural zero. Returns 1 if a cell was found. The
+   choice does not depend on the current values of the
+   account. */
+int
+chooseICellAccountMovePopn(int *iCell_r, SEXP combined_R)
+{
+    int maxAttempt = *INTEGER(GET_SLOT(combined_R, maxAttempt_sym));
+
+    SEXP descriptions_R = GET_SLOT(combined_R, descriptions_sym);
+    SEXP description_R = VECTOR_ELT(descriptions_R, 0);
+
+    SEXP systemModels_R = GET_SLOT(combined_R, systemModels_sym);
+    SEXP thisSystemModel_R = VECTOR_ELT(systemModels_R, 0);
+    int * strucZeroArray = INTEGER(GET_SLOT(thisSystemModel_R, strucZeroArray_sym));
+
+    int found = 0;
+
+    for (int i = 0; i < maxAttempt; i++) {
+        *iCell_r = chooseICellPopn(description_R);
+        int iCell = *iCell_r - 1;
+        int isStrucZero = strucZeroArray[iCell] == 0;
+        if (!isStrucZero) {
+            found = 1;
+            break;
+        }
+    }
+    return found;
+}
+
+/* Generate the proposal for cell 'iCell_r', chosen
+   by 'chooseICellAccountMovePopn' */
+void
+updateProposalAccountMovePopnCell(SEXP combined_R, int iCell_r,
+                                  int generatedNewProposal)
 {
     SEXP account_R = GET_SLOT(combined_R, account_sym);
     SEXP population_R = GET_SLOT(account_R, population_sym);
@@ -438,21 +488,8 @@ updateProposalAccountMovePopn(SEXP combined_R)
     SEXP systemModels_R = GET_SLOT(combined_R, systemModels_sym);
     SEXP thisSystemModel_R = VECTOR_ELT(systemModels_R, 0);
     double * theta = REAL(GET_SLOT(thisSystemModel_R, theta_sym));
-    int * strucZeroArray = INTEGER(GET_SLOT(thisSystemModel_R, strucZeroArray_sym));
 
-    int iCell_r = 0;
-    int iCell = 0;
-    int generatedNewProposal = 0;
-
-    for (int i = 0; i < maxAttempt; i++) {
-        iCell_r = chooseICellPopn(description_R);
-        iCell = iCell_r - 1;
-        int isStrucZero = strucZeroArray[iCell] == 0;
-        if (!isStrucZero) {
-            generatedNewProposal = 1;
-            break;
-        }
-    }
+    int iCell = iCell_r - 1;
 
     int iExposure_r = 0;
     int iExpFirst_r = getIExpFirstFromPopn(iCell_r, description_R);
@@ -516,6 +553,19 @@ updateProposalAccountMovePopn(SEXP combined_R)
 
     }
 
+    setProposalAccountMovePopn(combined_R, generatedNewProposal, iCell_r,
+                               iPopnNext_r, iAccNext_r, iExposure_r,
+                               iExpFirst_r, diffProp);
+}
+
+/* Record a population proposal in the slots of 'combined_R' */
+void
+setProposalAccountMovePopn(SEXP combined_R, int generatedNewProposal,
+                           int iCell_r, int iPopnNext_r, int iAccNext_r,
+                           int iExposure_r, int iExpFirst_r, int diffProp)
+{
+    int hasAge = *LOGICAL(GET_SLOT(combined_R, hasAge_sym));
+
     SET_LOGICALSCALE_SLOT(combined_R, generatedNewProposal_sym, generatedNewProposal);
     SET_LOGICALSCALE_SLOT(combined_R, isSmallUpdate_sym, 0);
     SET_LOGICALSCALE_SLOT(combined_R, isSmallUpdateFinal_sym, 0);
@@ -1971,24 +2021,20 @@ diffLogLikPopnOneDataset(int diff, int iFirst_r, SEXP iterator_R,
                         SEXP dataset_R, SEXP transform_R)
 {
     double ans = 0;
-    int iAfter_r = dembase_getIAfter(iFirst_r, transform_R);
+    int iAfter_r = getIAfterIndexed(iFirst_r, transform_R);
 
     if (iAfter_r > 0) {
         ans = diffLogLikPopnOneCell(iAfter_r, diff, population_R,
                                     model_R, dataset_R, transform_R);
     }
-    resetCP(iterator_R, iFirst_r);
-
-    int * finished_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-    int finished = *finished_ptr;
-    int * i_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
+    CohortSpan span;
+    makeCohortSpanCP(&span, iterator_R, iFirst_r);
+    int i = span.i;
 
-    while ( !finished ) {
-        advanceCP(iterator_R);
-        finished = *finished_ptr;
-        int i_r = *i_ptr;
+    for (int k = 0; k < span.nStep; ++k) {
+        i += cohortSpanStride(&span, k);
 
-        iAfter_r = dembase_getIAfter(i_r, transform_R);
+        iAfter_r = getIAfterIndexed(i + 1, transform_R);
 
         if (iAfter_r > 0) {
             ans += diffLogLikPopnOneCell(iAfter_r, diff, population_R,
@@ -2013,41 +2059,79 @@ diffLogLikPopnOneCell(int iAfter_r, int diff, SEXP population_R,
 
         int * population = INTEGER(population_R);
 
-        SEXP vec_iBefore_R = dembase_getIBefore(iAfter_r, transform_R);
-        int nBefore = LENGTH(vec_iBefore_R);
-        int *vec_iBefore = INTEGER(vec_iBefore_R);
+        int totalPopnCurr = sumOverIBefore(population, iAfter_r, transform_R);
 
-        int totalPopnCurr = 0;
+        int totalPopnProp = totalPopnCurr + diff;
 
-        for (int i = 0; i < nBefore; ++i) {
-            int iBefore = vec_iBefore[i] - 1;
-            totalPopnCurr += population[iBefore];
-        }
+        retValue = diffLogLikCountOneCell(model_R, totalPopnProp, totalPopnCurr,
+                                          dataset_R, iAfter_r);
+    }
+    /* if cellHasNoData, retValue stays at default value */
 
-        int totalPopnProp = totalPopnCurr + diff;
+    return retValue;
+}
 
-        double logLikProp = logLikelihood(model_R, totalPopnProp, dataset_R, iAfter_r);
-        double logLikCurr = logLikelihood(model_R, totalPopnCurr, dataset_R, iAfter_r);
 
-        if(R_finite(logLikProp) || R_finite(logLikCurr)) {
-            retValue = logLikProp - logLikCurr;
+/* Log-likelihood of 'countProp' minus log-likelihood of
+   'countCurr' for cell 'iAfter_r' of a dataset. If both
+   log-likelihoods are infinite, returns -1000000 if
+   'countProp' is further from the data than 'countCurr',
+   and 1000000 otherwise. Poisson and binomial models,
+   where the difference is always finite, skip the
+   separate calls to 'logLikelihood'. */
+double
+diffLogLikCountOneCell(SEXP model_R, int countProp, int countCurr,
+                       SEXP dataset_R, int iAfter_r)
+{
+    int * dataset = INTEGER(dataset_R);
+    int iAfter = iAfter_r - 1;
+    int x = dataset[iAfter];
+
+    int iMethodModel = *INTEGER(GET_SLOT(model_R, iMethodModel_sym));
+
+    switch(iMethodModel)
+    {
+        case 10: case 20: case 21: case 120: case 121: /* Poisson */
+        {
+            double theta = REAL(GET_SLOT(model_R, theta_sym))[iAfter];
+            double lambdaProp = theta * countProp;
+            double lambdaCurr = theta * countCurr;
+            if ((x >= 0) && (lambdaProp > 0) && (lambdaCurr > 0)
+                && R_finite(lambdaProp) && R_finite(lambdaCurr))
+                return diffLogDensPoisLambda(x, lambdaProp, lambdaCurr);
+            break;
         }
-        else {
-            double diffProp = abs(totalPopnProp - dataset[iAfter]);
-            double diffCurr = abs(totalPopnCurr - dataset[iAfter]);
-            if (diffProp > diffCurr) {
-                retValue = -1000000;
-            }
-            else {
-                retValue = 1000000;
-            }
+        case 9: case 18: case 19: case 118: case 119: /* Binomial */
+        {
+            double prob = REAL(GET_SLOT(model_R, theta_sym))[iAfter];
+            if ((x >= 0) && (countProp >= x) && (countCurr >= x)
+                && (prob > 0) && (prob < 1))
+                return diffLogDensBinomSize(x, countProp, countCurr, prob);
+            break;
         }
+        default:
+            break;
     }
-    /* if cellHasNoData, retValue stays at default value */
 
-    return retValue;
-}
+    double logLikProp = logLikelihood(model_R, countProp, dataset_R, iAfter_r);
+    double logLikCurr = logLikelihood(model_R, countCurr, dataset_R, iAfter_r);
 
+    double ans = 0;
+    if (R_finite(logLikProp) || R_finite(logLikCurr)) {
+        ans = logLikProp - logLikCurr;
+    }
+    else {
+        double diffProp = abs(countProp - x);
+        double diffCurr = abs(countCurr - x);
+        if (diffProp > diffCurr) {
+            ans = -1000000;
+        }
+        else {
+            ans = 1000000;
+        }
+    }
+    return ans;
+}
 
 double
 diffLogLikAccountMoveOrigDest(SEXP combined_R)
@@ -2147,7 +2231,7 @@ diffLogLikCellOneDataset(int diff, int iCell_r, SEXP component_R,
 {
     double ans = 0;
 
-    int iAfter_r = dembase_getIAfter(iCell_r, transform_R);
+    int iAfter_r = getIAfterIndexed(iCell_r, transform_R);
 
     int * dataset = INTEGER(dataset_R);
     int iAfter = iAfter_r - 1;
@@ -2159,37 +2243,12 @@ diffLogLikCellOneDataset(int diff, int iCell_r, SEXP component_R,
 
         int * component = INTEGER(component_R);
 
-        SEXP vec_iBefore_R = dembase_getIBefore(iAfter_r, transform_R);
-        int nBefore = LENGTH(vec_iBefore_R);
-        int *vec_iBefore = INTEGER(vec_iBefore_R);
-
-        int totalCompCurr = 0;
-
-        for (int i = 0; i < nBefore; ++i) {
-            int iBefore = vec_iBefore[i] - 1;
-            totalCompCurr += component[iBefore];
-        }
+        int totalCompCurr = sumOverIBefore(component, iAfter_r, transform_R);
 
         int totalCompProp = totalCompCurr + diff;
 
-        double logLikProp = logLikelihood(model_R, totalCompProp,
-                      dataset_R, iAfter_r);
-        double logLikCurr = logLikelihood(model_R, totalCompCurr,
-                      dataset_R, iAfter_r);
-
-        if (R_finite(logLikProp) || R_finite(logLikCurr)) {
-            ans = logLikProp - logLikCurr;
-        }
-        else {
-            double diffProp = abs(totalCompProp - dataset[iAfter]);
-            double diffCurr = abs(totalCompCurr - dataset[iAfter]);
-            if (diffProp > diffCurr) {
-                ans = -1000000;
-            }
-            else {
-                ans = 1000000;
-            }
-        }
+        ans = diffLogLikCountOneCell(model_R, totalCompProp, totalCompCurr,
+                                     dataset_R, iAfter_r);
     }
     /* if cellHasNoData, retValue stays at default value */
 
@@ -2205,14 +2264,14 @@ diffLogLikPopnPair(int diffOrig, int diffDest,
 		   SEXP datasets_R, SEXP seriesIndices_R,
 		   SEXP transforms_R)
 {
-  SEXP iteratorDest_R = NULL;
-  PROTECT(iteratorDest_R = duplicate(iterator_R));
-  int * iPopnOrigHere_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-  int * iPopnDestHere_ptr = INTEGER(GET_SLOT(iteratorDest_R, i_sym));
-  int * finished_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-  int finished;
   double ans = 0;
   if (iPopnOrig_r != iPopnDest_r) {
+    /* the two cohorts differ only in dimensions other
+     * than time and age, so follow the same path */
+    CohortSpan spanOrig;
+    CohortSpan spanDest;
+    makeCohortSpanCP(&spanOrig, iterator_R, iPopnOrig_r);
+    makeCohortSpanCP(&spanDest, iterator_R, iPopnDest_r);
     int nDatasets = LENGTH(datasets_R);
     int * seriesIndices = INTEGER(seriesIndices_R);
     for (int iDataset = 0; iDataset < nDatasets; ++iDataset) {
@@ -2221,8 +2280,8 @@ diffLogLikPopnPair(int diffOrig, int diffDest,
 	SEXP transform_R = VECTOR_ELT(transforms_R, iDataset);
 	SEXP model_R = VECTOR_ELT(dataModels_R, iDataset);
 	SEXP dataset_R = VECTOR_ELT(datasets_R, iDataset);
-	int iAfterOrig_r = dembase_getIAfter(iPopnOrig_r, transform_R);
-	int iAfterDest_r = dembase_getIAfter(iPopnDest_r, transform_R);
+	int iAfterOrig_r = getIAfterIndexed(iPopnOrig_r, transform_R);
+	int iAfterDest_r = getIAfterIndexed(iPopnDest_r, transform_R);
 	if (iAfterOrig_r != iAfterDest_r) {
 	  if (iAfterOrig_r > 0) {
 	    double diffLogLikOrig = diffLogLikPopnOneCell(iAfterOrig_r,
@@ -2243,16 +2302,13 @@ diffLogLikPopnPair(int diffOrig, int diffDest,
 	    ans += diffLogLikDest;
 	  }
 	}
-	resetCP(iterator_R, iPopnOrig_r);
-	resetCP(iteratorDest_R, iPopnDest_r);
-	finished = *finished_ptr;
-	while (!finished) {
-	  advanceCP(iterator_R);
-	  advanceCP(iteratorDest_R);
-	  int iPopnOrigHere_r = *iPopnOrigHere_ptr;
-	  int iPopnDestHere_r = *iPopnDestHere_ptr;
-	  int iAfterOrig_r = dembase_getIAfter(iPopnOrigHere_r, transform_R);
-	  int iAfterDest_r = dembase_getIAfter(iPopnDestHere_r, transform_R);
+	int iPopnOrigHere = spanOrig.i;
+	int iPopnDestHere = spanDest.i;
+	for (int k = 0; k < spanOrig.nStep; ++k) {
+	  iPopnOrigHere += cohortSpanStride(&spanOrig, k);
+	  iPopnDestHere += cohortSpanStride(&spanDest, k);
+	  int iAfterOrig_r = getIAfterIndexed(iPopnOrigHere + 1, transform_R);
+	  int iAfterDest_r = getIAfterIndexed(iPopnDestHere + 1, transform_R);
 	  if (iAfterOrig_r != iAfterDest_r) {
 	    if (iAfterOrig_r > 0) {
 	      double diffLogLikOrig = diffLogLikPopnOneCell(iAfterOrig_r,
@@ -2273,12 +2329,10 @@ diffLogLikPopnPair(int diffOrig, int diffDest,
 	      ans += diffLogLikDest;
 	    }
 	  }
-	  finished = *finished_ptr;
 	}
       }	/* assocWithPopn */
     }	/* for (int iDataset = 0; iDataset < nDatasets; ++iDataset) */
   }     /* iPopnOrig_r != iPopnDest_r */
-  UNPROTECT(1); 		/* iteratorDest_R */
   return ans;
 }
 
@@ -2685,47 +2739,25 @@ diffLogDensPopnOneCohort(int diff, SEXP population_R, int i_r,
              int * strucZeroArray)
 {
     int * population = INTEGER(population_R);
-    resetCP(iterator_R, i_r);
     double ans = 0;
 
-    int * i_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-    int * finished_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-
-    int valCurr = 0;
-    int valProp = 0;
-    double lambda = 0;
-    double logDensProp = 0;
-    double logDensCurr = 0;
-
-    int i = *i_ptr - 1;
-    int finished = *finished_ptr;
+    CohortSpan span;
+    makeCohortSpanCP(&span, iterator_R, i_r);
+    int i = span.i;
 
-    int isStrucZero = strucZeroArray[i] == 0;
-    if (!isStrucZero) {
-        valCurr = population[i];
-        valProp = valCurr + diff;
-        lambda = theta[i];
-        logDensProp = dpois(valProp, lambda, USE_LOG);
-        logDensCurr = dpois(valCurr, lambda, USE_LOG);
-        ans += (logDensProp - logDensCurr);
-    }
-
-    while (!finished) {
+    for (int k = 0; k <= span.nStep; ++k) {
 
-        advanceCP(iterator_R);
-        i = *i_ptr - 1;
-        finished = *finished_ptr;
-
-        isStrucZero = strucZeroArray[i] == 0;
+        int isStrucZero = strucZeroArray[i] == 0;
         if (!isStrucZero) {
-            valCurr = population[i];
-            valProp = valCurr + diff;
-            lambda = theta[i];
-            logDensProp = dpois(valProp, lambda, USE_LOG);
-            logDensCurr = dpois(valCurr, lambda, USE_LOG);
-            ans += (logDensProp - logDensCurr);
+            int valCurr = population[i];
+            int valProp = valCurr + diff;
+            double lambda = theta[i];
+            ans += diffLogDensPoisCount(valProp, valCurr, lambda);
         }
 
+        if (k < span.nStep) {
+            i += cohortSpanStride(&span, k);
+        }
     }
     return ans;
 }
@@ -2980,9 +3012,7 @@ diffLogDensExpOneOrigDestParChPool(int iCell_r, int hasAge,
 	  double thetaCurr = theta[iComp];
 	  double lambdaProp = thetaCurr * exposureProp;
 	  double lambdaCurr = thetaCurr * exposureCurr;
-	  double diffLogLik = dpois(compCurr, lambdaProp, USE_LOG)
-	    -
-	    dpois(compCurr, lambdaCurr, USE_LOG);
+	  double diffLogLik = diffLogDensPoisLambda(compCurr, lambdaProp, lambdaCurr);
 	  ans += diffLogLik;
 	}
       }
@@ -3146,9 +3176,7 @@ diffLogDensExpOneComp(int iCell_r, int hasAge,
 	double thetaCurr = theta[iComp];
 	double lambdaProp = thetaCurr * exposureProp;
 	double lambdaCurr = thetaCurr * exposureCurr;
-	double diffLogLik = dpois(compCurr, lambdaProp, USE_LOG)
-	  -
-	  dpois(compCurr, lambdaCurr, USE_LOG);
+	double diffLogLik = diffLogDensPoisLambda(compCurr, lambdaProp, lambdaCurr);
 	ans += diffLogLik;
       }
     }
@@ -3242,10 +3270,8 @@ diffLogDensJumpOrigDest(SEXP combined_R)
     else {
       double lambdaDensProp = thetaCell * exposureCellProp;
       double lambdaJump = thetaCell * exposureCellJump;
-      double diffLogDens = dpois(valProp, lambdaDensProp, USE_LOG) -
-	dpois(valCurr, lambdaDensProp, USE_LOG);
-      double diffLogJump = dpois(valCurr, lambdaJump, USE_LOG) -
-	dpois(valProp, lambdaJump, USE_LOG);
+      double diffLogDens = diffLogDensPoisCount(valProp, valCurr, lambdaDensProp);
+      double diffLogJump = diffLogDensPoisCount(valCurr, valProp, lambdaJump);
       ans = diffLogDens + diffLogJump;
     }
   }
@@ -3837,12 +3863,11 @@ diffLogDensJumpPoolWithExpose(SEXP combined_R)
 	double lambdaDensOutCurr = thetaOut * exposureOutCurr;
 	double lambdaDensInCurr = thetaIn * exposureInCurr;
 	double lambdaJump = thetaOut * exposureOutJump;
-	double diffLogDens = dpois(valOutProp, lambdaDensOutProp, USE_LOG)
-	  - dpois(valOutCurr, lambdaDensOutCurr, USE_LOG)
-	  + dpois(valInProp, lambdaDensInProp, USE_LOG)
-	  - dpois(valInCurr, lambdaDensInCurr, USE_LOG);
-	double diffLogJump = dpois(valOutCurr, lambdaJump, USE_LOG)
-	  - dpois(valOutProp, lambdaJump, USE_LOG);
+	double diffLogDens = diffLogDensPois(valOutProp, lambdaDensOutProp,
+					     valOutCurr, lambdaDensOutCurr)
+	  + diffLogDensPois(valInProp, lambdaDensInProp,
+			    valInCurr, lambdaDensInCurr);
+	double diffLogJump = diffLogDensPoisCount(valOutCurr, valOutProp, lambdaJump);
 	ans = diffLogDens + diffLogJump;
       }
     }
@@ -3876,8 +3901,7 @@ diffLogDensJumpPoolNoExpose(SEXP combined_R)
     int valInCurr = component[iCellIn];
     int valInProp = valInCurr + diff;
 
-    double ans = dpois(valInProp, thetaIn, USE_LOG)
-                          - dpois(valInCurr, thetaIn, USE_LOG);
+    double ans = diffLogDensPoisCount(valInProp, valInCurr, thetaIn);
 
     return ans;
 }
@@ -4028,10 +4052,8 @@ diffLogDensJumpComp(SEXP combined_R)
       else  {
 	double lambdaDensProp = thetaCell * exposureCellProp;
 	double lambdaJump = thetaCell * exposureCellJump;
-	double diffLogDens = dpois(valProp, lambdaDensProp, USE_LOG)
-	  - dpois(valCurr, lambdaDensProp, USE_LOG);
-	double diffLogJump = dpois(valCurr, lambdaJump, USE_LOG)
-	  - dpois(valProp, lambdaJump, USE_LOG);
+	double diffLogDens = diffLogDensPoisCount(valProp, valCurr, lambdaDensProp);
+	double diffLogJump = diffLogDensPoisCount(valCurr, valProp, lambdaJump);
 	ans = diffLogDens + diffLogJump;
       }
     }
@@ -4396,11 +4418,8 @@ diffLogDensJumpBirthsSmall(SEXP combined_R)
     ans = R_PosInf;
   }
   else {
-    double ans_dens_prop = dpois(val_up_prop, val_up_expect, USE_LOG) +
-      dpois(val_low_prop, val_low_expect, USE_LOG);
-    double ans_dens_curr = dpois(val_up_curr, val_up_expect, USE_LOG) +
-      dpois(val_low_curr, val_low_expect, USE_LOG);
-    ans = ans_dens_prop - ans_dens_curr;
+    ans = diffLogDensPoisCount(val_up_prop, val_up_curr, val_up_expect)
+      + diffLogDensPoisCount(val_low_prop, val_low_curr, val_low_expect);
   }
   return ans;
 }
@@ -4502,11 +4521,10 @@ diffLogDensJumpOrigDestSmall(SEXP combined_R)
       ans = R_PosInf;
     }
     else {
-      double ans_dens_prop = dpois(val_up_prop, val_up_expect_prop, USE_LOG) +
-	dpois(val_low_prop, val_low_expect_prop, USE_LOG);
-      double ans_dens_curr = dpois(val_up_curr, val_up_expect_curr, USE_LOG) +
-	dpois(val_low_curr, val_low_expect_curr, USE_LOG);
-      ans = ans_dens_prop - ans_dens_curr;
+      ans = diffLogDensPois(val_up_prop, val_up_expect_prop,
+                            val_up_curr, val_up_expect_curr)
+        + diffLogDensPois(val_low_prop, val_low_expect_prop,
+                          val_low_curr, val_low_expect_curr);
     }
   }
   UNPROTECT(1);
@@ -4613,11 +4631,10 @@ diffLogDensJumpCompSmall(SEXP combined_R)
       ans = R_PosInf;
     }
     else {
-      double ans_dens_prop = dpois(val_up_prop, val_up_expect_prop, USE_LOG) +
-	dpois(val_low_prop, val_low_expect_prop, USE_LOG);
-      double ans_dens_curr = dpois(val_up_curr, val_up_expect_curr, USE_LOG) +
-	dpois(val_low_curr, val_low_expect_curr, USE_LOG);
-      ans = ans_dens_prop - ans_dens_curr;
+      ans = diffLogDensPois(val_up_prop, val_up_expect_prop,
+                            val_up_curr, val_up_expect_curr)
+        + diffLogDensPois(val_low_prop, val_low_expect_prop,
+                          val_low_curr, val_low_expect_curr);
     }
   }
   UNPROTECT(1);
@@ -4642,15 +4659,17 @@ updateAccSmall(SEXP combined_R)
       if (is_orig_dest) {
 	int i_acc_dest_r = *INTEGER(GET_SLOT(combined_R, iAccNextOther_sym));
 	accession[i_acc_r - 1] -= diff;
+	noteCohortCellChange(accession, i_acc_r - 1, -diff);
 	accession[i_acc_dest_r - 1] += diff;
+	noteCohortCellChange(accession, i_acc_dest_r - 1, diff);
       }
       else {
 	int * isIncrementVec = LOGICAL(GET_SLOT(combined_R, isIncrement_sym));
 	int is_increment = isIncrementVec[i_comp_r - 1];
-	if (is_increment)
-	  accession[i_acc_r - 1] += diff;
-	else
-	  accession[i_acc_r - 1] -= diff;
+	if (!is_increment)
+	  diff = -diff;
+	accession[i_acc_r - 1] += diff;
+	noteCohortCellChange(accession, i_acc_r - 1, diff);
       }
     }
   }
@@ -4759,7 +4778,8 @@ updateCellMove(SEXP combined_R)
     if (isPopn) {
         int * population = INTEGER(GET_SLOT(account_R, population_sym));
         population[iCell] += diff;
-
+        noteSeriesChange(population, iCell, diff);
+        noteCohortCellChange(population, iCell, diff);
     }
     else { /* not population so use component */
 
@@ -4771,14 +4791,19 @@ updateCellMove(SEXP combined_R)
 
         if(isPool) {
             component[iCell] += diff;
+            noteSeriesChange(component, iCell, diff);
             component[iCellOther] += diff;
+            noteSeriesChange(component, iCellOther, diff);
         }
         else if(isIntNet || isSmallUpdate) {
             component[iCell] += diff;
+            noteSeriesChange(component, iCell, diff);
             component[iCellOther] -= diff;
+            noteSeriesChange(component, iCellOther, -diff);
         }
         else {
             component[iCell] += diff;
+            noteSeriesChange(component, iCell, diff);
         }
     }
 }
@@ -4809,24 +4834,10 @@ updateSubsequentPopnMove(SEXP combined_R)
     SEXP account_R = GET_SLOT(combined_R, account_sym);
     int * population = INTEGER(GET_SLOT(account_R, population_sym));
 
-    if (isPopn) {
-
-        resetCP(iterator_R, iPopnNext_r);
-        int * i_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-        int * finished_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-        int i = *i_ptr - 1;
-        int finished = *finished_ptr;
-        population[i] += diff;
-
-        while(!finished) {
-            advanceCP(iterator_R);
-            i = *i_ptr - 1 ;
-            finished = *finished_ptr;
-            population[i] += diff;
-        }
+    CohortSpan span;
+    makeCohortSpanCP(&span, iterator_R, iPopnNext_r);
 
-    }
-    else if(updateTwoCohorts) {
+    if(!isPopn && updateTwoCohorts) {
 
         int iPopnNextOther_r = *INTEGER(GET_SLOT(combined_R, iPopnNextOther_sym));
 
@@ -4837,54 +4848,46 @@ updateSubsequentPopnMove(SEXP combined_R)
             diffOrig = -diff;
             diffDest = diff;
         }
-        SEXP iteratorDest_R;
-        PROTECT(iteratorDest_R = duplicate(iterator_R));
-        resetCP(iterator_R, iPopnNext_r);
-        resetCP(iteratorDest_R, iPopnNextOther_r);
-
-        int * iOrig_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-        int * finishedOrig_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-        int * iDest_ptr = INTEGER(GET_SLOT(iteratorDest_R, i_sym));
-        int iOrig = *iOrig_ptr - 1;
-        int iDest = *iDest_ptr - 1;
-        int finishedOrig = *finishedOrig_ptr;
-        population[iOrig] += diffOrig;
-        population[iDest] += diffDest;
-
-        while(!finishedOrig) {
-            advanceCP(iterator_R);
-            advanceCP(iteratorDest_R);
-            iOrig = *iOrig_ptr - 1;
-            iDest = *iDest_ptr - 1;
-            finishedOrig = *finishedOrig_ptr;
+
+        CohortSpan spanDest;
+        makeCohortSpanCP(&spanDest, iterator_R, iPopnNextOther_r);
+
+        int iOrig = span.i;
+        int iDest = spanDest.i;
+        noteCohortPathChange(population, iOrig, diffOrig);
+        noteCohortPathChange(population, iDest, diffDest);
+
+        for (int k = 0; k <= span.nStep; ++k) {
             population[iOrig] += diffOrig;
+            noteSeriesChange(population, iOrig, diffOrig);
             population[iDest] += diffDest;
+            noteSeriesChange(population, iDest, diffDest);
+            if (k < span.nStep) {
+                iOrig += cohortSpanStride(&span, k);
+                iDest += cohortSpanStride(&spanDest, k);
+            }
         }
-
-        UNPROTECT(1); /* iteratorDest_R */
     }
     else {
-        int iComp = iComp_r - 1;
-        int isIncrement = isIncrementVec[iComp];
+        if (!isPopn) {
+            int iComp = iComp_r - 1;
+            int isIncrement = isIncrementVec[iComp];
 
-        if(!isIncrement) {
-            diff = -diff;
+            if(!isIncrement) {
+                diff = -diff;
+            }
         }
 
-        resetCP(iterator_R, iPopnNext_r);
-        int * i_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-        int * finished_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-        int i = *i_ptr - 1;
-        int finished = *finished_ptr;
-        population[i] += diff;
-
-        while(!finished) {
-            advanceCP(iterator_R);
-            i = *i_ptr - 1;
-            finished = *finished_ptr;
+        int i = span.i;
+        noteCohortPathChange(population, i, diff);
+
+        for (int k = 0; k <= span.nStep; ++k) {
             population[i] += diff;
+            noteSeriesChange(population, i, diff);
+            if (k < span.nStep) {
+                i += cohortSpanStride(&span, k);
+            }
         }
-
     }
 }
 
@@ -4916,24 +4919,10 @@ updateSubsequentAccMove(SEXP combined_R)
 
         int * accession = INTEGER(GET_SLOT(combined_R, accession_sym));
 
-        if (isPopn) {
-
-            resetCA(iterator_R, iAccNext_r);
-            int * i_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-            int * finished_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-            int i = *i_ptr - 1;
-            int finished = *finished_ptr;
-            accession[i] += diff;
+        CohortSpan span;
+        makeCohortSpanCA(&span, iterator_R, iAccNext_r);
 
-            while(!finished) {
-                advanceCA(iterator_R);
-                i = *i_ptr - 1 ;
-                finished = *finished_ptr;
-                accession[i] += diff;
-            }
-
-        }
-        else if(updateTwoCohorts) {
+        if(!isPopn && updateTwoCohorts) {
 
             int iAccNextOther_r = *INTEGER(GET_SLOT(combined_R, iAccNextOther_sym));
 
@@ -4944,54 +4933,43 @@ updateSubsequentAccMove(SEXP combined_R)
                 diffOrig = -diff;
                 diffDest = diff;
             }
-            SEXP iteratorDest_R;
-            PROTECT(iteratorDest_R = duplicate(iterator_R));
-            resetCA(iterator_R, iAccNext_r);
-            resetCA(iteratorDest_R, iAccNextOther_r);
-
-            int * iOrig_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-            int * finishedOrig_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-            int * iDest_ptr = INTEGER(GET_SLOT(iteratorDest_R, i_sym));
-            int iOrig = *iOrig_ptr - 1;
-            int iDest = *iDest_ptr - 1;
-            int finishedOrig = *finishedOrig_ptr;
-            accession[iOrig] += diffOrig;
-            accession[iDest] += diffDest;
-
-            while(!finishedOrig) {
-                advanceCA(iterator_R);
-                advanceCA(iteratorDest_R);
-                iOrig = *iOrig_ptr - 1;
-                iDest = *iDest_ptr - 1;
-                finishedOrig = *finishedOrig_ptr;
+
+            CohortSpan spanDest;
+            makeCohortSpanCA(&spanDest, iterator_R, iAccNextOther_r);
+
+            int iOrig = span.i;
+            int iDest = spanDest.i;
+            noteCohortPathChange(accession, iOrig, diffOrig);
+            noteCohortPathChange(accession, iDest, diffDest);
+
+            for (int k = 0; k <= span.nStep; ++k) {
                 accession[iOrig] += diffOrig;
                 accession[iDest] += diffDest;
+                if (k < span.nStep) {
+                    iOrig += cohortSpanStride(&span, k);
+                    iDest += cohortSpanStride(&spanDest, k);
+                }
             }
-
-            UNPROTECT(1); /* iteratorDest_R */
         }
         else {
-            int iComp = iComp_r - 1;
-            int isIncrement = isIncrementVec[iComp];
+            if (!isPopn) {
+                int iComp = iComp_r - 1;
+                int isIncrement = isIncrementVec[iComp];
 
-            if(!isIncrement) {
-                diff = -diff;
+                if(!isIncrement) {
+                    diff = -diff;
+                }
             }
 
-            resetCA(iterator_R, iAccNext_r);
-            int * i_ptr = INTEGER(GET_SLOT(iterator_R, i_sym));
-            int * finished_ptr = LOGICAL(GET_SLOT(iterator_R, finished_sym));
-            int i = *i_ptr - 1;
-            int finished = *finished_ptr;
-            accession[i] += diff;
-
-            while(!finished) {
-                advanceCA(iterator_R);
-                i = *i_ptr - 1;
-                finished = *finished_ptr;
+            int i = span.i;
+            noteCohortPathChange(accession, i, diff);
+
+            for (int k = 0; k <= span.nStep; ++k) {
                 accession[i] += diff;
+                if (k < span.nStep) {
+                    i += cohortSpanStride(&span, k);
+                }
             }
-
         }
     } /* end if !noSubsequentAccession */
 }
@@ -1,8 +1,10 @@
 
 #include "update-nongeneric.h"
+#include "model-state.h"
 #include "model-methods.h"
 #include "Prior-methods.h"
 #include "helper-functions.h"
+#include "random-streams.h"
 #include "demest.h"
 
 
@@ -65,6 +67,7 @@ extern SEXP
   scaleTheta_sym,
   scaleThetaMultiplier_sym,
   nAcceptTheta_sym,
+  nAcceptThetaAdapt_sym,
   betas_sym,
   priors_sym,
   iteratorBetas_sym,
@@ -2889,6 +2892,50 @@ get_log_gamma_dens(int n, double theta[],
     return result;
 }
 
+/* helper functions to calculate differences between log densities
+   for Metropolis-Hastings updates, leaving out terms that cancel,
+   such as lgamma(y + 1) in the Poisson and the binomial coefficient
+   in the binomial */
+static __inline__ double
+diff_log_dens_pois(int y, double lambda_prop, double lambda_curr,
+                double log_lambda_prop, double log_lambda_curr)
+{
+    double ans = lambda_curr - lambda_prop;
+    if (y > 0)
+        ans += y * (log_lambda_prop - log_lambda_curr);
+    return ans;
+}
+
+/* log(invlogit(x)), avoiding overflow */
+static __inline__ double
+log_inv_logit(double x)
+{
+    if (x > 0)
+        return -log1p(exp(-x));
+    else
+        return x - log1p(exp(x));
+}
+
+static __inline__ double
+diff_log_dens_binom(int y, int n, double logit_prop, double logit_curr)
+{
+    double ans = 0.0;
+    if (y > 0)
+        ans += y * (log_inv_logit(logit_prop) - log_inv_logit(logit_curr));
+    if (n > y)
+        ans += (n - y) * (log_inv_logit(-logit_prop) - log_inv_logit(-logit_curr));
+    return ans;
+}
+
+/* 'half_prec' is 1 / (2 * sd^2) */
+static __inline__ double
+diff_log_dens_norm(double x_prop, double x_curr, double mean, double half_prec)
+{
+    double diff_prop = x_prop - mean;
+    double diff_curr = x_curr - mean;
+    return (diff_curr * diff_curr - diff_prop * diff_prop) * half_prec;
+}
+
 void
 updateAlphaLN2(SEXP object_R, SEXP y_R, SEXP exposure_R)
 {
@@ -2960,15 +3007,23 @@ updateAlphaLN2(SEXP object_R, SEXP y_R, SEXP exposure_R)
 void
 updatePriorsBetas(SEXP object_R)
 {
-  SEXP priors_R = GET_SLOT(object_R, priorsBetas_sym);
-  SEXP betas_R = GET_SLOT(object_R, betas_sym);
-  int n_beta =  LENGTH(betas_R);
-  double *thetaTransformed = REAL(GET_SLOT(object_R, thetaTransformed_sym));
-  double sigma = *REAL(GET_SLOT(object_R, sigma_sym));
+  ModelState state;
+  initModelState(&state, object_R, R_NilValue, R_NilValue);
+  updatePriorsBetasInternal(&state);
+}
+
+/* The priors are updated through their SEXP objects,
+   as by 'updatePriorsBetas' */
+void
+updatePriorsBetasInternal(ModelState *state)
+{
+  int n_beta = state->nBeta;
+  double *thetaTransformed = state->thetaTransformed;
+  double sigma = *state->sigma;
   for (int i_beta = 0; i_beta < n_beta; ++i_beta) {
-    double *beta = REAL(VECTOR_ELT(betas_R, i_beta));
-    SEXP prior_R = VECTOR_ELT(priors_R, i_beta);
-    int J = *INTEGER(GET_SLOT(prior_R, J_sym));
+    double *beta = state->betas[i_beta];
+    SEXP prior_R = state->priors[i_beta];
+    int J = state->J[i_beta];
     updatePriorBeta(beta, J, prior_R, thetaTransformed, sigma);
   }
 }
@@ -2977,58 +3032,83 @@ updatePriorsBetas(SEXP object_R)
 void
 updateBetas(SEXP object_R)
 {
-  SEXP betas_R = GET_SLOT(object_R, betas_sym);
-  SEXP meansBetas_R = GET_SLOT(object_R, meansBetas_sym);
-  SEXP variancesBetas_R = GET_SLOT(object_R, variancesBetas_sym);
-  SEXP priorsBetas_R = GET_SLOT(object_R, priorsBetas_sym);
-  int *betaEqualsMean = LOGICAL(GET_SLOT(object_R, betaEqualsMean_sym));
-  SEXP theta_R = GET_SLOT(object_R, theta_sym);
-  double *theta = REAL(theta_R);
-  double *thetaTransformed = REAL(GET_SLOT(object_R, thetaTransformed_sym));
-  int *cellInLik = LOGICAL(GET_SLOT(object_R, cellInLik_sym));
-  SEXP iteratorBetas_R = GET_SLOT(object_R, iteratorBetas_sym);
-  double sigma = *REAL(GET_SLOT(object_R, sigma_sym));
+  ModelState state;
+  initModelState(&state, object_R, R_NilValue, R_NilValue);
+  updateBetasInternal(&state);
+}
+
+/* Gibbs sweep through the betas, using residuals
+   thetaTransformed - mu. Before each beta is updated its
+   own contribution is added back to the residuals, and
+   afterwards the contribution of the new values is subtracted,
+   so each beta costs one pass through the cells. If
+   'update_mu' is true, the residuals start from the
+   current value of mu, and mu is updated as each
+   beta changes, rather than being left unchanged. */
+static void
+updateBetasSweep(ModelState *state, int update_mu)
+{
+  double *thetaTransformed = state->thetaTransformed;
+  double *mu = state->mu;
+  int *cellInLik = state->cellInLik;
+  int *betaEqualsMean = state->betaEqualsMean;
+  double sigma = *state->sigma;
   double sigma_sq = sigma * sigma;
-  int n_beta =  LENGTH(betas_R);
-  int n_theta =  LENGTH(theta_R);
-  double *beta_ptr[n_beta];
-  double *mean_ptr[n_beta];
-  double *var_ptr[n_beta];
-  int *struc_zero_ptr[n_beta];
-  int J_vec[n_beta];
-  int max_J = 0;
-  for (int i_beta = 0; i_beta < n_beta; ++i_beta) {
-    beta_ptr[i_beta] = REAL(VECTOR_ELT(betas_R, i_beta));
-    mean_ptr[i_beta] = REAL(VECTOR_ELT(meansBetas_R, i_beta));
-    var_ptr[i_beta] = REAL(VECTOR_ELT(variancesBetas_R, i_beta));
-    SEXP prior_R = VECTOR_ELT(priorsBetas_R, i_beta);
-    struc_zero_ptr[i_beta] = LOGICAL(GET_SLOT(prior_R, allStrucZero_sym));
-    int J = *INTEGER(GET_SLOT(prior_R, J_sym));
-    J_vec[i_beta] = J;
-    if (J > max_J)
-      max_J = J;
+  int n_beta = state->nBeta;
+  int n_theta = state->nTheta;
+  int *beta_indices = getBetaIndices(state);
+  double *vbar = state->vbar;
+  int *n_vec = state->nVec;
+  double *delta = state->betaDelta;
+  double *resid = state->workTheta;
+
+  newStreamStage();
+
+  if (update_mu) {
+    for (int i = 0; i < n_theta; ++i) {
+      resid[i] = thetaTransformed[i] - mu[i];
+    }
   }
-  double *vbar = (double *)R_alloc(max_J, sizeof(double));
-  int *n_vec = (int *)R_alloc(max_J, sizeof(int));
+  else {
+    memcpy(resid, thetaTransformed, n_theta * sizeof(double));
+    for (int i_beta = 0; i_beta < n_beta; ++i_beta) {
+      double *beta = state->betas[i_beta];
+      int *index = beta_indices + i_beta * n_theta;
+      for (int i = 0; i < n_theta; ++i) {
+        resid[i] -= beta[index[i]];
+      }
+    }
+  }
+
   for (int i_beta = 0; i_beta < n_beta; ++i_beta) {
-    int J = J_vec[i_beta];
+    int J = state->J[i_beta];
+    double *beta = state->betas[i_beta];
+    double *mean = state->meansBetas[i_beta];
+    int *index = beta_indices + i_beta * n_theta;
+    for (int i = 0; i < n_theta; ++i) {
+      resid[i] += beta[index[i]];
+    }
+    if (update_mu) {
+      for (int j = 0; j < J; ++j) {
+        delta[j] = -beta[j];
+      }
+    }
     if (betaEqualsMean[i_beta]) {
       for (int j = 0; j < J; ++j) {
-    beta_ptr[i_beta][j] = mean_ptr[i_beta][j];
+    beta[j] = mean[j];
       }
     }
     else {
-      getVBarAndN(vbar, n_vec,
+      double *var = state->variancesBetas[i_beta];
+      int *struc_zero = state->allStrucZero[i_beta];
+      getVBarAndNFromResiduals(vbar, n_vec,
           J, cellInLik,
-          betas_R, iteratorBetas_R,
-          theta, n_theta,
-          thetaTransformed,
-          n_beta, i_beta);
+          index, resid, n_theta);
       for (int j = 0; j < J; ++j) {
-    int all_struc_zero = struc_zero_ptr[i_beta][j];
+    int all_struc_zero = struc_zero[j];
     if (!all_struc_zero) {
-      double mean_prior = mean_ptr[i_beta][j];
-      double var_prior = var_ptr[i_beta][j];
+      double mean_prior = mean[j];
+      double var_prior = var[j];
       double val_post;
       if (var_prior > 0) {
         double prec_data = n_vec[j] / sigma_sq;
@@ -3037,17 +3117,46 @@ updateBetas(SEXP object_R)
         double mean_data = vbar[j];
         double mean_post = (prec_data * mean_data + prec_prior * mean_prior) * var_post;
         double sd_post = sqrt(var_post);
-        val_post = rnorm(mean_post, sd_post);
+        val_post = rnormStream(mean_post, sd_post);
       }
       else
         val_post = mean_prior;
-      beta_ptr[i_beta][j] = val_post;
+      beta[j] = val_post;
+    }
+      }
+    }
+    if (update_mu) {
+      for (int j = 0; j < J; ++j) {
+        delta[j] += beta[j];
+      }
+      for (int i = 0; i < n_theta; ++i) {
+        int pos = index[i];
+        resid[i] -= beta[pos];
+        mu[i] += delta[pos];
+      }
     }
+    else {
+      for (int i = 0; i < n_theta; ++i) {
+        resid[i] -= beta[index[i]];
       }
     }
   }
 }
 
+void
+updateBetasInternal(ModelState *state)
+{
+  updateBetasSweep(state, 0);
+}
+
+/* Equivalent to calling 'updateBetasInternal' followed
+   by 'updateMuInternal', except for rounding error. */
+void
+updateBetasAndMuInternal(ModelState *state)
+{
+  updateBetasSweep(state, 1);
+}
+
 
 void
 updateLogPostBetas(SEXP object_R)
@@ -3101,48 +3210,62 @@ updateLogPostBetas(SEXP object_R)
 void
 updateMeansBetas(SEXP object_R)
 {
-  SEXP means_R = GET_SLOT(object_R, meansBetas_sym);
-  SEXP priors_R = GET_SLOT(object_R, priorsBetas_sym);
-  int n_beta =  LENGTH(means_R);
+  ModelState state;
+  initModelState(&state, object_R, R_NilValue, R_NilValue);
+  updateMeansBetasInternal(&state);
+}
 
+void
+updateMeansBetasInternal(ModelState *state)
+{
+  int n_beta = state->nBeta;
   for (int i = 0; i < n_beta; ++i) {
-    SEXP mean_R = VECTOR_ELT(means_R, i);
-    double *mean = REAL(mean_R);
-    int J = LENGTH(mean_R);
-    SEXP prior_R = VECTOR_ELT(priors_R, i);
-    betaHat(mean, prior_R, J);
+    betaHat(state->meansBetas[i], state->priors[i], state->J[i]);
   }
 }
 
 void
 updateMu(SEXP object_R)
 {
+  ModelState state;
+  initModelState(&state, object_R, R_NilValue, R_NilValue);
+  updateMuInternal(&state);
+}
 
-  SEXP mu_R = GET_SLOT(object_R, mu_sym);
-  double *mu = REAL(mu_R);
-  int n_mu = LENGTH(mu_R);
-
-  SEXP betas_R = GET_SLOT(object_R, betas_sym);
-  int n_beta =  LENGTH(betas_R);
-
-  SEXP iterator_R = GET_SLOT(object_R, iteratorBetas_sym);
-  resetB(iterator_R);
-
-  int *indices = INTEGER(GET_SLOT(iterator_R, indices_sym));
-
-  double* beta_ptr[n_beta]; /* array of pointers */
-  for (int b = 0; b < n_beta; ++b) {
-    beta_ptr[b] = REAL(VECTOR_ELT(betas_R, b));
-  }
+/* Uses the table from 'getBetaIndices' if the betas have
+   already been updated through 'state', and otherwise
+   steps through the cells with the iterator, so that
+   calculating mu on its own does not build the table. */
+void
+updateMuInternal(ModelState *state)
+{
+  double *mu = state->mu;
+  int n_mu = state->nTheta;
+  int n_beta = state->nBeta;
+  int *beta_indices = state->betaIndices;
 
-  for (int i = 0; i < n_mu; ++i) {
-    mu[i] = 0;
+  if (beta_indices) {
+    memset(mu, 0, n_mu * sizeof(double));
     for (int b = 0; b < n_beta; ++b) {
-      mu[i] += beta_ptr[b][indices[b]-1];
+      double *beta = state->betas[b];
+      int *index = beta_indices + b * n_mu;
+      for (int i = 0; i < n_mu; ++i) {
+        mu[i] += beta[index[i]];
+      }
+    }
+  }
+  else {
+    SEXP iterator_R = state->iteratorBetas_R;
+    resetB(iterator_R);
+    int *indices = INTEGER(GET_SLOT(iterator_R, indices_sym));
+    for (int i = 0; i < n_mu; ++i) {
+      mu[i] = 0;
+      for (int b = 0; b < n_beta; ++b) {
+        mu[i] += state->betas[b][indices[b] - 1];
+      }
+      advanceB(iterator_R);
     }
-    advanceB(iterator_R);
   }
-
 }
 
 
@@ -3150,30 +3273,44 @@ updateMu(SEXP object_R)
 void
 updateSigma_Varying(SEXP object)
 {
-  SEXP sigma_R = GET_SLOT(object, sigma_sym);
-  double sigma = *REAL(GET_SLOT(sigma_R, Data_sym));
-  double sigmaMax = *REAL(GET_SLOT(object, sigmaMax_sym));
+  ModelState state;
+  initModelState(&state, object, R_NilValue, R_NilValue);
+  updateSigma_VaryingInternal(&state);
+}
+
+void
+updateSigma_VaryingInternal(ModelState *state)
+{
+  double sigma = *state->sigma;
+  double sigmaMax = state->sigmaMax;
 
-  double A = *REAL(GET_SLOT(object, ASigma_sym));
-  double nu = *REAL(GET_SLOT(object, nuSigma_sym));
+  double A = state->ASigma;
+  double nu = state->nuSigma;
 
-  SEXP theta_R = GET_SLOT(object, theta_sym);
-  int n_theta = LENGTH(theta_R);
+  int n_theta = state->nTheta;
 
-  double *thetaTransformed = REAL(GET_SLOT(object, thetaTransformed_sym));
+  double *thetaTransformed = state->thetaTransformed;
 
-  double *mu = REAL(GET_SLOT(object, mu_sym));
+  double *mu = state->mu;
 
-  int *cellInLik = LOGICAL(GET_SLOT(object, cellInLik_sym));
+  int *cellInLik = state->cellInLik;
 
   double V = 0.0;
   int n = 0;
 
-  for (int i = 0; i < n_theta; ++i) {
-    if (cellInLik[i]) {
-      double tmp = thetaTransformed[i] - mu[i];
-      V += (tmp * tmp);
-      n += 1;
+  if (state->hasSumSqResid) {
+    /* calculated during theta update */
+    V = state->sumSqResid;
+    n = state->nSumSqResid;
+    state->hasSumSqResid = 0;
+  }
+  else {
+    for (int i = 0; i < n_theta; ++i) {
+      if (cellInLik[i]) {
+        double tmp = thetaTransformed[i] - mu[i];
+        V += (tmp * tmp);
+        n += 1;
+      }
     }
   }
 
@@ -3183,7 +3320,7 @@ updateSigma_Varying(SEXP object)
 
   if (successfullyUpdated) {
 
-    SET_DOUBLESCALE_SLOT(object, sigma_sym, sigma);
+    *state->sigma = sigma;
   }
 }
 
@@ -3231,41 +3368,67 @@ updateSigmaLN2(SEXP object_R)
 void
 updateTheta_BinomialVarying(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-  SEXP theta_R = GET_SLOT(object, theta_sym);
-  double *theta = REAL(theta_R);
-  int n_theta = LENGTH(theta_R);
-  double *thetaTransformed = REAL(GET_SLOT(object, thetaTransformed_sym));
+  ModelState state;
+  initModelState(&state, object, y_R, exposure_R);
+  updateTheta_BinomialVaryingInternal(&state);
+}
+
+void
+updateTheta_BinomialVaryingInternal(ModelState *state)
+{
+  double *theta = state->theta;
+  int n_theta = state->nTheta;
+  double *thetaTransformed = state->thetaTransformed;
   /* n_theta and length of y_R and exposure_R are all identical */
 
-  double *mu = REAL(GET_SLOT(object, mu_sym));
+  double *mu = state->mu;
 
-  double scale = *REAL(GET_SLOT(object, scaleTheta_sym));
-  double scale_multiplier = *REAL(GET_SLOT(object, scaleThetaMultiplier_sym));
+  double scale = *state->scaleTheta;
+  double scale_multiplier = *state->scaleThetaMultiplier;
 
-  double lower = *REAL(GET_SLOT(object, lower_sym));
-  double upper = *REAL(GET_SLOT(object, upper_sym));
-  double tolerance = *REAL(GET_SLOT(object, tolerance_sym));
-  int maxAttempt = *INTEGER(GET_SLOT(object, maxAttempt_sym));
+  double lower = state->lower;
+  double upper = state->upper;
+  double tolerance = state->tolerance;
+  int maxAttempt = state->maxAttempt;
 
-  double sigma = *REAL(GET_SLOT(object, sigma_sym));
+  double sigma = *state->sigma;
 
-  int *y = INTEGER(y_R);
-  int *exposure = INTEGER(exposure_R);
+  int *y = state->yInt;
+  int *exposure = state->exposureInt;
 
   int n_accept_theta = 0;
   int n_failed_prop_theta = 0;
 
   scale = scale * scale_multiplier;
 
+  double half_prec_prior = 0.5 / (sigma * sigma);
+
+  int *yMissing = state->yMissing; /* from 'initModelState' */
+
+  /* sum of squared residuals, for use by 'updateSigma_VaryingInternal' */
+  int *cellInLik = state->cellInLik;
+  double *sq_resid = state->sqResid;
+  int n_resid = 0;
+
+  /* cells are updated in parallel when using
+     counter-based random numbers, if there are enough of them */
+  int use_threads = usesCounterRNGThreads(n_theta);
+
+  newStreamStage();
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) if(use_threads) num_threads(nCounterRNGThreads()) reduction(+:n_accept_theta,n_failed_prop_theta,n_resid)
+#endif
   for (int i = 0; i < n_theta; ++i) {
 
+    setStreamCell(i);
+
     int this_y = y[i];
     int this_exposure = exposure[i];
-    int y_is_missing = ( this_y == NA_INTEGER || ISNA(this_y) );
+    int y_is_missing = yMissing[i];
 
     double mean = 0;
     double sd = 0;
-    double theta_curr = theta[i]; /* only used if y not missing */
     double logit_th_curr = thetaTransformed[i]; /* only used if y not missing */
 
     if (y_is_missing) {
@@ -3285,7 +3448,7 @@ updateTheta_BinomialVarying(SEXP object, SEXP y_R, SEXP exposure_R)
     while( (!found_prop) && (attempt < maxAttempt) ) {
 
       ++attempt;
-      logit_th_prop = rnorm(mean, sd);
+      logit_th_prop = rnormStream(mean, sd);
 
       found_prop = ( (logit_th_prop > lower + tolerance) &&
              (logit_th_prop < upper - tolerance));
@@ -3308,21 +3471,15 @@ updateTheta_BinomialVarying(SEXP object, SEXP y_R, SEXP exposure_R)
       }
       else {
 
-    double loglik_prop = dbinom(this_y, this_exposure,
-                    theta_prop, USE_LOG);
-    double loglik_curr = dbinom(this_y, this_exposure,
-                    theta_curr, USE_LOG);
-    /* Calculate log of (prior density * proposal density). The Jacobians
-       from the transformation of variables cancel, as do the normal
-       densitites in the proposal distributions.*/
-
-    double log_dens_prop = dnorm(logit_th_prop, mu[i], sigma, USE_LOG);
-    double log_dens_curr = dnorm(logit_th_curr, mu[i], sigma, USE_LOG);
-
-    double log_diff = loglik_prop + log_dens_prop
-      - loglik_curr - log_dens_curr;
+    /* Calculate log of (likelihood * prior density * proposal density).
+       The Jacobians from the transformation of variables cancel, as do
+       the normal densitites in the proposal distributions.*/
+    double log_diff = (diff_log_dens_binom(this_y, this_exposure,
+                                           logit_th_prop, logit_th_curr)
+                       + diff_log_dens_norm(logit_th_prop, logit_th_curr,
+                                            mu[i], half_prec_prior));
 
-    int accept = (!(log_diff < 0) || (runif(0, 1) < exp(log_diff)));
+    int accept = (!(log_diff < 0) || (runifStream(0, 1) < exp(log_diff)));
     /* acceptance */
     if (accept) {
       ++n_accept_theta;
@@ -3335,11 +3492,29 @@ updateTheta_BinomialVarying(SEXP object, SEXP y_R, SEXP exposure_R)
       ++n_failed_prop_theta;
     }
 
+    if (cellInLik[i]) {
+      double resid = thetaTransformed[i] - mu[i];
+      sq_resid[i] = resid * resid;
+      ++n_resid;
+    }
+    else {
+      sq_resid[i] = 0;
+    }
   } /* end loop through thetas */
 
+  newStreamStage();
+
     /* theta updated in place */
-  SET_INTSCALE_SLOT(object, nAcceptTheta_sym, n_accept_theta);
-  SET_INTSCALE_SLOT(object, nFailedPropTheta_sym, n_failed_prop_theta);
+  *state->nAcceptTheta = n_accept_theta;
+  *state->nFailedPropTheta = n_failed_prop_theta;
+
+  double ss_resid = 0;
+  for (int i = 0; i < n_theta; ++i) {
+    ss_resid += sq_resid[i];
+  }
+  state->sumSqResid = ss_resid;
+  state->nSumSqResid = n_resid;
+  state->hasSumSqResid = 1;
 }
 
 /* y_R is g'teed to be integer
@@ -4363,38 +4538,63 @@ updateThetaAndNu_CMPVaryingUseExp(SEXP object_R, SEXP y_R, SEXP exposure_R)
 void
 updateTheta_NormalVarying(SEXP object, SEXP y_R)
 {
+  ModelState state;
+  initModelState(&state, object, y_R, R_NilValue);
+  updateTheta_NormalVaryingInternal(&state);
+}
 
-  SEXP theta_R = GET_SLOT(object, theta_sym);
-  double *theta = REAL(theta_R);
-  int n_theta = LENGTH(theta_R);
-  double *thetaTransformed = REAL(GET_SLOT(object, thetaTransformed_sym));
+void
+updateTheta_NormalVaryingInternal(ModelState *state)
+{
 
-  double *mu = REAL(GET_SLOT(object, mu_sym));
+  double *theta = state->theta;
+  int n_theta = state->nTheta;
+  double *thetaTransformed = state->thetaTransformed;
 
-  double lower = *REAL(GET_SLOT(object, lower_sym));
-  double upper = *REAL(GET_SLOT(object, upper_sym));
-  double tolerance = *REAL(GET_SLOT(object, tolerance_sym));
+  double *mu = state->mu;
 
-  int maxAttempt = *INTEGER(GET_SLOT(object, maxAttempt_sym));
+  double lower = state->lower;
+  double upper = state->upper;
+  double tolerance = state->tolerance;
 
-  double *w = REAL(GET_SLOT(object, w_sym));
+  int maxAttempt = state->maxAttempt;
+
+  double *w = state->w;
   /* n_theta and length of y_R and w are all identical */
 
-  double sigma = *REAL(GET_SLOT(object, sigma_sym));
-  double varsigma = *REAL(GET_SLOT(object, varsigma_sym));
+  double sigma = *state->sigma;
+  double varsigma = *state->varsigma;
 
-  double *y = REAL(y_R);
+  double *y = state->yReal;
 
   double prec_prior = 1/(sigma*sigma);
   double varsigma_sq = varsigma*varsigma;
 
   int n_failed_prop_theta = 0;
 
+  int *yMissing = state->yMissing; /* from 'initModelState' */
+
+  /* sum of squared residuals, for use by 'updateSigma_VaryingInternal' */
+  int *cellInLik = state->cellInLik;
+  double *sq_resid = state->sqResid;
+  int n_resid = 0;
+
+  /* cells are updated in parallel when using
+     counter-based random numbers, if there are enough of them */
+  int use_threads = usesCounterRNGThreads(n_theta);
+
+  newStreamStage();
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) if(use_threads) num_threads(nCounterRNGThreads()) reduction(+:n_failed_prop_theta,n_resid)
+#endif
   for (int i = 0; i < n_theta; ++i) {
 
+    setStreamCell(i);
+
     double this_y = y[i];
 
-    int y_is_missing = ( this_y == NA_REAL || ISNA(this_y) );
+    int y_is_missing = yMissing[i];
 
     double mean = 0;
     double sd = 0;
@@ -4418,7 +4618,7 @@ updateTheta_NormalVarying(SEXP object, SEXP y_R)
 
       ++attempt;
 
-      theta_prop = rnorm(mean, sd);
+      theta_prop = rnormStream(mean, sd);
 
       found_prop = ( ( theta_prop > (lower + tolerance) )
              && ( theta_prop < (upper - tolerance) ) );
@@ -4432,9 +4632,27 @@ updateTheta_NormalVarying(SEXP object, SEXP y_R)
       ++n_failed_prop_theta;
     }
 
+    if (cellInLik[i]) {
+      double resid = thetaTransformed[i] - mu[i];
+      sq_resid[i] = resid * resid;
+      ++n_resid;
+    }
+    else {
+      sq_resid[i] = 0;
+    }
   } /* end loop through thetas */
 
-  SET_INTSCALE_SLOT(object, nFailedPropTheta_sym, n_failed_prop_theta);
+  newStreamStage();
+
+  *state->nFailedPropTheta = n_failed_prop_theta;
+
+  double ss_resid = 0;
+  for (int i = 0; i < n_theta; ++i) {
+    ss_resid += sq_resid[i];
+  }
+  state->sumSqResid = ss_resid;
+  state->nSumSqResid = n_resid;
+  state->hasSumSqResid = 1;
 }
 
 /* y_R is g'teed to be real */
@@ -5084,95 +5302,107 @@ updateThetaAndValueAgFun_Normal(SEXP object, SEXP y_R)
 void
 updateTheta_PoissonVaryingNotUseExp(SEXP object, SEXP y_R)
 {
-  double boxCoxParam = *REAL(GET_SLOT(object, boxCoxParam_sym));
+  ModelState state;
+  initModelState(&state, object, y_R, R_NilValue);
+  updateTheta_PoissonVaryingNotUseExpInternal(&state);
+}
+
+void
+updateTheta_PoissonVaryingNotUseExpInternal(ModelState *state)
+{
+  double boxCoxParam = state->boxCoxParam;
   int usesBoxCoxTransformation = (boxCoxParam > 0);
 
-  SEXP theta_R = GET_SLOT(object, theta_sym);
-  double *theta = REAL(theta_R);
-  int n_theta = LENGTH(theta_R);
-  double *thetaTransformed = REAL(GET_SLOT(object, thetaTransformed_sym));
-  int *cellInLik = LOGICAL(GET_SLOT(object, cellInLik_sym));
+  double *theta = state->theta;
+  double *thetaTransformed = state->thetaTransformed;
+  int *cellInLik = state->cellInLik;
   /* n_theta and length of y_R and cellInLik are all identical */
 
-  double *mu = REAL(GET_SLOT(object, mu_sym));
+  double *mu = state->mu;
 
-  double lower = *REAL(GET_SLOT(object, lower_sym));
-  double upper = *REAL(GET_SLOT(object, upper_sym));
-  double tolerance = *REAL(GET_SLOT(object, tolerance_sym));
-  int maxAttempt = *INTEGER(GET_SLOT(object, maxAttempt_sym));
+  double lower = state->lower;
+  double upper = state->upper;
+  double tolerance = state->tolerance;
+  int maxAttempt = state->maxAttempt;
 
-  double scale = *REAL(GET_SLOT(object, scaleTheta_sym));
-  double scale_multiplier = *REAL(GET_SLOT(object, scaleThetaMultiplier_sym));
+  double scale = *state->scaleTheta;
+  double scale_multiplier = *state->scaleThetaMultiplier;
 
-  double sigma = *REAL(GET_SLOT(object, sigma_sym));
+  double sigma = *state->sigma;
 
-  int *y = INTEGER(y_R); /* length n_theta */
+  int *y = state->yInt; /* length n_theta */
 
-  /* make an array that has 0's if y is there, 1s if missing */
-  int *yMissing = (int *)R_alloc(n_theta, sizeof(int));
-  memset(yMissing, 0, n_theta * sizeof(int));
+  /* cells to update, and what to do with each of them,
+   * from 'initModelState' */
+  int *yMissing = state->yMissing;
+  int n_cell_active = state->nCellActive;
+  int *cells_active = state->cellsActive;
+  int *cell_kind = state->cellKind;
+  int *i_after_subtotal = state->iAfterSubtotal;
 
-  for (int i = 0; i < n_theta; ++i) {
-    int this_y = y[i];
-    if ( this_y == NA_INTEGER || ISNA(this_y) ) {
-      yMissing[i] = 1;
-    }
-  }
-
-  SEXP transformSubtotals_R = NULL;
-
-  int has_subtotals = ( R_has_slot(y_R, subtotals_sym) );
-  if (has_subtotals) {
-
-    transformSubtotals_R = GET_SLOT(y_R, transformSubtotals_sym);
-  }
+  TransformIndex *subtotalsIndex = state->subtotalsIndex;
 
   int n_accept_theta = 0;
   int n_failed_prop_theta = 0;
 
   scale = scale * scale_multiplier;
 
-  for (int i = 0; i < n_theta; ++i) {
+  double half_prec_prior = 0.5 / (sigma * sigma);
 
-    int this_y = y[i];
-    int y_is_missing = yMissing[i];
+  /* sum of squared residuals, for use by 'updateSigma_VaryingInternal' */
+  double *sq_resid = state->sqResid;
+  int n_resid = 0;
 
-        int is_struc_zero = !cellInLik[i] && !y_is_missing && (this_y == 0);
+  /* Cells are updated in parallel when using counter-based
+     random numbers, except for cells belonging to subtotals,
+     which depend on each other. These
+     are updated afterwards, serially, in a second pass.
+     Because each cell has its own stream, the results are
+     the same as updating all cells in order. */
+  int use_threads = usesCounterRNGThreads(n_cell_active);
+  int n_pass = use_threads ? 2 : 1;
 
-    if (!is_struc_zero) {
+  newStreamStage();
 
-      int ir = i + 1; /* R index */
+  for (int pass = 0; pass < n_pass; ++pass) {
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if(use_threads && (pass == 0)) num_threads(nCounterRNGThreads()) reduction(+:n_accept_theta,n_failed_prop_theta,n_resid)
+#endif
+    for (int k = 0; k < n_cell_active; ++k) {
+
+      int i = cells_active[k];
+      int kind = cell_kind[i];
+      if (use_threads && ((kind == CELL_MISSING_SUBTOTAL) != (pass == 1)))
+        continue;
+      setStreamCell(i);
+      int this_y = y[i];
 
       double mean = 0;
       double sd = 0;
       double theta_curr = theta[i];
       double transformedThetaCurr = thetaTransformed[i];
 
-      int use_subtotal = 0;
-      int ir_after = 0;
-      if (y_is_missing && has_subtotals) {
-    ir_after = dembase_getIAfter(ir, transformSubtotals_R);
-    use_subtotal = (ir_after > 0);
-      }
-
-      int draw_straight_from_prior = (y_is_missing && !use_subtotal);
+      int y_is_missing = (kind != CELL_OBSERVED);
+      int use_subtotal = (kind == CELL_MISSING_SUBTOTAL);
+      int ir_after = i_after_subtotal[i];
+      int draw_straight_from_prior = (kind == CELL_MISSING_PRIOR);
 
       if (draw_straight_from_prior) {
 
-    mean = mu[i];
-    sd = sigma;
+        mean = mu[i];
+        sd = sigma;
 
       }
       else {
 
-    mean = transformedThetaCurr;
+        mean = transformedThetaCurr;
 
-    if (y_is_missing) {
-      sd = scale / scale_multiplier;
-    }
-    else {
-      sd = scale / sqrt(1 + this_y);
-    }
+        if (y_is_missing) {
+          sd = scale / scale_multiplier;
+        }
+        else {
+          sd = scale / sqrt(1 + this_y);
+        }
 
       }
 
@@ -5183,9 +5413,9 @@ updateTheta_PoissonVaryingNotUseExp(SEXP object, SEXP y_R)
 
       while( (!found_prop) && (attempt < maxAttempt) ) {
 
-    ++attempt;
+        ++attempt;
 
-        transformedThetaProp = rnorm(mean, sd);
+        transformedThetaProp = rnormStream(mean, sd);
         found_prop = ( (transformedThetaProp > lower + tolerance) &&
                (transformedThetaProp < upper - tolerance));
       }
@@ -5193,79 +5423,97 @@ updateTheta_PoissonVaryingNotUseExp(SEXP object, SEXP y_R)
       if (found_prop) {
 
         double theta_prop = 0;
+        double log_theta_prop = 0;
         if (usesBoxCoxTransformation) {
-      theta_prop = pow(boxCoxParam * transformedThetaProp + 1, 1/boxCoxParam);
+          log_theta_prop = log(boxCoxParam * transformedThetaProp + 1) / boxCoxParam;
+          theta_prop = pow(boxCoxParam * transformedThetaProp + 1, 1/boxCoxParam);
         }
         else {
-      theta_prop = exp(transformedThetaProp);
+          log_theta_prop = transformedThetaProp;
+          theta_prop = exp(transformedThetaProp);
         }
 
         if (draw_straight_from_prior) {
-      theta[i] = theta_prop;
-      thetaTransformed[i] = transformedThetaProp;
+          theta[i] = theta_prop;
+          thetaTransformed[i] = transformedThetaProp;
         }
         else {
 
-      double log_lik_prop = 0;
-      double log_lik_curr = 0;
+          double diff_log_lik = 0;
+
+          if (use_subtotal) {
 
-      if (use_subtotal) {
+            int *subtotals = state->subtotalsNet;
+            int i_after = ir_after -1;
+            int subtotal = subtotals[i_after];
 
-        int *subtotals = INTEGER(GET_SLOT(y_R, subtotalsNet_sym));
-        int i_after = ir_after -1;
-        int subtotal = subtotals[i_after];
+            /* cells sharing the subtotal */
+            int *i_shared = subtotalsIndex->iBefore;
+            int k_end = subtotalsIndex->rowStart[i_after + 1];
 
-        SEXP ir_shared_R;
-        PROTECT( ir_shared_R
-             = dembase_getIShared(ir, transformSubtotals_R) );
+            double lambda_curr = 0;
+            for (int k = subtotalsIndex->rowStart[i_after]; k < k_end; ++k) {
+              int shared_index = i_shared[k];
+              if (yMissing[shared_index]) {
+                lambda_curr += theta[shared_index];
+              }
+            }
 
-        int n_ir_shared = LENGTH(ir_shared_R);
-        int *ir_shared = INTEGER(ir_shared_R);
+            double lambda_prop = lambda_curr + theta_prop - theta_curr;
+            diff_log_lik = diff_log_dens_pois(subtotal, lambda_prop, lambda_curr,
+                                              log(lambda_prop), log(lambda_curr));
 
-        double lambda_curr = 0;
-        for (int j = 0; j < n_ir_shared; ++j) {
-          int shared_index = ir_shared[j] - 1;
-          if (yMissing[shared_index]) {
-        lambda_curr += theta[shared_index];
           }
-        }
+          else {
 
-        UNPROTECT(1); /* ir_shared_R */
+            double log_theta_curr = (usesBoxCoxTransformation
+                                     ? log(boxCoxParam * transformedThetaCurr + 1) / boxCoxParam
+                                     : transformedThetaCurr);
+            diff_log_lik = diff_log_dens_pois(this_y, theta_prop, theta_curr,
+                                              log_theta_prop, log_theta_curr);
+          }
 
-        double lambda_prop = lambda_curr + theta_prop - theta_curr;
-        log_lik_prop = dpois(subtotal, lambda_prop, USE_LOG);
-        log_lik_curr = dpois(subtotal, lambda_curr, USE_LOG);
+          double log_diff = (diff_log_lik
+                             + diff_log_dens_norm(transformedThetaProp,
+                                                  transformedThetaCurr,
+                                                  mu[i], half_prec_prior));
 
+          int accept = (!(log_diff < 0) || (runifStream(0, 1) < exp(log_diff)));
+          if (accept) {
+            ++n_accept_theta;
+            theta[i] = theta_prop;
+            thetaTransformed[i] = transformedThetaProp;
+          }
+        }
       }
-      else {
-
-        log_lik_prop = dpois(this_y, theta_prop, USE_LOG);
-        log_lik_curr = dpois(this_y, theta_curr, USE_LOG);
+      else { /* not found prop */
+        ++n_failed_prop_theta;
       }
 
-      double log_dens_prop = dnorm(transformedThetaProp, mu[i], sigma, USE_LOG);
-      double log_dens_curr = dnorm(transformedThetaCurr, mu[i], sigma, USE_LOG);
-      double log_diff = (log_lik_prop + log_dens_prop
-                 - log_lik_curr - log_dens_curr);
-
-      int accept = (!(log_diff < 0) || (runif(0, 1) < exp(log_diff)));
-      if (accept) {
-        ++n_accept_theta;
-        theta[i] = theta_prop;
-        thetaTransformed[i] = transformedThetaProp;
-      }
-        }
+      if (cellInLik[i]) {
+        double resid = thetaTransformed[i] - mu[i];
+        sq_resid[i] = resid * resid;
+        ++n_resid;
       }
-      else { /* not found prop */
-    ++n_failed_prop_theta;
+      else {
+        sq_resid[i] = 0;
       }
+    } /* end loop through thetas */
+  } /* end loop through passes */
 
-    } /* end if (!is_struc_zero) */
-  } /* end loop through thetas */
+  newStreamStage();
+
+  *state->nAcceptTheta = n_accept_theta;
+  *state->nFailedPropTheta = n_failed_prop_theta;
 
-  SET_INTSCALE_SLOT(object, nAcceptTheta_sym, n_accept_theta);
-  SET_INTSCALE_SLOT(object, nFailedPropTheta_sym, n_failed_prop_theta);
 
+  double ss_resid = 0;
+  for (int k = 0; k < n_cell_active; ++k) {
+    ss_resid += sq_resid[cells_active[k]];
+  }
+  state->sumSqResid = ss_resid;
+  state->nSumSqResid = n_resid;
+  state->hasSumSqResid = 1;
 }
 
 /* y_R and exposure_R are both Counts objects,
@@ -5275,91 +5523,104 @@ updateTheta_PoissonVaryingNotUseExp(SEXP object, SEXP y_R)
 void
 updateTheta_PoissonVaryingUseExp(SEXP object, SEXP y_R, SEXP exposure_R)
 {
-  double boxCoxParam = *REAL(GET_SLOT(object, boxCoxParam_sym));
-  int usesBoxCoxTransformation = (boxCoxParam > 0);
-
-  SEXP theta_R = GET_SLOT(object, theta_sym);
-  double *theta = REAL(theta_R);
-  int n_theta = LENGTH(theta_R);
-  double *thetaTransformed = REAL(GET_SLOT(object, thetaTransformed_sym));
-  int *cellInLik = LOGICAL(GET_SLOT(object, cellInLik_sym));
-  /* n_theta and length of y_R, cellInLik, and exposure_R are all identical */
+  ModelState state;
+  initModelState(&state, object, y_R, exposure_R);
+  updateTheta_PoissonVaryingUseExpInternal(&state);
+}
 
-  double *mu = REAL(GET_SLOT(object, mu_sym));
+void
+updateTheta_PoissonVaryingUseExpInternal(ModelState *state)
+{
+  double boxCoxParam = state->boxCoxParam;
+  int usesBoxCoxTransformation = (boxCoxParam > 0);
 
-  double lower = *REAL(GET_SLOT(object, lower_sym));
-  double upper = *REAL(GET_SLOT(object, upper_sym));
-  double tolerance = *REAL(GET_SLOT(object, tolerance_sym));
-  int maxAttempt = *INTEGER(GET_SLOT(object, maxAttempt_sym));
+  double *theta = state->theta;
+  double *thetaTransformed = state->thetaTransformed;
+  int *cellInLik = state->cellInLik;
+  /* n_theta and length of y_R, exposure_R, and cellInLik are all identical */
 
-  double scale = *REAL(GET_SLOT(object, scaleTheta_sym));
-  double scale_multiplier = *REAL(GET_SLOT(object, scaleThetaMultiplier_sym));
+  double *mu = state->mu;
 
-  double sigma = *REAL(GET_SLOT(object, sigma_sym));
+  double lower = state->lower;
+  double upper = state->upper;
+  double tolerance = state->tolerance;
+  int maxAttempt = state->maxAttempt;
 
-  int *y = INTEGER(y_R);
+  double scale = *state->scaleTheta;
+  double scale_multiplier = *state->scaleThetaMultiplier;
 
-  /* make an array that has 0's if y is there, 1s if missing */
-  int *yMissing = (int *)R_alloc(n_theta, sizeof(int));
-  memset(yMissing, 0, n_theta * sizeof(int));
+  double sigma = *state->sigma;
 
-  for (int i = 0; i < n_theta; ++i) {
-    int this_y = y[i];
-    if ( this_y == NA_INTEGER || ISNA(this_y) ) {
-      yMissing[i] = 1;
-    }
-  }
+  int *y = state->yInt; /* length n_theta */
 
-  double *exposure = REAL(exposure_R);
+  /* cells to update, and what to do with each of them,
+   * from 'initModelState' */
+  int *yMissing = state->yMissing;
+  int n_cell_active = state->nCellActive;
+  int *cells_active = state->cellsActive;
+  int *cell_kind = state->cellKind;
+  int *i_after_subtotal = state->iAfterSubtotal;
 
-  SEXP transformSubtotals_R = NULL;
+  double *exposure = state->exposureReal;
 
-  int has_subtotals = ( R_has_slot(y_R, subtotals_sym) );
-  if (has_subtotals) {
-    transformSubtotals_R = GET_SLOT(y_R, transformSubtotals_sym);
-  }
+  TransformIndex *subtotalsIndex = state->subtotalsIndex;
 
   int n_accept_theta = 0;
   int n_failed_prop_theta = 0;
 
   scale = scale * scale_multiplier;
 
-  for (int i = 0; i < n_theta; ++i) {
+  double half_prec_prior = 0.5 / (sigma * sigma);
 
-    int this_y = y[i];
-    int y_is_missing = yMissing[i];
+  /* sum of squared residuals, for use by 'updateSigma_VaryingInternal' */
+  double *sq_resid = state->sqResid;
+  int n_resid = 0;
 
-    int is_struc_zero = !cellInLik[i] && !y_is_missing && (this_y == 0);
+  /* Cells are updated in parallel when using counter-based
+     random numbers, except for cells belonging to subtotals,
+     which depend on each other. These
+     are updated afterwards, serially, in a second pass.
+     Because each cell has its own stream, the results are
+     the same as updating all cells in order. */
+  int use_threads = usesCounterRNGThreads(n_cell_active);
+  int n_pass = use_threads ? 2 : 1;
 
-    if (!is_struc_zero) {
+  newStreamStage();
+
+  for (int pass = 0; pass < n_pass; ++pass) {
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if(use_threads && (pass == 0)) num_threads(nCounterRNGThreads()) reduction(+:n_accept_theta,n_failed_prop_theta,n_resid)
+#endif
+    for (int k = 0; k < n_cell_active; ++k) {
 
-      int ir = i + 1; /* R index */
+      int i = cells_active[k];
+      int kind = cell_kind[i];
+      if (use_threads && ((kind == CELL_MISSING_SUBTOTAL) != (pass == 1)))
+        continue;
+      setStreamCell(i);
+      int this_y = y[i];
 
       double mean = 0;
       double sd = 0;
       double theta_curr = theta[i];
       double transformedThetaCurr = thetaTransformed[i];
 
-      int use_subtotal = 0;
-      int ir_after = 0;
-      if (y_is_missing && has_subtotals) {
-    ir_after = dembase_getIAfter(ir, transformSubtotals_R);
-    use_subtotal = (ir_after > 0);
-      }
-
-      int draw_straight_from_prior = (y_is_missing && !use_subtotal);
+      int y_is_missing = (kind != CELL_OBSERVED);
+      int use_subtotal = (kind == CELL_MISSING_SUBTOTAL);
+      int ir_after = i_after_subtotal[i];
+      int draw_straight_from_prior = (kind == CELL_MISSING_PRIOR);
 
       if (draw_straight_from_prior) {
-    mean = mu[i];
-    sd = sigma;
+        mean = mu[i];
+        sd = sigma;
       }
       else {
         mean = transformedThetaCurr;
         if (y_is_missing) {
-      sd = scale / scale_multiplier;
+          sd = scale / scale_multiplier;
         }
         else {
-      sd = scale / sqrt(1 + this_y);
+          sd = scale / sqrt(1 + this_y);
         }
       }
 
@@ -5370,9 +5631,9 @@ updateTheta_PoissonVaryingUseExp(SEXP object, SEXP y_R, SEXP exposure_R)
 
       while( (!found_prop) && (attempt < maxAttempt) ) {
 
-    attempt++;
+        attempt++;
 
-    transformedThetaProp = rnorm(mean, sd);
+        transformedThetaProp = rnormStream(mean, sd);
         found_prop = ( (transformedThetaProp > lower + tolerance) &&
                (transformedThetaProp < upper - tolerance));
 
@@ -5381,82 +5642,102 @@ updateTheta_PoissonVaryingUseExp(SEXP object, SEXP y_R, SEXP exposure_R)
       if (found_prop) {
 
         double theta_prop = 0;
+        double log_theta_prop = 0;
         if (usesBoxCoxTransformation) {
-      theta_prop = pow(boxCoxParam * transformedThetaProp + 1, 1/boxCoxParam);
+          log_theta_prop = log(boxCoxParam * transformedThetaProp + 1) / boxCoxParam;
+          theta_prop = pow(boxCoxParam * transformedThetaProp + 1, 1/boxCoxParam);
         }
         else {
-      theta_prop = exp(transformedThetaProp);
+          log_theta_prop = transformedThetaProp;
+          theta_prop = exp(transformedThetaProp);
         }
 
         if (draw_straight_from_prior) {
-      theta[i] = theta_prop;
-      thetaTransformed[i] = transformedThetaProp;
+          theta[i] = theta_prop;
+          thetaTransformed[i] = transformedThetaProp;
         }
         else {
 
-      double log_lik_prop = 0;
-      double log_lik_curr = 0;
+          double diff_log_lik = 0;
 
-      double this_exposure = exposure[i];
+          double this_exposure = exposure[i];
 
-      if (use_subtotal) {
+          if (use_subtotal) {
 
-            int *subtotals = INTEGER(GET_SLOT(y_R, subtotalsNet_sym));
+            int *subtotals = state->subtotalsNet;
             int i_after = ir_after -1;
             int subtotal = subtotals[i_after];
 
-            SEXP ir_shared_R;
-            PROTECT( ir_shared_R
-             = dembase_getIShared(ir, transformSubtotals_R) );
-            int n_ir_shared = LENGTH(ir_shared_R);
-            int *ir_shared = INTEGER(ir_shared_R);
+            /* cells sharing the subtotal */
+            int *i_shared = subtotalsIndex->iBefore;
+            int k_end = subtotalsIndex->rowStart[i_after + 1];
 
             double lambda_curr = 0;
-            for (int j = 0; j < n_ir_shared; ++j) {
-          int shared_index = ir_shared[j] - 1;
-          if (yMissing[shared_index]) {
+            for (int k = subtotalsIndex->rowStart[i_after]; k < k_end; ++k) {
+              int shared_index = i_shared[k];
+              if (yMissing[shared_index]) {
                 lambda_curr += theta[shared_index]
           * exposure[ shared_index ];
-          }
+              }
             }
 
-            UNPROTECT(1); /* ir_shared_R */
-
             double lambda_prop = lambda_curr
           + (theta_prop - theta_curr) * this_exposure;
-            log_lik_prop = dpois(subtotal, lambda_prop, USE_LOG);
-            log_lik_curr = dpois(subtotal, lambda_curr, USE_LOG);
-
-      }
-      else {
-
-            log_lik_prop = dpois(this_y, theta_prop*this_exposure, USE_LOG);
-            log_lik_curr = dpois(this_y, theta_curr*this_exposure, USE_LOG);
-      }
+            diff_log_lik = diff_log_dens_pois(subtotal, lambda_prop, lambda_curr,
+                                              log(lambda_prop), log(lambda_curr));
 
-      double log_dens_prop = dnorm(transformedThetaProp, mu[i], sigma, USE_LOG);
-      double log_dens_curr = dnorm(transformedThetaCurr, mu[i], sigma, USE_LOG);
+          }
+          else {
+
+            double log_theta_curr = (usesBoxCoxTransformation
+                                     ? log(boxCoxParam * transformedThetaCurr + 1) / boxCoxParam
+                                     : transformedThetaCurr);
+            /* log(exposure) cancels */
+            diff_log_lik = diff_log_dens_pois(this_y, theta_prop*this_exposure,
+                                              theta_curr*this_exposure,
+                                              log_theta_prop, log_theta_curr);
+          }
 
-      double log_diff = (log_lik_prop + log_dens_prop
-                 - log_lik_curr - log_dens_curr);
+          double log_diff = (diff_log_lik
+                             + diff_log_dens_norm(transformedThetaProp,
+                                                  transformedThetaCurr,
+                                                  mu[i], half_prec_prior));
 
-      int accept = (!(log_diff < 0) || (runif(0, 1) < exp(log_diff)));
-      if (accept) {
+          int accept = (!(log_diff < 0) || (runifStream(0, 1) < exp(log_diff)));
+          if (accept) {
             ++n_accept_theta;
             theta[i] = theta_prop;
-        thetaTransformed[i] = transformedThetaProp;
-      }
+            thetaTransformed[i] = transformedThetaProp;
+          }
         }
       }
       else { /* not found prop */
         ++n_failed_prop_theta;
       }
 
-    } /* end if (!is_struc_zero) */
-  } /* end loop through thetas */
+      if (cellInLik[i]) {
+        double resid = thetaTransformed[i] - mu[i];
+        sq_resid[i] = resid * resid;
+        ++n_resid;
+      }
+      else {
+        sq_resid[i] = 0;
+      }
+    } /* end loop through thetas */
+  } /* end loop through passes */
 
-  SET_INTSCALE_SLOT(object, nAcceptTheta_sym, n_accept_theta);
-  SET_INTSCALE_SLOT(object, nFailedPropTheta_sym, n_failed_prop_theta);
+  newStreamStage();
+
+  *state->nAcceptTheta = n_accept_theta;
+  *state->nFailedPropTheta = n_failed_prop_theta;
+
+  double ss_resid = 0;
+  for (int k = 0; k < n_cell_active; ++k) {
+    ss_resid += sq_resid[cells_active[k]];
+  }
+  state->sumSqResid = ss_resid;
+  state->nSumSqResid = n_resid;
+  state->hasSumSqResid = 1;
 }
 
 
@@ -7240,16 +7521,17 @@ updateThetaAndValueAgLife_PoissonUseExp(SEXP object, SEXP y_R, SEXP exposure_R)
 void
 updateVariancesBetas(SEXP object_R)
 {
-  SEXP variances_R = GET_SLOT(object_R, variancesBetas_sym);
-  SEXP priors_R = GET_SLOT(object_R, priorsBetas_sym);
-  int n_beta =  LENGTH(variances_R);
+  ModelState state;
+  initModelState(&state, object_R, R_NilValue, R_NilValue);
+  updateVariancesBetasInternal(&state);
+}
 
+void
+updateVariancesBetasInternal(ModelState *state)
+{
+  int n_beta = state->nBeta;
   for (int i = 0; i < n_beta; ++i) {
-    SEXP variance_R = VECTOR_ELT(variances_R, i);
-    double *variance = REAL(variance_R);
-    int J = LENGTH(variance_R);
-    SEXP prior_R = VECTOR_ELT(priors_R, i);
-    getV_Internal(variance, prior_R, J);
+    getV_Internal(state->variancesBetas[i], state->priors[i], state->J[i]);
   }
 }
 
@@ -7613,22 +7895,47 @@ updateCountsBinomial(SEXP y_R, SEXP model_R,
   }
 }
 
+/* States for the data models of a combined object, set up
+   once per .Call. The exposures for data models are collapsed
+   series, which are supplied at each iteration, using
+   'setModelStateExposure'. */
+ModelState *
+prepareDataModelStates(SEXP dataModels_R, SEXP datasets_R)
+{
+  int nObs = LENGTH(dataModels_R);
+  ModelState *states = (ModelState *)R_alloc(nObs, sizeof(ModelState));
+  for (int i = 0; i < nObs; ++i) {
+    SEXP model_R = VECTOR_ELT(dataModels_R, i);
+    SEXP dataset_R = VECTOR_ELT(datasets_R, i);
+    prepareModelState(states + i, model_R, dataset_R, R_NilValue);
+  }
+  return states;
+}
+
 void
 updateDataModelsCounts(SEXP y_R, SEXP dataModels_R,
                SEXP datasets_R, SEXP transforms_R)
+{
+  ModelState *states = prepareDataModelStates(dataModels_R, datasets_R);
+  updateDataModelsCountsStates(y_R, dataModels_R, datasets_R,
+                               transforms_R, states);
+}
+
+void
+updateDataModelsCountsStates(SEXP y_R, SEXP dataModels_R,
+                             SEXP datasets_R, SEXP transforms_R,
+                             ModelState *states)
 {
   int nObs = LENGTH(dataModels_R);
 
   for (int i = 0; i < nObs; ++i) {
 
     SEXP model_R = VECTOR_ELT(dataModels_R, i);
-    SEXP dataset_R = VECTOR_ELT(datasets_R, i);
     SEXP transform_R = VECTOR_ELT(transforms_R, i);
 
     SEXP yCollapsed_R;
 
     int nProtect  = 0;
-    int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
 
     const char *class_name = CHAR(STRING_ELT(GET_SLOT((model_R), R_ClassSymbol), 0));
     int found = !((strstr(class_name, "Poisson") == NULL) && (strstr(class_name, "CMP") == NULL));
@@ -7648,8 +7955,9 @@ updateDataModelsCounts(SEXP y_R, SEXP dataModels_R,
     }
 
     /* yCollapsed_R should now be in appropriate state for model */
-    updateModelUseExp_Internal(model_R, dataset_R,
-                   yCollapsed_R, i_method_model);
+    setModelStateExposure(states + i, yCollapsed_R);
+    updateModelState(states + i);
+    recordModelStateAccept(states + i);
 
     UNPROTECT(nProtect); /* yCollapsed_R and possibly also y_Collapsed_tmp_R*/
 
@@ -7660,9 +7968,17 @@ updateDataModelsCounts(SEXP y_R, SEXP dataModels_R,
 void
 updateDataModelsAccount(SEXP combined_R)
 {
-
   SEXP dataModels_R = GET_SLOT(combined_R, dataModels_sym);
   SEXP datasets_R = GET_SLOT(combined_R, datasets_sym);
+  ModelState *states = prepareDataModelStates(dataModels_R, datasets_R);
+  updateDataModelsAccountStates(combined_R, states);
+}
+
+void
+updateDataModelsAccountStates(SEXP combined_R, ModelState *states)
+{
+
+  SEXP dataModels_R = GET_SLOT(combined_R, dataModels_sym);
   SEXP seriesIndices_R = GET_SLOT(combined_R, seriesIndices_sym);
   SEXP transforms_R = GET_SLOT(combined_R, transforms_sym);
 
@@ -7681,7 +7997,6 @@ updateDataModelsAccount(SEXP combined_R)
         if (updateDataModel[i]) {
 
             SEXP model_R = VECTOR_ELT(dataModels_R, i);
-            SEXP dataset_R = VECTOR_ELT(datasets_R, i);
             SEXP transform_R = VECTOR_ELT(transforms_R, i);
 
             int seriesIndex_r = seriesIndices[i];
@@ -7693,11 +8008,17 @@ updateDataModelsAccount(SEXP combined_R)
             SEXP seriesCollapsed_R;
 
             int nProtect  = 0;
-            int i_method_model = *(INTEGER(GET_SLOT(model_R, iMethodModel_sym)));
 
             const char *class_name = CHAR(STRING_ELT(GET_SLOT((model_R), R_ClassSymbol), 0));
             int found = !((strstr(class_name, "Poisson") == NULL) && (strstr(class_name, "CMP") == NULL));
-            if (found) {
+
+            /* collapsed series maintained by 'updateValuesAccount', if available */
+            SEXP seriesCollapsedCached_R = getCollapsedSeries(transform_R, found);
+
+            if (!isNull(seriesCollapsedCached_R)) {
+                seriesCollapsed_R = seriesCollapsedCached_R;
+            }
+            else if (found) {
 
                 SEXP seriesCollapsed_tmp_R;
                 /* collapse_R in demographic is okay with series_R being integer
@@ -7714,8 +8035,9 @@ updateDataModelsAccount(SEXP combined_R)
             }
 
             /* seriesCollapsed_R should now be in appropriate state for model */
-            updateModelUseExp_Internal(model_R, dataset_R,
-                     seriesCollapsed_R, i_method_model);
+            setModelStateExposure(states + i, seriesCollapsed_R);
+            updateModelState(states + i);
+            recordModelStateAccept(states + i);
 
             UNPROTECT(nProtect); /* seriesCollapsed_R and possibly also series_Collapsed_tmp_R*/
 
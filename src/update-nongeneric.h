@@ -4,6 +4,7 @@
 
 
     #include <Rinternals.h>
+    #include "model-state.h"
 
     /* updatePhi etc code */
     #define K_MAX_ATTEMPTS 1000
@@ -23,5 +24,13 @@
     
     void updatePriorsBetas(SEXP object_R);
 
+    ModelState * prepareDataModelStates(SEXP dataModels_R, SEXP datasets_R);
+
+    void updateDataModelsCountsStates(SEXP y_R, SEXP dataModels_R,
+                                      SEXP datasets_R, SEXP transforms_R,
+                                      ModelState *states);
+
+    void updateDataModelsAccountStates(SEXP combined_R, ModelState *states);
+
     
 #endif